@@ -0,0 +1,176 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @file   mola-backend-bench.cpp
+ * @brief  Benchmarks a back-end with synthetic SLAM workloads
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 20, 2019
+ */
+
+#include <mola-slam-gtsam/AllocProfiler.h>
+#include <mola-slam-gtsam/BackendHarness.h>
+#include <mola-slam-gtsam/ProcessMemory.h>
+#include <mola-slam-gtsam/SyntheticWorkload.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+static void usage(const char* argv0)
+{
+    std::cerr
+        << "Usage: " << argv0
+        << " [--workload <Manhattan|Sphere|Corridor|Stereo|all>]\n"
+           "       [--kfs <N>] [--seed <S>] [--spin-every <N>]\n"
+           "       [--backend <CLASS>] [--config <FILE.yml>]\n"
+           "       [--output <FILE.json>]\n"
+           "Writes one JSON object per workload, with per-call latency "
+           "percentiles,\nthroughput, memory and final trajectory error "
+           "(plus allocations per\nback-end scope, if built with "
+           "MOLA_SLAM_GTSAM_ALLOC_PROFILING).\n";
+}
+
+/** Runs one workload in a fresh back-end, and writes its JSON report */
+static void runWorkload(
+    const mola::SyntheticWorkload::Parameters& wp,
+    const std::string& backendClass, const std::string& cfg, std::ostream& o)
+{
+    using mola::SyntheticWorkload;
+
+    const auto typeName =
+        mrpt::typemeta::TEnumType<SyntheticWorkload::Type>::value2name(
+            wp.type);
+
+    mola::BackendHarness h(backendClass, cfg);
+    SyntheticWorkload    w(wp);
+
+    if (!w.prepareBackend(h.backend()))
+    {
+        std::cerr << "Skipping workload `" << typeName << "`: not supported by "
+                  << backendClass << "\n";
+        return;
+    }
+
+    mola::AllocProfiler::reset();
+    const auto mem0  = mola::processMemory();
+    const auto stats = mola::replayBackendCalls(w.source(), h.backend());
+    const auto mem1  = mola::processMemory();
+
+    // Allocations per back-end scope, over the replay time only:
+    std::stringstream allocs;
+    if (mola::AllocProfiler::available()) mola::AllocProfiler::toJSON(allocs);
+
+    const auto err = mola::evaluateWorkload(w, h.worldmodel(), stats.kf_ids);
+    h.quit();
+
+    const double MB = 1.0 / (1024.0 * 1024.0);
+    o << "{\n"
+      << "\"backend\": \"" << backendClass << "\",\n"
+      << "\"workload\": \"" << typeName << "\",\n"
+      << "\"num_kfs\": " << wp.num_kfs << ",\n"
+      << "\"seed\": " << wp.seed << ",\n"
+      << "\"kfs_per_s\": "
+      << wp.num_kfs / std::max(stats.total_time, 1e-9) << ",\n"
+      << "\"memory\": {\"rss_before_mb\": " << mem0.rss * MB
+      << ", \"rss_after_mb\": " << mem1.rss * MB
+      << ", \"peak_rss_mb\": " << mem1.peak_rss * MB << "},\n"
+      << "\"replay\": ";
+    stats.toJSON(o);
+    o << ",\n\"error\": ";
+    mola::reportToJSON(err, o);
+    if (!allocs.str().empty()) o << ",\n\"allocations\": " << allocs.str();
+    o << "}";
+}
+
+int main(int argc, char** argv)
+{
+    try
+    {
+        using mola::SyntheticWorkload;
+
+        std::string                   backendClass = "ASLAM_gtsam";
+        std::string                   workload     = "all";
+        std::string                   cfg, outFile;
+        SyntheticWorkload::Parameters wp;
+
+        for (int i = 1; i < argc; i++)
+        {
+            const bool has_arg = (i + 1 < argc);
+            if (!std::strcmp(argv[i], "--workload") && has_arg)
+                workload = argv[++i];
+            else if (!std::strcmp(argv[i], "--kfs") && has_arg)
+                wp.num_kfs = std::stoul(argv[++i]);
+            else if (!std::strcmp(argv[i], "--seed") && has_arg)
+                wp.seed = static_cast<uint32_t>(std::stoul(argv[++i]));
+            else if (!std::strcmp(argv[i], "--spin-every") && has_arg)
+                wp.spin_every = static_cast<unsigned>(std::stoul(argv[++i]));
+            else if (!std::strcmp(argv[i], "--backend") && has_arg)
+                backendClass = argv[++i];
+            else if (!std::strcmp(argv[i], "--config") && has_arg)
+            {
+                std::ifstream f(argv[++i]);
+                if (!f.is_open())
+                    throw std::runtime_error(
+                        std::string("Cannot open: ") + argv[i]);
+                std::stringstream ss;
+                ss << f.rdbuf();
+                cfg = ss.str();
+            }
+            else if (!std::strcmp(argv[i], "--output") && has_arg)
+                outFile = argv[++i];
+            else
+            {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+
+        if (cfg.empty())
+            cfg = mola::BackendHarness::defaultConfig(backendClass);
+
+        std::vector<SyntheticWorkload::Type> types;
+        if (workload == "all")
+            types = {SyntheticWorkload::Type::Manhattan,
+                     SyntheticWorkload::Type::Sphere,
+                     SyntheticWorkload::Type::Corridor,
+                     SyntheticWorkload::Type::Stereo};
+        else
+            types.push_back(
+                mrpt::typemeta::TEnumType<SyntheticWorkload::Type>::name2value(
+                    workload));
+
+        std::ofstream fOut;
+        if (!outFile.empty())
+        {
+            fOut.open(outFile);
+            if (!fOut.is_open())
+                throw std::runtime_error("Cannot write: " + outFile);
+        }
+        std::ostream& o = outFile.empty() ? std::cout : fOut;
+
+        o << "[\n";
+        bool first = true;
+        for (const auto type : types)
+        {
+            wp.type = type;
+            std::stringstream ss;
+            runWorkload(wp, backendClass, cfg, ss);
+            if (ss.str().empty()) continue;  // Skipped
+            o << (first ? "" : ",\n") << ss.str();
+            first = false;
+        }
+        o << "\n]\n";
+        return 0;
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
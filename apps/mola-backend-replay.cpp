@@ -0,0 +1,120 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @file   mola-backend-replay.cpp
+ * @brief  Replays a recorded log of back-end API calls, without front-ends
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 13, 2019
+ */
+
+#include <mola-slam-gtsam/BackendCallLog.h>
+#include <mola-slam-gtsam/BackendHarness.h>
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+static std::string readFile(const char* fil)
+{
+    std::ifstream f(fil);
+    if (!f.is_open())
+        throw std::runtime_error(std::string("Cannot open: ") + fil);
+    std::stringstream ss;
+    ss << f.rdbuf();
+    return ss.str();
+}
+
+static mola::BackendReplayStats replay(
+    const char* logFile, const std::string& backendClass,
+    const std::string& cfg, const mola::BackendReplayOptions& opts)
+{
+    mola::BackendCallReader log;
+    log.open(logFile);
+
+    mola::BackendHarness h(backendClass, cfg);
+
+    const auto stats = mola::replayBackendCalls(log, h.backend(), opts);
+    h.quit();
+    return stats;
+}
+
+static void usage(const char* argv0)
+{
+    std::cerr << "Usage: " << argv0
+              << " <LOG.bin> [--backend <CLASS>] [--config <FILE.yml>]\n"
+                 "       [--compare <CLASS> [--compare-config <FILE.yml>]]\n"
+                 "       [--realtime] [--speed <X>]\n";
+}
+
+int main(int argc, char** argv)
+{
+    try
+    {
+        if (argc < 2)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+
+        std::string                backendClass = "ASLAM_gtsam";
+        std::string                cfg, compareClass, compareCfg;
+        mola::BackendReplayOptions opts;
+
+        for (int i = 2; i < argc; i++)
+        {
+            const bool has_arg = (i + 1 < argc);
+            if (!std::strcmp(argv[i], "--backend") && has_arg)
+                backendClass = argv[++i];
+            else if (!std::strcmp(argv[i], "--config") && has_arg)
+                cfg = readFile(argv[++i]);
+            else if (!std::strcmp(argv[i], "--compare") && has_arg)
+                compareClass = argv[++i];
+            else if (!std::strcmp(argv[i], "--compare-config") && has_arg)
+                compareCfg = readFile(argv[++i]);
+            else if (!std::strcmp(argv[i], "--realtime"))
+                opts.realtime = true;
+            else if (!std::strcmp(argv[i], "--speed") && has_arg)
+                opts.speed = std::stod(argv[++i]);
+            else
+            {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+
+        // Unless given, the headless default of each back-end:
+        if (cfg.empty())
+            cfg = mola::BackendHarness::defaultConfig(backendClass);
+        if (!compareClass.empty() && compareCfg.empty())
+            compareCfg = mola::BackendHarness::defaultConfig(compareClass);
+
+        const auto stats = replay(argv[1], backendClass, cfg, opts);
+
+        if (!compareClass.empty())
+        {
+            // Same session into a second back-end. IDs returned by
+            // different back-ends need not match, so only the first one
+            // decides the exit code.
+            const auto stats2 = replay(argv[1], compareClass, compareCfg, opts);
+
+            std::cout << "=== " << backendClass << " ===\n";
+            stats.print(std::cout);
+            std::cout << "\n=== " << compareClass << " ===\n";
+            stats2.print(std::cout);
+        }
+        else
+            stats.print(std::cout);
+
+        return stats.id_mismatches == 0 ? 0 : 2;
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
@@ -0,0 +1,266 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @file   mola-backend-soak.cpp
+ * @brief  Long-horizon soak test of ASLAM_gtsam: drift of latency & memory
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 20, 2019
+ */
+
+#include <mola-slam-gtsam/ASLAM_gtsam.h>
+#include <mola-slam-gtsam/BackendHarness.h>
+#include <mola-slam-gtsam/ProcessMemory.h>
+#include <mola-slam-gtsam/SyntheticWorkload.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <vector>
+
+/** Sampled metrics, in this order */
+static const std::vector<std::string> METRICS = {
+    "spin_ms",    "spin_ms_max",    "rss_mb",       "isam2_factors",
+    "isam2_cliques", "values",      "time2kf",      "trajectory",
+    "stereo_factors", "vizmap_nodes", "vizmap_edges"};
+
+/** Default max. slopes, in metric units per simulated hour */
+static const std::map<std::string, double> DEFAULT_LIMITS = {
+    {"spin_ms", 5.0}, {"rss_mb", 100.0}};
+
+struct Sample
+{
+    double              sim_hours{0};
+    std::size_t         kfs{0};
+    std::vector<double> values;  //!< One per METRICS entry
+};
+
+/** Least-squares slope of y(x) */
+static double slope(const std::vector<double>& x, const std::vector<double>& y)
+{
+    const std::size_t n = x.size();
+    if (n < 2) return 0;
+    double mx = 0, my = 0;
+    for (std::size_t i = 0; i < n; i++)
+    {
+        mx += x[i];
+        my += y[i];
+    }
+    mx /= n;
+    my /= n;
+    double sxy = 0, sxx = 0;
+    for (std::size_t i = 0; i < n; i++)
+    {
+        sxy += (x[i] - mx) * (y[i] - my);
+        sxx += (x[i] - mx) * (x[i] - mx);
+    }
+    return sxx > 0 ? sxy / sxx : 0;
+}
+
+static void usage(const char* argv0)
+{
+    std::cerr
+        << "Usage: " << argv0
+        << " [--hours <H>] [--kf-period <SECONDS>]\n"
+           "       [--workload <Manhattan|Sphere|Corridor|Stereo>] "
+           "[--seed <S>]\n"
+           "       [--samples <N>] [--warmup <FRACTION>] [--config "
+           "<FILE.yml>]\n"
+           "       [--limit <METRIC>=<MAX_SLOPE_PER_HOUR>]... "
+           "[--csv <FILE.csv>]\n"
+           "Runs ASLAM_gtsam over a simulated session of H hours (default: "
+           "4),\nas fast as possible, sampling spinOnce() latency, memory "
+           "and container\nsizes. Fails (exit code 2) if the slope of any "
+           "metric, after the warm-up\nfraction of the session (default: "
+           "0.1), exceeds its limit.\nDefault limits: spin_ms=5, "
+           "rss_mb=100.\n";
+}
+
+int main(int argc, char** argv)
+{
+    try
+    {
+        using mola::SyntheticWorkload;
+
+        double      hours = 4.0, warmup = 0.1;
+        std::size_t num_samples = 100;
+        std::string cfg, csvFile;
+        auto        limits = DEFAULT_LIMITS;
+
+        SyntheticWorkload::Parameters wp;
+        wp.type = SyntheticWorkload::Type::Manhattan;
+
+        for (int i = 1; i < argc; i++)
+        {
+            const bool has_arg = (i + 1 < argc);
+            if (!std::strcmp(argv[i], "--hours") && has_arg)
+                hours = std::stod(argv[++i]);
+            else if (!std::strcmp(argv[i], "--kf-period") && has_arg)
+                wp.kf_period = std::stod(argv[++i]);
+            else if (!std::strcmp(argv[i], "--workload") && has_arg)
+                wp.type = mrpt::typemeta::TEnumType<
+                    SyntheticWorkload::Type>::name2value(argv[++i]);
+            else if (!std::strcmp(argv[i], "--seed") && has_arg)
+                wp.seed = static_cast<uint32_t>(std::stoul(argv[++i]));
+            else if (!std::strcmp(argv[i], "--samples") && has_arg)
+                num_samples = std::stoul(argv[++i]);
+            else if (!std::strcmp(argv[i], "--warmup") && has_arg)
+                warmup = std::stod(argv[++i]);
+            else if (!std::strcmp(argv[i], "--config") && has_arg)
+            {
+                std::ifstream f(argv[++i]);
+                if (!f.is_open())
+                    throw std::runtime_error(
+                        std::string("Cannot open: ") + argv[i]);
+                std::stringstream ss;
+                ss << f.rdbuf();
+                cfg = ss.str();
+            }
+            else if (!std::strcmp(argv[i], "--limit") && has_arg)
+            {
+                const std::string s   = argv[++i];
+                const auto        pos = s.find('=');
+                if (pos == std::string::npos ||
+                    std::find(METRICS.begin(), METRICS.end(),
+                              s.substr(0, pos)) == METRICS.end())
+                    throw std::runtime_error("Invalid limit: " + s);
+                limits[s.substr(0, pos)] = std::stod(s.substr(pos + 1));
+            }
+            else if (!std::strcmp(argv[i], "--csv") && has_arg)
+                csvFile = argv[++i];
+            else
+            {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        ASSERT_(hours > 0 && wp.kf_period > 0 && num_samples >= 2);
+        ASSERT_(warmup >= 0 && warmup < 1);
+        if (cfg.empty())
+            cfg = mola::BackendHarness::defaultConfig("ASLAM_gtsam");
+
+        wp.num_kfs = static_cast<std::size_t>(
+            std::ceil(hours * 3600.0 / wp.kf_period));
+        const std::size_t sample_every =
+            std::max<std::size_t>(1, wp.num_kfs / num_samples);
+
+        mola::BackendHarness h("ASLAM_gtsam", cfg);
+        auto& aslam = dynamic_cast<mola::ASLAM_gtsam&>(h.backend());
+
+        SyntheticWorkload w(wp);
+        if (!w.prepareBackend(aslam))
+            throw std::runtime_error("Workload not supported by ASLAM_gtsam");
+
+        std::cout << "Simulating " << hours << " h: " << wp.num_kfs
+                  << " keyframes, one sample every " << sample_every
+                  << " keyframes...\n";
+
+        // Sample at the first spinOnce() after each `sample_every` KFs:
+        std::vector<Sample> samples;
+        std::size_t         kfs = 0, spins = 0;
+        double              spin_sum = 0, spin_max = 0;
+
+        mola::BackendReplayOptions opts;
+        opts.on_call = [&](const mola::BackendCallRecord& r, double dt) {
+            if (r.call == mola::BackendCall::AddKeyFrame) kfs++;
+            if (r.call != mola::BackendCall::SpinOnce) return;
+
+            spins++;
+            spin_sum += dt;
+            spin_max = std::max(spin_max, dt);
+            if (kfs < (samples.size() + 1) * sample_every) return;
+
+            const auto mem = mola::processMemory();
+            const auto sz  = aslam.state_sizes();
+
+            Sample s;
+            s.kfs       = kfs;
+            s.sim_hours = kfs * wp.kf_period / 3600.0;
+            s.values    = {
+                1e3 * spin_sum / spins,
+                1e3 * spin_max,
+                mem.rss / (1024.0 * 1024.0),
+                static_cast<double>(sz.isam2_factors),
+                static_cast<double>(sz.isam2_cliques),
+                static_cast<double>(sz.values),
+                static_cast<double>(sz.time2kf),
+                static_cast<double>(sz.trajectory),
+                static_cast<double>(sz.stereo_factors),
+                static_cast<double>(sz.vizmap_nodes),
+                static_cast<double>(sz.vizmap_edges)};
+            samples.push_back(s);
+
+            spins    = 0;
+            spin_sum = 0;
+            spin_max = 0;
+        };
+
+        const auto stats = mola::replayBackendCalls(w.source(), aslam, opts);
+        h.quit();
+
+        std::cout << "Done in " << stats.total_time << " s ("
+                  << hours * 3600.0 / std::max(stats.total_time, 1e-9)
+                  << "x real time), " << samples.size() << " samples.\n";
+
+        if (!csvFile.empty())
+        {
+            std::ofstream f(csvFile);
+            if (!f.is_open())
+                throw std::runtime_error("Cannot write: " + csvFile);
+            f << "sim_hours,kfs";
+            for (const auto& m : METRICS) f << "," << m;
+            f << "\n";
+            for (const auto& s : samples)
+            {
+                f << s.sim_hours << "," << s.kfs;
+                for (const auto v : s.values) f << "," << v;
+                f << "\n";
+            }
+        }
+
+        // Slopes, after the warm-up:
+        const auto first = static_cast<std::size_t>(warmup * samples.size());
+        std::vector<double> x;
+        for (std::size_t i = first; i < samples.size(); i++)
+            x.push_back(samples[i].sim_hours);
+
+        bool ok = true;
+        std::cout << std::left << std::setw(16) << "metric" << std::right
+                  << std::setw(14) << "last" << std::setw(14) << "slope/h"
+                  << std::setw(14) << "limit/h"
+                  << "\n";
+        for (std::size_t m = 0; m < METRICS.size(); m++)
+        {
+            std::vector<double> y;
+            for (std::size_t i = first; i < samples.size(); i++)
+                y.push_back(samples[i].values[m]);
+            const double sl = slope(x, y);
+
+            std::cout << std::left << std::setw(16) << METRICS[m]
+                      << std::right << std::setw(14)
+                      << (y.empty() ? 0.0 : y.back()) << std::setw(14) << sl;
+            if (const auto it = limits.find(METRICS[m]); it != limits.end())
+            {
+                const bool pass = sl <= it->second;
+                ok              = ok && pass;
+                std::cout << std::setw(14) << it->second
+                          << (pass ? "  ok" : "  EXCEEDED");
+            }
+            std::cout << "\n";
+        }
+        return ok ? 0 : 2;
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
@@ -0,0 +1,75 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @file   mola-g2o-optimize.cpp
+ * @brief  Feeds a g2o/TORO pose graph to ASLAM_gtsam and saves the result
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 12, 2019
+ */
+
+#include <mola-slam-gtsam/ASLAM_gtsam.h>
+#include <mola-slam-gtsam/BackendHarness.h>
+#include <mola-slam-gtsam/PoseGraphIO.h>
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+int main(int argc, char** argv)
+{
+    try
+    {
+        if (argc != 3 && argc != 5)
+        {
+            std::cerr << "Usage: " << argv[0]
+                      << " <INPUT.g2o|.graph> <OUTPUT.g2o> "
+                         "[--spin-every <N_EDGES>]\n";
+            return 1;
+        }
+
+        mola::PoseGraphImportOptions opts;
+        if (argc == 5 && !std::strcmp(argv[3], "--spin-every"))
+            opts.spin_every_n_edges = std::stoul(argv[4]);
+
+        std::ifstream fin(argv[1]);
+        if (!fin.is_open())
+            throw std::runtime_error(std::string("Cannot open: ") + argv[1]);
+
+        mola::BackendHarness h(
+            "ASLAM_gtsam", mola::BackendHarness::defaultConfig("ASLAM_gtsam"));
+        auto& slam = dynamic_cast<mola::ASLAM_gtsam&>(h.backend());
+
+        using clock = std::chrono::steady_clock;
+        const auto t0  = clock::now();
+        const auto res = mola::importPoseGraph(fin, slam, opts);
+        const auto t1  = clock::now();
+        slam.spinOnce();
+        const auto t2 = clock::now();
+
+        std::ofstream fout(argv[2]);
+        if (!fout.is_open())
+            throw std::runtime_error(std::string("Cannot create: ") + argv[2]);
+        slam.exportPoseGraphG2O(fout);
+        const auto t3 = clock::now();
+
+        const auto secs = [](clock::duration d) {
+            return std::chrono::duration<double>(d).count();
+        };
+        std::cout << "vertices: " << res.vertices << " edges: " << res.edges
+                  << " ignored lines: " << res.ignored_lines << "\n"
+                  << "import: " << secs(t1 - t0)
+                  << " s, final spinOnce: " << secs(t2 - t1)
+                  << " s, export: " << secs(t3 - t2) << " s\n";
+        return 0;
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
@@ -0,0 +1,332 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @file   mola-gtsam-microbench.cpp
+ * @brief  Microbenchmarks of factors, conversions and keyframe ID maps
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 20, 2019
+ */
+
+#include <gtsam/inference/Symbol.h>  // X(), V()
+#include <gtsam/nonlinear/NonlinearFactorGraph.h>
+#include <mola-slam-gtsam/ASLAM_gtsam.h>
+#include <mola-slam-gtsam/BackendHarness.h>
+#include <mola-slam-gtsam/ConstVelocityFactorSE3.h>
+#include <mola-slam-gtsam/KeyframeTimeIndex.h>
+#include <mola-slam-gtsam/gtsam_mola_bridge.h>
+#include <mrpt/core/bits_math.h>  // DEG2RAD()
+#include <mrpt/poses/CPose3D.h>
+#include <mrpt/random/RandomGenerators.h>
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+using namespace gtsam::symbol_shorthand;  // X(), V()
+
+/** Sweep sizes */
+static const std::vector<std::size_t> SIZES = {100, 1000, 10000, 100000};
+
+static double      min_time = 0.2;  // [s] per benchmark
+static std::string filter;
+
+/** Keeps results alive, so the compiler cannot drop the benchmarked code */
+static volatile double sink = 0;
+
+struct Result
+{
+    std::string name;
+    std::size_t n{0};  //!< Sweep size, or 0
+    double      ns_per_op{0};
+    std::size_t ops{0};
+};
+static std::vector<Result> results;
+
+static bool enabled(const std::string& name)
+{
+    return filter.empty() || name.find(filter) != std::string::npos;
+}
+
+/** Calls `f()`, which runs `ops_per_call` operations, until `min_time` has
+ * elapsed, and stores the mean time per operation. */
+template <class FUNCTOR>
+static void bench(
+    const std::string& name, const std::size_t n,
+    const std::size_t ops_per_call, FUNCTOR&& f)
+{
+    using clock = std::chrono::steady_clock;
+
+    f();  // warm up
+
+    std::size_t calls = 0;
+    const auto  t0    = clock::now();
+    double      dt    = 0;
+    do
+    {
+        f();
+        calls++;
+        dt = std::chrono::duration<double>(clock::now() - t0).count();
+    } while (dt < min_time);
+
+    Result r;
+    r.name      = name;
+    r.n         = n;
+    r.ops       = calls * ops_per_call;
+    r.ns_per_op = 1e9 * dt / r.ops;
+    results.push_back(r);
+
+    std::cout << std::left << std::setw(40) << name << std::right
+              << std::setw(9) << (n ? std::to_string(n) : std::string("-"))
+              << std::setw(14) << std::fixed << std::setprecision(1)
+              << r.ns_per_op << " ns/op\n";
+}
+
+static std::vector<mrpt::math::TPose3D> randomPoses(const std::size_t n)
+{
+    auto& rng = mrpt::random::getRandomGenerator();
+
+    const double                     pi = mrpt::DEG2RAD(180.0);
+    std::vector<mrpt::math::TPose3D> poses(n);
+    for (auto& p : poses)
+        p = mrpt::math::TPose3D(
+            rng.drawUniform(-50.0, 50.0), rng.drawUniform(-50.0, 50.0),
+            rng.drawUniform(-5.0, 5.0), rng.drawUniform(-pi, pi),
+            rng.drawUniform(-0.5, 0.5), rng.drawUniform(-0.5, 0.5));
+    return poses;
+}
+
+static void bench_const_vel_factor()
+{
+    const auto noise = gtsam::noiseModel::Isotropic::Sigma(6, 0.1);
+
+    if (enabled("ConstVelocityFactorSE3.evaluateError"))
+    {
+        const mola::ConstVelocityFactorSE3 f(
+            X(0), V(0), X(1), V(1), 0.1, noise);
+        const auto             p  = randomPoses(2);
+        const auto             x1 = mola::toPose3(p[0]);
+        const auto             x2 = mola::toPose3(p[1]);
+        const gtsam::Velocity3 v1(1, 0, 0), v2(1.1, 0, 0);
+
+        bench("ConstVelocityFactorSE3.evaluateError", 0, 1, [&]() {
+            sink = sink + f.evaluateError(x1, v1, x2, v2)[0];
+        });
+
+        gtsam::Matrix H1, H2, H3, H4;
+        bench("ConstVelocityFactorSE3.evaluateError+J", 0, 1, [&]() {
+            sink = sink + f.evaluateError(x1, v1, x2, v2, H1, H2, H3, H4)[0];
+        });
+    }
+
+    // Sweep: linearization of a chain of N factors, as done by the
+    // optimizers
+    if (enabled("ConstVelocityFactorSE3.linearize"))
+    {
+        for (const auto n : SIZES)
+        {
+            gtsam::NonlinearFactorGraph graph;
+            gtsam::Values               values;
+            const auto                  poses = randomPoses(n + 1);
+            for (std::size_t i = 0; i <= n; i++)
+            {
+                values.insert(X(i), mola::toPose3(poses[i]));
+                values.insert(V(i), gtsam::Velocity3(1, 0, 0));
+                if (i > 0)
+                    graph.emplace_shared<mola::ConstVelocityFactorSE3>(
+                        X(i - 1), V(i - 1), X(i), V(i), 0.1, noise);
+            }
+            bench("ConstVelocityFactorSE3.linearize", n, n, [&]() {
+                sink = sink + graph.linearize(values)->size();
+            });
+            bench("ConstVelocityFactorSE3.error", n, n, [&]() {
+                sink = sink + graph.error(values);
+            });
+        }
+    }
+}
+
+static void bench_conversions()
+{
+    const std::size_t N     = 1000;
+    const auto        poses = randomPoses(N);
+
+    std::vector<gtsam::Pose3> poses3;
+    for (const auto& p : poses) poses3.push_back(mola::toPose3(p));
+
+    if (enabled("toPose3"))
+        bench("toPose3", 0, N, [&]() {
+            for (const auto& p : poses) sink = sink + mola::toPose3(p).x();
+        });
+    if (enabled("toTPose3D"))
+        bench("toTPose3D", 0, N, [&]() {
+            for (const auto& p : poses3) sink = sink + mola::toTPose3D(p).x;
+        });
+    if (enabled("toTTwist3D"))
+    {
+        const gtsam::Velocity3 v(1, 2, 3);
+        bench("toTTwist3D", 0, N, [&]() {
+            for (std::size_t i = 0; i < N; i++)
+                sink = sink + mola::toTTwist3D(v).vx;
+        });
+    }
+}
+
+static void bench_time_index()
+{
+    if (!enabled("find_closest_KF_in_time")) return;
+
+    auto& rng = mrpt::random::getRandomGenerator();
+
+    const auto t0 = mrpt::Clock::fromDouble(1.5e9);
+    const auto at = [&](const double t) {
+        return t0 + std::chrono::duration_cast<mrpt::Clock::duration>(
+                        std::chrono::duration<double>(t));
+    };
+
+    for (const auto n : SIZES)
+    {
+        // One KF every 0.5 s, queries uniformly distributed over the session
+        mola::KeyframeTimeIndex index;
+        for (std::size_t i = 0; i < n; i++) index[at(0.5 * i)] = i;
+
+        const std::size_t                    Q = 1000;
+        std::vector<mrpt::Clock::time_point> queries;
+        for (std::size_t i = 0; i < Q; i++)
+            queries.push_back(at(rng.drawUniform(0.0, 0.5 * n)));
+
+        bench("find_closest_KF_in_time", n, Q, [&]() {
+            for (const auto& q : queries)
+                sink = sink + mola::find_closest_KF_in_time(index, q);
+        });
+    }
+}
+
+/** New KFs in ASLAM_gtsam (registered in the ID maps by
+ * mola2gtsam_register_new_kf()), as the map grows; then,
+ * ASLAM_gtsam::write_back() of N optimized poses and velocities, as run at
+ * the end of spinOnce(). */
+static void bench_kf_maps()
+{
+    const bool do_add   = enabled("ASLAM_gtsam.doAddKeyFrame");
+    const bool do_write = enabled("write_back");
+    if (!do_add && !do_write) return;
+
+    mola::BackendHarness h(
+        "ASLAM_gtsam", mola::BackendHarness::defaultConfig(
+                           "ASLAM_gtsam", "  state_vector: SE3Vel\n"));
+    auto&                be   = h.backend();
+    auto&                slam = dynamic_cast<mola::ASLAM_gtsam&>(be);
+
+    const auto              t0   = mrpt::Clock::fromDouble(1.5e9);
+    std::vector<mola::id_t> kfs;
+    std::size_t             next   = 0;
+    const auto              add_kf = [&]() {
+        mola::BackEndBase::ProposeKF_Input in;
+        in.timestamp = t0 + std::chrono::seconds(next++);
+        kfs.push_back(be.doAddKeyFrame(in).new_kf_id.value());
+    };
+
+    for (const auto n : SIZES)
+    {
+        if (n > 10000) break;  // Too slow to grow, and little more to learn
+
+        // Grow up to N KFs, then time the creation of 100 more:
+        while (kfs.size() < n) add_kf();
+        if (do_add)
+        {
+            // Just once, since the map grows with each call:
+            const std::size_t M     = 100;
+            const double      old_t = min_time;
+            min_time                = 0;
+            bench("ASLAM_gtsam.doAddKeyFrame", n, M, [&]() {
+                for (std::size_t i = 0; i < M; i++) add_kf();
+            });
+            min_time = old_t;
+        }
+
+        if (!do_write) continue;
+
+        // The actual write-back of spinOnce(), with all KFs changed:
+        gtsam::Values values;
+        gtsam::KeySet keys;
+        const auto    poses = randomPoses(n);
+        for (std::size_t i = 0; i < n; i++)
+        {
+            values.insert(X(kfs[i]), mola::toPose3(poses[i]));
+            values.insert(V(kfs[i]), gtsam::Velocity3(1, 0, 0));
+            keys.insert(X(kfs[i]));
+            keys.insert(V(kfs[i]));
+        }
+
+        bench("write_back", n, 2 * n, [&]() {
+            slam.write_back(values, keys);
+        });
+    }
+}
+
+static void usage(const char* argv0)
+{
+    std::cerr << "Usage: " << argv0
+              << " [--filter <SUBSTRING>] [--min-time <SECONDS>]\n"
+                 "       [--json <FILE.json>]\n";
+}
+
+int main(int argc, char** argv)
+{
+    try
+    {
+        std::string jsonFile;
+        for (int i = 1; i < argc; i++)
+        {
+            const bool has_arg = (i + 1 < argc);
+            if (!std::strcmp(argv[i], "--filter") && has_arg)
+                filter = argv[++i];
+            else if (!std::strcmp(argv[i], "--min-time") && has_arg)
+                min_time = std::stod(argv[++i]);
+            else if (!std::strcmp(argv[i], "--json") && has_arg)
+                jsonFile = argv[++i];
+            else
+            {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+
+        mrpt::random::getRandomGenerator().randomize(1);
+
+        bench_const_vel_factor();
+        bench_conversions();
+        bench_time_index();
+        bench_kf_maps();
+
+        if (!jsonFile.empty())
+        {
+            std::ofstream f(jsonFile);
+            if (!f.is_open())
+                throw std::runtime_error("Cannot write: " + jsonFile);
+            f << "[\n";
+            for (std::size_t i = 0; i < results.size(); i++)
+            {
+                const auto& r = results[i];
+                f << "{\"name\": \"" << r.name << "\", \"n\": " << r.n
+                  << ", \"ops\": " << r.ops
+                  << ", \"ns_per_op\": " << r.ns_per_op << "}"
+                  << (i + 1 < results.size() ? ",\n" : "\n");
+            }
+            f << "]\n";
+        }
+        return 0;
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
@@ -0,0 +1,43 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @file   mola-trajectory-compact.cpp
+ * @brief  Builds the final trajectory from a binary stream written by
+ *         ASLAM_gtsam (see TrajectoryWriter)
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 02, 2019
+ */
+
+#include <mola-slam-gtsam/TrajectoryWriter.h>
+
+#include <iostream>
+
+int main(int argc, char** argv)
+{
+    try
+    {
+        if (argc != 3 && argc != 4)
+        {
+            std::cerr << "Usage: " << argv[0]
+                      << " <INPUT_STREAM.bin> <OUTPUT_FILE> [TUM|KITTI]\n";
+            return 1;
+        }
+
+        auto fmt = mola::TrajectoryWriter::Format::TUM;
+        if (argc == 4)
+            fmt = mrpt::typemeta::TEnumType<
+                mola::TrajectoryWriter::Format>::name2value(argv[3]);
+
+        mola::TrajectoryWriter::Compact(argv[1], argv[2], fmt);
+        return 0;
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
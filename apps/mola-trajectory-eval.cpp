@@ -0,0 +1,90 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @file   mola-trajectory-eval.cpp
+ * @brief  Computes ATE and RPE of an estimated trajectory vs. ground truth
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 09, 2019
+ */
+
+#include <mola-slam-gtsam/TrajectoryEvaluation.h>
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+static void usage(const char* prg)
+{
+    std::cerr
+        << "Usage: " << prg
+        << " <ESTIMATED_PATH> <GROUND_TRUTH> [options]\n"
+           "Options:\n"
+           "  --max-dt <s>       Max. timestamp difference (default: 0.02)\n"
+           "  --scale            Align with a similarity transform\n"
+           "  --rpe-delta <n>    RPE step, in poses (default: 1)\n"
+           "  --output <file>    Write the JSON report here (default: "
+           "stdout)\n";
+}
+
+int main(int argc, char** argv)
+{
+    try
+    {
+        if (argc < 3)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+
+        mola::TrajectoryEvalParams p;
+        std::string                outFile;
+        for (int i = 3; i < argc; i++)
+        {
+            const bool hasArg = (i + 1 < argc);
+            if (!std::strcmp(argv[i], "--max-dt") && hasArg)
+                p.max_dt = std::stod(argv[++i]);
+            else if (!std::strcmp(argv[i], "--scale"))
+                p.with_scale = true;
+            else if (!std::strcmp(argv[i], "--rpe-delta") && hasArg)
+                p.rpe_delta = std::stoul(argv[++i]);
+            else if (!std::strcmp(argv[i], "--output") && hasArg)
+                outFile = argv[++i];
+            else
+            {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+
+        const auto t0  = std::chrono::steady_clock::now();
+        const auto est = mola::loadTrajectory(argv[1]);
+        const auto gt  = mola::loadTrajectory(argv[2]);
+        const auto res = mola::evaluateTrajectory(est, gt, p);
+        const auto t1  = std::chrono::steady_clock::now();
+
+        std::cerr << "Evaluated " << res.associated << " poses in "
+                  << std::chrono::duration<double>(t1 - t0).count()
+                  << " s. ATE RMSE=" << res.ate_trans.rmse << " m\n";
+
+        if (outFile.empty())
+            mola::reportToJSON(res, std::cout);
+        else
+        {
+            std::ofstream f(outFile);
+            if (!f.is_open())
+                throw std::runtime_error("Cannot create: " + outFile);
+            mola::reportToJSON(res, f);
+        }
+        return 0;
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
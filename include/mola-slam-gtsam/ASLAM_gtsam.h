@@ -14,6 +14,18 @@
 // mrpt includes first:
 #include <mola-kernel/WorkerThreadsPool.h>
 #include <mola-kernel/interfaces/BackEndBase.h>
+#include <mola-slam-gtsam/AllocProfiler.h>
+#include <mola-slam-gtsam/BackendCallLog.h>
+#include <mola-slam-gtsam/BackendJournal.h>
+#include <mola-slam-gtsam/ChunkedMap.h>
+#include <mola-slam-gtsam/KeyframeObsStore.h>
+#include <mola-slam-gtsam/KeyframeTimeIndex.h>
+#include <mola-slam-gtsam/LatencyHistogram.h>
+#include <mola-slam-gtsam/SeparatorExchange.h>
+#include <mola-slam-gtsam/SolverCheckpoint.h>
+#include <mola-slam-gtsam/TraceRecorder.h>
+#include <mola-slam-gtsam/TrajectoryStore.h>
+#include <mola-slam-gtsam/TrajectoryWriter.h>
 #include <mrpt/graphs/CNetworkOfPoses.h>
 #include <mrpt/gui/CDisplayWindow3D.h>
 #include <mrpt/poses/CPose3DInterpolator.h>
@@ -23,9 +35,15 @@
 #include <gtsam/geometry/Pose3.h>
 #include <gtsam/nonlinear/ISAM2.h>
 #include <gtsam/nonlinear/NonlinearFactorGraph.h>
+#include <gtsam_unstable/nonlinear/IncrementalFixedLagSmoother.h>
 #include <gtsam_unstable/slam/SmartStereoProjectionPoseFactor.h>
 
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <deque>
 #include <mutex>
+#include <optional>
 
 namespace mola
 {
@@ -90,17 +108,163 @@ class ASLAM_gtsam : public BackEndBase
          * formats, if !="" (default:"") */
         std::string save_trajectory_file_prefix{};
 
+        /** If !=None, poses are also streamed to disk while SLAM runs, into
+         * `<save_trajectory_file_prefix>_stream.<ext>`, so they survive a
+         * crash. Keyframes are appended again each time the optimizer
+         * corrects them; text formats are compacted at onQuit(). See
+         * TrajectoryWriter. (default:None) */
+        TrajectoryWriter::Format stream_trajectory_format{
+            TrajectoryWriter::Format::None};
+
+        /** Minimum time between non-keyframe poses kept in memory for
+         * save_trajectory_file_prefix [s]. 0: keep all (default) */
+        double trajectory_decimation_period{0};
+
+        /** If >0, only this number of chunks of the in-memory trajectory
+         * are kept in RAM, older ones are moved to a memory-mapped file
+         * `<save_trajectory_file_prefix>_trajectory.spill`. See
+         * TrajectoryStore. */
+        int trajectory_max_resident_chunks{0};
+
         /** Save map at end of a SLAM session. See
          * WorldModel::map_base_directory() to see where maps are stored by
          * default and how to change it. */
         bool save_map_at_end{true};
 
+        /** If >0, the map is saved in chunks of this number of entities
+         * (or factors) into `<map_base_directory>/WorldModel.chunks`, in
+         * parallel and rewriting only chunks modified since the last save.
+         * See ChunkedMapWriter. 0: single `WorldModel.map` file (default) */
+        int map_chunk_size{0};
+
+        /** gzip level for map chunks (0-9) */
+        int map_compress_level{1};
+
+        /** If >0 and `map_chunk_size>0`, the map is also saved in the
+         * background with this period [s] while SLAM runs. */
+        double map_save_period{0};
+
+        /** If true, initialize() loads the map from
+         * `<map_base_directory>/WorldModel.chunks` (or, if it does not
+         * exist, `WorldModel.map`) and continues SLAM from it.
+         * (default:false) */
+        bool load_map_at_start{false};
+
+        /** Localization-only mode: keyframes of the loaded map (see
+         * `load_map_at_start`) are frozen and never optimized again. New
+         * keyframes are optimized in a sliding window of the last
+         * `localization_window_size` keyframes; frozen (or older)
+         * keyframes they connect to enter the window as strong priors.
+         * Per-update cost does not depend on the size of the prior map.
+         * Smart factors are not supported in this mode: adding one throws.
+         * (default:false) */
+        bool localization_only{false};
+        int  localization_window_size{20};
+
+        /** If !="", the solver state is saved to this file at the end (see
+         * saveCheckpoint()), and restored from it at start together with
+         * `load_map_at_start`, instead of rebuilding the graph from the
+         * WorldModel. (default:"") */
+        std::string checkpoint_file{};
+
+        /** If !="", crash recovery is enabled: every back-end API call is
+         * appended to a write-ahead journal in this directory before it is
+         * applied (see BackendJournal), and consistent checkpoints of the
+         * map and the solver are taken in the background every
+         * `checkpoint_period` seconds. At start, the latest checkpoint is
+         * loaded and the journal tail replayed, instead of
+         * `load_map_at_start`.
+         * Requires `map_chunk_size>0`, and replaces `map_save_period`.
+         * (default:"") */
+        std::string journal_directory{};
+
+        /** Minimum period between journal fsync()s [s]. 0: each call is
+         * synced before it is applied, which costs an fsync() per call.
+         * Otherwise, it is written to the OS before being applied, but
+         * synced together with later calls (group commit), so the calls of
+         * the last period may be lost on a power failure, though not if
+         * only the process crashes. (default:1.0) */
+        double journal_sync_period{1.0};
+
+        /** Period between background checkpoints [s] */
+        double checkpoint_period{60.0};
+
+        /** Multi-robot mode: ID of this robot (>=0), or -1 to disable.
+         * Each robot runs its own instance and keeps only its own map, in
+         * its own frame, plus copies of the keyframes of other robots that
+         * its inter-robot constraints reference (see addInterRobotFactor())
+         * and the pose of each peer's frame (see peerFramePose()).
+         * Instances exchange SeparatorSummary messages through Unix
+         * sockets in `separator_ipc_directory`, every
+         * `separator_exchange_period` seconds (0: each spinOnce()). */
+        int         robot_id{-1};
+        std::string separator_ipc_directory{};
+        double      separator_exchange_period{0.5};
+
         /** Const. velocity model: sigma of the position equation (see paper) */
         double const_vel_model_std_pos{0.1};
         /** Const. velocity model: sigma of the velocity equation (see paper) */
         double const_vel_model_std_vel{1.0};
 
         double max_interval_between_kfs_for_dynamic_model{5.0};
+
+        /** Show the SLAM graph in a 3D window (default:true). Set to false
+         * for headless runs and benchmarks. */
+        bool show_gui{true};
+
+        /** If !="", all calls to the back-end API are recorded into this
+         * binary file, for later use with mola-backend-replay. See
+         * BackendCallRecorder. (default:"") */
+        std::string record_api_calls_file{};
+
+        /** If !="", keyframe raw observations are moved out of the world
+         * model into this append-only file, and only the most recently used
+         * ones are kept in RAM. Use keyframe_observations() to access them.
+         * Saved maps still contain the observations; the file is deleted at
+         * the end of the session only once the map was saved.
+         * (default:"") */
+        std::string keyframe_obs_store_file{};
+
+        /** Memory budget for cached keyframe observations, when
+         * `keyframe_obs_store_file` is set [MiB] */
+        double keyframe_obs_cache_mb{256.0};
+
+        /** Number of the most recent per-spin statistics kept in memory.
+         * See spin_stats(). 0: disabled. (default:1000) */
+        int spin_stats_capacity{1000};
+
+        /** If !="", the per-spin statistics in memory are written to this
+         * CSV file at onQuit(). (default:"") */
+        std::string spin_stats_csv_file{};
+
+        /** If !="", end-to-end latency percentiles are written to this
+         * JSON file at onQuit(). See latency_histograms(). (default:"") */
+        std::string latency_stats_file{};
+
+        /** If >0, memory_report() is logged with this period [s], from
+         * spinOnce(). 0: disabled. (default:0) */
+        double memory_report_period{0};
+
+        /** If !="", a timeline of back-end calls and spinOnce() phases,
+         * from all threads, is recorded (see TraceRecorder) and written to
+         * this file at onQuit(), in the Chrome trace-event JSON format.
+         * (default:"") */
+        std::string trace_file{};
+
+        /** If !="", heap allocations per back-end call and spinOnce()
+         * phase (see AllocProfiler) are written to this JSON file at
+         * onQuit(). Requires building with the CMake option
+         * MOLA_SLAM_GTSAM_ALLOC_PROFILING. (default:"") */
+        std::string alloc_stats_file{};
+
+        /** If true, each iSAM2 update also estimates the cost of each kind
+         * of factor (see SpinStats::factor_costs). The linearization of up
+         * to `factor_cost_samples` factors of each kind is timed again after
+         * the update (smart factors, with their triangulation), and scaled
+         * to the number of factors of that kind that the update linearized.
+         * (default:false) */
+        bool factor_cost_stats{false};
+        int  factor_cost_samples{20};
     };
 
     Parameters params_;
@@ -113,6 +277,64 @@ class ASLAM_gtsam : public BackEndBase
     void onSmartFactorChanged(
         mola::fid_t id, const mola::FactorBase* f) override;
 
+    /** Like doAddKeyFrame(), but takes shared ownership of the observations
+     * instead of copying them into a new CSensoryFrame. The caller must not
+     * modify `observations` afterwards. `observations` may be nullptr.
+     *
+     * doAddKeyFrame() gets the frame by value inside a const
+     * ProposeKF_Input, so it cannot avoid one copy of it. Callers that own
+     * a CSensoryFrame::Ptr should use this method instead, as
+     * replayBackendCalls() (and hence journal recovery) does. */
+    ProposeKF_Output addKeyFrameShared(
+        const mrpt::Clock::time_point&       timestamp,
+        const mrpt::obs::CSensoryFrame::Ptr& observations);
+
+    /** Adds one observation to an existing smart stereo factor. This is
+     * what onSmartFactorChanged() does for SmartFactorStereoProjectionPose;
+     * it is exposed to replay recorded sessions. The caller must hold
+     * lock_slam(). */
+    void addSmartStereoObservation(
+        const mola::fid_t id, const mola::id_t observing_kf,
+        const double x_left, const double x_right, const double y);
+
+    /** Sets the initial guess of a KF that is not in the solver yet (in
+     * the map frame, where the root KF is the identity). It is used instead
+     * of dead reckoning when the first factor reaching the KF arrives.
+     * Ignored for the root KF and for KFs that already have a value. */
+    void setKeyFrameInitialGuess(
+        const mola::id_t kf_id, const mrpt::math::TPose3D& pose);
+
+    /** Saves the complete solver state (iSAM2 Bayes tree, factors and
+     * linearization point, pending factors, ID maps, bookkeeping) to a
+     * binary file. The WorldModel itself is not included: save the map
+     * too. Thread-safe. */
+    void saveCheckpoint(const std::string& file);
+
+    /** Restores a file written by saveCheckpoint(). Must be called before
+     * any keyframe is added, once the matching map is in the WorldModel.
+     * The iSAM2 Bayes tree is restored as it was saved: there is no
+     * elimination nor re-optimization. */
+    void loadCheckpoint(const std::string& file);
+
+    /** Rebuilds the gtsam graph, initial values, and all ID/timestamp
+     * indices from the contents of the WorldModel, then initializes the
+     * solver in one batch step. Used to continue from a loaded map:
+     * initialize() calls it for `load_map_at_start`; otherwise, call it
+     * after loading a map (e.g. with loadChunkedMap()), before adding any
+     * keyframe. */
+    void rebuild_from_worldmodel();
+
+    /** Raw observations of a keyframe, either from the world model entity
+     * or from the on-disk store (see Parameters::keyframe_obs_store_file).
+     * Returns nullptr if the KF has no observations. */
+    mrpt::obs::CSensoryFrame::Ptr keyframe_observations(const mola::id_t kf);
+
+    /** Sends the values of `keys` in `result` to the WorldModel, the map
+     * viz and the trajectory writer, as spinOnce() does with the keys
+     * changed by each solver update. Keys which are not KF poses or
+     * velocities are ignored. Public for benchmarking. */
+    void write_back(const gtsam::Values& result, const gtsam::KeySet& keys);
+
     void lock_slam() override;
     void unlock_slam() override;
 
@@ -123,6 +345,202 @@ class ASLAM_gtsam : public BackEndBase
     mola::id_t temp_createLandmark(
         const mrpt::math::TPoint3D& init_value) override;
 
+    /** Writes the current pose graph in g2o format: one `VERTEX_SE3:QUAT`
+     * per keyframe (with its latest estimate), one `EDGE_SE3:QUAT` per
+     * relative pose factor, and a `FIX` for the global reference frame.
+     * Vertex IDs are MOLA WorldModel IDs. See importPoseGraph() for the
+     * inverse operation. */
+    void exportPoseGraphG2O(std::ostream& o);
+
+    /** Starts a new, disconnected map in the atlas, e.g. when the front-end
+     * lost tracking: the next keyframe gets a new global reference frame
+     * (like the first one), with no dynamics factor nor initial guess from
+     * the former map. A later FactorRelativePose3 between keyframes of two
+     * maps merges them into one. Thread-safe. */
+    void startNewMap();
+
+    /** Number of maps in the atlas: 1 until startNewMap() is called, and
+     * decremented when two maps are merged. */
+    std::size_t atlas_map_count();
+
+    /** Multi-robot mode: adds a constraint with the pose of keyframe
+     * `peer_kf` of robot `peer_robot` as seen from our keyframe `kf`.
+     * The peer learns about it with the next summary. Thread-safe. */
+    void addInterRobotFactor(
+        const mola::id_t kf, const uint32_t peer_robot,
+        const mola::id_t peer_kf, const mrpt::math::TPose3D& rel_pose,
+        const double sigma_xyz, const double sigma_rot);
+
+    struct SeparatorStatus
+    {
+        std::size_t sent{0}, received{0}, constraints{0};
+        /** Max. distance between our estimate of peer keyframes and their
+         * owner's estimate, in the latest summary of each peer [m]. It
+         * goes to zero as the robots' maps become consistent. */
+        double max_disagreement{0};
+        /** Time spent computing the marginals of summaries: in total, and
+         * for the latest one [s]. */
+        double marginals_time{0}, last_marginals_time{0};
+        /** Dimension of the joint (top of the Bayes tree) the latest
+         * marginals were computed from. It is bounded by the number of
+         * separators, not by the size of the map. */
+        std::size_t last_marginals_dim{0};
+    };
+    SeparatorStatus separatorStatus();
+
+    /** Multi-robot mode: our estimate of the pose of the frame of robot
+     * `peer` (where its map starts) in our frame, or none until its first
+     * summary referencing one of our constraints has been processed. */
+    std::optional<mrpt::math::TPose3D> peerFramePose(const uint32_t peer);
+
+    /** Number of elements in the solver and in the main containers of the
+     * back-end state, to monitor their growth over long sessions */
+    struct StateSizes
+    {
+        std::size_t isam2_factors{0};  //!< Non-null factors in iSAM2
+        std::size_t isam2_cliques{0};  //!< Cliques in the Bayes tree
+        std::size_t values{0};  //!< Variables in the latest estimate
+        std::size_t kfs{0};  //!< Keyframes with gtsam keys
+        std::size_t time2kf{0}, trajectory{0}, stereo_factors{0};
+        std::size_t vizmap_nodes{0}, vizmap_edges{0};
+    };
+    /** Thread-safe. O(number of cliques) */
+    StateSizes state_sizes();
+
+    /** Kinds of gtsam factors, for SpinStats::factor_costs */
+    enum class FactorKind : uint8_t
+    {
+        RelativePose3 = 0,  //!< BetweenFactor<Pose3>
+        ConstVelocity,  //!< ConstVelocityFactorSE3
+        StereoProjection,  //!< GenericStereoFactor
+        SmartStereo,  //!< SmartStereoProjectionPoseFactor
+        Prior,  //!< Priors on poses and velocities
+        Other,
+        //-- end of list --
+        Count
+    };
+
+    /** Cost of one kind of factors in an iSAM2 update */
+    struct FactorKindCost
+    {
+        /** Factors linearized in the update, as iSAM2 does: new ones,
+         * and those whose variables were all re-eliminated (only those on
+         * relinearized variables, with cacheLinearizedFactors) */
+        std::size_t linearized{0};
+        /** Estimated time to linearize them [s]. Smart factors are timed
+         * with triangulation, even if their poses did not change. */
+        double t_linearize{0};
+        /** Approximate cost of the dense partial Cholesky of each
+         * re-eliminated clique [flops], split among the kinds of the
+         * factors on its frontal variables in proportion to their
+         * dimension */
+        double elimination_flops{0};
+    };
+    using FactorKindCosts = std::array<
+        FactorKindCost, static_cast<std::size_t>(FactorKind::Count)>;
+
+    /** Solver statistics of one spinOnce() call */
+    struct SpinStats
+    {
+        uint64_t                spin{0};  //!< Sequence number
+        mrpt::Clock::time_point timestamp{};  //!< When it started
+        /** false if there was nothing new to optimize */
+        bool solved{false};
+
+        std::size_t new_factors{0}, removed_factors{0}, new_variables{0};
+        /** iSAM2 only: variables re-eliminated and relinearized in this
+         * update, factors relinearized, and cliques in the Bayes tree */
+        std::size_t variables_reeliminated{0}, variables_relinearized{0};
+        std::size_t factors_recalculated{0}, cliques{0};
+        /** Variables in the new estimate */
+        std::size_t variables_total{0};
+        /** Total error before and after the update (NaN if unknown) */
+        double error_before{std::nan("")}, error_after{std::nan("")};
+
+        /** Time of each phase [s]: solver update (including additional
+         * update steps), estimate, write-back to the WorldModel, and the
+         * whole spinOnce() */
+        double t_update{0}, t_estimate{0}, t_writeback{0}, t_total{0};
+
+        /** Per kind of factor, indexed by FactorKind. iSAM2 only, and only
+         * if Parameters::factor_cost_stats is enabled (zero otherwise) */
+        FactorKindCosts factor_costs{};
+    };
+
+    /** The latest Parameters::spin_stats_capacity spin statistics, oldest
+     * first. Thread-safe. */
+    std::vector<SpinStats> spin_stats();
+
+    /** Time spent by the crash recovery journal, see
+     * Parameters::journal_directory */
+    BackendJournal::Stats journal_stats() const { return journal_.stats(); }
+
+    /** Writes spin_stats() to a CSV file, with a header line */
+    void saveSpinStatsCSV(const std::string& file);
+
+    /** Stages of the end-to-end latency of keyframes, factors and smart
+     * factor observations: from their arrival (doAddKeyFrame(),
+     * doAddFactor(), addSmartStereoObservation()) to the start of the
+     * solver update that includes them (Queue), the update itself plus the
+     * estimate (Solve), the write-back of the results into the WorldModel
+     * (WriteBack), and all of them (Total). */
+    enum class LatencyStage : uint8_t
+    {
+        Queue = 0,
+        Solve,
+        WriteBack,
+        Total,
+        //-- end of list --
+        Count
+    };
+    using LatencyStageHistograms = std::array<
+        LatencyHistogram, static_cast<std::size_t>(LatencyStage::Count)>;
+
+    /** Latency histograms per arrival type (`KeyFrame`,
+     * `FactorRelativePose3`, `SmartStereoObservation`,...). Thread-safe. */
+    std::map<std::string, LatencyStageHistograms> latency_histograms();
+
+    /** Writes the count, mean and percentiles of latency_histograms(), per
+     * type and stage, as a JSON object */
+    void saveLatencyStatsJSON(const std::string& file);
+
+    /** Approximate memory held by each part of the back-end state [bytes].
+     * These are estimates from the number and type of elements of each
+     * container, without allocator overhead, to find out what grows. */
+    struct MemoryReport
+    {
+        /** iSAM2 (or the sliding-window smoother): Bayes tree cliques with
+         * their conditionals and cached factors; nonlinear factors (except
+         * smart ones), their linearization and the variable index; and the
+         * linearization point and deltas. */
+        std::size_t isam2_bayes_tree{0}, isam2_factors{0}, isam2_values{0};
+        /** Factors and values not passed to the solver yet */
+        std::size_t pending{0};
+        std::size_t last_values{0};
+        /** KF and smart factor ID maps, kf_has_value */
+        std::size_t id_maps{0};
+        std::size_t time2kf{0};
+        /** Resident chunks of the in-memory trajectory */
+        std::size_t trajectory{0};
+        /** Smart factors, including their linearization in the solver */
+        std::size_t smart_factors{0};
+        /** vizmap and vizmap_dyn */
+        std::size_t vizmap{0};
+        /** Render decorations of keyframes, shown in the GUI (serialized
+         * size) */
+        std::size_t gui_decorations{0};
+        /** Raw observations of keyframes in the WorldModel, plus those
+         * cached by the on-disk store (serialized size) */
+        std::size_t kf_observations{0};
+
+        std::size_t total() const;
+    };
+
+    /** Thread-safe. O(cliques + factors + variables), plus serializing the
+     * observations and decorations of keyframes not seen by a former
+     * call. See Parameters::memory_report_period */
+    MemoryReport memory_report();
+
    private:
     /** Indices for accessing the KF_gtsam_keys array */
     enum kf_key_index_t
@@ -150,6 +568,9 @@ class ASLAM_gtsam : public BackEndBase
         std::set<mola::id_t> kf_has_value;
         gtsam::Values        last_values;
 
+        /** See setKeyFrameInitialGuess(). Entries are removed once used */
+        std::map<mola::id_t, mrpt::math::TPose3D> kf_initial_guess;
+
         template <class T>
         T at_new_or_last_values(const gtsam::Key& k) const
         {
@@ -164,16 +585,19 @@ class ASLAM_gtsam : public BackEndBase
          * non-keyframes. We keep them relative so we can reconstruct the
          * optimal poses at any moment, composing the poses of the base,
          * optimized, KF of reference for each entry. */
-        std::map<mrpt::Clock::time_point, AdvertiseUpdatedLocalization_Input>
-            trajectory{};
+        TrajectoryStore trajectory;
 
         // locked by last_kf_estimates_lock_ as well:
         mrpt::graphs::CNetworkOfPoses3D            vizmap;
         std::map<mola::id_t, mrpt::math::TTwist3D> vizmap_dyn;
 
-        /** Absolute coordinates single reference frame (WorldModel index) */
+        /** Absolute coordinates single reference frame (WorldModel index)
+         * of the current map. See startNewMap() */
         id_t root_kf_id{mola::INVALID_ID};
 
+        /** Set by startNewMap(), cleared when the new root is created */
+        bool new_map_requested{false};
+
         id_t last_created_kf_id{mola::INVALID_ID};
         id_t former_last_created_kf_id{mola::INVALID_ID};
 
@@ -206,12 +630,42 @@ class ASLAM_gtsam : public BackEndBase
         };
         StereoSmartFactorState stereo_factors;
 
-        std::map<mrpt::Clock::time_point, mola::id_t> time2kf;
+        KeyframeTimeIndex time2kf;
 
         std::vector<mola::SmartFactorIMU*> active_imu_factors;
+
+        /** Sliding-window solver for Parameters::localization_only */
+        std::unique_ptr<gtsam::IncrementalFixedLagSmoother> loc_smoother;
+        /** KFs of the prior map, never modified in localization mode */
+        std::set<mola::id_t> frozen_kfs;
+        /** Sequence number of each non-frozen KF in the sliding window,
+         * used as "timestamp" by loc_smoother so the lag counts KFs. */
+        std::map<mola::id_t, double> loc_kf_seq;
+        double                       loc_last_seq{0};
     };
 
     SLAM_state state_;
+
+    /** See Parameters::robot_id. Locked by isam2_lock_ */
+    struct SeparatorState
+    {
+        SeparatorChannel channel;
+        /** All known constraints involving this robot */
+        std::vector<InterRobotConstraint> constraints;
+        /** Factor from the owner's summary on each copy of a peer KF (a
+         * BetweenFactor from the peer's frame_key()): its index in iSAM2,
+         * or in `newfactors` while pending. */
+        std::map<gtsam::Key, gtsam::FactorIndex> prior_index;
+        std::map<std::size_t, gtsam::Key>        pending_priors;
+        gtsam::FactorIndices                     to_remove;
+
+        std::map<uint32_t, uint64_t> last_seq;  //!< per peer
+        std::map<uint32_t, double>   disagreement;
+        uint64_t                     seq{0};
+        mrpt::Clock::time_point      last_sent{};
+        SeparatorStatus              status;
+    };
+    SeparatorState separators_;
     /** mutex for: gtsam solver (isam2), newfactors, newvalues & kf_has_value */
     std::recursive_timed_mutex isam2_lock_;
     std::recursive_timed_mutex vizmap_lock_;
@@ -223,11 +677,95 @@ class ASLAM_gtsam : public BackEndBase
     fid_t addFactor(const SmartFactorStereoProjectionPose& f);
     fid_t addFactor(const SmartFactorIMU& f);
 
-    mola::id_t internal_addKeyFrame_Root(const ProposeKF_Input& i);
-    mola::id_t internal_addKeyFrame_Regular(const ProposeKF_Input& i);
+    /** Replaces `pose` with the setKeyFrameInitialGuess() of `kf_id`, if
+     * any, and forgets it. isam2_lock_ must be held. */
+    void take_initial_guess(const mola::id_t kf_id, mrpt::math::TPose3D& pose);
+
+    /** Creates the gtsam factor(s) for an existing MOLA factor, without
+     * touching the WorldModel. Used by addFactor() and when loading maps. */
+    void gtsam_add_factor(const FactorRelativePose3& f);
+    void gtsam_add_factor(const FactorDynamicsConstVel& f, const double dt);
+
+    /** gtsam key of our copy of keyframe `kf` of robot `robot` */
+    static gtsam::Key peer_key(const uint32_t robot, const mola::id_t kf);
+    /** gtsam key of the pose of the frame of robot `robot` in ours */
+    static gtsam::Key frame_key(const uint32_t robot);
+    /** Our own KFs use X(), peer ones peer_key() */
+    gtsam::Key separator_key(const uint32_t robot, const mola::id_t kf) const;
+    /** All separator variables: our KFs and peer KF copies in
+     * constraints, and the frames of peers. isam2_lock_ must be held. */
+    gtsam::KeySet separator_keys() const;
+    /** Orders the separator variables last in the iSAM2 update `up`, so
+     * they stay at the root of the Bayes tree. isam2_lock_ must be held,
+     * after separator_receive(). */
+    void separator_constrain(gtsam::ISAM2UpdateParams& up) const;
+    /** Adds a constraint, and a copy of the peer KF if it is new. Does
+     * nothing if it is already known. isam2_lock_ must be held. */
+    void separator_add_constraint(const InterRobotConstraint& c);
+    /** Processes all pending summaries from peers. isam2_lock_ must be
+     * held, before the iSAM2 update. */
+    void separator_receive();
+    /** Records the iSAM2 indices of new summary factors. */
+    void separator_on_update(const gtsam::ISAM2Result& res);
+    /** Sends a summary to each peer, if it is time to. Locks isam2_lock_ */
+    void separator_send();
+    /** Rebuilds the known constraints and prior indices from the iSAM2
+     * graph, e.g. after its factors got new indices. */
+    void separator_reindex();
+
+    /** Localization-only mode: runs one sliding-window update with the
+     * pending new factors and values, and returns the estimate of
+     * non-frozen variables. isam2_lock_ must be held by the caller. */
+    gtsam::Values localization_update();
+
+    /** Copies the solver state into a checkpoint. The iSAM2 state is
+     * serialized in memory, since smart factors keep changing, or, if
+     * `defer_isam2`, copied with its smart factors cloned, to be
+     * serialized later by writeSolverCheckpoint(), which takes much
+     * longer. Pending factors are shared, except smart ones, which are
+     * cloned. Locks isam2_lock_, vizmap_lock_ and keys_map_lock_. */
+    SolverCheckpoint take_checkpoint(const bool defer_isam2 = false);
+    void             restore_checkpoint(const SolverCheckpoint& cp);
+
+
+    /** Atlas: all maps live in the same solver as disconnected subgraphs,
+     * each with its own root prior, hence independent trees in the iSAM2
+     * Bayes tree: an update in one map does not touch the others.
+     * A map is identified by the ID of its root (RefPose3), which is the
+     * `base_id_` of its keyframes in the WorldModel. Returns INVALID_ID for
+     * non-keyframe entities. Locks the WorldModel entities. */
+    mola::id_t atlas_map_of(const mola::id_t id);
+
+    /** Merges the maps joined by `f`: the map not containing the oldest
+     * root is moved into the frame of the other one by the rigid transform
+     * that satisfies `f` with the current estimates, its root prior is
+     * dropped, and the whole graph is re-solved in one batch step.
+     * isam2_lock_ must be held by the caller. */
+    void atlas_merge(
+        const FactorRelativePose3& f, const mola::id_t map_from,
+        const mola::id_t map_to);
+
+    /** Common implementation of doAddKeyFrame() and addKeyFrameShared() */
+    ProposeKF_Output internal_addKeyFrame(
+        const mrpt::Clock::time_point&       timestamp,
+        const mrpt::obs::CSensoryFrame::Ptr& obs, const double rec_t0);
+    mola::id_t internal_addKeyFrame_Root(
+        const mrpt::Clock::time_point&       timestamp,
+        const mrpt::obs::CSensoryFrame::Ptr& obs);
+    mola::id_t internal_addKeyFrame_Regular(
+        const mrpt::Clock::time_point&       timestamp,
+        const mrpt::obs::CSensoryFrame::Ptr& obs);
 
     void mola2gtsam_register_new_kf(const mola::id_t kf_id);
 
+    /** Noise of the strong prior of the root KF. Also used for frozen KFs
+     * in localization_only mode, which are constants as well. */
+    static gtsam::SharedNoiseModel root_prior_noise();
+
+    /** Adds the initial value and the strong prior of the global reference
+     * frame (root) */
+    void gtsam_add_root_prior(const mola::id_t root_id);
+
     void internal_add_gtsam_prior_vel(const mola::id_t kf_id);
 
     struct whole_path_t
@@ -246,6 +784,104 @@ class ASLAM_gtsam : public BackEndBase
     std::mutex                         latest_localization_data_mtx_;
     AdvertiseUpdatedLocalization_Input latest_localization_data_;
 
+    /** Incremental trajectory output. See
+     * Parameters::stream_trajectory_format */
+    TrajectoryWriter trajectory_writer_;
+    std::mutex       trajectory_writer_mtx_;
+
+    /** See Parameters::record_api_calls_file */
+    BackendCallRecorder api_recorder_;
+
+    /** See Parameters::keyframe_obs_store_file */
+    KeyframeObsStore kf_obs_store_;
+
+    /** Moves the raw observations of keyframe entities (e.g. just loaded
+     * from a map) into kf_obs_store_ */
+    void kf_observations_to_store();
+    /** Puts back the raw observations from kf_obs_store_ into keyframe
+     * entities, e.g. before saving a single-file map */
+    void kf_observations_from_store();
+
+    /** See Parameters::map_chunk_size. nullptr if disabled */
+    std::unique_ptr<ChunkedMapWriter> map_writer_;
+    mrpt::Clock::time_point           last_map_save_{};
+
+    /** Where the chunked map is saved. See Parameters::map_chunk_size */
+    std::string chunked_map_directory() const;
+
+    /** See Parameters::journal_directory. Checkpoint N (a directory with
+     * the map chunks and the solver state) plus journal file N, which has
+     * all calls after it, give the latest state. */
+    BackendJournal          journal_;
+    std::size_t             journal_seq_{0};
+    std::size_t             journal_ckpt_seq_{0};  //!< last checkpoint
+    mrpt::Clock::time_point last_checkpoint_{};
+    mola::WorkerThreadsPool checkpoint_worker_{1};
+    std::future<void>       pending_checkpoint_;
+
+    std::string journal_checkpoint_dir(const std::size_t n) const;
+    std::string journal_file(const std::size_t n) const;
+
+    /** Loads the latest checkpoint and replays the journal after it.
+     * Returns false if there is no checkpoint. */
+    bool journal_recover();
+
+    /** Starts a new checkpoint: copies the solver state and dirty map
+     * chunks, and switches to a new journal file while holding
+     * isam2_lock_, then serializes and writes them in the background.
+     * The time ingest is paused for is in the profiler, as
+     * "journal_checkpoint.pause". Does nothing if the previous one is
+     * still being written, unless `wait` is true, in which case it waits
+     * for both. */
+    void journal_checkpoint(const bool wait);
+
+    /** Arrival time of keyframes and factors not yet in the solver, and
+     * their type name. Locked by isam2_lock_ */
+    using latency_clock_t = std::chrono::steady_clock;
+    struct Arrival
+    {
+        const char*                 type{nullptr};
+        latency_clock_t::time_point t{};
+    };
+    std::vector<Arrival> pending_arrivals_;
+
+    /** See latency_histograms() */
+    std::map<std::string, LatencyStageHistograms> latency_;
+    std::mutex                                    latency_mtx_;
+
+    /** Adds the latencies of all `arrivals`, processed in a solver update
+     * that ran from `solve_start` to `solve_end`, and written back to the
+     * WorldModel at `writeback_end` */
+    void latency_add(
+        const std::vector<Arrival>&        arrivals,
+        const latency_clock_t::time_point& solve_start,
+        const latency_clock_t::time_point& solve_end,
+        const latency_clock_t::time_point& writeback_end);
+
+    /** See spin_stats() */
+    std::deque<SpinStats> spin_stats_;
+    std::mutex            spin_stats_mtx_;
+    uint64_t              spin_count_{0};
+
+    /** Stores the statistics of a spinOnce() call, and adds them to the
+     * profiler */
+    void spin_stats_add(const SpinStats& st);
+
+    /** Fills in SpinStats::factor_costs after an iSAM2 update with
+     * detailed results. isam2_lock_ must be held. */
+    void factor_costs_compute(const gtsam::ISAM2Result& res, SpinStats& st);
+
+    /** Serialized size of the raw observations and the render decoration
+     * of each keyframe, computed once. Locked by memory_mtx_ */
+    std::map<mola::id_t, std::pair<std::size_t, std::size_t>> kf_bytes_;
+    std::mutex                                                memory_mtx_;
+
+    /** See Parameters::memory_report_period */
+    mrpt::Clock::time_point last_memory_report_{};
+
+    /** Writes a memory_report() to the log */
+    void memory_report_log(const MemoryReport& m);
+
     /** Returns the closest KF in time, or invalid_id if none. */
     mola::id_t find_closest_KF_in_time(const mrpt::Clock::time_point& t) const;
 
@@ -285,3 +921,12 @@ MRPT_FILL_ENUM_MEMBER(mola::ASLAM_gtsam::StateVectorType, SE3);
 MRPT_FILL_ENUM_MEMBER(mola::ASLAM_gtsam::StateVectorType, SE2Vel);
 MRPT_FILL_ENUM_MEMBER(mola::ASLAM_gtsam::StateVectorType, SE3Vel);
 MRPT_ENUM_TYPE_END()
+
+MRPT_ENUM_TYPE_BEGIN(mola::ASLAM_gtsam::FactorKind)
+MRPT_FILL_ENUM_MEMBER(mola::ASLAM_gtsam::FactorKind, RelativePose3);
+MRPT_FILL_ENUM_MEMBER(mola::ASLAM_gtsam::FactorKind, ConstVelocity);
+MRPT_FILL_ENUM_MEMBER(mola::ASLAM_gtsam::FactorKind, StereoProjection);
+MRPT_FILL_ENUM_MEMBER(mola::ASLAM_gtsam::FactorKind, SmartStereo);
+MRPT_FILL_ENUM_MEMBER(mola::ASLAM_gtsam::FactorKind, Prior);
+MRPT_FILL_ENUM_MEMBER(mola::ASLAM_gtsam::FactorKind, Other);
+MRPT_ENUM_TYPE_END()
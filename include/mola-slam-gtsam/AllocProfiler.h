@@ -0,0 +1,85 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   AllocProfiler.h
+ * @brief  Heap allocation counters per named scope
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 20, 2019
+ */
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+
+namespace mola
+{
+/** Heap allocation counters, attributed to the innermost AllocScope active
+ * in the allocating thread.
+ *
+ * Only enabled if built with the CMake option
+ * `MOLA_SLAM_GTSAM_ALLOC_PROFILING`, which replaces the global operator
+ * new/delete, including the `std::align_val_t` overloads. The replacement
+ * is process-wide: once this library is linked, every allocation of the
+ * application and of all other libraries goes through it, pays a few
+ * atomic increments, and is counted in totals(). Otherwise, available()
+ * is false, AllocScope does nothing and no allocation is counted.
+ *
+ * The macro is private to the library: this header is the same in all
+ * builds, and AllocScope works in code outside the library too.
+ *
+ * Only allocations through operator new are seen: Eigen matrices and other
+ * buffers obtained with malloc() directly are not counted.
+ *
+ * \ingroup mola_slam_gtsam_grp */
+class AllocProfiler
+{
+   public:
+    struct Counters
+    {
+        uint64_t calls{0};  //!< Times the scope was entered
+        uint64_t allocs{0}, bytes{0};
+    };
+
+    /** Whether allocations are being counted in this build */
+    static bool available();
+
+    /** Counters of each scope, excluding nested scopes */
+    static std::map<std::string, Counters> scopes();
+
+    /** All allocations, inside scopes or not */
+    static Counters totals();
+
+    /** Time since the first scope or the last reset() [s] */
+    static double elapsed();
+
+    /** Sets all counters to zero */
+    static void reset();
+
+    /** Writes the counters of each scope and the totals, per call and per
+     * second, as a JSON object */
+    static void toJSON(std::ostream& o);
+};
+
+/** Attributes the allocations of the calling thread to `name` while alive.
+ * `name` must be a string literal, or outlive the profiler. Does nothing
+ * if AllocProfiler::available() is false.
+ * \ingroup mola_slam_gtsam_grp */
+class AllocScope
+{
+   public:
+    explicit AllocScope(const char* name);
+    ~AllocScope();
+
+    AllocScope(const AllocScope&) = delete;
+    AllocScope& operator=(const AllocScope&) = delete;
+
+   private:
+    void* prev_;  //!< Enclosing scope of this thread, restored at the end
+};
+
+}  // namespace mola
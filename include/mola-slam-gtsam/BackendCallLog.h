@@ -0,0 +1,259 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   BackendCallLog.h
+ * @brief  Binary record & replay of back-end API calls
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 16, 2019
+ */
+#pragma once
+
+#include <mola-kernel/interfaces/BackEndBase.h>
+#include <mola-slam-gtsam/MappedFile.h>
+#include <mrpt/img/TCamera.h>
+#include <mrpt/math/TPoint3D.h>
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace mola
+{
+/** Type of a recorded back-end API call */
+enum class BackendCall : uint8_t
+{
+    AddKeyFrame = 1,
+    AddFactor,
+    SmartStereoObservation,
+    AdvertiseUpdatedLocalization,
+    SpinOnce,
+    StartNewMap,
+    /** ID returned by the former call, when it was recorded before the
+     * call was applied (see BackendJournal). BackendCallReader merges it
+     * into that call's record. */
+    CallResult,
+    /** The former call threw, and was not applied (see BackendJournal).
+     * BackendCallReader drops it together with this record. */
+    CallAborted,
+    /** temp_createStereoCamera() */
+    DefineStereoCamera,
+    /** temp_createLandmark() */
+    CreateLandmark
+};
+
+/** One decoded entry of a back-end call log. Only the payload fields
+ * relevant to `call` are filled in. */
+struct BackendCallRecord
+{
+    BackendCall call{BackendCall::SpinOnce};
+    /** Time of the call since the log was opened [s] */
+    double wall_time{0};
+    /** Time spent inside the call, when recorded [s] */
+    double duration{0};
+    /** KF, landmark or factor ID returned by the call, or INVALID_ID */
+    uint64_t result_id{mola::INVALID_ID};
+
+    /** AddKeyFrame: only `kf.timestamp` is filled in. The observations
+     * are in `kf_observations`, so they can be shared instead of copied. */
+    BackEndBase::ProposeKF_Input                   kf;
+    mrpt::obs::CSensoryFrame::Ptr                  kf_observations;
+
+    BackEndBase::AdvertiseUpdatedLocalization_Input loc;
+    Factor                                          factor;
+
+    struct StereoObservation
+    {
+        mola::fid_t factor_id{mola::INVALID_FID};
+        mola::id_t  observing_kf{mola::INVALID_ID};
+        double      x_left{0}, x_right{0}, y{0};
+    };
+    StereoObservation stereo_obs;
+
+    struct StereoCamera
+    {
+        mrpt::img::TCamera left, right;
+        double             baseline{0};
+    };
+    StereoCamera stereo_camera;
+
+    /** CreateLandmark: initial guess of its position */
+    mrpt::math::TPoint3D landmark;
+};
+
+/** Appends back-end API calls to a compact binary file: an 8-byte header,
+ * then one record per call: `[type:u8][payload_len:u32][wall_time:f64]
+ * [duration:f64][payload]`. Payloads use MRPT serialization for
+ * observations and factors. Calls are buffered in memory until flush().
+ *
+ * All methods are thread-safe and do nothing if the log is not open.
+ * \ingroup mola_slam_gtsam_grp */
+class BackendCallRecorder
+{
+   public:
+    BackendCallRecorder() = default;
+    ~BackendCallRecorder();
+
+    BackendCallRecorder(const BackendCallRecorder&) = delete;
+    BackendCallRecorder& operator=(const BackendCallRecorder&) = delete;
+
+    /** Creates (truncates) the log file. Throws on error. */
+    void open(const std::string& fileName);
+    /** Like open(), but with times measured from `time_origin`, so that
+     * now() stamps are interchangeable with those of another recorder */
+    void open(
+        const std::string&                           fileName,
+        const std::chrono::steady_clock::time_point& time_origin);
+    bool is_open() const { return f_ != nullptr; }
+    void close();
+    /** Writes buffered records to the OS */
+    void flush();
+
+    /** Seconds since open() (or the time origin). Use it to stamp the
+     * start of a call, then pass it to the record*() method after the call
+     * returns. */
+    double now() const;
+
+    std::chrono::steady_clock::time_point time_origin() const { return t0_; }
+
+    /** `obs` may be nullptr if the keyframe has no observations */
+    void recordAddKeyFrame(
+        const double t_start, const mrpt::Clock::time_point& timestamp,
+        const mrpt::obs::CSensoryFrame* obs,
+        const BackEndBase::ProposeKF_Output& o);
+    void recordAddFactor(
+        const double t_start, const Factor& f,
+        const BackEndBase::AddFactor_Output& o);
+    void recordSmartStereoObservation(
+        const double t_start, const mola::fid_t factor_id,
+        const mola::id_t observing_kf, const double x_left,
+        const double x_right, const double y);
+    void recordAdvertiseUpdatedLocalization(
+        const double t_start,
+        const BackEndBase::AdvertiseUpdatedLocalization_Input& l);
+    void recordSpinOnce(const double t_start);
+    void recordStartNewMap(const double t_start);
+    void recordDefineStereoCamera(
+        const double t_start, const mrpt::img::TCamera& left,
+        const mrpt::img::TCamera& right, const double baseline);
+    void recordCreateLandmark(
+        const double t_start, const mrpt::math::TPoint3D& init_value,
+        const mola::id_t new_id);
+
+    /** Bytes written so far, including buffered ones */
+    uint64_t bytes() const;
+
+   protected:
+    /** Appends a BackendCall::CallResult record with the ID returned by
+     * the former call, recorded with an invalid one */
+    void recordCallResult(const double t_start, const uint64_t result_id);
+    /** Appends a BackendCall::CallAborted record for the former call */
+    void recordCallAborted(const double t_start);
+
+    /** Called with the mutex held, after records are written to the OS
+     * by flush() */
+    virtual void onFlushed() {}
+
+    std::FILE* f_{nullptr};
+
+   private:
+    mutable std::mutex                    mtx_;
+    std::string                           buf_;
+    uint64_t                              written_{0};
+    std::chrono::steady_clock::time_point t0_;
+
+    void append(
+        BackendCall call, double t_start, const std::vector<uint8_t>& payload);
+    void flush_nolock();
+};
+
+/** Reads a log written by BackendCallRecorder, via a memory mapping.
+ * A truncated last record (e.g. after a crash) is silently dropped.
+ * BackendCall::CallResult records are merged into the former call, so
+ * next() never returns them: a call whose result is missing (a crash
+ * while applying it) has `result_id==INVALID_ID`. Calls followed by a
+ * BackendCall::CallAborted record are skipped.
+ * \ingroup mola_slam_gtsam_grp */
+class BackendCallReader
+{
+   public:
+    /** Throws if the file cannot be opened or has a wrong header */
+    void open(const std::string& fileName);
+
+    /** Decodes the next record. Returns false at the end of the log. */
+    bool next(BackendCallRecord& r);
+
+    /** Position of the next record, in bytes from the file start */
+    std::size_t position() const { return pos_; }
+
+   private:
+    MappedFile  file_;
+    std::size_t pos_{0};
+};
+
+struct BackendReplayOptions
+{
+    /** If true, calls are issued at the recorded pace (scaled by `speed`).
+     * Otherwise, as fast as possible. */
+    bool   realtime{false};
+    double speed{1.0};
+
+    /** If set, called after each replayed call with its duration [s] */
+    std::function<void(const BackendCallRecord&, double)> on_call;
+};
+
+struct BackendReplayStats
+{
+    struct PerCall
+    {
+        std::size_t         count{0};
+        double              recorded_total{0};
+        std::vector<double> durations;  //!< replay durations [s]
+    };
+    std::map<BackendCall, PerCall> calls;
+
+    /** Calls whose returned ID differs from the recorded one (the back-end
+     * did not behave deterministically, or is a different one) */
+    std::size_t id_mismatches{0};
+    /** Recorded => replayed keyframe IDs */
+    std::map<uint64_t, uint64_t> kf_ids;
+    /** Records that could not be replayed with this back-end */
+    std::size_t skipped{0};
+    double      total_time{0};
+
+    /** Writes a human-readable table with count, total, mean, median, p99
+     * and max time per call type, plus the recorded totals. */
+    void print(std::ostream& o) const;
+
+    /** Same per call type (plus p90), as a JSON object */
+    void toJSON(std::ostream& o) const;
+};
+
+/** Returns the next record to replay, or false at the end */
+using BackendCallSource = std::function<bool(BackendCallRecord&)>;
+
+/** Drives a back-end with the calls stored in a log. Smart stereo
+ * observations can only be replayed into ASLAM_gtsam.
+ *
+ * Keyframe, landmark and factor IDs referenced by later records are
+ * translated into the IDs actually returned in this replay, so a log can
+ * be replayed into a back-end which numbers entities differently. */
+BackendReplayStats replayBackendCalls(
+    BackendCallReader& log, BackEndBase& backend,
+    const BackendReplayOptions& opts = BackendReplayOptions());
+
+/** Like above, for records from any source (e.g. SyntheticWorkload) */
+BackendReplayStats replayBackendCalls(
+    const BackendCallSource& next, BackEndBase& backend,
+    const BackendReplayOptions& opts = BackendReplayOptions());
+
+/** Short name of each call type, as used in reports */
+const char* backendCallName(BackendCall c);
+
+}  // namespace mola
@@ -0,0 +1,66 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   BackendHarness.h
+ * @brief  Runs a back-end module plus its WorldModel outside mola-launcher
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 12, 2019
+ */
+#pragma once
+
+#include <mola-kernel/WorldModel.h>
+#include <mola-kernel/interfaces/BackEndBase.h>
+
+#include <memory>
+#include <string>
+
+namespace mola
+{
+/** Owns a WorldModel and a back-end module (e.g. `ASLAM_gtsam`) wired
+ * together as mola-launcher would do, so tools and benchmarks can drive the
+ * back-end API (doAddKeyFrame(), doAddFactor(), spinOnce(),...) directly
+ * from a single thread.
+ *
+ * \ingroup mola_slam_gtsam_grp */
+class BackendHarness
+{
+   public:
+    /** Creates and initializes the modules.
+     * \param backendClass Registered module class name, e.g. "ASLAM_gtsam"
+     * \param backendCfg YAML block for the back-end, as in a launch file
+     *        (with a top-level `params:` entry).
+     * \param worldModelCfg YAML block for the WorldModel.
+     */
+    BackendHarness(
+        const std::string& backendClass, const std::string& backendCfg,
+        const std::string& worldModelCfg = "params: {}");
+    ~BackendHarness();
+
+    /** Back-end YAML block to run `backendClass` headless, without saving
+     * the map at the end: for ASLAM_gtsam and RSLAM_gtsam, an SE3 state
+     * vector and the incremental solver. `extraParams` are more lines of
+     * `params:` (e.g. `"  robot_id: 1\n"`), and replace the defaults with
+     * the same key. Throws for other back-ends. */
+    static std::string defaultConfig(
+        const std::string& backendClass,
+        const std::string& extraParams = std::string());
+
+    BackEndBase& backend() { return *backend_; }
+    WorldModel&  worldmodel() { return *worldmodel_; }
+
+    BackEndBase::Ptr backendPtr() { return backend_; }
+
+    /** Calls onQuit() on all modules (done by the destructor, if not
+     * called before) */
+    void quit();
+
+   private:
+    WorldModel::Ptr  worldmodel_;
+    BackEndBase::Ptr backend_;
+    bool             quit_done_{false};
+};
+
+}  // namespace mola
@@ -0,0 +1,155 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   BackendJournal.h
+ * @brief  Durable write-ahead journal of back-end API calls
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 19, 2019
+ */
+#pragma once
+
+#include <mola-slam-gtsam/BackendCallLog.h>
+
+#include <atomic>
+#include <chrono>
+#include <exception>  // uncaught_exceptions()
+#include <mutex>
+
+namespace mola
+{
+/** A BackendCallRecorder whose file is made durable with `fsync()`, for
+ * crash recovery by replaying it with replayBackendCalls().
+ *
+ * Write-ahead: each call is journaled with a begin*() method before it is
+ * applied, then end() is called once it has been applied, with the KF or
+ * factor ID it returned (if any). begin*() writes the record to the OS and
+ * syncs it, unless a sync happened less than `sync_period` seconds ago
+ * (then it is synced by a later call: group commit). With
+ * `sync_period=0`, every call is durable before it is applied; otherwise,
+ * calls from the last `sync_period` seconds may be lost in a power
+ * failure, but not if only the process crashes.
+ *
+ * Callers must serialize begin*() and the application of each call (e.g.
+ * with the back-end mutex), so the journal order is the order in which
+ * calls were applied. A call that throws instead is marked with abort()
+ * (see AbortGuard), so it is not replayed.
+ *
+ * The time spent by the journal is measured and compared against the time
+ * of the journaled calls themselves (see Stats).
+ * \ingroup mola_slam_gtsam_grp */
+class BackendJournal : public BackendCallRecorder
+{
+   public:
+    BackendJournal() = default;
+    ~BackendJournal() override;
+
+    /** Creates (truncates) the journal file. Throws on error.
+     * `time_origin` must be that of the recorder whose now() is used to
+     * stamp calls, see BackendCallRecorder::open(). */
+    void open(
+        const std::string& fileName, const double sync_period,
+        const std::chrono::steady_clock::time_point& time_origin);
+    /** Syncs and closes the file */
+    void close();
+    /** Syncs and closes the current file, then starts a new one */
+    void rotate(const std::string& newFileName);
+
+    /** Writes buffered records, and syncs them if `sync_period` has
+     * elapsed since the last sync */
+    void flush();
+    /** Writes buffered records and syncs them unconditionally */
+    void sync();
+
+    /** Journals a call before applying it. Returns the time (now()) to pass
+     * to end(). */
+    double beginAddKeyFrame(
+        const mrpt::Clock::time_point&  timestamp,
+        const mrpt::obs::CSensoryFrame* obs);
+    double beginAddFactor(const Factor& f);
+    double beginSmartStereoObservation(
+        const mola::fid_t factor_id, const mola::id_t observing_kf,
+        const double x_left, const double x_right, const double y);
+    double beginAdvertiseUpdatedLocalization(
+        const BackEndBase::AdvertiseUpdatedLocalization_Input& l);
+    double beginSpinOnce();
+    double beginStartNewMap();
+    double beginDefineStereoCamera(
+        const mrpt::img::TCamera& left, const mrpt::img::TCamera& right,
+        const double baseline);
+    double beginCreateLandmark(const mrpt::math::TPoint3D& init_value);
+
+    /** Ends a call started with begin*(), once applied. `result_id` is the
+     * KF, landmark or factor ID returned by AddKeyFrame, CreateLandmark and
+     * AddFactor calls. */
+    void end(const double t_begin, const uint64_t result_id = INVALID_ID);
+
+    /** Marks a call started with begin*() as not applied, because it threw.
+     * The marker is synced right away, and BackendCallReader drops the
+     * call, so recovery does not replay (and throw) it again. */
+    void abort(const double t_begin);
+
+    /** Calls abort() if the scope where it lives is left by an exception.
+     * Declare it right after begin*(); end() is still called explicitly. */
+    class AbortGuard
+    {
+       public:
+        AbortGuard(BackendJournal& j, const double t_begin)
+            : j_(j), t_begin_(t_begin), exceptions_(std::uncaught_exceptions())
+        {
+        }
+        ~AbortGuard();
+
+       private:
+        BackendJournal& j_;
+        const double    t_begin_;
+        const int       exceptions_;
+    };
+
+    struct Stats
+    {
+        std::size_t records{0}, syncs{0};
+        /** Time spent journaling: encoding and writing records [s] */
+        double append_time{0};
+        /** Time spent in fsync() [s] */
+        double sync_time{0};
+        /** Total time applying the journaled calls, between begin*() and
+         * end(), excluding the journal [s] */
+        double calls_time{0};
+
+        /** Journal time relative to calls_time, in percent */
+        double overhead_percent() const
+        {
+            return calls_time > 0
+                       ? 100.0 * (append_time + sync_time) / calls_time
+                       : 0;
+        }
+    };
+    /** Accumulated since construction, over all rotated files */
+    Stats stats() const;
+
+   protected:
+    void onFlushed() override;
+
+   private:
+    using clock = std::chrono::steady_clock;
+
+    double            sync_period_{0};
+    std::atomic_bool  force_sync_{false};
+    clock::time_point last_sync_{};
+
+    mutable std::mutex stats_mtx_;
+    Stats              stats_;
+    /** fsync() time within the ongoing flush, not to count it twice */
+    clock::duration last_flush_sync_time_{};
+
+    /** Runs `record` (which appends a record), writes and syncs it, and
+     * accounts the time into `append_time` and `sync_time`. Returns now().
+     */
+    template <class RECORD>
+    double write_ahead(RECORD&& record);
+};
+
+}  // namespace mola
@@ -0,0 +1,171 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   ChunkedMap.h
+ * @brief  Chunked, compressed and incremental WorldModel map files
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 16, 2019
+ */
+#pragma once
+
+#include <mola-kernel/WorkerThreadsPool.h>
+#include <mola-kernel/WorldModel.h>
+#include <mrpt/obs/CSensoryFrame.h>
+
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <set>
+#include <string>
+
+namespace mola
+{
+/** Parameters shared by ChunkedMapWriter and the map loader */
+struct ChunkedMapParameters
+{
+    /** Number of consecutive entity (or factor) IDs per chunk file */
+    std::size_t chunk_size{4096};
+
+    /** gzip compression level (0-9) */
+    int compress_level{1};
+
+    /** Number of threads for (de)serialization. 0: one per CPU core */
+    unsigned int num_threads{0};
+};
+
+/** Statistics of one ChunkedMapWriter::save() */
+struct ChunkedMapSaveStats
+{
+    std::size_t entity_chunks_written{0}, factor_chunks_written{0};
+    std::size_t entity_chunks_total{0}, factor_chunks_total{0};
+    std::size_t bytes_written{0};  //!< compressed size of written chunks
+    double      seconds{0};
+};
+
+/** Saves the entities and factors of a WorldModel into a directory, as one
+ * gzip-compressed file per chunk of `chunk_size` consecutive IDs:
+ *
+ *  - `<dir>/index.txt`: chunk size and list of chunk files.
+ *  - `<dir>/e_<N>.chunk.gz`, `<dir>/f_<N>.chunk.gz`: entities and factors
+ *    with IDs in `[N*chunk_size, (N+1)*chunk_size)`. Entities are saved
+ *    with their annotations (e.g. `render_decoration`). Annotating an
+ *    entity does not mark it dirty by itself.
+ *
+ * Chunks are serialized and compressed in parallel. Only chunks marked as
+ * dirty (see markEntityDirty(), markFactorDirty()) since the last save are
+ * rewritten; the first save writes everything.
+ *
+ * Both save() and save_async() copy the dirty chunks while holding the
+ * WorldModel read locks, and serialize and compress them after releasing
+ * them. save_async() does the latter in the background, so the caller
+ * (e.g. the SLAM thread) is only blocked for the copy.
+ *
+ * Each chunk file is written to a temporary name and renamed when
+ * complete, and the index is written last, so an interrupted save leaves
+ * the previous map readable. Chunk files not in the new index (e.g. from a
+ * former save with a different `chunk_size`) are deleted afterwards.
+ *
+ * Keyframes whose raw observations were moved out of the WorldModel (see
+ * KeyframeObsStore) are saved with them, as provided by
+ * setObservationsSource().
+ *
+ * \ingroup mola_slam_gtsam_grp */
+class ChunkedMapWriter
+{
+   public:
+    explicit ChunkedMapWriter(
+        const ChunkedMapParameters& p = ChunkedMapParameters());
+    ~ChunkedMapWriter();
+
+    ChunkedMapWriter(const ChunkedMapWriter&) = delete;
+    ChunkedMapWriter& operator=(const ChunkedMapWriter&) = delete;
+
+    const ChunkedMapParameters& parameters() const { return params_; }
+
+    /** Returns the raw observations of a keyframe, or nullptr */
+    using ObservationsSource =
+        std::function<mrpt::obs::CSensoryFrame::Ptr(const mola::id_t)>;
+
+    /** If set, keyframe entities without raw observations are written with
+     * those returned by `src` for their ID. It is invoked from the worker
+     * threads, so it must be thread-safe. */
+    void setObservationsSource(const ObservationsSource& src);
+
+    /** Notifies that an entity was created or modified. Thread-safe. */
+    void markEntityDirty(const mola::id_t id);
+    /** Notifies that a factor was created or modified. Thread-safe. */
+    void markFactorDirty(const mola::fid_t id);
+    /** Forces the next save to rewrite all chunks */
+    void markAllDirty();
+    /** Forgets all dirty marks, e.g. right after loading the map from the
+     * same directory */
+    void markAllClean();
+
+    /** Writes all dirty chunks and the index. Blocks until done.
+     * Waits for any pending save_async() first. Throws on I/O errors. */
+    ChunkedMapSaveStats save(WorldModel& wm, const std::string& dir);
+
+    /** Like save(), but returns once dirty chunks have been copied out of
+     * the WorldModel. Returns false (and does nothing) if the previous
+     * asynchronous save is still running. */
+    bool save_async(WorldModel& wm, const std::string& dir);
+
+    /** true if an asynchronous save is running */
+    bool is_busy() const;
+
+    /** Blocks until the pending asynchronous save, if any, finishes, and
+     * returns its statistics. Rethrows its exceptions, if any. */
+    ChunkedMapSaveStats wait();
+
+    /** Name of the file for a given chunk, relative to the map directory */
+    static std::string ChunkFileName(const bool isEntity, const std::size_t n);
+
+   private:
+    ChunkedMapParameters    params_;
+    ObservationsSource      obs_source_;
+    mola::WorkerThreadsPool workers_;
+    mola::WorkerThreadsPool async_;
+
+    /** Chunks pending to be written */
+    struct Dirty
+    {
+        bool                  all{false};
+        std::set<std::size_t> entities, factors;
+    };
+    std::mutex dirty_mtx_;
+    Dirty      dirty_;
+
+    /** Returns the current dirty set and clears it */
+    Dirty take_dirty();
+    /** Merges back a dirty set, after a failed save */
+    void restore_dirty(const Dirty& d);
+
+    std::future<ChunkedMapSaveStats> pending_;
+};
+
+/** Statistics of loadChunkedMap() */
+struct ChunkedMapLoadStats
+{
+    std::size_t entities{0}, factors{0}, chunks{0};
+    /** `chunk_size` the map was saved with */
+    std::size_t chunk_size{0};
+    double      seconds{0};
+};
+
+/** true if `dir` contains a map written by ChunkedMapWriter */
+bool chunkedMapExists(const std::string& dir);
+
+/** Loads a map written by ChunkedMapWriter into an empty WorldModel.
+ * Chunks are decompressed and deserialized in parallel, and inserted into
+ * the WorldModel in ID order as they become available. Throws on I/O
+ * errors, or if the WorldModel does not assign the stored IDs (e.g. it was
+ * not empty). */
+ChunkedMapLoadStats loadChunkedMap(
+    WorldModel& wm, const std::string& dir,
+    const ChunkedMapParameters& p = ChunkedMapParameters());
+
+}  // namespace mola
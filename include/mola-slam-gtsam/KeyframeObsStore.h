@@ -0,0 +1,141 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   KeyframeObsStore.h
+ * @brief  Disk-backed, LRU-cached store of keyframe raw observations
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 14, 2019
+ */
+#pragma once
+
+#include <mola-kernel/id.h>
+#include <mola-slam-gtsam/MappedFile.h>
+#include <mrpt/obs/CSensoryFrame.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace mola
+{
+/** Keeps the raw observations of keyframes in an append-only file, so they
+ * do not need to stay in RAM for the whole session. Each keyframe is
+ * reduced to a Handle (file offset and length); the most recently used
+ * sensory frames are kept decoded in an LRU cache whose size is capped by
+ * Parameters::max_cached_bytes.
+ *
+ * Cache sizes are measured as serialized bytes, which is a good estimate
+ * of the in-memory footprint for image and point-cloud observations.
+ *
+ * All methods are thread-safe.
+ *
+ * \ingroup mola_slam_gtsam_grp */
+class KeyframeObsStore
+{
+   public:
+    KeyframeObsStore() = default;
+    ~KeyframeObsStore();
+
+    KeyframeObsStore(const KeyframeObsStore&) = delete;
+    KeyframeObsStore& operator=(const KeyframeObsStore&) = delete;
+
+    struct Parameters
+    {
+        /** Backing file. It is created (truncated) by open() */
+        std::string file;
+
+        /** Upper limit of decoded observations kept in memory [bytes].
+         * 0 means "do not cache anything". */
+        std::size_t max_cached_bytes{256 * 1024 * 1024};
+    };
+
+    /** Location of one keyframe's observations in the backing file */
+    struct Handle
+    {
+        uint64_t offset{0};
+        uint64_t length{0};
+    };
+
+    struct Stats
+    {
+        std::size_t hits{0}, misses{0}, evictions{0};
+    };
+
+    /** Creates the backing file. Throws on error. */
+    void open(const Parameters& p);
+    bool is_open() const;
+    /** Closes and, unless disabled with set_delete_on_close(), deletes the
+     * backing file */
+    void close();
+    /** Whether close() deletes the backing file (default: true). Disable
+     * it while the observations are not yet safe elsewhere, e.g. during a
+     * map save. */
+    void set_delete_on_close(const bool del);
+
+    /** Serializes and appends the observations of keyframe `kf`, which must
+     * not be already in the store. The pointer is kept in the cache, so
+     * the caller may hand over its only reference. */
+    Handle put(const mola::id_t kf, const mrpt::obs::CSensoryFrame::Ptr& sf);
+
+    /** Returns the observations of `kf`, from the cache or decoded from
+     * the backing file, or nullptr if the keyframe is not in the store. */
+    mrpt::obs::CSensoryFrame::Ptr get(const mola::id_t kf);
+
+    /** Like get(), but observations read from disk are not inserted into
+     * the cache. Use it for one-pass sweeps (e.g. saving the map), which
+     * would otherwise evict the working set. */
+    mrpt::obs::CSensoryFrame::Ptr load(const mola::id_t kf);
+
+    /** IDs of all keyframes in the store, in no particular order */
+    std::vector<mola::id_t> ids() const;
+
+    bool        contains(const mola::id_t kf) const;
+    std::size_t size() const;
+    /** Memory currently held by the cache [bytes] */
+    std::size_t cached_bytes() const;
+    /** Size of the backing file [bytes] */
+    std::size_t file_bytes() const;
+    Stats       stats() const;
+
+   private:
+    struct CacheEntry
+    {
+        mrpt::obs::CSensoryFrame::Ptr   sf;
+        std::size_t                     bytes{0};
+        std::list<mola::id_t>::iterator lru_it;
+    };
+
+    Parameters                             params_;
+    bool                                   delete_on_close_{true};
+    mutable std::mutex                     mtx_;
+    std::FILE*                             out_{nullptr};
+    uint64_t                               file_size_{0};
+    MappedFile                             in_;
+    std::unordered_map<mola::id_t, Handle> handles_;
+
+    /** Most recently used at the front */
+    std::list<mola::id_t>                      lru_;
+    std::unordered_map<mola::id_t, CacheEntry> cache_;
+    std::size_t                                cached_bytes_{0};
+    Stats                                      stats_;
+
+    /** Cache lookup, then decoding from the file. mtx_ must be locked by
+     * the caller. */
+    mrpt::obs::CSensoryFrame::Ptr get_locked(
+        const mola::id_t kf, const bool insert_in_cache);
+
+    /** Inserts into the cache as most recently used, evicting as needed.
+     * mtx_ must be locked by the caller. */
+    void cache_insert(
+        const mola::id_t kf, const mrpt::obs::CSensoryFrame::Ptr& sf,
+        const std::size_t bytes);
+};
+
+}  // namespace mola
@@ -0,0 +1,30 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   KeyframeTimeIndex.h
+ * @brief  Keyframe IDs indexed by timestamp
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 20, 2019
+ */
+#pragma once
+
+#include <mola-kernel/id.h>
+#include <mrpt/core/Clock.h>
+
+#include <map>
+
+namespace mola
+{
+/** Keyframe IDs indexed by timestamp */
+using KeyframeTimeIndex = std::map<mrpt::Clock::time_point, mola::id_t>;
+
+/** Returns the keyframe closest in time to `t`, if it is not farther than
+ * `tolerance` seconds, or INVALID_ID otherwise. O(log(N)) */
+mola::id_t find_closest_KF_in_time(
+    const KeyframeTimeIndex& index, const mrpt::Clock::time_point& t,
+    const double tolerance = 0.1);
+
+}  // namespace mola
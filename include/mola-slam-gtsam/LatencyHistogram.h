@@ -0,0 +1,53 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   LatencyHistogram.h
+ * @brief  Fixed-size histogram of durations, with log-spaced bins
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 20, 2019
+ */
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <ostream>
+
+namespace mola
+{
+/** Histogram of durations with 10 log-spaced bins per decade, from 1 us to
+ * 1000 s (plus one bin for shorter ones, and one for longer ones).
+ * Constant memory and O(1) insertion; percentiles are approximated by the
+ * upper edge of their bin (relative error < 26%).
+ *
+ * \ingroup mola_slam_gtsam_grp */
+class LatencyHistogram
+{
+   public:
+    /** Adds one duration [s] */
+    void add(const double seconds);
+
+    std::size_t count() const { return count_; }
+    double      mean() const { return count_ ? sum_ / count_ : 0; }
+    double      max() const { return max_; }
+
+    /** Approximate percentile [s], with `p` in [0,1]. 0 if empty. */
+    double percentile(const double p) const;
+
+    /** Writes count, mean, p50, p90, p99 and max [ms], as a JSON object */
+    void toJSON(std::ostream& o) const;
+
+   private:
+    static constexpr int    BINS_PER_DECADE = 10;
+    static constexpr int    DECADES         = 9;
+    static constexpr int    NUM_BINS        = BINS_PER_DECADE * DECADES + 2;
+    static constexpr double MIN_TIME        = 1e-6;
+
+    std::array<uint64_t, NUM_BINS> bins_{};
+    std::size_t                    count_{0};
+    double                         sum_{0}, max_{0};
+};
+
+}  // namespace mola
@@ -0,0 +1,56 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   MappedFile.h
+ * @brief  Read-only memory-mapped view of a local file
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 05, 2019
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace mola
+{
+/** Read-only memory-mapped view of a whole file. Files which are still
+ * being appended to can be re-mapped with remap() to see the new data.
+ * On platforms without mmap(), the file contents are read into memory.
+ *
+ * \ingroup mola_slam_gtsam_grp */
+class MappedFile
+{
+   public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /** Maps the given file. Throws on error. */
+    void open(const std::string& fileName);
+    void close();
+    /** Re-maps the file, after it grew since open() */
+    void remap();
+
+    bool               is_open() const { return !fileName_.empty(); }
+    const std::string& fileName() const { return fileName_; }
+
+    const uint8_t* data() const { return data_; }
+    std::size_t    size() const { return size_; }
+
+   private:
+    std::string          fileName_;
+    const uint8_t*       data_{nullptr};
+    std::size_t          size_{0};
+    std::vector<uint8_t> fallback_buf_;
+
+    void unmap();
+};
+
+}  // namespace mola
@@ -0,0 +1,70 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   PoseGraphIO.h
+ * @brief  Streamed import of g2o/TORO pose-graph files into a back-end
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 12, 2019
+ */
+#pragma once
+
+#include <mola-kernel/interfaces/BackEndBase.h>
+
+#include <cstdint>
+#include <istream>
+#include <unordered_map>
+
+namespace mola
+{
+/** @name posegraph_io Pose-graph file import
+ * @{ */
+
+struct PoseGraphImportOptions
+{
+    /** Keyframes are created with timestamps `vertex_id*vertex_time_step`
+     * [s]. Must be larger than the back-end tolerance to merge KFs close in
+     * time. */
+    double vertex_time_step{1.0};
+
+    /** If >0, call the back-end spinOnce() every this number of edges. If 0,
+     * the caller is responsible for running the optimizer. */
+    std::size_t spin_every_n_edges{0};
+
+    /** Pass vertex poses to the back-end as initial guesses, relative to
+     * the first vertex (which becomes the fixed root KF). Only for
+     * ASLAM_gtsam (see ASLAM_gtsam::setKeyFrameInitialGuess()); other
+     * back-ends initialize KFs from the incoming factors. */
+    bool use_vertex_guesses{true};
+};
+
+struct PoseGraphImportResult
+{
+    std::size_t vertices{0}, edges{0}, ignored_lines{0};
+    /** Map: file vertex ID => back-end KF ID */
+    std::unordered_map<uint64_t, mola::id_t> vertex2kf;
+};
+
+/** Reads a pose graph line by line and feeds it to the back-end: one
+ * doAddKeyFrame() per vertex and one doAddFactor(FactorRelativePose3) per
+ * edge. Vertex poses are used as initial guesses, see
+ * PoseGraphImportOptions::use_vertex_guesses.
+ *
+ * Supported tags: g2o `VERTEX_SE3:QUAT`, `EDGE_SE3:QUAT`, `VERTEX_SE2`,
+ * `EDGE_SE2`; TORO `VERTEX2`, `EDGE2`, `VERTEX3`, `EDGE3`. Other lines
+ * (e.g. `FIX`) are counted in `ignored_lines`. Edge noise sigmas are taken
+ * from the diagonal of the information matrix, averaged over the
+ * translational and rotational parts; off-diagonal terms are ignored.
+ * The rotational information of g2o `EDGE_SE3:QUAT` is expressed over the
+ * quaternion vector part (about half the rotation angle), and is scaled by
+ * 1/4 into angle units. Throws on malformed lines.
+ */
+PoseGraphImportResult importPoseGraph(
+    std::istream& in, BackEndBase& backend,
+    const PoseGraphImportOptions& opts = PoseGraphImportOptions());
+
+/** @} */
+
+}  // namespace mola
@@ -0,0 +1,29 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   ProcessMemory.h
+ * @brief  Resident memory of the current process
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 20, 2019
+ */
+#pragma once
+
+#include <cstddef>
+
+namespace mola
+{
+struct ProcessMemory
+{
+    /** Current and peak resident set size [bytes]. 0 if unknown. */
+    std::size_t rss{0}, peak_rss{0};
+};
+
+/** Reads /proc/self/status on Linux; elsewhere, only the peak from
+ * getrusage() is available (and nothing on Windows).
+ * \ingroup mola_slam_gtsam_grp */
+ProcessMemory processMemory();
+
+}  // namespace mola
@@ -13,12 +13,36 @@
 
 // mrpt includes first:
 #include <mola-kernel/interfaces/BackEndBase.h>
+#include <mola-slam-gtsam/KeyframeTimeIndex.h>
 // gtsam next:
-#include <gtsam/slam/BetweenFactor.h>
+#include <gtsam/geometry/Pose3.h>
+#include <gtsam/linear/NoiseModel.h>
+
+#include <map>
+#include <mutex>
+#include <vector>
 
 namespace mola
 {
-/** Reference implementation of relative SLAM with GTSAM factor graphs
+/** Reference implementation of relative SLAM with GTSAM factor graphs.
+ *
+ * Each keyframe is stored in the WorldModel relative to an *anchor*
+ * keyframe (its `base_id_`). Anchors are created every
+ * `anchor_max_distance` meters or `anchor_max_kfs` keyframes, and are
+ * themselves relative to the former anchor.
+ *
+ * There is no global estimate: the back-end keeps the best estimate of the
+ * relative pose along each edge (FactorRelativePose3) of the graph. Each
+ * spinOnce() only optimizes the neighbourhood of the latest keyframe (a
+ * breadth-first search of `local_window_depth` edges, up to
+ * `local_window_max_kfs` keyframes), with the keyframes at its boundary
+ * fixed. A loop closure is just one more edge, corrected as soon as it
+ * enters a local window, so the cost per update does not grow with the
+ * size of the map.
+ *
+ * Only FactorRelativePose3 factors are optimized. Other factors are
+ * stored in the WorldModel but ignored.
+ *
  * See docs in: \ref mola_slam_gtsam_grp
  * \ingroup mola_slam_gtsam_grp */
 class RSLAM_gtsam : public BackEndBase
@@ -39,7 +63,85 @@ class RSLAM_gtsam : public BackEndBase
     void             doAdvertiseUpdatedLocalization(
                     AdvertiseUpdatedLocalization_Input l) override;
 
+    struct Parameters
+    {
+        /** Max. number of edges between the latest keyframe and any other
+         * keyframe in the local window */
+        int local_window_depth{4};
+
+        /** Max. number of keyframes in the local window (incl. its fixed
+         * boundary), to bound the cost of dense areas and loop closures */
+        int local_window_max_kfs{60};
+
+        /** A new anchor is created when the latest keyframe is farther
+         * than this from the current anchor [m] ... */
+        double anchor_max_distance{10.0};
+
+        /** ... or when this number of keyframes refer to it */
+        int anchor_max_kfs{25};
+
+        /** Lev-Marq. iterations of each local optimization */
+        int max_iterations{10};
+    };
+
+    Parameters params_;
+
+    /** Number of keyframes (incl. fixed ones) in the last local window */
+    std::size_t last_window_size() const { return last_window_size_; }
+
    private:
+    /** A FactorRelativePose3 in the graph */
+    struct Edge
+    {
+        mola::id_t              from{mola::INVALID_ID}, to{mola::INVALID_ID};
+        gtsam::Pose3            measure;
+        gtsam::SharedNoiseModel noise;
+        /** Current estimate of the pose of `to` wrt `from` */
+        gtsam::Pose3 estimate;
+    };
+
+    /** Relative coordinates of each keyframe (and of the root) */
+    struct KeyFrame
+    {
+        /** Frame of `rel_pose`. INVALID_ID for the root */
+        mola::id_t   base{mola::INVALID_ID};
+        gtsam::Pose3 rel_pose;
+        /** Whether `rel_pose` has got any value yet */
+        bool has_value{false};
+        /** Edges, as indices in `edges_` */
+        std::vector<std::size_t> edges;
+    };
+
+    std::recursive_mutex state_lock_;
+
+    std::map<mola::id_t, KeyFrame>                kfs_;
+    std::vector<Edge>                             edges_;
+    KeyframeTimeIndex                             time2kf_;
+
+    mola::id_t  root_id_{mola::INVALID_ID};
+    mola::id_t  anchor_id_{mola::INVALID_ID};
+    std::size_t anchor_kf_count_{0};
+    mola::id_t  last_kf_id_{mola::INVALID_ID};
+    /** New edges since the last local optimization */
+    bool        dirty_{false};
+    std::size_t last_window_size_{0};
+    bool        warned_ignored_factor_{false};
+
+    std::mutex                         latest_localization_data_mtx_;
+    AdvertiseUpdatedLocalization_Input latest_localization_data_;
+
+    /** Creates a keyframe entity relative to the current anchor (or a new
+     * one). state_lock_ must be held. */
+    mola::id_t addKeyFrameEntity(
+        const mrpt::Clock::time_point&       timestamp,
+        const mrpt::obs::CSensoryFrame::Ptr& obs);
+
+    /** state_lock_ must be held */
+    void addEdge(const FactorRelativePose3& f);
+
+    /** Optimizes the neighbourhood of the latest keyframe and writes the
+     * results back. state_lock_ must be held. */
+    void optimizeLocalWindow();
 };
 
 }  // namespace mola
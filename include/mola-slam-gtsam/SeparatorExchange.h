@@ -0,0 +1,106 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   SeparatorExchange.h
+ * @brief  Separator summaries exchanged between multi-robot back-ends
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 20, 2019
+ */
+#pragma once
+
+#include <gtsam/geometry/Pose3.h>
+#include <mola-kernel/id.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace mola
+{
+/** Relative pose constraint between keyframes of two robots: pose of
+ * `kf_to` (of `robot_to`) as seen from `kf_from` (of `robot_from`). */
+struct InterRobotConstraint
+{
+    uint32_t     robot_from{0};
+    mola::id_t   kf_from{mola::INVALID_ID};
+    uint32_t     robot_to{0};
+    mola::id_t   kf_to{mola::INVALID_ID};
+    gtsam::Pose3 rel_pose;
+    double       sigma_xyz{0.1}, sigma_rot{0.01};
+
+    bool sameEdge(const InterRobotConstraint& o) const
+    {
+        return robot_from == o.robot_from && kf_from == o.kf_from &&
+               robot_to == o.robot_to && kf_to == o.kf_to;
+    }
+};
+
+/** Condensed view of one robot's map for one of its peers: the marginals
+ * of its separator keyframes (those in constraints with the peer),
+ * computed without the information received from that same peer, plus
+ * the inter-robot constraints between both. Its size depends on the
+ * number of separators, not on the size of the map.
+ * \ingroup mola_slam_gtsam_grp */
+struct SeparatorSummary
+{
+    uint32_t robot_id{0};
+    /** Increasing with each summary sent by `robot_id` */
+    uint64_t seq{0};
+
+    struct Marginal
+    {
+        mola::id_t kf{mola::INVALID_ID};
+        /** In the frame of the owner (where its map starts) */
+        gtsam::Pose3 mean;
+        /** In the tangent space of `mean`, gtsam ordering (rot, pos) */
+        gtsam::Matrix6 cov;
+        /** The owner's best estimate, with all its information. Only used
+         * to monitor the consistency among robots. */
+        gtsam::Pose3 estimate;
+    };
+    std::vector<Marginal>             marginals;
+    std::vector<InterRobotConstraint> constraints;
+
+    std::vector<uint8_t> encode() const;
+    /** Throws on malformed or incompatible data */
+    void decode(const uint8_t* data, const std::size_t len);
+};
+
+/** Local IPC between back-end instances on the same machine: each robot
+ * binds a Unix domain datagram socket `<directory>/robot_<ID>.sock`, and
+ * sends one datagram per summary to its peers. Not available on Windows.
+ * \ingroup mola_slam_gtsam_grp */
+class SeparatorChannel
+{
+   public:
+    SeparatorChannel() = default;
+    ~SeparatorChannel();
+
+    SeparatorChannel(const SeparatorChannel&) = delete;
+    SeparatorChannel& operator=(const SeparatorChannel&) = delete;
+
+    /** Binds the socket of `robot_id`. Throws on error. */
+    void open(const std::string& directory, const uint32_t robot_id);
+    bool is_open() const { return fd_ >= 0; }
+    void close();
+
+    /** Returns false if the peer is not listening (e.g. not started yet),
+     * or its queue is full. Summaries are idempotent, so the caller just
+     * sends a newer one later. */
+    bool send(const uint32_t peer, const SeparatorSummary& s);
+
+    /** Non-blocking: returns false if there is nothing to read. Malformed
+     * datagrams are dropped. */
+    bool receive(SeparatorSummary& s);
+
+   private:
+    int         fd_{-1};
+    std::string directory_, path_;
+
+    std::string socketPath(const uint32_t robot) const;
+};
+
+}  // namespace mola
@@ -0,0 +1,120 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   SolverCheckpoint.h
+ * @brief  Snapshot of the ASLAM_gtsam solver state, for warm restarts
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 18, 2019
+ */
+#pragma once
+
+#include <mola-kernel/id.h>
+
+#include <gtsam/geometry/Cal3_S2Stereo.h>
+#include <gtsam/geometry/Pose3.h>
+#include <gtsam/nonlinear/ISAM2.h>
+#include <gtsam/nonlinear/NonlinearFactorGraph.h>
+#include <gtsam/nonlinear/Values.h>
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace mola
+{
+/** All the state of ASLAM_gtsam needed to resume SLAM without re-running
+ * the optimization from scratch, including the iSAM2 Bayes tree. Factor
+ * indices refer to the iSAM2 factor graph, with its null (removed) entries
+ * kept. See ASLAM_gtsam::saveCheckpoint().
+ *
+ * \ingroup mola_slam_gtsam_grp */
+struct SolverCheckpoint
+{
+    /** The iSAM2 state: Bayes tree, factors, linearization point, variable
+     * index and deltas, as written by serializeISAM2(). Kept serialized
+     * since smart factors are shared with the live solver, which keeps
+     * modifying them. Empty after readSolverCheckpoint(), which restores
+     * it directly into a solver. */
+    std::string isam2;
+
+    /** Alternatively, if `isam2` is empty, a private copy of the iSAM2
+     * state (see snapshotISAM2()), which writeSolverCheckpoint()
+     * serializes. Taking it is much faster than serializing it, so the
+     * live solver is not held for that long. */
+    std::shared_ptr<const gtsam::ISAM2> isam2_snapshot;
+
+    /** Sizes of the iSAM2 graph (non-null factors) and linearization
+     * point, for reporting */
+    std::size_t num_factors{0}, num_variables{0};
+
+    /** Pending (not optimized yet) factors and values */
+    gtsam::NonlinearFactorGraph                  newfactors;
+    gtsam::Values                                newvalues;
+    std::map<std::size_t, mola::fid_t>           newFactor2molaid;
+    std::map<std::size_t, std::vector<uint64_t>> changedSmartFactors;
+
+    /** KFs registered in the mola <-> gtsam key maps */
+    std::vector<mola::id_t> kfs;
+    std::set<mola::id_t>    kf_has_value;
+
+    mola::id_t root_kf_id{mola::INVALID_ID};
+    mola::id_t last_created_kf_id{mola::INVALID_ID};
+    mola::id_t former_last_created_kf_id{mola::INVALID_ID};
+    int64_t    last_created_kf_id_tim{0};  //!< mrpt::Clock::rep
+    bool       has_last_created_kf_id_tim{false};
+
+    /** time2kf, with timestamps as mrpt::Clock::rep */
+    std::map<int64_t, mola::id_t> time2kf;
+
+    /** Stereo smart factors: camera calibration, and index of each one
+     * (by MOLA factor ID) in the iSAM2 graph or in `newfactors` */
+    bool                               has_camera_K{false};
+    gtsam::Cal3_S2Stereo               camera_K;
+    std::map<mola::fid_t, std::size_t> smart_in_graph, smart_in_newfactors;
+    std::map<std::size_t, mola::fid_t> smart_ids;  //!< iSAM2 idx => fid
+
+    /** Visualization map: nodes, edges and velocities */
+    std::map<mola::id_t, gtsam::Pose3>        viz_nodes;
+    std::vector<mola::id_t>                   viz_edge_from, viz_edge_to;
+    std::vector<gtsam::Pose3>                 viz_edge_pose;
+    std::map<mola::id_t, std::vector<double>> viz_dyn;  //!< vx..wz
+};
+
+/** Serializes the state of an iSAM2 solver, except its parameters, for
+ * SolverCheckpoint::isam2. */
+std::string serializeISAM2(const gtsam::ISAM2& isam2);
+
+/** Copies the state of an iSAM2 solver, to serialize it later while the
+ * original one keeps changing. The Bayes tree cliques, values and indices
+ * are copied, while conditionals and factors are shared, since iSAM2
+ * replaces them instead of modifying them. Factors that are modified in
+ * place (smart factors) must be cloned by `copyFactor`, which is called
+ * for each non-null factor of the graph. */
+std::shared_ptr<gtsam::ISAM2> snapshotISAM2(
+    const gtsam::ISAM2& isam2,
+    const std::function<gtsam::NonlinearFactor::shared_ptr(
+        const gtsam::NonlinearFactor::shared_ptr&)>& copyFactor);
+
+/** Writes a checkpoint to a binary file, via a temporary file renamed on
+ * success. Throws on I/O errors. Returns the file size in bytes. */
+std::size_t writeSolverCheckpoint(
+    const SolverCheckpoint& cp, const std::string& file);
+
+/** Reads a checkpoint written by writeSolverCheckpoint(). All fields but
+ * `cp.isam2` are filled in; the iSAM2 state is restored into `isam2`,
+ * which must be empty and keeps its own parameters. The file is
+ * memory-mapped and deserialized from the mapping, with no intermediary
+ * file buffer or factor graph copy; the resulting objects are still
+ * allocated in the heap, as Boost serialization cannot use them in place.
+ * Throws on I/O errors or if the file is not a valid checkpoint. */
+void readSolverCheckpoint(
+    const std::string& file, SolverCheckpoint& cp, gtsam::ISAM2& isam2);
+
+}  // namespace mola
@@ -0,0 +1,170 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   SyntheticWorkload.h
+ * @brief  Synthetic SLAM sessions as sequences of back-end API calls
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 20, 2019
+ */
+#pragma once
+
+#include <mola-kernel/WorldModel.h>
+#include <mola-kernel/interfaces/BackEndBase.h>
+#include <mola-slam-gtsam/BackendCallLog.h>
+#include <mola-slam-gtsam/TrajectoryEvaluation.h>
+#include <mrpt/poses/CPose3D.h>
+#include <mrpt/random/RandomGenerators.h>
+#include <mrpt/typemeta/TEnumType.h>
+
+#include <deque>
+#include <map>
+#include <tuple>
+#include <vector>
+
+namespace mola
+{
+/** Generates a synthetic SLAM session, with known ground truth, as the
+ * sequence of back-end calls a front-end would issue: keyframes, noisy
+ * odometry (FactorRelativePose3), loop closures, smart stereo
+ * observations and spinOnce(). Records are meant to be fed to
+ * replayBackendCalls(). Their IDs are local to the generator, and are
+ * translated by the replay. Fully deterministic for a given seed.
+ *
+ * Workloads:
+ * - Manhattan: random walk on a 2D grid, 1 m per keyframe, with loop
+ *   closures each time a cell is revisited.
+ * - Sphere: a spiral over a sphere, with loop closures between
+ *   consecutive rings (like the classic sphere2500 dataset).
+ * - Corridor: a long corridor traversed back and forth, with loop
+ *   closures to the former pass at each position.
+ * - Stereo: a straight corridor with point landmarks on its walls,
+ *   observed by a stereo camera through smart factors (see stereoCamera()).
+ *   Only supported by ASLAM_gtsam.
+ *
+ * \ingroup mola_slam_gtsam_grp */
+class SyntheticWorkload
+{
+   public:
+    enum class Type : int8_t
+    {
+        Manhattan = 0,
+        Sphere,
+        Corridor,
+        Stereo
+    };
+
+    struct Parameters
+    {
+        Type        type{Type::Manhattan};
+        std::size_t num_kfs{1000};
+        uint32_t    seed{1};
+        /** Time between keyframes [s] */
+        double kf_period{1.0};
+        /** One spinOnce() call every this number of keyframes */
+        unsigned spin_every{1};
+        /** Noise of odometry and loop closures (std. dev., [m] and [rad]) */
+        double sigma_xyz{0.02}, sigma_rot{0.005};
+
+        /** Manhattan: probability of turning at each step */
+        double manhattan_turn_prob{0.3};
+        /** Sphere: keyframes per ring and radius [m] */
+        unsigned sphere_kfs_per_ring{50};
+        double   sphere_radius{50.0};
+        /** Corridor: keyframes per pass */
+        unsigned corridor_length{100};
+        /** Stereo: landmarks per meter, and pixel noise (std. dev.) */
+        double stereo_landmarks_per_meter{10.0};
+        double stereo_pixel_sigma{0.5};
+    };
+
+    explicit SyntheticWorkload(const Parameters& p);
+
+    const Parameters& params() const { return params_; }
+
+    /** Next back-end call. Returns false at the end of the session. */
+    bool next(BackendCallRecord& r);
+
+    /** A source for replayBackendCalls(). The object must outlive it. */
+    BackendCallSource source()
+    {
+        return [this](BackendCallRecord& r) { return next(r); };
+    }
+
+    struct GroundTruthKF
+    {
+        /** ID as in the generated records */
+        mola::id_t           id{mola::INVALID_ID};
+        double               stamp{0};
+        mrpt::poses::CPose3D pose;
+    };
+    /** Keyframes generated so far */
+    const std::vector<GroundTruthKF>& groundTruth() const { return gt_; }
+
+    /** Stereo camera of the Stereo workload: focal length and principal
+     * point [px], image size, baseline [m] */
+    struct StereoCamera
+    {
+        double   f{400}, cx{320}, cy{240};
+        unsigned ncols{640}, nrows{480};
+        double   baseline{0.2};
+    };
+    StereoCamera stereoCamera() const { return camera_; }
+
+    /** Prepares a back-end for this workload, before replaying it: creates
+     * the stereo camera of the Stereo workload. Returns false if the
+     * back-end does not support the workload. */
+    bool prepareBackend(BackEndBase& backend) const;
+
+   private:
+    Parameters                     params_;
+    StereoCamera                   camera_;
+    mrpt::random::CRandomGenerator rng_;
+    std::deque<BackendCallRecord>  pending_;
+    std::vector<GroundTruthKF>     gt_;
+    mrpt::Clock::time_point        t0_;
+    uint64_t                       next_kf_id_{0}, next_factor_id_{0};
+
+    // Manhattan and Corridor: index of the last KF at each visited cell
+    std::map<std::tuple<long, long, long>, std::size_t> visited_;
+    int                                                 heading_{0};
+
+    // Stereo: landmarks ahead of the camera
+    struct Landmark
+    {
+        mrpt::math::TPoint3D pos;
+        uint64_t             factor_id{mola::INVALID_FID};
+    };
+    std::deque<Landmark> landmarks_;
+    double               landmarks_until_{0};
+
+    mrpt::poses::CPose3D nextPose(const std::size_t k);
+    void                 generateKeyFrame(const std::size_t k);
+    void addRelPose(const std::size_t from, const std::size_t to);
+    void addStereoObservations(const std::size_t k);
+    void push(BackendCallRecord&& r);
+};
+
+/** Absolute pose of a keyframe in the WorldModel, composing relative poses
+ * along `base_id_` up to the root. Locks the WorldModel entities. */
+mrpt::poses::CPose3D worldModelKeyFramePose(
+    WorldModel& wm, const mola::id_t kf_id);
+
+/** Compares the current keyframe poses in the WorldModel to the ground
+ * truth of a workload replayed into a back-end. `kf_ids` maps generated
+ * to actual IDs (see BackendReplayStats::kf_ids). Keyframes which were not
+ * created are ignored. */
+TrajectoryEvalResult evaluateWorkload(
+    const SyntheticWorkload& w, WorldModel& wm,
+    const std::map<uint64_t, uint64_t>& kf_ids);
+
+}  // namespace mola
+
+MRPT_ENUM_TYPE_BEGIN(mola::SyntheticWorkload::Type)
+MRPT_FILL_ENUM_MEMBER(mola::SyntheticWorkload::Type, Manhattan);
+MRPT_FILL_ENUM_MEMBER(mola::SyntheticWorkload::Type, Sphere);
+MRPT_FILL_ENUM_MEMBER(mola::SyntheticWorkload::Type, Corridor);
+MRPT_FILL_ENUM_MEMBER(mola::SyntheticWorkload::Type, Stereo);
+MRPT_ENUM_TYPE_END()
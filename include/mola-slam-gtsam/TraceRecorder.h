@@ -0,0 +1,132 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   TraceRecorder.h
+ * @brief  Timeline of scopes from all threads, in Chrome trace-event format
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 20, 2019
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace mola
+{
+/** Process-wide recorder of begin/end events of named scopes, from any
+ * thread, exported in the Chrome trace-event JSON format, which can be
+ * loaded in local trace viewers (chrome://tracing, Perfetto, speedscope).
+ *
+ * Each thread writes into its own fixed-size buffer, without locks nor
+ * allocations; a mutex is only taken the first time a thread records an
+ * event. Events that do not fit in a full buffer are dropped and counted.
+ * While disabled, each scope costs one relaxed atomic load.
+ *
+ * Use it through TraceScope.
+ * \ingroup mola_slam_gtsam_grp */
+class TraceRecorder
+{
+   public:
+    static TraceRecorder& Instance();
+
+    /** Starts recording. Buffers are created with room for
+     * `events_per_thread` events (24 bytes each) the first time each thread
+     * records an event. */
+    void enable(const std::size_t events_per_thread = 1 << 18);
+    void disable() { enabled_.store(false, std::memory_order_relaxed); }
+    bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+    /** `name` must be a string literal, or outlive the recorder */
+    void begin(const char* name)
+    {
+        if (enabled()) record(name, 'B');
+    }
+    void end(const char* name)
+    {
+        if (enabled()) record(name, 'E');
+    }
+
+    /** Name of the calling thread in the trace. Does nothing if disabled */
+    void setThreadName(const std::string& name);
+
+    /** Writes all events recorded so far, as a JSON object. Other threads
+     * may keep recording meanwhile. */
+    void saveJSON(std::ostream& o) const;
+    void saveJSON(const std::string& file) const;
+
+    /** Number of events recorded and dropped so far, in all threads */
+    std::size_t recorded() const;
+    std::size_t dropped() const;
+
+   private:
+    friend class TraceScope;
+
+    TraceRecorder();
+
+    struct Event
+    {
+        const char* name;
+        int64_t     t_ns;  //!< Since epoch_
+        char        phase;  //!< 'B'egin or 'E'nd
+    };
+
+    /** Written only by its thread. `size` is published with release
+     * semantics, so saveJSON() can read events [0,size) concurrently. */
+    struct ThreadBuffer
+    {
+        ThreadBuffer(const std::size_t cap, const uint32_t id);
+
+        std::unique_ptr<Event[]> events;
+        const std::size_t        capacity;
+        const uint32_t           tid;
+        std::atomic<std::size_t> size{0}, dropped{0};
+        std::string              name;  //!< Locked by mtx_
+    };
+
+    void          record(const char* name, const char phase);
+    ThreadBuffer& thread_buffer();
+
+    std::atomic<bool>                           enabled_{false};
+    std::size_t                                 capacity_{1 << 18};
+    const std::chrono::steady_clock::time_point epoch_;
+
+    /** All buffers, kept after their threads end */
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers_;
+    mutable std::mutex                         mtx_;
+};
+
+/** Records a begin event on construction and the matching end event on
+ * destruction, if the TraceRecorder was enabled at construction.
+ * `name` must be a string literal, or outlive the recorder.
+ * \ingroup mola_slam_gtsam_grp */
+class TraceScope
+{
+   public:
+    explicit TraceScope(const char* name)
+        : name_(TraceRecorder::Instance().enabled() ? name : nullptr)
+    {
+        if (name_) TraceRecorder::Instance().record(name_, 'B');
+    }
+    ~TraceScope()
+    {
+        // (Even if disabled meanwhile, to keep begin/end pairs balanced)
+        if (name_) TraceRecorder::Instance().record(name_, 'E');
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+   private:
+    const char* name_;
+};
+
+}  // namespace mola
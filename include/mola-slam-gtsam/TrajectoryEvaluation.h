@@ -0,0 +1,101 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   TrajectoryEvaluation.h
+ * @brief  Trajectory accuracy metrics (ATE, RPE) against ground truth
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 09, 2019
+ */
+#pragma once
+
+#include <Eigen/Geometry>
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace mola
+{
+/** @name trajectory_eval Trajectory accuracy evaluation
+ * @{ */
+
+using aligned_poses_t = std::vector<
+    Eigen::Isometry3d, Eigen::aligned_allocator<Eigen::Isometry3d>>;
+
+/** A timestamped sequence of poses, sorted by time */
+struct TimedTrajectory
+{
+    std::vector<double> stamps;
+    aligned_poses_t     poses;
+
+    std::size_t size() const { return stamps.size(); }
+};
+
+/** Loads a trajectory from a text file. The format is detected from the
+ * number of columns:
+ * - 8: TUM (`t x y z qx qy qz qw`),
+ * - 7: MRPT CPose3DInterpolator (`t x y z yaw pitch roll`, as written to
+ *      `<save_trajectory_file_prefix>_path.txt`),
+ * - 12: KITTI (3x4 row-major matrix; the line index is used as timestamp).
+ * Lines starting with `#` or `%` are ignored. Throws on error. */
+TimedTrajectory loadTrajectory(const std::string& fileName);
+
+/** Index pairs (estimate, ground truth) of associated poses */
+using TrajectoryAssociation = std::vector<std::pair<std::size_t, std::size_t>>;
+
+/** For each estimated pose, finds the closest ground truth pose in time, if
+ * it is closer than `max_dt` seconds. Runs in parallel. */
+TrajectoryAssociation associateByTime(
+    const TimedTrajectory& est, const TimedTrajectory& gt,
+    const double max_dt = 0.02);
+
+/** Returns the rigid (or similarity, if `with_scale`) transformation that
+ * best aligns the associated estimated positions onto ground truth
+ * (Umeyama's method). */
+Eigen::Isometry3d alignTrajectories(
+    const TimedTrajectory& est, const TimedTrajectory& gt,
+    const TrajectoryAssociation& assoc, const bool with_scale = false,
+    double* out_scale = nullptr);
+
+struct ErrorStats
+{
+    std::size_t count{0};
+    double      rmse{0}, mean{0}, median{0}, std{0}, min{0}, max{0};
+};
+
+/** Computes summary statistics of a list of errors */
+ErrorStats computeErrorStats(std::vector<double> errors);
+
+struct TrajectoryEvalResult
+{
+    std::size_t est_poses{0}, gt_poses{0}, associated{0};
+    double      scale{1.0};
+    /** Absolute trajectory error, translational [m] */
+    ErrorStats ate_trans;
+    /** Relative pose error: translational [m] and rotational [deg] */
+    ErrorStats rpe_trans, rpe_rot;
+    /** RPE step, in number of associated poses */
+    std::size_t rpe_delta{1};
+};
+
+struct TrajectoryEvalParams
+{
+    double      max_dt{0.02};
+    bool        with_scale{false};
+    std::size_t rpe_delta{1};
+};
+
+/** Associates, aligns and computes ATE and RPE in one call. */
+TrajectoryEvalResult evaluateTrajectory(
+    const TimedTrajectory& est, const TimedTrajectory& gt,
+    const TrajectoryEvalParams& p = TrajectoryEvalParams());
+
+/** Writes the result as a JSON object */
+void reportToJSON(const TrajectoryEvalResult& r, std::ostream& o);
+
+/** @} */
+
+}  // namespace mola
@@ -0,0 +1,153 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   TrajectoryStore.h
+ * @brief  Chunked, columnar storage of localization history
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 05, 2019
+ */
+#pragma once
+
+#include <mola-kernel/id.h>
+#include <mola-slam-gtsam/MappedFile.h>
+#include <mrpt/core/Clock.h>
+#include <mrpt/math/TPose3D.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace mola
+{
+/** Append-only history of vehicle poses, each one relative to a reference
+ * keyframe, stored in fixed-size chunks of columns (timestamps, reference
+ * KF IDs, relative poses as `float`s).
+ *
+ * Optionally, entries closer in time than `decimation_period` to the
+ * previous one are dropped, and all but the newest `max_resident_chunks`
+ * chunks are moved to a memory-mapped spill file.
+ *
+ * Entries are kept in insertion order, which is not required to be sorted
+ * by timestamp. An entry with the same timestamp as the last one replaces
+ * it.
+ *
+ * \ingroup mola_slam_gtsam_grp */
+class TrajectoryStore
+{
+   public:
+    TrajectoryStore() = default;
+    ~TrajectoryStore();
+
+    TrajectoryStore(const TrajectoryStore&) = delete;
+    TrajectoryStore& operator=(const TrajectoryStore&) = delete;
+
+    struct Parameters
+    {
+        /** Number of entries per chunk */
+        std::size_t chunk_size{4096};
+        /** Minimum time between stored entries [s]. 0: store all */
+        double decimation_period{0};
+        /** Full chunks beyond this number are spilled to `spill_file`.
+         * 0: keep all in memory */
+        std::size_t max_resident_chunks{0};
+        /** Spill file, created on demand. Required if
+         * max_resident_chunks!=0 */
+        std::string spill_file;
+    };
+
+    /** Must be called before any push_back() */
+    void setParameters(const Parameters& p);
+    const Parameters& parameters() const { return params_; }
+
+    /** Appends an entry, or replaces the last one if `t` equals its
+     * timestamp */
+    void push_back(
+        const mrpt::Clock::time_point& t, const mola::id_t ref_kf,
+        const mrpt::math::TPose3D& rel_pose);
+
+    /** Number of stored entries */
+    std::size_t size() const { return count_; }
+    bool        empty() const { return count_ == 0; }
+
+    /** Removes all entries and the spill file, if any */
+    void clear();
+
+    /** Approximate heap memory in use by resident chunks [bytes] */
+    std::size_t memory_bytes() const;
+
+    /** Visits all entries in insertion order, as:
+     * `f(const mrpt::Clock::time_point&, mola::id_t, const TPose3D&)` */
+    template <class FUNCTOR>
+    void for_each(FUNCTOR&& f) const;
+
+   private:
+    struct Chunk
+    {
+        std::vector<mrpt::Clock::rep> stamps;
+        std::vector<mola::id_t>       ref_kfs;
+        /** x y z yaw pitch roll, 6 per entry */
+        std::vector<float> poses;
+
+        /** If !=-1, data is stored in the spill file at this offset */
+        int64_t     spill_offset{-1};
+        std::size_t spilled_count{0};
+
+        std::size_t size() const
+        {
+            return spill_offset >= 0 ? spilled_count : stamps.size();
+        }
+    };
+
+    Parameters         params_;
+    std::vector<Chunk> chunks_;
+    std::size_t        count_{0};
+    mrpt::Clock::rep   last_stamp_{0};
+    std::FILE*         spill_out_{nullptr};
+    int64_t            spill_size_{0};
+    mutable MappedFile spill_in_;
+
+    void spill_old_chunks();
+    const uint8_t* spilled_data(const Chunk& c) const;
+};
+
+template <class FUNCTOR>
+void TrajectoryStore::for_each(FUNCTOR&& f) const
+{
+    for (const auto& c : chunks_)
+    {
+        const std::size_t       n = c.size();
+        const mrpt::Clock::rep* stamps;
+        const mola::id_t*       ref_kfs;
+        const float*            poses;
+
+        if (c.spill_offset >= 0)
+        {
+            const uint8_t* d = spilled_data(c);
+            stamps           = reinterpret_cast<const mrpt::Clock::rep*>(d);
+            ref_kfs          = reinterpret_cast<const mola::id_t*>(
+                d + n * sizeof(mrpt::Clock::rep));
+            poses = reinterpret_cast<const float*>(
+                d + n * (sizeof(mrpt::Clock::rep) + sizeof(mola::id_t)));
+        }
+        else
+        {
+            stamps  = c.stamps.data();
+            ref_kfs = c.ref_kfs.data();
+            poses   = c.poses.data();
+        }
+
+        for (std::size_t i = 0; i < n; i++)
+        {
+            const float* p = poses + 6 * i;
+            f(mrpt::Clock::time_point(mrpt::Clock::duration(stamps[i])),
+              ref_kfs[i],
+              mrpt::math::TPose3D(p[0], p[1], p[2], p[3], p[4], p[5]));
+        }
+    }
+}
+
+}  // namespace mola
@@ -0,0 +1,149 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   TrajectoryWriter.h
+ * @brief  Append-only, streamed trajectory writer (TUM, KITTI, binary)
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 02, 2019
+ */
+#pragma once
+
+#include <mola-kernel/id.h>
+#include <mrpt/core/Clock.h>
+#include <mrpt/math/TPose3D.h>
+#include <mrpt/typemeta/TEnumType.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <unordered_set>
+
+namespace mola
+{
+/** Writes vehicle poses to disk as they are produced, so a crash does not
+ * lose the trajectory and onQuit() does not need to dump the whole path.
+ *
+ * While open, the file is append-only: keyframes whose pose is corrected by
+ * the optimizer are appended again as "revisions". Compact() turns a
+ * `Binary` stream into the final trajectory, with non-keyframes re-attached
+ * to the last revision of their reference keyframes.
+ *
+ * Text formats (TUM, KITTI) cannot be compacted by themselves, since KITTI
+ * lines carry no timestamp nor KF ID. For them, a `Binary` stream is also
+ * written next to the text file (see streamFileName()), and close() replaces
+ * the text log with its compacted version and deletes the binary stream.
+ * After a crash, the text file is left as a log with duplicated poses, and
+ * the binary stream can be compacted with `mola-trajectory-compact`.
+ *
+ * \ingroup mola_slam_gtsam_grp */
+class TrajectoryWriter
+{
+   public:
+    TrajectoryWriter() = default;
+    ~TrajectoryWriter();
+
+    TrajectoryWriter(const TrajectoryWriter&) = delete;
+    TrajectoryWriter& operator=(const TrajectoryWriter&) = delete;
+
+    enum class Format : int8_t
+    {
+        /** `timestamp x y z qx qy qz qw` per line */
+        TUM = 0,
+        /** Row-major 3x4 pose matrix per line, no timestamp */
+        KITTI,
+        /** Fixed-size little-endian records. See BinaryRecord */
+        Binary,
+        None = -1
+    };
+
+    enum class EntryKind : uint8_t
+    {
+        NonKeyFrame = 0,
+        KeyFrame,
+        KeyFrameRevision
+    };
+
+    /** One entry of a Binary stream. On disk, fields are stored in this
+     * order without padding (kBinaryRecordSize bytes). */
+    struct BinaryRecord
+    {
+        double    timestamp{0};
+        EntryKind kind{EntryKind::NonKeyFrame};
+        /** KF ID for keyframes; the reference KF for non-keyframes */
+        uint64_t kf_id{0};
+        /** Pose wrt kf_id (non-keyframes only): x y z qx qy qz qw */
+        float rel_pose[7]{0, 0, 0, 0, 0, 0, 1};
+        /** Absolute pose, as known at write time: x y z qx qy qz qw */
+        double abs_pose[7]{0, 0, 0, 0, 0, 0, 1};
+    };
+    static constexpr std::size_t kBinaryRecordSize =
+        sizeof(double) + sizeof(uint8_t) + sizeof(uint64_t) +
+        7 * sizeof(float) + 7 * sizeof(double);
+
+    /** Creates (truncates) the output file, plus the side binary stream
+     * for text formats. Throws on error. */
+    void open(const std::string& fileName, Format fmt);
+    bool is_open() const { return f_ != nullptr; }
+    /** Flushes pending data and closes the file. Text formats are then
+     * compacted from the side binary stream. */
+    void close();
+
+    /** Name of the side binary stream written along a text file */
+    static std::string streamFileName(const std::string& textFileName);
+
+    /** Writes buffered records to the OS. Call it once per SLAM iteration:
+     * individual append calls only copy into a memory buffer. */
+    void flush();
+
+    void appendNonKeyFrame(
+        const mrpt::Clock::time_point& t, const mola::id_t ref_kf,
+        const mrpt::math::TPose3D& rel_pose,
+        const mrpt::math::TPose3D& abs_pose);
+
+    /** Appends a keyframe pose. The first time a given `kf_id` is seen, it
+     * is stored as KeyFrame, later calls as KeyFrameRevision. */
+    void appendKeyFrame(
+        const mrpt::Clock::time_point& t, const mola::id_t kf_id,
+        const mrpt::math::TPose3D& abs_pose);
+
+    /** Default file extension for each format (including the dot) */
+    static std::string fileExtension(Format fmt);
+
+    /** Reads a Binary stream and writes the final trajectory in the given
+     * (text) format: the latest revision of each keyframe, plus all
+     * non-keyframes composed on top of the latest pose of their reference
+     * KF. Output is sorted by timestamp. Throws on I/O errors. */
+    static void Compact(
+        const std::string& binaryStreamFile, const std::string& outFile,
+        Format outFmt = Format::TUM);
+
+    /** Reads the next record from a Binary stream. Returns false on EOF */
+    static bool readRecord(std::FILE* f, BinaryRecord& r);
+
+   private:
+    std::FILE*                     f_{nullptr};
+    Format                         fmt_{Format::None};
+    std::string                    buf_;
+    std::unordered_set<mola::id_t> known_kfs_;
+
+    /** Text formats only: output file, and its side binary stream */
+    std::string                       file_name_;
+    std::unique_ptr<TrajectoryWriter> stream_;
+
+    /** Opens the file alone, without side stream */
+    void open_log(const std::string& fileName, Format fmt);
+    void append(const BinaryRecord& r);
+};
+
+}  // namespace mola
+
+MRPT_ENUM_TYPE_BEGIN(mola::TrajectoryWriter::Format)
+MRPT_FILL_ENUM_MEMBER(mola::TrajectoryWriter::Format, TUM);
+MRPT_FILL_ENUM_MEMBER(mola::TrajectoryWriter::Format, KITTI);
+MRPT_FILL_ENUM_MEMBER(mola::TrajectoryWriter::Format, Binary);
+MRPT_FILL_ENUM_MEMBER(mola::TrajectoryWriter::Format, None);
+MRPT_ENUM_TYPE_END()
@@ -0,0 +1,88 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   variant_serialization.h
+ * @brief  Serialization of std::variant<> of CSerializable (Entity, Factor)
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 16, 2019
+ */
+#pragma once
+
+#include <mrpt/serialization/CArchive.h>
+#include <mrpt/serialization/CSerializable.h>
+
+#include <cstdint>
+#include <type_traits>
+#include <variant>
+
+namespace mola
+{
+/** Writes the active alternative of a variant (e.g. mola::Entity or
+ * mola::Factor) as an MRPT object. Alternatives which are not
+ * CSerializable (e.g. std::monostate) are written as an empty object. */
+template <class VARIANT>
+void writeVariant(mrpt::serialization::CArchive& out, const VARIANT& v)
+{
+    std::visit(
+        [&out](const auto& x) {
+            using T = std::decay_t<decltype(x)>;
+            if constexpr (std::is_base_of_v<
+                              mrpt::serialization::CSerializable, T>)
+            {
+                out.WriteAs<uint8_t>(1);
+                out << x;
+            }
+            else
+                out.WriteAs<uint8_t>(0);
+        },
+        v);
+}
+
+namespace internal
+{
+template <class VARIANT, std::size_t I = 0>
+bool variant_from_object(
+    const mrpt::serialization::CSerializable::Ptr& o, VARIANT& v)
+{
+    if constexpr (I < std::variant_size_v<VARIANT>)
+    {
+        using T = std::variant_alternative_t<I, VARIANT>;
+        if constexpr (std::is_base_of_v<mrpt::serialization::CSerializable, T>)
+        {
+            if (const auto* p = dynamic_cast<const T*>(o.get()); p)
+            {
+                v = *p;
+                return true;
+            }
+        }
+        return variant_from_object<VARIANT, I + 1>(o, v);
+    }
+    else
+        return false;
+}
+}  // namespace internal
+
+/** Reads a variant written by writeVariant(). Empty objects are left as
+ * a default-constructed variant. Throws if the object class is not one of
+ * the variant alternatives. */
+template <class VARIANT>
+void readVariant(mrpt::serialization::CArchive& in, VARIANT& v)
+{
+    const auto hasObject = in.ReadAs<uint8_t>();
+    if (!hasObject)
+    {
+        v = VARIANT();
+        return;
+    }
+    const auto o = in.ReadObject();
+    ASSERTMSG_(
+        internal::variant_from_object(o, v),
+        mrpt::format(
+            "Object of class `%s` does not fit in the target variant",
+            o ? o->GetRuntimeClass()->className : "(null)"));
+}
+
+}  // namespace mola
@@ -26,8 +26,12 @@
 #include <mrpt/opengl/CSetOfLines.h>  // TODO: Remove after vizmap module
 #include <mrpt/opengl/graph_tools.h>  // TODO: Remove after vizmap module
 #include <mrpt/opengl/stock_objects.h>  // TODO: Remove after vizmap module
+#include <mrpt/system/filesystem.h>
 #include <yaml-cpp/yaml.h>
 
+#include <chrono>
+#include <fstream>
+
 using namespace mola;
 
 // arguments: class_name, parent_class, class namespace
@@ -151,6 +155,19 @@ void ASLAM_gtsam::initialize(const std::string& cfg_block)
     YAML_LOAD_REQ(params_, use_incremental_solver, bool);
     YAML_LOAD_OPT(params_, save_trajectory_file_prefix, std::string);
     YAML_LOAD_OPT(params_, save_map_at_end, bool);
+    YAML_LOAD_OPT(params_, map_chunk_size, int);
+    YAML_LOAD_OPT(params_, map_compress_level, int);
+    YAML_LOAD_OPT(params_, map_save_period, double);
+    YAML_LOAD_OPT(params_, load_map_at_start, bool);
+    YAML_LOAD_OPT(params_, localization_only, bool);
+    YAML_LOAD_OPT(params_, localization_window_size, int);
+    YAML_LOAD_OPT(params_, checkpoint_file, std::string);
+    YAML_LOAD_OPT(params_, journal_directory, std::string);
+    YAML_LOAD_OPT(params_, journal_sync_period, double);
+    YAML_LOAD_OPT(params_, checkpoint_period, double);
+    YAML_LOAD_OPT(params_, robot_id, int);
+    YAML_LOAD_OPT(params_, separator_ipc_directory, std::string);
+    YAML_LOAD_OPT(params_, separator_exchange_period, double);
     YAML_LOAD_OPT(params_, isam2_additional_update_steps, int);
     YAML_LOAD_OPT(params_, isam2_relinearize_threshold, double);
     YAML_LOAD_OPT(params_, isam2_relinearize_skip, int);
@@ -158,11 +175,99 @@ void ASLAM_gtsam::initialize(const std::string& cfg_block)
     YAML_LOAD_OPT(params_, const_vel_model_std_pos, double);
     YAML_LOAD_OPT(params_, const_vel_model_std_vel, double);
     YAML_LOAD_OPT(params_, max_interval_between_kfs_for_dynamic_model, double);
+    YAML_LOAD_OPT(params_, trajectory_decimation_period, double);
+    YAML_LOAD_OPT(params_, trajectory_max_resident_chunks, int);
+    YAML_LOAD_OPT(params_, show_gui, bool);
+    YAML_LOAD_OPT(params_, record_api_calls_file, std::string);
+    YAML_LOAD_OPT(params_, keyframe_obs_store_file, std::string);
+    YAML_LOAD_OPT(params_, keyframe_obs_cache_mb, double);
+    YAML_LOAD_OPT(params_, spin_stats_capacity, int);
+    YAML_LOAD_OPT(params_, spin_stats_csv_file, std::string);
+    YAML_LOAD_OPT(params_, latency_stats_file, std::string);
+    YAML_LOAD_OPT(params_, memory_report_period, double);
+    YAML_LOAD_OPT(params_, trace_file, std::string);
+    YAML_LOAD_OPT(params_, alloc_stats_file, std::string);
+    YAML_LOAD_OPT(params_, factor_cost_stats, bool);
+    YAML_LOAD_OPT(params_, factor_cost_samples, int);
+
+    if (cfg["stream_trajectory_format"])
+    {
+        std::string s = cfg["stream_trajectory_format"].as<std::string>();
+        params_.stream_trajectory_format =
+            mrpt::typemeta::TEnumType<TrajectoryWriter::Format>::name2value(s);
+    }
 
     // Ensure we have access to the worldmodel:
     ASSERT_(worldmodel_);
 
-    MRPT_TODO("Load existing map from world model?");
+    if (!params_.trace_file.empty()) TraceRecorder::Instance().enable();
+
+    if (!params_.alloc_stats_file.empty())
+    {
+        if (AllocProfiler::available())
+            AllocProfiler::reset();
+        else
+            MRPT_LOG_WARN(
+                "`alloc_stats_file` is ignored: build with the CMake option "
+                "MOLA_SLAM_GTSAM_ALLOC_PROFILING to count allocations.");
+    }
+
+    if (!params_.save_trajectory_file_prefix.empty())
+    {
+        TrajectoryStore::Parameters tp;
+        tp.decimation_period   = params_.trajectory_decimation_period;
+        tp.max_resident_chunks = static_cast<std::size_t>(
+            std::max(0, params_.trajectory_max_resident_chunks));
+        tp.spill_file =
+            params_.save_trajectory_file_prefix + "_trajectory.spill";
+        state_.trajectory.setParameters(tp);
+    }
+
+    if (!params_.record_api_calls_file.empty())
+    {
+        MRPT_LOG_INFO_STREAM(
+            "Recording back-end API calls to: "
+            << params_.record_api_calls_file);
+        api_recorder_.open(params_.record_api_calls_file);
+    }
+
+    if (params_.map_chunk_size > 0)
+    {
+        ChunkedMapParameters mp;
+        mp.chunk_size     = static_cast<std::size_t>(params_.map_chunk_size);
+        mp.compress_level = params_.map_compress_level;
+        map_writer_       = std::make_unique<ChunkedMapWriter>(mp);
+        last_map_save_    = mrpt::Clock::now();
+    }
+
+    if (!params_.keyframe_obs_store_file.empty())
+    {
+        KeyframeObsStore::Parameters sp;
+        sp.file             = params_.keyframe_obs_store_file;
+        sp.max_cached_bytes = static_cast<std::size_t>(
+            std::max(0.0, params_.keyframe_obs_cache_mb) * 1024 * 1024);
+        MRPT_LOG_INFO_STREAM("Storing keyframe observations in: " << sp.file);
+        kf_obs_store_.open(sp);
+
+        // Saved map chunks must still have the observations:
+        if (map_writer_)
+            map_writer_->setObservationsSource(
+                [this](const mola::id_t id) { return kf_obs_store_.load(id); });
+    }
+
+    if (params_.stream_trajectory_format != TrajectoryWriter::Format::None)
+    {
+        ASSERTMSG_(
+            !params_.save_trajectory_file_prefix.empty(),
+            "`stream_trajectory_format` requires "
+            "`save_trajectory_file_prefix`");
+
+        const auto fil = params_.save_trajectory_file_prefix + "_stream" +
+                         TrajectoryWriter::fileExtension(
+                             params_.stream_trajectory_format);
+        MRPT_LOG_INFO_STREAM("Streaming estimated poses to: " << fil);
+        trajectory_writer_.open(fil, params_.stream_trajectory_format);
+    }
 
     // Init iSAM2:
     if (params_.use_incremental_solver)
@@ -176,6 +281,116 @@ void ASLAM_gtsam::initialize(const std::string& cfg_block)
         parameters.evaluateNonlinearError = true;
 
         state_.isam2 = std::make_unique<gtsam::ISAM2>(parameters);
+
+        if (params_.localization_only)
+        {
+            ASSERT_(params_.localization_window_size > 0);
+            // KF sequence numbers are used as timestamps, see
+            // localization_update():
+            state_.loc_smoother =
+                std::make_unique<gtsam::IncrementalFixedLagSmoother>(
+                    params_.localization_window_size, parameters);
+        }
+    }
+    else
+    {
+        ASSERTMSG_(
+            !params_.localization_only,
+            "`localization_only` requires `use_incremental_solver`");
+    }
+
+    // Crash recovery?
+    bool recovered = false;
+    if (!params_.journal_directory.empty())
+    {
+        ASSERTMSG_(
+            map_writer_, "`journal_directory` requires `map_chunk_size>0`");
+        ASSERTMSG_(
+            state_.isam2 && !state_.loc_smoother,
+            "`journal_directory` requires `use_incremental_solver` and is "
+            "not available in `localization_only` mode");
+        if (params_.map_save_period > 0)
+            MRPT_LOG_WARN(
+                "`map_save_period` is ignored when `journal_directory` is "
+                "set: checkpoints save the map.");
+
+        mrpt::system::createDirectory(params_.journal_directory);
+        recovered = journal_recover();
+    }
+
+    // Continue from an existing map?
+    if (!recovered && params_.load_map_at_start)
+    {
+        ProfilerEntry tle(profiler_, "initialize.load_map");
+        const auto    t0 = mrpt::Clock::now();
+
+        if (const auto mapDir = chunked_map_directory();
+            chunkedMapExists(mapDir))
+        {
+            ChunkedMapParameters mp;
+            if (map_writer_) mp = map_writer_->parameters();
+
+            MRPT_LOG_INFO_STREAM("Loading chunked map from: " << mapDir);
+            const auto st = loadChunkedMap(*worldmodel_, mapDir, mp);
+            MRPT_LOG_INFO_FMT(
+                "Loaded %zu entities and %zu factors from %zu chunks in "
+                "%.03f s",
+                st.entities, st.factors, st.chunks, st.seconds);
+
+            // Chunks on disk are already up to date, unless they have
+            // another size:
+            if (map_writer_ && st.chunk_size == mp.chunk_size)
+                map_writer_->markAllClean();
+        }
+        else if (const auto mapFil =
+                     worldmodel_->map_base_directory() + "/WorldModel.map";
+                 mrpt::system::fileExists(mapFil))
+        {
+            MRPT_LOG_INFO_STREAM("Loading WorldModel map from: " << mapFil);
+            worldmodel_->map_load_from(mapFil);
+        }
+        else
+        {
+            MRPT_LOG_WARN_STREAM(
+                "load_map_at_start: no map found in: "
+                << worldmodel_->map_base_directory());
+        }
+        kf_observations_to_store();
+
+        if (!params_.checkpoint_file.empty() &&
+            mrpt::system::fileExists(params_.checkpoint_file))
+            loadCheckpoint(params_.checkpoint_file);
+        else
+            rebuild_from_worldmodel();
+
+        MRPT_LOG_INFO_FMT(
+            "Map loaded and solver initialized in %.03f s",
+            mrpt::system::timeDifference(t0, mrpt::Clock::now()));
+    }
+
+    // Base checkpoint, and start journaling:
+    if (!params_.journal_directory.empty()) journal_checkpoint(true);
+
+    // Multi-robot mode:
+    if (params_.robot_id >= 0)
+    {
+        ASSERTMSG_(
+            state_.isam2 && !state_.loc_smoother,
+            "`robot_id` requires `use_incremental_solver` and is not "
+            "available in `localization_only` mode");
+        ASSERTMSG_(
+            !params_.separator_ipc_directory.empty(),
+            "`robot_id` requires `separator_ipc_directory`");
+
+        mrpt::system::createDirectory(params_.separator_ipc_directory);
+        separators_.channel.open(
+            params_.separator_ipc_directory,
+            static_cast<uint32_t>(params_.robot_id));
+        // Constraints from a restored map:
+        separator_reindex();
+        MRPT_LOG_INFO_FMT(
+            "Multi-robot mode: robot #%i, IPC directory: `%s`",
+            params_.robot_id, params_.separator_ipc_directory.c_str());
     }
 
     MRPT_END
@@ -184,18 +399,69 @@ void ASLAM_gtsam::spinOnce()
 {
     MRPT_START
     ProfilerEntry tleg(profiler_, "spinOnce");
+    TraceScope    trg("spinOnce");
+    AllocScope    alg("spinOnce");
+    const double  rec_t0 = api_recorder_.now();
+    TraceRecorder::Instance().setThreadName("ASLAM_gtsam spinOnce");
+
+    // Write-ahead journal: see below.
+    double journal_t = 0;
 
     MRPT_TODO("Refactor into 2-3 methods");
 
+    // Per-spin statistics:
+    using clock = std::chrono::steady_clock;
+    const auto spin_t0 = clock::now();
+    const auto elapsed = [](const clock::time_point& t0) {
+        return std::chrono::duration<double>(clock::now() - t0).count();
+    };
+    SpinStats st;
+    st.timestamp = mrpt::Clock::now();
+
+    // End-to-end latency of what gets into the solver in this spin:
+    std::vector<Arrival> arrivals;
+    clock::time_point    solve_t0{}, solve_t1{};
+
     // Incremental SAM solution:
     gtsam::Values                      result;
     gtsam::ISAM2Result                 isam2_res, isam2_res_refine;
     std::map<std::size_t, mola::fid_t> processedFactor2molaid;
 
-    if (params_.use_incremental_solver)
+    if (state_.loc_smoother)
     {
         auto lock = lockHelper(isam2_lock_);
 
+        if (!state_.newfactors.empty() || !state_.newvalues.empty())
+        {
+            st.solved        = true;
+            st.new_factors   = state_.newfactors.size();
+            st.new_variables = state_.newvalues.size();
+            arrivals.swap(pending_arrivals_);
+
+            solve_t0           = clock::now();
+            result             = localization_update();
+            solve_t1           = clock::now();
+            st.t_update        = elapsed(solve_t0);
+            state_.last_values = result;
+        }
+    }
+    else if (params_.use_incremental_solver)
+    {
+        auto lock = lockHelper(isam2_lock_);
+
+        // Write-ahead journal, before anything changes, and under the same
+        // lock as the update, so no other call can be applied between both.
+        // (Journaling requires this solver, see initialize())
+        if (journal_.is_open())
+        {
+            ProfilerEntry tle(profiler_, "spinOnce.journal");
+            journal_t = journal_.beginSpinOnce();
+        }
+        BackendJournal::AbortGuard journal_abort(journal_, journal_t);
+
+        // Summaries from other robots:
+        if (separators_.channel.is_open()) separator_receive();
+
         // smart factors are not re-added to newfactors, but we should
         // re-optimize if needed anyway:
         if (!state_.newfactors.empty() || !state_.newvalues.empty() ||
@@ -205,23 +471,70 @@ void ASLAM_gtsam::spinOnce()
             gtsam::ISAM2UpdateParams updateParams;
             updateParams.newAffectedKeys =
                 std::move(state_.changedSmartFactors);
+            // Outdated priors from other robots' summaries:
+            if (!separators_.to_remove.empty())
+            {
+                updateParams.removeFactorIndices = separators_.to_remove;
+                separators_.to_remove.clear();
+            }
+            // Keep separators at the root, for cheap summaries:
+            if (separators_.channel.is_open())
+                separator_constrain(updateParams);
+
+            st.solved          = true;
+            st.new_factors     = state_.newfactors.size();
+            st.new_variables   = state_.newvalues.size();
+            st.removed_factors = updateParams.removeFactorIndices.size();
+            arrivals.swap(pending_arrivals_);
 
             {
                 ProfilerEntry tle(profiler_, "spinOnce.isam2_update");
+                TraceScope    tr("spinOnce.isam2_update");
+                AllocScope    al("spinOnce.isam2_update");
+                solve_t0  = clock::now();
                 isam2_res = state_.isam2->update(
                     state_.newfactors, state_.newvalues, updateParams);
 
                 // Extra refining steps:
+                gtsam::ISAM2UpdateParams refineParams;
+                refineParams.constrainedKeys = updateParams.constrainedKeys;
                 for (int i = 0; i < params_.isam2_additional_update_steps; i++)
-                    isam2_res_refine = state_.isam2->update();
+                    isam2_res_refine = state_.isam2->update(
+                        gtsam::NonlinearFactorGraph(), gtsam::Values(),
+                        refineParams);
+                st.t_update = elapsed(solve_t0);
+            }
+            separator_on_update(isam2_res);
+
+            if (params_.factor_cost_stats)
+            {
+                ProfilerEntry tle(profiler_, "spinOnce.factor_costs");
+                TraceScope    tr("spinOnce.factor_costs");
+                AllocScope    al("spinOnce.factor_costs");
+                factor_costs_compute(isam2_res, st);
             }
 
             {
                 ProfilerEntry tle(profiler_, "spinOnce.isam2_calcEstimate");
+                TraceScope    tr("spinOnce.isam2_calcEstimate");
+                AllocScope    al("spinOnce.isam2_calcEstimate");
+                const auto    t0 = clock::now();
                 // result = state_.isam2->calculateEstimate();
-                result = state_.isam2->calculateBestEstimate();
+                result        = state_.isam2->calculateBestEstimate();
+                st.t_estimate = elapsed(t0);
+                solve_t1      = clock::now();
             }
 
+            st.variables_reeliminated = isam2_res.variablesReeliminated;
+            st.variables_relinearized = isam2_res.variablesRelinearized;
+            st.factors_recalculated   = isam2_res.factorsRecalculated;
+            st.cliques                = isam2_res.cliques;
+            if (isam2_res.errorBefore) st.error_before = *isam2_res.errorBefore;
+            if (isam2_res_refine.errorAfter)
+                st.error_after = *isam2_res_refine.errorAfter;
+            else if (isam2_res.errorAfter)
+                st.error_after = *isam2_res.errorAfter;
+
             state_.last_values = result;
 
             // If we processed a "newvalue" that was the first gross estimate of
@@ -264,10 +577,21 @@ void ASLAM_gtsam::spinOnce()
         {
             ProfilerEntry tle(
                 profiler_, "spinOnce.LevenbergMarquardtOptimizer");
+            TraceScope tr("spinOnce.LevenbergMarquardtOptimizer");
+            AllocScope al("spinOnce.LevenbergMarquardtOptimizer");
 
+            st.solved        = true;
+            st.new_factors   = state_.newfactors.size();
+            st.new_variables = state_.newvalues.size();
+            arrivals.swap(pending_arrivals_);
+
+            solve_t0 = clock::now();
             gtsam::LevenbergMarquardtOptimizer optimizer(
                 state_.newfactors, state_.newvalues);
-            result = optimizer.optimize();
+            result         = optimizer.optimize();
+            solve_t1       = clock::now();
+            st.t_update    = elapsed(solve_t0);
+            st.error_after = optimizer.error();
 
             MRPT_LOG_DEBUG_STREAM(
                 "LevenbergMarquardt ran: error=" << optimizer.error()
@@ -292,8 +616,14 @@ void ASLAM_gtsam::spinOnce()
 #endif
     }
 
+    st.variables_total = result.size();
+
+    const auto writeback_t0 = clock::now();
     if (result.size())
     {
+        TraceScope tr("spinOnce.write_back");
+        AllocScope al("spinOnce.write_back");
+
         // MRPT_TODO("gtsam Values: add print(ostream) method");
         if (this->isLoggingLevelVisible(mrpt::system::LVL_DEBUG))
             result.print("isam2 result:");
@@ -329,7 +659,7 @@ void ASLAM_gtsam::spinOnce()
 
         // Send only those variables that have been updated:
         gtsam::KeySet changedKeys;
-        if (params_.use_incremental_solver)
+        if (params_.use_incremental_solver && !state_.loc_smoother)
         {
             ASSERT_(isam2_res.detail);
             for (auto keyedStatus : isam2_res.detail->variableStatus)
@@ -341,52 +671,87 @@ void ASLAM_gtsam::spinOnce()
         }
         else
         {
-            // Batch: all keys
+            // Batch or sliding window: all keys
             for (const auto& keyVal : result) changedKeys.insert(keyVal.key);
         }
 
-        auto lk = lockHelper(keys_map_lock_);
+        write_back(result, changedKeys);
+    }
+    st.t_writeback = elapsed(writeback_t0);
 
-        // Send values to the world model:
-        worldmodel_->entities_lock_for_write();
+    if (!arrivals.empty())
+        latency_add(arrivals, solve_t0, solve_t1, clock::now());
+
+    // Periodic background save of the map:
+    if (map_writer_ && params_.map_save_period > 0 &&
+        params_.journal_directory.empty())
+    {
+        const auto tNow = mrpt::Clock::now();
+        if (mrpt::system::timeDifference(last_map_save_, tNow) >
+            params_.map_save_period)
+        {
+            ProfilerEntry tle(profiler_, "spinOnce.map_save_async");
+            TraceScope    tr("spinOnce.map_save_async");
+            try
+            {
+                if (map_writer_->save_async(
+                        *worldmodel_, chunked_map_directory()))
+                    last_map_save_ = tNow;
+            }
+            catch (const std::exception& e)
+            {
+                MRPT_LOG_ERROR_STREAM(
+                    "Background map save failed: " << e.what());
+            }
+        }
+    }
 
-        for (auto key : changedKeys)
+    // Periodic memory report:
+    if (params_.memory_report_period > 0)
+    {
+        const auto tNow = mrpt::Clock::now();
+        if (mrpt::system::timeDifference(last_memory_report_, tNow) >
+            params_.memory_report_period)
         {
-            using std::cout;
-            const gtsam::Value& value = result.at(key);
+            ProfilerEntry tle(profiler_, "spinOnce.memory_report");
+            TraceScope    tr("spinOnce.memory_report");
+            last_memory_report_ = tNow;
+            memory_report_log(memory_report());
+        }
+    }
 
-            if (auto it_kf = state_.gtsam2mola[KF_KEY_POSE].find(key);
-                it_kf != state_.gtsam2mola[KF_KEY_POSE].end())
-            {
-                const mola::id_t kf_id   = it_kf->second;
-                gtsam::Pose3     kf_pose = value.cast<gtsam::Pose3>();
+    if (separators_.channel.is_open())
+    {
+        ProfilerEntry tle(profiler_, "spinOnce.separator_send");
+        TraceScope    tr("spinOnce.separator_send");
+        separator_send();
+    }
 
-                // Dont update the pose of the global reference, fixed to
-                // Identity()
-                if (kf_id != state_.root_kf_id)
-                    updateEntityPose(worldmodel_->entity_by_id(kf_id), kf_pose);
+    api_recorder_.recordSpinOnce(rec_t0);
+    api_recorder_.flush();
+
+    if (journal_.is_open())
+    {
+        journal_.end(journal_t);
 
-                // mapviz:
-                const auto p               = toTPose3D(kf_pose);
-                state_.vizmap.nodes[kf_id] = mrpt::poses::CPose3D(p);
+        if (params_.checkpoint_period > 0 &&
+            mrpt::system::timeDifference(last_checkpoint_, mrpt::Clock::now()) >
+                params_.checkpoint_period)
+        {
+            try
+            {
+                journal_checkpoint(false);
             }
-            else if (auto it_kf = state_.gtsam2mola[KF_KEY_VEL].find(key);
-                     it_kf != state_.gtsam2mola[KF_KEY_VEL].end())
+            catch (const std::exception& e)
             {
-                const mola::id_t kf_id  = it_kf->second;
-                gtsam::Velocity3 kf_vel = value.cast<gtsam::Velocity3>();
-
-                // worldmodel:
-                updateEntityVel(worldmodel_->entity_by_id(kf_id), kf_vel);
-                // mapviz:
-                state_.vizmap_dyn[kf_id].vx = kf_vel.x();
-                state_.vizmap_dyn[kf_id].vy = kf_vel.y();
-                state_.vizmap_dyn[kf_id].vz = kf_vel.z();
+                MRPT_LOG_ERROR_STREAM("Checkpoint failed: " << e.what());
             }
         }
-        worldmodel_->entities_unlock_for_write();
     }
 
+    st.t_total = elapsed(spin_t0);
+    spin_stats_add(st);
+
 #if 0
     MRPT_LOG_DEBUG("iSAM2 detail status:");
     for (auto keyedStatus : isam2_res.detail->variableStatus)
@@ -412,6 +777,8 @@ void ASLAM_gtsam::spinOnce()
 
     // Show in GUI:
     // -------------------
+    if (!params_.show_gui) return;
+
     auto di = std::make_shared<DisplayInfo>();
     {
         auto lock = lockHelper(vizmap_lock_);
@@ -434,9 +801,13 @@ void ASLAM_gtsam::spinOnce()
  * - The global coordinate reference frame (state_.root_kf_id), and
  * - The actual first *Keyframe* (with the desired state space model).
  * It returns the ID of the latter.
+ * It is also used for the first KF of each new map in the atlas (see
+ * startNewMap()), whose root gets its own prior.
  * isam2_lock_ is locked from the caller site.
  */
-mola::id_t ASLAM_gtsam::internal_addKeyFrame_Root(const ProposeKF_Input& i)
+mola::id_t ASLAM_gtsam::internal_addKeyFrame_Root(
+    const mrpt::Clock::time_point&       timestamp,
+    const mrpt::obs::CSensoryFrame::Ptr& obs)
 {
     MRPT_START
 
@@ -444,15 +815,12 @@ mola::id_t ASLAM_gtsam::internal_addKeyFrame_Root(const ProposeKF_Input& i)
     {
         worldmodel_->entities_lock_for_write();
         mola::RefPose3 root;
-        root.timestamp_   = i.timestamp;
+        root.timestamp_   = timestamp;
         state_.root_kf_id = worldmodel_->entity_emplace_back(root);
         worldmodel_->entities_unlock_for_write();
+        if (map_writer_) map_writer_->markEntityDirty(state_.root_kf_id);
     }
 
-    // And add a prior to iSAM2:
-    const double prior_std_rot = mrpt::DEG2RAD(0.01);  // [rad]
-    const double prior_std_pos = 1e-4;  // [m]
-
     // mapviz:
     {
         auto lock = lockHelper(vizmap_lock_);
@@ -477,7 +845,7 @@ mola::id_t ASLAM_gtsam::internal_addKeyFrame_Root(const ProposeKF_Input& i)
     // relative to the global root frame.
     // We will add a strong "fix" factor between this new KF and the root,
     // so it shows up attached to the origin of coordinates.
-    auto new_id = internal_addKeyFrame_Regular(i);
+    auto new_id = internal_addKeyFrame_Regular(timestamp, obs);
 
     internal_add_gtsam_prior_vel(new_id);
 
@@ -494,24 +862,12 @@ mola::id_t ASLAM_gtsam::internal_addKeyFrame_Root(const ProposeKF_Input& i)
         case StateVectorType::SE3:
         {
             // Index map: MOLA worldmodel <-> gtsam
-            const auto key_root    = X(state_.root_kf_id);
             const auto key_kf_pose = X(new_id);
 
-            // Rot, Pos:
-            const auto state0 = gtsam::Pose3::identity();
-
-            const gtsam::Vector6 diag_stds =
-                (gtsam::Vector6() << prior_std_rot * gtsam::ones(3, 1),
-                 prior_std_pos * gtsam::ones(3, 1))
-                    .finished();
-
             // RefPose:
-            state_.newvalues.insert(key_root, state0);
-            state_.newfactors.emplace_shared<gtsam::PriorFactor<gtsam::Pose3>>(
-                key_root, state0,
-                gtsam::noiseModel::Diagonal::Sigmas(diag_stds));
+            gtsam_add_root_prior(state_.root_kf_id);
             // First actual KeyFrame:
-            state_.newvalues.insert(key_kf_pose, state0);
+            state_.newvalues.insert(key_kf_pose, gtsam::Pose3::identity());
 
             break;
         };
@@ -561,40 +917,21 @@ mola::id_t ASLAM_gtsam::find_closest_KF_in_time(
     const mrpt::Clock::time_point& t) const
 {
     const double kf_merge_time_tolerance = 0.1;
-    const auto   tim_delta               = std::chrono::microseconds(
-        static_cast<uint32_t>(1e6 * kf_merge_time_tolerance));
-
-    auto t_min = t, t_max = t;
-    t_min -= tim_delta;
-    t_max += tim_delta;
-
-    auto it_lo = state_.time2kf.lower_bound(t_min);
-    auto it_hi = state_.time2kf.upper_bound(t_max);
-
-    double     min_distance = std::numeric_limits<double>::max();
-    mola::id_t min_id       = mola::INVALID_ID;
-
-    for (auto it = it_lo; it != it_hi; ++it)
-    {
-        const auto dist = std::abs(mrpt::system::timeDifference(it->first, t));
-        if (dist < min_distance)
-        {
-            min_distance = dist;
-            min_id       = it->second;
-        }
-    }
-    return min_id;
+    return mola::find_closest_KF_in_time(
+        state_.time2kf, t, kf_merge_time_tolerance);
 }
 
 // isam2_lock_ is locked from the caller site.
-mola::id_t ASLAM_gtsam::internal_addKeyFrame_Regular(const ProposeKF_Input& i)
+mola::id_t ASLAM_gtsam::internal_addKeyFrame_Regular(
+    const mrpt::Clock::time_point&       timestamp,
+    const mrpt::obs::CSensoryFrame::Ptr& obs)
 {
     MRPT_START
 
     using namespace gtsam::symbol_shorthand;  // X(), V()
 
     // Do we already have a KF for this timestamp?
-    auto known_kf_id = find_closest_KF_in_time(i.timestamp);
+    auto known_kf_id = find_closest_KF_in_time(timestamp);
     if (known_kf_id != mola::INVALID_ID) return known_kf_id;
 
     MRPT_TODO("refactor this to avoid code duplication -> template?");
@@ -605,11 +942,9 @@ mola::id_t ASLAM_gtsam::internal_addKeyFrame_Regular(const ProposeKF_Input& i)
         {
             mola::RelPose3KF new_kf;
             new_kf.base_id_   = state_.root_kf_id;
-            new_kf.timestamp_ = i.timestamp;
-            // Copy the raw observations (shallow copy):
-            if (i.observations)
-                new_kf.raw_observations_ =
-                    mrpt::obs::CSensoryFrame::Create(i.observations.value());
+            new_kf.timestamp_ = timestamp;
+            // Share the raw observations (no copy):
+            if (!kf_obs_store_.is_open()) new_kf.raw_observations_ = obs;
             new_ent = std::move(new_kf);
         }
         break;
@@ -617,11 +952,9 @@ mola::id_t ASLAM_gtsam::internal_addKeyFrame_Regular(const ProposeKF_Input& i)
         {
             RelDynPose3KF new_kf;
             new_kf.base_id_   = state_.root_kf_id;
-            new_kf.timestamp_ = i.timestamp;
-            // Copy the raw observations (shallow copy):
-            if (i.observations)
-                new_kf.raw_observations_ =
-                    mrpt::obs::CSensoryFrame::Create(i.observations.value());
+            new_kf.timestamp_ = timestamp;
+            // Share the raw observations (no copy):
+            if (!kf_obs_store_.is_open()) new_kf.raw_observations_ = obs;
             new_ent = std::move(new_kf);
         }
         break;
@@ -635,9 +968,17 @@ mola::id_t ASLAM_gtsam::internal_addKeyFrame_Regular(const ProposeKF_Input& i)
     worldmodel_->entities_lock_for_write();
     const auto new_kf_id = worldmodel_->entity_emplace_back(std::move(new_ent));
     worldmodel_->entities_unlock_for_write();
+    if (map_writer_) map_writer_->markEntityDirty(new_kf_id);
+
+    // Raw observations go to disk, if so configured:
+    if (obs && kf_obs_store_.is_open())
+    {
+        ProfilerEntry tle(profiler_, "internal_addKeyFrame.store_observations");
+        kf_obs_store_.put(new_kf_id, obs);
+    }
 
     // Add to timestamp register:
-    state_.time2kf[i.timestamp] = new_kf_id;
+    state_.time2kf[timestamp] = new_kf_id;
 
     const gtsam::Key key_kf_pose = X(new_kf_id), key_kf_vel = V(new_kf_id);
 
@@ -724,7 +1065,7 @@ mola::id_t ASLAM_gtsam::internal_addKeyFrame_Regular(const ProposeKF_Input& i)
             state_.former_last_created_kf_id == INVALID_ID)
         {
             const double kf2kf_tim = mrpt::system::timeDifference(
-                state_.last_created_kf_id_tim, i.timestamp);
+                state_.last_created_kf_id_tim, timestamp);
             if (kf2kf_tim < params_.max_interval_between_kfs_for_dynamic_model)
             {
                 FactorDynamicsConstVel fDyn(
@@ -754,7 +1095,7 @@ mola::id_t ASLAM_gtsam::internal_addKeyFrame_Regular(const ProposeKF_Input& i)
     }
 
     // This one must be updated here, since it's used in the if() above.
-    state_.last_created_kf_id_tim = i.timestamp;
+    state_.last_created_kf_id_tim = timestamp;
     MRPT_LOG_DEBUG_STREAM("updateLastCreatedKF: " << new_kf_id);
     state_.updateLastCreatedKF(new_kf_id);
 
@@ -767,36 +1108,91 @@ BackEndBase::ProposeKF_Output ASLAM_gtsam::doAddKeyFrame(
     const ProposeKF_Input& i)
 {
     MRPT_START
-    ProfilerEntry    tleg(profiler_, "doAddKeyFrame");
+    ProfilerEntry tleg(profiler_, "doAddKeyFrame");
+    TraceScope    trg("doAddKeyFrame");
+    AllocScope    alg("doAddKeyFrame");
+    const double  rec_t0 = api_recorder_.now();
+
+    // The input is const, so this is the only copy we make of the
+    // observations container (observations themselves are shared).
+    // addKeyFrameShared() avoids it:
+    mrpt::obs::CSensoryFrame::Ptr obs;
+    if (i.observations)
+    {
+        ProfilerEntry tle(profiler_, "doAddKeyFrame.copy_observations");
+        obs = mrpt::obs::CSensoryFrame::Create(i.observations.value());
+    }
+
+    return internal_addKeyFrame(i.timestamp, obs, rec_t0);
+
+    MRPT_END
+}
+
+BackEndBase::ProposeKF_Output ASLAM_gtsam::addKeyFrameShared(
+    const mrpt::Clock::time_point&       timestamp,
+    const mrpt::obs::CSensoryFrame::Ptr& observations)
+{
+    MRPT_START
+    ProfilerEntry tleg(profiler_, "addKeyFrameShared");
+    TraceScope    trg("addKeyFrameShared");
+    AllocScope    alg("addKeyFrameShared");
+    const double  rec_t0 = api_recorder_.now();
+
+    return internal_addKeyFrame(timestamp, observations, rec_t0);
+
+    MRPT_END
+}
+
+BackEndBase::ProposeKF_Output ASLAM_gtsam::internal_addKeyFrame(
+    const mrpt::Clock::time_point&       timestamp,
+    const mrpt::obs::CSensoryFrame::Ptr& obs, const double rec_t0)
+{
+    MRPT_START
     ProposeKF_Output o;
+    const auto       t_arrival = latency_clock_t::now();
 
     MRPT_LOG_DEBUG_FMT(
         "Creating new KeyFrame (timestamp=%s)",
-        mrpt::system::dateTimeLocalToString(i.timestamp).c_str());
+        mrpt::system::dateTimeLocalToString(timestamp).c_str());
 
-    auto lock = lockHelper(isam2_lock_);
+    auto         lock      = lockHelper(isam2_lock_);
+    const double journal_t = journal_.beginAddKeyFrame(timestamp, obs.get());
+
+    BackendJournal::AbortGuard journal_abort(journal_, journal_t);
+    pending_arrivals_.push_back({"KeyFrame", t_arrival});
 
     // If this is the first KF, create an absolute coordinate reference
-    // frame in the map:
-    if (state_.root_kf_id == INVALID_ID)
+    // frame in the map. Same for the first KF of a new map in the atlas:
+    if (state_.root_kf_id == INVALID_ID || state_.new_map_requested)
     {
-        o.new_kf_id = internal_addKeyFrame_Root(i);
+        if (state_.new_map_requested)
+        {
+            // Nothing links the new map to the former one: no initial guess
+            // nor dynamics factor from the last KF.
+            state_.last_created_kf_id        = INVALID_ID;
+            state_.former_last_created_kf_id = INVALID_ID;
+            state_.last_created_kf_id_tim    = INVALID_TIMESTAMP;
+            state_.new_map_requested         = false;
+        }
+        o.new_kf_id = internal_addKeyFrame_Root(timestamp, obs);
         o.success   = true;
-        return o;
     }
     else
     {
         // Regular KF:
-        o.new_kf_id = internal_addKeyFrame_Regular(i);
+        o.new_kf_id = internal_addKeyFrame_Regular(timestamp, obs);
 
         // No need to add anything else to the gtsam graph.
         // A keyframe will be added when the first factor involving that KF
         // is created.
 
         o.success = true;
-        return o;
     }
 
+    api_recorder_.recordAddKeyFrame(rec_t0, timestamp, obs.get(), o);
+    journal_.end(journal_t, o.new_kf_id ? o.new_kf_id.value() : INVALID_ID);
+    return o;
+
     MRPT_END
 }
 
@@ -806,9 +1202,21 @@ void ASLAM_gtsam::doAdvertiseUpdatedLocalization(
     MRPT_START
 
     ProfilerEntry tleg(profiler_, "doAdvertiseUpdatedLocalization");
+    TraceScope    trg("doAdvertiseUpdatedLocalization");
+    AllocScope    alg("doAdvertiseUpdatedLocalization");
+    const double  rec_t0 = api_recorder_.now();
 
     ASSERT_(l.timestamp != INVALID_TIMESTAMP);
 
+    // Journaling and applying the call must be atomic w.r.t. checkpoints
+    // and other calls. Without a journal, the front-end must not wait for
+    // spinOnce(), so the solver is not locked:
+    std::unique_lock<decltype(isam2_lock_)> lock(isam2_lock_, std::defer_lock);
+    if (!params_.journal_directory.empty()) lock.lock();
+    const double journal_t = journal_.beginAdvertiseUpdatedLocalization(l);
+
+    BackendJournal::AbortGuard journal_abort(journal_, journal_t);
+
     //
     latest_localization_data_mtx_.lock();
     latest_localization_data_ = l;
@@ -821,7 +1229,35 @@ void ASLAM_gtsam::doAdvertiseUpdatedLocalization(
 
     // Insert into trajectory path?
     if (!params_.save_trajectory_file_prefix.empty())
-        state_.trajectory[l.timestamp] = l;
+        state_.trajectory.push_back(l.timestamp, l.reference_kf, l.pose);
+
+    // Stream to disk, using the current estimate of the reference KF:
+    if (trajectory_writer_.is_open())
+    {
+        mrpt::poses::CPose3D ref_pose;
+        bool                 have_ref_pose = false;
+        {
+            auto lock = lockHelper(vizmap_lock_);
+            if (const auto it = state_.vizmap.nodes.find(l.reference_kf);
+                it != state_.vizmap.nodes.end())
+            {
+                ref_pose      = it->second;
+                have_ref_pose = true;
+            }
+        }
+        if (have_ref_pose)
+        {
+            const auto abs_pose =
+                (ref_pose + mrpt::poses::CPose3D(l.pose)).asTPose();
+
+            std::lock_guard<std::mutex> lck(trajectory_writer_mtx_);
+            trajectory_writer_.appendNonKeyFrame(
+                l.timestamp, l.reference_kf, l.pose, abs_pose);
+        }
+    }
+
+    api_recorder_.recordAdvertiseUpdatedLocalization(rec_t0, l);
+    journal_.end(journal_t);
 
     MRPT_END
 }
@@ -835,6 +1271,9 @@ void ASLAM_gtsam::doUpdateDisplay(std::shared_ptr<DisplayInfo> di)
         using namespace std::string_literals;
 
         ProfilerEntry tleg(profiler_, "doUpdateDisplay");
+        TraceScope    trg("doUpdateDisplay");
+        AllocScope    alg("doUpdateDisplay");
+        TraceRecorder::Instance().setThreadName("ASLAM_gtsam GUI");
 
         if (!display_)
         {
@@ -984,6 +1423,66 @@ void ASLAM_gtsam::doUpdateDisplay(std::shared_ptr<DisplayInfo> di)
     }
 }
 
+void ASLAM_gtsam::write_back(
+    const gtsam::Values& result, const gtsam::KeySet& keys)
+{
+    MRPT_START
+
+    auto lk = lockHelper(keys_map_lock_);
+    std::lock_guard<std::mutex> lck_traj(trajectory_writer_mtx_);
+
+    // Send values to the world model:
+    worldmodel_->entities_lock_for_write();
+
+    for (auto key : keys)
+    {
+        const gtsam::Value& value = result.at(key);
+
+        if (auto it_kf = state_.gtsam2mola[KF_KEY_POSE].find(key);
+            it_kf != state_.gtsam2mola[KF_KEY_POSE].end())
+        {
+            const mola::id_t kf_id   = it_kf->second;
+            gtsam::Pose3     kf_pose = value.cast<gtsam::Pose3>();
+
+            // Dont update the pose of the global reference, fixed to
+            // Identity()
+            if (kf_id != state_.root_kf_id)
+                updateEntityPose(worldmodel_->entity_by_id(kf_id), kf_pose);
+            if (map_writer_) map_writer_->markEntityDirty(kf_id);
+
+            // mapviz:
+            const auto p               = toTPose3D(kf_pose);
+            state_.vizmap.nodes[kf_id] = mrpt::poses::CPose3D(p);
+
+            // Append new KF or pose revision to the output stream:
+            if (trajectory_writer_.is_open() && kf_id != state_.root_kf_id)
+                trajectory_writer_.appendKeyFrame(
+                    mola::entity_get_timestamp(
+                        worldmodel_->entity_by_id(kf_id)),
+                    kf_id, p);
+        }
+        else if (auto it_kf = state_.gtsam2mola[KF_KEY_VEL].find(key);
+                 it_kf != state_.gtsam2mola[KF_KEY_VEL].end())
+        {
+            const mola::id_t kf_id  = it_kf->second;
+            gtsam::Velocity3 kf_vel = value.cast<gtsam::Velocity3>();
+
+            // worldmodel:
+            updateEntityVel(worldmodel_->entity_by_id(kf_id), kf_vel);
+            if (map_writer_) map_writer_->markEntityDirty(kf_id);
+            // mapviz:
+            state_.vizmap_dyn[kf_id].vx = kf_vel.x();
+            state_.vizmap_dyn[kf_id].vy = kf_vel.y();
+            state_.vizmap_dyn[kf_id].vz = kf_vel.z();
+        }
+    }
+    worldmodel_->entities_unlock_for_write();
+
+    trajectory_writer_.flush();
+
+    MRPT_END
+}
+
 void ASLAM_gtsam::mola2gtsam_register_new_kf(const mola::id_t kf_id)
 {
     using namespace gtsam::symbol_shorthand;  // X(), V()
@@ -1036,22 +1535,21 @@ ASLAM_gtsam::whole_path_t ASLAM_gtsam::reconstruct_whole_path() const
     worldmodel_->entities_unlock_for_read();
 
     // 2nd pass: non key-frames:
-    for (const auto& localiz_pts : state_.trajectory)
-    {
-        const auto                                tim = localiz_pts.first;
-        const AdvertiseUpdatedLocalization_Input& li  = localiz_pts.second;
-
-        // if we have a KF for this timestamp, the KF is more trustful since
-        // it underwent optimization:
-        if (path.poses.find(tim) != path.poses.end()) continue;
-
-        // otherwise, we have a non KF: compute its pose wrt some other KF:
-        TPose3D abs_pose;
-        path.poses.at(path.id2time.at(li.reference_kf))
-            .composePose(li.pose, abs_pose);
-
-        path.poses.insert(tim, abs_pose);
-    }
+    state_.trajectory.for_each(
+        [&](const mrpt::Clock::time_point& tim, const mola::id_t ref_kf,
+            const TPose3D& rel_pose) {
+            // if we have a KF for this timestamp, the KF is more trustful
+            // since it underwent optimization:
+            if (path.time2id.count(tim) != 0) return;
+
+            // otherwise, we have a non KF: compute its pose wrt some other
+            // KF:
+            TPose3D abs_pose;
+            path.poses.at(path.id2time.at(ref_kf))
+                .composePose(rel_pose, abs_pose);
+
+            path.poses.insert(tim, abs_pose);
+        });
 
     return path;
     MRPT_END
@@ -1066,16 +1564,98 @@ void ASLAM_gtsam::onQuit()
     using mrpt::poses::CPose3DInterpolator;
     using namespace std::string_literals;
 
+    if (!params_.spin_stats_csv_file.empty())
+    {
+        MRPT_LOG_INFO_STREAM(
+            "Saving per-spin statistics to: " << params_.spin_stats_csv_file);
+        saveSpinStatsCSV(params_.spin_stats_csv_file);
+    }
+    if (!params_.latency_stats_file.empty())
+    {
+        MRPT_LOG_INFO_STREAM(
+            "Saving latency statistics to: " << params_.latency_stats_file);
+        saveLatencyStatsJSON(params_.latency_stats_file);
+    }
+    if (!params_.trace_file.empty())
+    {
+        auto& tr = TraceRecorder::Instance();
+        MRPT_LOG_INFO_STREAM(
+            "Saving trace (" << tr.recorded() << " events, " << tr.dropped()
+                             << " dropped) to: " << params_.trace_file);
+        tr.saveJSON(params_.trace_file);
+    }
+    if (!params_.alloc_stats_file.empty() && AllocProfiler::available())
+    {
+        MRPT_LOG_INFO_STREAM(
+            "Saving allocation statistics to: " << params_.alloc_stats_file);
+        std::ofstream f(params_.alloc_stats_file);
+        if (!f.is_open())
+            THROW_EXCEPTION_FMT(
+                "Cannot write: `%s`", params_.alloc_stats_file.c_str());
+        AllocProfiler::toJSON(f);
+        f << "\n";
+    }
+
+    // A clean shutdown leaves an up-to-date checkpoint and an empty
+    // journal:
+    if (journal_.is_open())
+    {
+        journal_checkpoint(true);
+
+        const auto js = journal_.stats();
+        MRPT_LOG_INFO_FMT(
+            "Journal: %zu records, %zu syncs. Append: %.03f s, fsync: "
+            "%.03f s, %.02f%% of the time of journaled calls.",
+            js.records, js.syncs, js.append_time, js.sync_time,
+            js.overhead_percent());
+        journal_.close();
+    }
+
+    // Until the map is saved, the store file is the only copy of the
+    // keyframe observations. If saving fails, it is kept.
+    if (params_.save_map_at_end) kf_obs_store_.set_delete_on_close(false);
+
     // save Map?
-    if (params_.save_map_at_end)
+    if (params_.save_map_at_end && map_writer_)
+    {
+        const auto mapDir = chunked_map_directory();
+        // Checkpoints saved the dirty chunks elsewhere:
+        if (!params_.journal_directory.empty()) map_writer_->markAllDirty();
+        MRPT_LOG_INFO_STREAM("Saving WorldModel chunked map to: " << mapDir);
+
+        // A failed background save only leaves its chunks dirty:
+        try
+        {
+            map_writer_->wait();
+        }
+        catch (const std::exception& e)
+        {
+            MRPT_LOG_ERROR_STREAM("Background map save failed: " << e.what());
+        }
+
+        const auto st = map_writer_->save(*worldmodel_, mapDir);
+        MRPT_LOG_INFO_FMT(
+            "Map saved in %.03f s: %zu/%zu entity chunks, %zu/%zu factor "
+            "chunks, %.02f MiB written",
+            st.seconds, st.entity_chunks_written, st.entity_chunks_total,
+            st.factor_chunks_written, st.factor_chunks_total,
+            st.bytes_written / (1024.0 * 1024.0));
+    }
+    else if (params_.save_map_at_end)
     {
         // Pass relative path:
         auto mapFil = worldmodel_->map_base_directory();
         mapFil += "/WorldModel.map"s;
 
         MRPT_LOG_INFO_STREAM("Saving WorldModel map to: " << mapFil);
+        // This brings all observations back to RAM, but we are quitting:
+        kf_observations_from_store();
         worldmodel_->map_save_to(mapFil);
     }
+    kf_obs_store_.set_delete_on_close(true);
+
+    if (!params_.checkpoint_file.empty())
+        saveCheckpoint(params_.checkpoint_file);
 
     // save path?
     if (!params_.save_trajectory_file_prefix.empty())
@@ -1104,8 +1684,52 @@ void ASLAM_gtsam::onQuit()
 
     }  // end save path
 
+    {
+        std::lock_guard<std::mutex> lck(trajectory_writer_mtx_);
+        trajectory_writer_.close();
+    }
+    api_recorder_.close();
+
+    if (kf_obs_store_.is_open())
+    {
+        const auto st = kf_obs_store_.stats();
+        MRPT_LOG_INFO_FMT(
+            "Keyframe observations store: %zu KFs, %.02f MiB on disk, "
+            "cache hits=%zu misses=%zu evictions=%zu",
+            kf_obs_store_.size(),
+            kf_obs_store_.file_bytes() / (1024.0 * 1024.0), st.hits,
+            st.misses, st.evictions);
+        kf_obs_store_.close();
+    }
+
     MRPT_END
 }
+gtsam::SharedNoiseModel ASLAM_gtsam::root_prior_noise()
+{
+    const double prior_std_rot = mrpt::DEG2RAD(0.01);  // [rad]
+    const double prior_std_pos = 1e-4;  // [m]
+
+    // Rot, Pos:
+    const gtsam::Vector6 diag_stds =
+        (gtsam::Vector6() << prior_std_rot * gtsam::ones(3, 1),
+         prior_std_pos * gtsam::ones(3, 1))
+            .finished();
+
+    return gtsam::noiseModel::Diagonal::Sigmas(diag_stds);
+}
+
+void ASLAM_gtsam::gtsam_add_root_prior(const mola::id_t root_id)
+{
+    using namespace gtsam::symbol_shorthand;  // X()
+
+    const auto key_root = X(root_id);
+    const auto state0   = gtsam::Pose3::identity();
+
+    state_.newvalues.insert(key_root, state0);
+    state_.newfactors.emplace_shared<gtsam::PriorFactor<gtsam::Pose3>>(
+        key_root, state0, root_prior_noise());
+}
+
 void ASLAM_gtsam::internal_add_gtsam_prior_vel(const mola::id_t kf_id)
 {
     using namespace gtsam::symbol_shorthand;  // X(), V()
@@ -1150,6 +1774,8 @@ void ASLAM_gtsam::onSmartFactorChanged(
     mola::fid_t id, const mola::FactorBase* f)
 {
     MRPT_START
+    TraceScope trg("onSmartFactorChanged");
+    AllocScope alg("onSmartFactorChanged");
 
     MRPT_TODO("Refactor in a more elegant way?");
 
@@ -1172,30 +1798,9 @@ void ASLAM_gtsam::onSmartFactorChanged(
         // process it:
         const auto& last_obs = *all_obs.rbegin();
 
-        const auto sp = gtsam::StereoPoint2(
-            last_obs.pixel_coords.x_left, last_obs.pixel_coords.x_right,
-            last_obs.pixel_coords.y);
-
-        const gtsam::Key pose_key = X(last_obs.observing_kf);
-
-#if 0
-        MRPT_LOG_DEBUG_STREAM(
-            "SmartFactorStereoProjectionPose.add(): fid="
-            << id << " from kf id#" << last_obs.observing_kf);
-#endif
-
-        // Notify iSAM2 that this factor now has new affected Keys:
-        // Only if the factor *already* existed:
-        const auto& mola2gtsam_ids = state_.stereo_factors.ids.mola2gtsam;
-        if (mola2gtsam_ids.count(id) != 0)
-        {
-            const auto gtsam_factor_id = mola2gtsam_ids.at(id);
-            state_.changedSmartFactors[gtsam_factor_id].insert(pose_key);
-        }
-
-        // Actually add observation to factor:
-        state_.stereo_factors.factors.at(id)->add(
-            sp, pose_key, state_.stereo_factors.camera_K);
+        addSmartStereoObservation(
+            id, last_obs.observing_kf, last_obs.pixel_coords.x_left,
+            last_obs.pixel_coords.x_right, last_obs.pixel_coords.y);
     }
     else if (const auto* fstptr = dynamic_cast<const mola::SmartFactorIMU*>(f);
              fstptr != nullptr)
@@ -1266,12 +1871,170 @@ void ASLAM_gtsam::onSmartFactorChanged(
     MRPT_END
 }
 
+std::string ASLAM_gtsam::chunked_map_directory() const
+{
+    return worldmodel_->map_base_directory() + "/WorldModel.chunks";
+}
+
+mrpt::obs::CSensoryFrame::Ptr ASLAM_gtsam::keyframe_observations(
+    const mola::id_t kf)
+{
+    MRPT_START
+
+    if (kf_obs_store_.is_open() && kf_obs_store_.contains(kf))
+        return kf_obs_store_.get(kf);
+
+    mrpt::obs::CSensoryFrame::Ptr sf;
+
+    worldmodel_->entities_lock_for_read();
+    std::visit(
+        overloaded{
+            [&](const mola::RelPose3KF& e) { sf = e.raw_observations_; },
+            [&](const mola::RelDynPose3KF& e) { sf = e.raw_observations_; },
+            []([[maybe_unused]] const auto& e) {},
+        },
+        worldmodel_->entity_by_id(kf));
+    worldmodel_->entities_unlock_for_read();
+
+    return sf;
+
+    MRPT_END
+}
+
+void ASLAM_gtsam::kf_observations_to_store()
+{
+    MRPT_START
+    if (!kf_obs_store_.is_open()) return;
+
+    ProfilerEntry tle(profiler_, "kf_observations_to_store");
+
+    const auto move = [&](const mola::id_t id, auto& kf) {
+        if (!kf.raw_observations_) return;
+        if (!kf_obs_store_.contains(id))
+            kf_obs_store_.put(id, kf.raw_observations_);
+        kf.raw_observations_.reset();
+    };
+
+    worldmodel_->entities_lock_for_write();
+    try
+    {
+        for (const auto id : worldmodel_->entity_all_ids())
+            std::visit(
+                overloaded{
+                    [&](mola::RelPose3KF& kf) { move(id, kf); },
+                    [&](mola::RelDynPose3KF& kf) { move(id, kf); },
+                    []([[maybe_unused]] auto& other) {},
+                },
+                worldmodel_->entity_by_id(id));
+    }
+    catch (...)
+    {
+        worldmodel_->entities_unlock_for_write();
+        throw;
+    }
+    worldmodel_->entities_unlock_for_write();
+
+    MRPT_END
+}
+
+void ASLAM_gtsam::kf_observations_from_store()
+{
+    MRPT_START
+    if (!kf_obs_store_.is_open()) return;
+
+    ProfilerEntry tle(profiler_, "kf_observations_from_store");
+
+    const auto restore = [&](const mola::id_t id, auto& kf) {
+        if (!kf.raw_observations_)
+            kf.raw_observations_ = kf_obs_store_.load(id);
+    };
+
+    worldmodel_->entities_lock_for_write();
+    try
+    {
+        for (const auto id : kf_obs_store_.ids())
+            std::visit(
+                overloaded{
+                    [&](mola::RelPose3KF& kf) { restore(id, kf); },
+                    [&](mola::RelDynPose3KF& kf) { restore(id, kf); },
+                    []([[maybe_unused]] auto& other) {},
+                },
+                worldmodel_->entity_by_id(id));
+    }
+    catch (...)
+    {
+        worldmodel_->entities_unlock_for_write();
+        throw;
+    }
+    worldmodel_->entities_unlock_for_write();
+
+    MRPT_END
+}
+
+void ASLAM_gtsam::addSmartStereoObservation(
+    const mola::fid_t id, const mola::id_t observing_kf, const double x_left,
+    const double x_right, const double y)
+{
+    MRPT_START
+
+    using namespace gtsam::symbol_shorthand;  // X()
+
+    const double rec_t0 = api_recorder_.now();
+    // (isam2_lock_ is held by the caller, see lock_slam())
+    const double journal_t = journal_.beginSmartStereoObservation(
+        id, observing_kf, x_left, x_right, y);
+
+    BackendJournal::AbortGuard journal_abort(journal_, journal_t);
+
+    const auto sp = gtsam::StereoPoint2(x_left, x_right, y);
+
+    const gtsam::Key pose_key = X(observing_kf);
+
+#if 0
+    MRPT_LOG_DEBUG_STREAM(
+        "SmartFactorStereoProjectionPose.add(): fid="
+        << id << " from kf id#" << observing_kf);
+#endif
+
+    pending_arrivals_.push_back(
+        {"SmartStereoObservation", latency_clock_t::now()});
+
+    // Notify iSAM2 that this factor now has new affected Keys:
+    // Only if the factor *already* existed:
+    const auto& mola2gtsam_ids = state_.stereo_factors.ids.mola2gtsam;
+    if (mola2gtsam_ids.count(id) != 0)
+    {
+        const auto gtsam_factor_id = mola2gtsam_ids.at(id);
+        state_.changedSmartFactors[gtsam_factor_id].insert(pose_key);
+    }
+
+    // Actually add observation to factor:
+    state_.stereo_factors.factors.at(id)->add(
+        sp, pose_key, state_.stereo_factors.camera_K);
+
+    // The front-end modified the factor in the world model:
+    if (map_writer_) map_writer_->markFactorDirty(id);
+
+    api_recorder_.recordSmartStereoObservation(
+        rec_t0, id, observing_kf, x_left, x_right, y);
+    journal_.end(journal_t);
+
+    MRPT_END
+}
+
 mola::id_t ASLAM_gtsam::temp_createStereoCamera(
     const mrpt::img::TCamera& left, const mrpt::img::TCamera& right,
     const double baseline)
 {
     MRPT_START
 
+    const double rec_t0 = api_recorder_.now();
+    // (isam2_lock_ is held by the caller, see lock_slam())
+    const double journal_t =
+        journal_.beginDefineStereoCamera(left, right, baseline);
+
+    BackendJournal::AbortGuard journal_abort(journal_, journal_t);
+
     MRPT_TODO("Add into the world-model and get a real entity id");
     mola::id_t cam_K_id = 10000000;
 
@@ -1290,11 +2053,44 @@ mola::id_t ASLAM_gtsam::temp_createStereoCamera(
     state_.stereo_factors.camera_K = gtsam::Cal3_S2Stereo::shared_ptr(
         new gtsam::Cal3_S2Stereo(fx, fy, 0.0, cx, cy, baseline));
 
+    api_recorder_.recordDefineStereoCamera(rec_t0, left, right, baseline);
+    journal_.end(journal_t);
+
     return cam_K_id;
 
     MRPT_END
 }
 
+ASLAM_gtsam::StateSizes ASLAM_gtsam::state_sizes()
+{
+    MRPT_START
+
+    auto lock = lockHelper(isam2_lock_);
+
+    StateSizes s;
+    if (state_.isam2)
+    {
+        s.isam2_factors = state_.isam2->getFactorsUnsafe().nrFactors();
+        s.isam2_cliques = state_.isam2->size();
+    }
+    s.values         = state_.last_values.size();
+    s.time2kf        = state_.time2kf.size();
+    s.trajectory     = state_.trajectory.size();
+    s.stereo_factors = state_.stereo_factors.factors.size();
+    {
+        auto lk = lockHelper(keys_map_lock_);
+        s.kfs   = state_.mola2gtsam.size();
+    }
+    {
+        auto lk        = lockHelper(vizmap_lock_);
+        s.vizmap_nodes = state_.vizmap.nodes.size();
+        s.vizmap_edges = state_.vizmap.edges.size();
+    }
+    return s;
+
+    MRPT_END
+}
+
 void ASLAM_gtsam::lock_slam() { isam2_lock_.lock(); }
 void ASLAM_gtsam::unlock_slam() { isam2_lock_.unlock(); }
 
@@ -1302,11 +2098,18 @@ mola::id_t ASLAM_gtsam::temp_createLandmark(
     const mrpt::math::TPoint3D& init_value)
 {
     MRPT_START
-    //
+
+    const double rec_t0 = api_recorder_.now();
+    // (isam2_lock_ is held by the caller, see lock_slam())
+    const double journal_t = journal_.beginCreateLandmark(init_value);
+
+    BackendJournal::AbortGuard journal_abort(journal_, journal_t);
+
     worldmodel_->entities_lock_for_write();
     mola::LandmarkPoint3 lm;
     auto                 new_id = worldmodel_->entity_emplace_back(lm);
     worldmodel_->entities_unlock_for_write();
+    if (map_writer_) map_writer_->markEntityDirty(new_id);
 
     using namespace gtsam::symbol_shorthand;  // X(), L()
 
@@ -1314,6 +2117,9 @@ mola::id_t ASLAM_gtsam::temp_createLandmark(
 
     state_.newvalues.insert(lm_key, toPoint3(init_value));
 
+    api_recorder_.recordCreateLandmark(rec_t0, init_value, new_id);
+    journal_.end(journal_t, new_id);
+
     return new_id;
 
     MRPT_END
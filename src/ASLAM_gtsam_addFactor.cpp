@@ -23,30 +23,55 @@ BackEndBase::AddFactor_Output ASLAM_gtsam::doAddFactor(Factor& newF)
 {
     MRPT_START
     ProfilerEntry    tleg(profiler_, "doAddFactor");
+    TraceScope       trg("doAddFactor");
+    AllocScope       alg("doAddFactor");
     AddFactor_Output o;
+    const double     rec_t0    = api_recorder_.now();
+    const auto       t_arrival = latency_clock_t::now();
 
-    auto lock = lockHelper(isam2_lock_);
+    auto         lock      = lockHelper(isam2_lock_);
+    const double journal_t = journal_.beginAddFactor(newF);
 
-    mola::fid_t fid = INVALID_FID;
+    BackendJournal::AbortGuard journal_abort(journal_, journal_t);
+
+    mola::fid_t fid  = INVALID_FID;
+    const char* type = nullptr;
 
     std::visit(
         overloaded{
-            [&](const FactorRelativePose3& f) { fid = addFactor(f); },
-            [&](const FactorDynamicsConstVel& f) { fid = addFactor(f); },
-            [&](const FactorStereoProjectionPose& f) { fid = addFactor(f); },
+            [&](const FactorRelativePose3& f) {
+                type = "FactorRelativePose3";
+                fid  = addFactor(f);
+            },
+            [&](const FactorDynamicsConstVel& f) {
+                type = "FactorDynamicsConstVel";
+                fid  = addFactor(f);
+            },
+            [&](const FactorStereoProjectionPose& f) {
+                type = "FactorStereoProjectionPose";
+                fid  = addFactor(f);
+            },
             [&](const SmartFactorStereoProjectionPose& f) {
-                fid = addFactor(f);
+                type = "SmartFactorStereoProjectionPose";
+                fid  = addFactor(f);
+            },
+            [&](const SmartFactorIMU& f) {
+                type = "SmartFactorIMU";
+                fid  = addFactor(f);
             },
-            [&](const SmartFactorIMU& f) { fid = addFactor(f); },
             [this, newF]([[maybe_unused]] auto f) {
                 THROW_EXCEPTION("Unknown factor type!");
             },
         },
         newF);
 
+    pending_arrivals_.push_back({type, t_arrival});
+
     o.success       = true;
     o.new_factor_id = fid;
 
+    api_recorder_.recordAddFactor(rec_t0, newF, o);
+    journal_.end(journal_t, o.new_factor_id);
     return o;
 
     MRPT_END
@@ -57,14 +82,23 @@ fid_t ASLAM_gtsam::addFactor(const FactorRelativePose3& f)
     MRPT_START
     MRPT_LOG_DEBUG("Adding new FactorRelativePose3");
 
+    // A constraint between two maps of the atlas merges them first, so the
+    // code below works with poses in the same frame:
+    if (!state_.loc_smoother)
+    {
+        const auto map_from = atlas_map_of(f.from_kf_);
+        const auto map_to   = atlas_map_of(f.to_kf_);
+        if (map_from != INVALID_ID && map_to != INVALID_ID &&
+            map_from != map_to)
+            atlas_merge(f, map_from, map_to);
+    }
+
     // Add to the WorldModel:
     worldmodel_->factors_lock_for_write();
     const fid_t new_fid = worldmodel_->factor_push_back(f);
+    if (map_writer_) map_writer_->markFactorDirty(new_fid);
     worldmodel_->factors_unlock_for_write();
 
-    // Relative pose:
-    const gtsam::Pose3 measure = toPose3(f.rel_pose_);
-
     // Initial estimation of the new KF:
     mrpt::math::TPose3D to_pose_est;
 
@@ -76,13 +110,17 @@ fid_t ASLAM_gtsam::addFactor(const FactorRelativePose3& f)
     const auto from_pose_est = mola::entity_get_pose(kf_from);
 
     from_pose_est.composePose(f.rel_pose_, to_pose_est);
+    take_initial_guess(f.to_kf_, to_pose_est);
 
     // Store the result just in case we need it as a quick guess in next
     // factors, before running the actual optimizer:
     // Dont update the pose of the global reference, fixed to Identity()
     if (f.to_kf_ != state_.root_kf_id)
+    {
         updateEntityPose(
             worldmodel_->entity_by_id(f.to_kf_), toPose3(to_pose_est));
+        if (map_writer_) map_writer_->markEntityDirty(f.to_kf_);
+    }
 
     worldmodel_->entities_unlock_for_write();
 
@@ -95,27 +133,9 @@ fid_t ASLAM_gtsam::addFactor(const FactorRelativePose3& f)
             f.from_kf_, f.to_kf_, mrpt::poses::CPose3D(to_pose_est));
     }
 
-    // Measure noise model:
-    MRPT_TODO("handle custom noise matrix from input factor");
-
-    const double std_xyz = f.noise_model_diag_xyz_;
-    const double std_ang = f.noise_model_diag_rot_;
-
-    auto noise_relpose = gtsam::noiseModel::Diagonal::Sigmas(
-        (gtsam::Vector6() << std_ang, std_ang, std_ang, std_xyz, std_xyz,
-         std_xyz)
-            .finished());
-
-    MRPT_TODO("robust kernel: make optional");
-    auto robust_noise_model = gtsam::noiseModel::Robust::Create(
-        gtsam::noiseModel::mEstimator::Huber::Create(1.345), noise_relpose);
-
-    const auto to_pose_key   = state_.mola2gtsam.at(f.to_kf_)[KF_KEY_POSE];
-    const auto from_pose_key = state_.mola2gtsam.at(f.from_kf_)[KF_KEY_POSE];
+    const auto to_pose_key = state_.mola2gtsam.at(f.to_kf_)[KF_KEY_POSE];
     // (vel keys may be used or not; declare here for convenience anyway)
     const auto to_vel_key = state_.mola2gtsam.at(f.to_kf_)[KF_KEY_VEL];
-    // const auto from_vel_key =
-    // state_.mola2gtsam.at(f.from_kf_)[KF_KEY_VEL];
 
     // Add to list of initial guess (if not done already with a former
     // factor):
@@ -153,24 +173,7 @@ fid_t ASLAM_gtsam::addFactor(const FactorRelativePose3& f)
     }
 
     // Add relative pose factor:
-    switch (params_.state_vector)
-    {
-        case StateVectorType::SE2:
-            THROW_EXCEPTION("to do!");
-            break;
-        case StateVectorType::SE2Vel:
-            THROW_EXCEPTION("to do!");
-            break;
-
-        case StateVectorType::SE3:
-        case StateVectorType::SE3Vel:
-            state_.newfactors
-                .emplace_shared<gtsam::BetweenFactor<gtsam::Pose3>>(
-                    from_pose_key, to_pose_key, measure, robust_noise_model);
-            break;
-        default:
-            THROW_EXCEPTION("Unhandled state vector type");
-    };
+    gtsam_add_factor(f);
 
     return new_fid;
 
@@ -187,6 +190,7 @@ fid_t ASLAM_gtsam::addFactor(const FactorDynamicsConstVel& f)
     // Add to the WorldModel:
     worldmodel_->factors_lock_for_write();
     const fid_t new_fid = worldmodel_->factor_push_back(f);
+    if (map_writer_) map_writer_->markFactorDirty(new_fid);
     worldmodel_->factors_unlock_for_write();
 
     // Initial estimation of the new KF:
@@ -203,21 +207,23 @@ fid_t ASLAM_gtsam::addFactor(const FactorDynamicsConstVel& f)
 
     MRPT_TODO("Build KF guess from dynamics");
     to_pose_est = from_pose_est;
+    take_initial_guess(f.to_kf_, to_pose_est);
 
     // Store the result just in case we need it as a quick guess in next
     // factors, before running the actual optimizer:
     // Dont update the pose of the global reference, fixed to Identity()
     if (f.to_kf_ != state_.root_kf_id)
+    {
         updateEntityPose(
             worldmodel_->entity_by_id(f.to_kf_), toPose3(to_pose_est));
+        if (map_writer_) map_writer_->markEntityDirty(f.to_kf_);
+    }
 
     worldmodel_->entities_unlock_for_write();
 
-    const auto to_pose_key   = state_.mola2gtsam.at(f.to_kf_)[KF_KEY_POSE];
-    const auto from_pose_key = state_.mola2gtsam.at(f.from_kf_)[KF_KEY_POSE];
+    const auto to_pose_key = state_.mola2gtsam.at(f.to_kf_)[KF_KEY_POSE];
     // (vel keys may be used or not; declare here for convenience anyway)
-    const auto to_vel_key   = state_.mola2gtsam.at(f.to_kf_)[KF_KEY_VEL];
-    const auto from_vel_key = state_.mola2gtsam.at(f.from_kf_)[KF_KEY_VEL];
+    const auto to_vel_key = state_.mola2gtsam.at(f.to_kf_)[KF_KEY_VEL];
 
     // Add to list of initial guess (if not done already with a former
     // factor):
@@ -255,46 +261,7 @@ fid_t ASLAM_gtsam::addFactor(const FactorDynamicsConstVel& f)
     }
 
     // Add const-vel factor to gtsam itself:
-    switch (params_.state_vector)
-    {
-        case StateVectorType::SE3Vel:
-        {
-            const double dt = mrpt::system::timeDifference(from_tim, to_tim);
-            ASSERT_(dt > 0);
-
-            // errors in constant vel:
-            const double std_pos = params_.const_vel_model_std_pos;
-            const double std_vel = params_.const_vel_model_std_vel;
-
-            const gtsam::Vector6 diag_stds =
-                (gtsam::Vector6() << std_pos, std_pos, std_pos, std_vel,
-                 std_vel, std_vel)
-                    .finished();
-
-            auto noise_velModel =
-                gtsam::noiseModel::Diagonal::Sigmas(diag_stds);
-
-            if (dt > 10.0)
-            {
-                MRPT_LOG_WARN_FMT(
-                    "A constant-time velocity factor has been added for "
-                    "KFs "
-                    "too far-away in time: dT=%.03f s. Adding it, anyway, "
-                    "as "
-                    "requested.",
-                    dt);
-            }
-
-            state_.newfactors.emplace_shared<mola::ConstVelocityFactorSE3>(
-                from_pose_key, from_vel_key, to_pose_key, to_vel_key, dt,
-                noise_velModel);
-        }
-        break;
-
-        default:
-            // Ignore dynamics
-            break;
-    };
+    gtsam_add_factor(f, mrpt::system::timeDifference(from_tim, to_tim));
 
     return new_fid;
 
@@ -306,9 +273,17 @@ fid_t ASLAM_gtsam::addFactor(const SmartFactorStereoProjectionPose& f)
     MRPT_START
     // MRPT_LOG_DEBUG("Adding new SmartFactorStereoProjectionPose");
 
+    // Its observations would straddle the sliding window boundary, and
+    // those of marginalized KFs would be lost:
+    ASSERTMSG_(
+        !state_.loc_smoother,
+        "SmartFactorStereoProjectionPose is not supported in "
+        "`localization_only` mode");
+
     // Add to the WorldModel:
     worldmodel_->factors_lock_for_write();
     const fid_t new_fid = worldmodel_->factor_push_back(f);
+    if (map_writer_) map_writer_->markFactorDirty(new_fid);
     worldmodel_->factors_unlock_for_write();
 
     MRPT_TODO("Take noise params from f");
@@ -342,6 +317,7 @@ fid_t ASLAM_gtsam::addFactor(const SmartFactorIMU& f)
     // Add to the WorldModel:
     worldmodel_->factors_lock_for_write();
     const fid_t new_fid = worldmodel_->factor_push_back(f);
+    if (map_writer_) map_writer_->markFactorDirty(new_fid);
 
     {
         Factor&               fa = worldmodel_->factor_by_id(new_fid);
@@ -366,6 +342,7 @@ fid_t ASLAM_gtsam::addFactor(const FactorStereoProjectionPose& f)
     // Add to the WorldModel:
     worldmodel_->factors_lock_for_write();
     const fid_t new_fid = worldmodel_->factor_push_back(f);
+    if (map_writer_) map_writer_->markFactorDirty(new_fid);
     worldmodel_->factors_unlock_for_write();
 
     MRPT_TODO("Take noise params from f");
@@ -396,3 +373,107 @@ fid_t ASLAM_gtsam::addFactor(const FactorStereoProjectionPose& f)
 
     MRPT_END
 }
+
+// isam2_lock_ is locked from the caller site.
+void ASLAM_gtsam::gtsam_add_factor(const FactorRelativePose3& f)
+{
+    MRPT_START
+
+    const gtsam::Pose3 measure = toPose3(f.rel_pose_);
+
+    // Measure noise model:
+    MRPT_TODO("handle custom noise matrix from input factor");
+
+    const double std_xyz = f.noise_model_diag_xyz_;
+    const double std_ang = f.noise_model_diag_rot_;
+
+    auto noise_relpose = gtsam::noiseModel::Diagonal::Sigmas(
+        (gtsam::Vector6() << std_ang, std_ang, std_ang, std_xyz, std_xyz,
+         std_xyz)
+            .finished());
+
+    MRPT_TODO("robust kernel: make optional");
+    auto robust_noise_model = gtsam::noiseModel::Robust::Create(
+        gtsam::noiseModel::mEstimator::Huber::Create(1.345), noise_relpose);
+
+    const auto to_pose_key   = state_.mola2gtsam.at(f.to_kf_)[KF_KEY_POSE];
+    const auto from_pose_key = state_.mola2gtsam.at(f.from_kf_)[KF_KEY_POSE];
+
+    switch (params_.state_vector)
+    {
+        case StateVectorType::SE2:
+            THROW_EXCEPTION("to do!");
+            break;
+        case StateVectorType::SE2Vel:
+            THROW_EXCEPTION("to do!");
+            break;
+
+        case StateVectorType::SE3:
+        case StateVectorType::SE3Vel:
+            state_.newfactors
+                .emplace_shared<gtsam::BetweenFactor<gtsam::Pose3>>(
+                    from_pose_key, to_pose_key, measure, robust_noise_model);
+            break;
+        default:
+            THROW_EXCEPTION("Unhandled state vector type");
+    };
+
+    MRPT_END
+}
+
+// isam2_lock_ is locked from the caller site.
+void ASLAM_gtsam::gtsam_add_factor(
+    const FactorDynamicsConstVel& f, const double dt)
+{
+    MRPT_START
+
+    switch (params_.state_vector)
+    {
+        case StateVectorType::SE3Vel:
+        {
+            ASSERT_(dt > 0);
+
+            const auto to_pose_key =
+                state_.mola2gtsam.at(f.to_kf_)[KF_KEY_POSE];
+            const auto from_pose_key =
+                state_.mola2gtsam.at(f.from_kf_)[KF_KEY_POSE];
+            const auto to_vel_key = state_.mola2gtsam.at(f.to_kf_)[KF_KEY_VEL];
+            const auto from_vel_key =
+                state_.mola2gtsam.at(f.from_kf_)[KF_KEY_VEL];
+
+            // errors in constant vel:
+            const double std_pos = params_.const_vel_model_std_pos;
+            const double std_vel = params_.const_vel_model_std_vel;
+
+            const gtsam::Vector6 diag_stds =
+                (gtsam::Vector6() << std_pos, std_pos, std_pos, std_vel,
+                 std_vel, std_vel)
+                    .finished();
+
+            auto noise_velModel =
+                gtsam::noiseModel::Diagonal::Sigmas(diag_stds);
+
+            if (dt > 10.0)
+            {
+                MRPT_LOG_WARN_FMT(
+                    "A constant-time velocity factor has been added for "
+                    "KFs "
+                    "too far-away in time: dT=%.03f s. Adding it, anyway, "
+                    "as "
+                    "requested.",
+                    dt);
+            }
+
+            state_.newfactors.emplace_shared<mola::ConstVelocityFactorSE3>(
+                from_pose_key, from_vel_key, to_pose_key, to_vel_key, dt,
+                noise_velModel);
+        }
+        break;
+
+        default:
+            // Ignore dynamics
+            break;
+    };
+
+    MRPT_END
+}
@@ -0,0 +1,296 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @file   ASLAM_gtsam_atlas.cpp
+ * @brief  SLAM in absolute coordinates with GTSAM: multi-map atlas
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 20, 2019
+ */
+
+#include <gtsam/inference/Symbol.h>  // X(), V() symbols
+#include <gtsam/slam/PriorFactor.h>
+#include <mola-kernel/entities/entities-common.h>
+#include <mola-kernel/lock_helper.h>
+#include <mola-kernel/variant_helper.h>  // overloaded{}
+#include <mola-slam-gtsam/ASLAM_gtsam.h>
+#include <mola-slam-gtsam/gtsam_mola_bridge.h>
+
+using namespace mola;
+
+namespace
+{
+/** Root of the map `e` belongs to, see ASLAM_gtsam::atlas_map_of() */
+mola::id_t entityMapRoot(const mola::id_t id, const mola::Entity& e)
+{
+    mola::id_t root = mola::INVALID_ID;
+    std::visit(
+        overloaded{
+            [&](const RefPose3&) { root = id; },
+            [&](const RelPose3KF& kf) { root = kf.base_id_; },
+            [&](const RelDynPose3KF& kf) { root = kf.base_id_; },
+            []([[maybe_unused]] const auto& other) {},
+        },
+        e);
+    return root;
+}
+}  // namespace
+
+void ASLAM_gtsam::startNewMap()
+{
+    MRPT_START
+
+    ASSERTMSG_(
+        !params_.localization_only,
+        "startNewMap() is not available in `localization_only` mode");
+
+    const double rec_t0    = api_recorder_.now();
+    auto         lock      = lockHelper(isam2_lock_);
+    const double journal_t = journal_.beginStartNewMap();
+
+    BackendJournal::AbortGuard journal_abort(journal_, journal_t);
+
+    // Before the first KF, there is nothing to separate from:
+    if (state_.root_kf_id != INVALID_ID)
+    {
+        state_.new_map_requested = true;
+        MRPT_LOG_INFO("Atlas: the next keyframe starts a new map.");
+    }
+
+    api_recorder_.recordStartNewMap(rec_t0);
+    journal_.end(journal_t);
+
+    MRPT_END
+}
+
+std::size_t ASLAM_gtsam::atlas_map_count()
+{
+    MRPT_START
+
+    auto lock = lockHelper(isam2_lock_);
+    auto lk   = lockHelper(keys_map_lock_);
+
+    std::set<mola::id_t> roots;
+    worldmodel_->entities_lock_for_read();
+    for (const auto& m2g : state_.mola2gtsam)
+    {
+        const auto& e = worldmodel_->entity_by_id(m2g.first);
+        // Roots of merged maps have no keyframes left:
+        if (!std::holds_alternative<RefPose3>(e))
+            roots.insert(entityMapRoot(m2g.first, e));
+    }
+    worldmodel_->entities_unlock_for_read();
+
+    return roots.size();
+
+    MRPT_END
+}
+
+mola::id_t ASLAM_gtsam::atlas_map_of(const mola::id_t id)
+{
+    worldmodel_->entities_lock_for_read();
+    const auto root = entityMapRoot(id, worldmodel_->entity_by_id(id));
+    worldmodel_->entities_unlock_for_read();
+    return root;
+}
+
+void ASLAM_gtsam::atlas_merge(
+    const FactorRelativePose3& f, const mola::id_t map_from,
+    const mola::id_t map_to)
+{
+    MRPT_START
+    ProfilerEntry tleg(profiler_, "atlas_merge");
+
+    using namespace gtsam::symbol_shorthand;  // X(), V()
+
+    const auto t0 = mrpt::Clock::now();
+
+    // The oldest map keeps its reference frame:
+    const bool       move_to = map_from < map_to;
+    const mola::id_t keep    = move_to ? map_from : map_to;
+    const mola::id_t moved   = move_to ? map_to : map_from;
+
+    auto lock_viz = lockHelper(vizmap_lock_);
+    auto lk       = lockHelper(keys_map_lock_);
+
+    // Whole graph and current estimate, solved and pending parts:
+    gtsam::NonlinearFactorGraph        graph;
+    gtsam::Values                      values;
+    std::map<std::size_t, std::size_t> isam2graph;  // iSAM2 idx => graph
+    if (state_.isam2)
+    {
+        const auto& factors = state_.isam2->getFactorsUnsafe();
+        // (Including outdated priors from other robots, see
+        // separator_receive())
+        const std::set<std::size_t> removed(
+            separators_.to_remove.begin(), separators_.to_remove.end());
+        for (std::size_t i = 0; i < factors.size(); i++)
+        {
+            if (!factors[i] || removed.count(i) != 0) continue;
+            isam2graph[i] = graph.size();
+            graph.push_back(factors[i]);
+        }
+        values = state_.isam2->calculateEstimate();
+    }
+    const std::size_t first_pending = graph.size();
+    graph.push_back(state_.newfactors);
+    for (const auto kv : state_.newvalues)
+        if (!values.exists(kv.key)) values.insert(kv.key, kv.value);
+
+    // Keyframes of the map to be moved:
+    std::vector<mola::id_t> moved_kfs;
+    worldmodel_->entities_lock_for_read();
+    for (const auto& m2g : state_.mola2gtsam)
+    {
+        const auto id = m2g.first;
+        if (entityMapRoot(id, worldmodel_->entity_by_id(id)) == moved)
+            moved_kfs.push_back(id);
+    }
+    const auto poseOf = [&](const mola::id_t id) {
+        if (values.exists(X(id))) return values.at<gtsam::Pose3>(X(id));
+        return toPose3(mola::entity_get_pose(worldmodel_->entity_by_id(id)));
+    };
+    const gtsam::Pose3 p_from = poseOf(f.from_kf_), p_to = poseOf(f.to_kf_);
+    worldmodel_->entities_unlock_for_read();
+
+    // Rigid alignment: pose of the moved map frame in the kept one, such
+    // that `f` holds exactly with the current estimates.
+    const gtsam::Pose3 rel = toPose3(f.rel_pose_);
+    const gtsam::Pose3 T =
+        move_to ? p_from.compose(rel).compose(p_to.inverse())
+                : p_to.compose(rel.inverse()).compose(p_from.inverse());
+
+    for (const auto id : moved_kfs)
+    {
+        if (values.exists(X(id)))
+            values.update(X(id), T.compose(values.at<gtsam::Pose3>(X(id))));
+        // Velocities are in the map frame too:
+        if (values.exists(V(id)))
+            values.update(
+                V(id), gtsam::Velocity3(T.rotation().rotate(
+                           values.at<gtsam::Velocity3>(V(id)))));
+    }
+
+    // The moved root is not fixed anymore: drop its prior.
+    gtsam::NonlinearFactorGraph        merged;
+    std::map<std::size_t, std::size_t> graph2merged;
+    for (std::size_t i = 0; i < graph.size(); i++)
+    {
+        const auto prior =
+            boost::dynamic_pointer_cast<gtsam::PriorFactor<gtsam::Pose3>>(
+                graph[i]);
+        if (prior && prior->key() == X(moved)) continue;
+        graph2merged[i] = merged.size();
+        merged.push_back(graph[i]);
+    }
+
+    // Single batch re-solve of the merged graph:
+    auto& ids = state_.stereo_factors.ids;
+    if (state_.isam2)
+    {
+        ProfilerEntry tle(profiler_, "atlas_merge.isam2_batch");
+
+        auto isam2 = std::make_unique<gtsam::ISAM2>(state_.isam2->params());
+        const auto res = isam2->update(merged, values);
+        state_.isam2   = std::move(isam2);
+
+        // Smart factors got new indices:
+        const auto newIndex = [&](const std::size_t graph_idx) {
+            return res.newFactorsIndices.at(graph2merged.at(graph_idx));
+        };
+        TriMap<std::size_t> new_ids;
+        for (const auto& g2m : ids.gtsam2mola)
+        {
+            const auto it = isam2graph.find(g2m.first);
+            if (it == isam2graph.end()) continue;
+            const auto gtsam_id            = newIndex(it->second);
+            new_ids.gtsam2mola[gtsam_id]   = g2m.second;
+            new_ids.mola2gtsam[g2m.second] = gtsam_id;
+        }
+        for (const auto& n2m : state_.newFactor2molaid)
+        {
+            const auto gtsam_id = newIndex(first_pending + n2m.first);
+            new_ids.gtsam2mola[gtsam_id]   = n2m.second;
+            new_ids.mola2gtsam[n2m.second] = gtsam_id;
+        }
+        ids = std::move(new_ids);
+
+        for (const auto kv : state_.newvalues)
+        {
+            const auto& g2m = state_.gtsam2mola[KF_KEY_POSE];
+            if (auto it_kf = g2m.find(kv.key); it_kf != g2m.end())
+                state_.kf_has_value.insert(it_kf->second);
+        }
+
+        state_.last_values = state_.isam2->calculateEstimate();
+        state_.newfactors.resize(0);
+        state_.newvalues.clear();
+        state_.changedSmartFactors.clear();
+        state_.newFactor2molaid.clear();
+
+        separators_.to_remove.clear();
+        if (separators_.channel.is_open()) separator_reindex();
+    }
+    else
+    {
+        // Lev-Marq. re-solves the whole graph in the next spinOnce() anyway
+        std::map<std::size_t, mola::fid_t> newFactor2molaid;
+        for (const auto& n2m : state_.newFactor2molaid)
+            newFactor2molaid[graph2merged.at(first_pending + n2m.first)] =
+                n2m.second;
+
+        state_.newfactors       = std::move(merged);
+        state_.newvalues        = values;
+        state_.last_values      = values;
+        state_.newFactor2molaid = std::move(newFactor2molaid);
+    }
+
+    // Update the WorldModel: all KFs may have moved after the re-solve, and
+    // moved ones now belong to the kept map.
+    worldmodel_->entities_lock_for_write();
+    for (const auto& m2g : state_.mola2gtsam)
+    {
+        const auto id = m2g.first;
+        auto&      e  = worldmodel_->entity_by_id(id);
+        if (std::holds_alternative<RefPose3>(e)) continue;
+
+        const bool was_moved =
+            std::binary_search(moved_kfs.begin(), moved_kfs.end(), id);
+        if (!was_moved && !state_.isam2) continue;
+
+        if (state_.last_values.exists(X(id)))
+        {
+            const auto p = state_.last_values.at<gtsam::Pose3>(X(id));
+            updateEntityPose(e, p);
+            state_.vizmap.nodes[id] = mrpt::poses::CPose3D(toTPose3D(p));
+        }
+        if (state_.last_values.exists(V(id)))
+            updateEntityVel(e, state_.last_values.at<gtsam::Velocity3>(V(id)));
+
+        if (was_moved)
+            std::visit(
+                overloaded{
+                    [&](RelPose3KF& kf) { kf.base_id_ = keep; },
+                    [&](RelDynPose3KF& kf) { kf.base_id_ = keep; },
+                    []([[maybe_unused]] auto& other) {},
+                },
+                e);
+
+        if (map_writer_) map_writer_->markEntityDirty(id);
+    }
+    worldmodel_->entities_unlock_for_write();
+    state_.vizmap.nodes[moved] = mrpt::poses::CPose3D(toTPose3D(T));
+
+    if (state_.root_kf_id == moved) state_.root_kf_id = keep;
+
+    MRPT_LOG_INFO_FMT(
+        "Atlas: merged map #%lu (%zu keyframes) into map #%lu in %.03f s",
+        static_cast<unsigned long>(moved), moved_kfs.size() - 1,
+        static_cast<unsigned long>(keep),
+        mrpt::system::timeDifference(t0, mrpt::Clock::now()));
+
+    MRPT_END
+}
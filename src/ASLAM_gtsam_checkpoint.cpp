@@ -0,0 +1,273 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @file   ASLAM_gtsam_checkpoint.cpp
+ * @brief  SLAM in absolute coordinates with GTSAM: solver checkpoints
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 18, 2019
+ */
+
+#include <mola-kernel/lock_helper.h>
+#include <mola-slam-gtsam/ASLAM_gtsam.h>
+#include <mola-slam-gtsam/gtsam_mola_bridge.h>
+
+using namespace mola;
+
+void ASLAM_gtsam::saveCheckpoint(const std::string& file)
+{
+    MRPT_START
+    ProfilerEntry tleg(profiler_, "saveCheckpoint");
+
+    const auto t0 = mrpt::Clock::now();
+
+    const SolverCheckpoint cp     = take_checkpoint();
+    const std::size_t      nbytes = writeSolverCheckpoint(cp, file);
+
+    MRPT_LOG_INFO_FMT(
+        "Checkpoint saved to `%s`: %zu factors, %zu variables, %.02f MiB "
+        "in %.03f s",
+        file.c_str(), cp.num_factors, cp.num_variables,
+        nbytes / (1024.0 * 1024.0),
+        mrpt::system::timeDifference(t0, mrpt::Clock::now()));
+
+    MRPT_END
+}
+
+void ASLAM_gtsam::loadCheckpoint(const std::string& file)
+{
+    MRPT_START
+    ProfilerEntry tleg(profiler_, "loadCheckpoint");
+
+    const auto t0 = mrpt::Clock::now();
+
+    ASSERTMSG_(
+        state_.isam2 && !state_.loc_smoother,
+        "Checkpoints require `use_incremental_solver` and are not "
+        "available in `localization_only` mode");
+
+    SolverCheckpoint cp;
+    {
+        auto lock = lockHelper(isam2_lock_);
+        ASSERTMSG_(
+            state_.root_kf_id == INVALID_ID,
+            "loadCheckpoint() must be called before adding keyframes");
+
+        ProfilerEntry tle(profiler_, "loadCheckpoint.read");
+        readSolverCheckpoint(file, cp, *state_.isam2);
+    }
+    restore_checkpoint(cp);
+
+    MRPT_LOG_INFO_FMT(
+        "Checkpoint restored from `%s`: %zu factors, %zu variables in "
+        "%.03f s",
+        file.c_str(), cp.num_factors, cp.num_variables,
+        mrpt::system::timeDifference(t0, mrpt::Clock::now()));
+
+    MRPT_END
+}
+
+SolverCheckpoint ASLAM_gtsam::take_checkpoint(const bool defer_isam2)
+{
+    MRPT_START
+    ProfilerEntry tleg(profiler_, "take_checkpoint");
+
+    ASSERTMSG_(
+        state_.isam2 && !state_.loc_smoother,
+        "Checkpoints require `use_incremental_solver` and are not "
+        "available in `localization_only` mode");
+
+    auto lock     = lockHelper(isam2_lock_);
+    auto lock_viz = lockHelper(vizmap_lock_);
+    auto lk       = lockHelper(keys_map_lock_);
+
+    SolverCheckpoint cp;
+
+    // Smart factors are modified in place as new observations arrive, so
+    // the iSAM2 state is serialized (or copied with its smart factors
+    // cloned) right away, and pending ones are cloned:
+    std::map<const gtsam::NonlinearFactor*, mola::fid_t> smart_fids;
+    for (const auto& id_f : state_.stereo_factors.factors)
+        smart_fids[id_f.second.get()] = id_f.first;
+
+    const auto copyFactor = [&](const gtsam::NonlinearFactor::shared_ptr& f,
+                                mola::fid_t& smart_fid) {
+        smart_fid = mola::INVALID_FID;
+        if (const auto it = smart_fids.find(f.get()); it != smart_fids.end())
+        {
+            smart_fid = it->second;
+            return gtsam::NonlinearFactor::shared_ptr(
+                boost::make_shared<gtsam::SmartStereoProjectionPoseFactor>(
+                    *state_.stereo_factors.factors.at(smart_fid)));
+        }
+        return f;
+    };
+
+    // iSAM2 state, Bayes tree included. Factor indices are kept as they
+    // are, null (removed) entries too:
+    if (defer_isam2)
+    {
+        ProfilerEntry tle(profiler_, "take_checkpoint.isam2_snapshot");
+        cp.isam2_snapshot = snapshotISAM2(
+            *state_.isam2, [&](const gtsam::NonlinearFactor::shared_ptr& f) {
+                mola::fid_t smart_fid;
+                return copyFactor(f, smart_fid);
+            });
+    }
+    else
+    {
+        ProfilerEntry tle(profiler_, "take_checkpoint.isam2");
+        cp.isam2 = serializeISAM2(*state_.isam2);
+    }
+    cp.num_factors   = state_.isam2->getFactorsUnsafe().nrFactors();
+    cp.num_variables = state_.isam2->getLinearizationPoint().size();
+
+    const auto& factors = state_.isam2->getFactorsUnsafe();
+    for (std::size_t i = 0; i < factors.size(); i++)
+        if (const auto it = smart_fids.find(factors[i].get());
+            factors[i] && it != smart_fids.end())
+            cp.smart_in_graph[it->second] = i;
+    for (const auto& g2m : state_.stereo_factors.ids.gtsam2mola)
+        cp.smart_ids[g2m.first] = g2m.second;
+
+    // Pending factors:
+    for (std::size_t i = 0; i < state_.newfactors.size(); i++)
+    {
+        mola::fid_t smart_fid;
+        cp.newfactors.push_back(copyFactor(state_.newfactors[i], smart_fid));
+        if (smart_fid != mola::INVALID_FID)
+            cp.smart_in_newfactors[smart_fid] = i;
+    }
+    cp.newvalues        = state_.newvalues;
+    cp.newFactor2molaid = state_.newFactor2molaid;
+    for (const auto& idx_keys : state_.changedSmartFactors)
+        cp.changedSmartFactors[idx_keys.first].assign(
+            idx_keys.second.begin(), idx_keys.second.end());
+
+    if (state_.stereo_factors.camera_K)
+    {
+        cp.has_camera_K = true;
+        cp.camera_K     = *state_.stereo_factors.camera_K;
+    }
+
+    // ID maps and bookkeeping:
+    for (const auto& m2g : state_.mola2gtsam) cp.kfs.push_back(m2g.first);
+    cp.kf_has_value              = state_.kf_has_value;
+    cp.root_kf_id                = state_.root_kf_id;
+    cp.last_created_kf_id        = state_.last_created_kf_id;
+    cp.former_last_created_kf_id = state_.former_last_created_kf_id;
+    cp.has_last_created_kf_id_tim =
+        (state_.last_created_kf_id_tim != INVALID_TIMESTAMP);
+    cp.last_created_kf_id_tim =
+        state_.last_created_kf_id_tim.time_since_epoch().count();
+
+    for (const auto& t2k : state_.time2kf)
+        cp.time2kf[t2k.first.time_since_epoch().count()] = t2k.second;
+
+    // Visualization:
+    for (const auto& n : state_.vizmap.nodes)
+        cp.viz_nodes[n.first] = toPose3(n.second.asTPose());
+    for (const auto& e : state_.vizmap.edges)
+    {
+        cp.viz_edge_from.push_back(e.first.first);
+        cp.viz_edge_to.push_back(e.first.second);
+        cp.viz_edge_pose.push_back(toPose3(e.second.asTPose()));
+    }
+    for (const auto& d : state_.vizmap_dyn)
+        cp.viz_dyn[d.first] = {d.second.vx, d.second.vy, d.second.vz,
+                               d.second.wx, d.second.wy, d.second.wz};
+
+    return cp;
+
+    MRPT_END
+}
+
+void ASLAM_gtsam::restore_checkpoint(const SolverCheckpoint& cp)
+{
+    MRPT_START
+    ProfilerEntry tleg(profiler_, "restore_checkpoint");
+
+    ASSERTMSG_(
+        state_.isam2 && !state_.loc_smoother,
+        "Checkpoints require `use_incremental_solver` and are not "
+        "available in `localization_only` mode");
+
+    auto lock     = lockHelper(isam2_lock_);
+    auto lock_viz = lockHelper(vizmap_lock_);
+
+    ASSERTMSG_(
+        state_.root_kf_id == INVALID_ID,
+        "restore_checkpoint() must be called before adding keyframes");
+
+    for (const auto kf : cp.kfs) mola2gtsam_register_new_kf(kf);
+
+    // The iSAM2 state, Bayes tree included, was already restored by
+    // readSolverCheckpoint(): no elimination is needed.
+    state_.last_values = state_.isam2->calculateEstimate();
+
+    // Smart factors (and their IDs) now live in the restored graph, at
+    // the same indices:
+    auto&       sf      = state_.stereo_factors;
+    const auto& factors = state_.isam2->getFactorsUnsafe();
+    for (const auto& fid_idx : cp.smart_in_graph)
+        sf.factors[fid_idx.first] =
+            boost::dynamic_pointer_cast<gtsam::SmartStereoProjectionPoseFactor>(
+                factors.at(fid_idx.second));
+    for (const auto& [idx, fid] : cp.smart_ids)
+    {
+        sf.ids.gtsam2mola[idx] = fid;
+        sf.ids.mola2gtsam[fid] = idx;
+    }
+    if (cp.has_camera_K)
+        sf.camera_K = boost::make_shared<gtsam::Cal3_S2Stereo>(cp.camera_K);
+
+    // Pending factors:
+    state_.newfactors       = cp.newfactors;
+    state_.newvalues        = cp.newvalues;
+    state_.newFactor2molaid = cp.newFactor2molaid;
+    for (const auto& fid_idx : cp.smart_in_newfactors)
+        sf.factors[fid_idx.first] =
+            boost::dynamic_pointer_cast<gtsam::SmartStereoProjectionPoseFactor>(
+                state_.newfactors.at(fid_idx.second));
+    for (const auto& idx_keys : cp.changedSmartFactors)
+        state_.changedSmartFactors[idx_keys.first].insert(
+            idx_keys.second.begin(), idx_keys.second.end());
+
+    // Bookkeeping:
+    state_.kf_has_value              = cp.kf_has_value;
+    state_.root_kf_id                = cp.root_kf_id;
+    state_.last_created_kf_id        = cp.last_created_kf_id;
+    state_.former_last_created_kf_id = cp.former_last_created_kf_id;
+    if (cp.has_last_created_kf_id_tim)
+        state_.last_created_kf_id_tim = mrpt::Clock::time_point(
+            mrpt::Clock::duration(cp.last_created_kf_id_tim));
+
+    for (const auto& t2k : cp.time2kf)
+        state_.time2kf[mrpt::Clock::time_point(
+            mrpt::Clock::duration(t2k.first))] = t2k.second;
+
+    // Visualization:
+    for (const auto& n : cp.viz_nodes)
+        state_.vizmap.nodes[n.first] =
+            mrpt::poses::CPose3D(toTPose3D(n.second));
+    for (std::size_t i = 0; i < cp.viz_edge_pose.size(); i++)
+        state_.vizmap.insertEdgeAtEnd(
+            cp.viz_edge_from.at(i), cp.viz_edge_to.at(i),
+            mrpt::poses::CPose3D(toTPose3D(cp.viz_edge_pose[i])));
+    for (const auto& d : cp.viz_dyn)
+    {
+        ASSERT_EQUAL_(d.second.size(), 6U);
+        auto& tw = state_.vizmap_dyn[d.first];
+        tw.vx    = d.second[0];
+        tw.vy    = d.second[1];
+        tw.vz    = d.second[2];
+        tw.wx    = d.second[3];
+        tw.wy    = d.second[4];
+        tw.wz    = d.second[5];
+    }
+
+    MRPT_END
+}
@@ -0,0 +1,216 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   ASLAM_gtsam_factor_costs.cpp
+ * @brief  ASLAM_gtsam: linearization and elimination cost per factor kind
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 20, 2019
+ */
+
+#include <gtsam/navigation/NavState.h>  // Velocity3
+#include <gtsam/slam/BetweenFactor.h>
+#include <gtsam/slam/PriorFactor.h>
+#include <gtsam/slam/StereoFactor.h>
+#include <gtsam_unstable/slam/SmartStereoProjectionPoseFactor.h>
+#include <mola-slam-gtsam/ASLAM_gtsam.h>
+#include <mola-slam-gtsam/ConstVelocityFactorSE3.h>
+
+#include <algorithm>
+#include <set>
+
+using namespace mola;
+
+namespace
+{
+using FactorKind = ASLAM_gtsam::FactorKind;
+
+constexpr auto NUM_KINDS = static_cast<std::size_t>(FactorKind::Count);
+
+FactorKind factor_kind(const gtsam::NonlinearFactor& f)
+{
+    if (dynamic_cast<const gtsam::BetweenFactor<gtsam::Pose3>*>(&f))
+        return FactorKind::RelativePose3;
+    if (dynamic_cast<const ConstVelocityFactorSE3*>(&f))
+        return FactorKind::ConstVelocity;
+    if (dynamic_cast<const gtsam::GenericStereoFactor<
+            gtsam::Pose3, gtsam::Point3>*>(&f))
+        return FactorKind::StereoProjection;
+    if (dynamic_cast<const gtsam::SmartStereoProjectionPoseFactor*>(&f))
+        return FactorKind::SmartStereo;
+    if (dynamic_cast<const gtsam::PriorFactor<gtsam::Pose3>*>(&f) ||
+        dynamic_cast<const gtsam::PriorFactor<gtsam::Velocity3>*>(&f))
+        return FactorKind::Prior;
+    return FactorKind::Other;
+}
+
+std::size_t kind_index(const gtsam::NonlinearFactor& f)
+{
+    return static_cast<std::size_t>(factor_kind(f));
+}
+
+/** Gives access to the triangulation cache of smart stereo factors */
+struct SmartStereoCache : gtsam::SmartStereoProjectionPoseFactor
+{
+    /** Forgets the poses of the last triangulation, so the next
+     * linearization triangulates again */
+    static void clear(gtsam::SmartStereoProjectionPoseFactor& f)
+    {
+        (f.*(&SmartStereoCache::cameraPosesTriangulation_)).clear();
+    }
+};
+
+/** Linearizes `f` at `theta`, as a full relinearization would. A smart
+ * factor skips triangulation if its poses did not change since the last
+ * time, so a copy without that cache is linearized instead. */
+void linearize_uncached(
+    const gtsam::NonlinearFactor& f, const gtsam::Values& theta)
+{
+    if (const auto* smart =
+            dynamic_cast<const gtsam::SmartStereoProjectionPoseFactor*>(&f))
+    {
+        gtsam::SmartStereoProjectionPoseFactor copy(*smart);
+        SmartStereoCache::clear(copy);
+        copy.linearize(theta);
+        return;
+    }
+    f.linearize(theta);
+}
+
+/** Dimension of the variables [first,last) */
+template <class IT>
+double dims(const gtsam::Values& theta, IT first, const IT last)
+{
+    double d = 0;
+    for (; first != last; ++first) d += theta.at(*first).dim();
+    return d;
+}
+}  // namespace
+
+void ASLAM_gtsam::factor_costs_compute(
+    const gtsam::ISAM2Result& res, SpinStats& st)
+{
+    MRPT_START
+
+    ASSERT_(state_.isam2);
+    ASSERT_(res.detail);
+
+    const auto& isam2   = *state_.isam2;
+    const auto& factors = isam2.getFactorsUnsafe();
+    const auto& vi      = isam2.getVariableIndex();
+    const auto& theta   = isam2.getLinearizationPoint();
+
+    gtsam::KeySet relinearized, reeliminated;
+    for (const auto& ks : res.detail->variableStatus)
+    {
+        if (ks.second.isRelinearized) relinearized.insert(ks.first);
+        if (ks.second.isReeliminated) reeliminated.insert(ks.first);
+    }
+
+    // Factors linearized by the update. iSAM2 does not report them, but,
+    // as in ISAM2::relinearizeAffectedFactors(), they are the new ones plus
+    // those whose variables were all re-eliminated. With
+    // cacheLinearizedFactors, only those of the latter on relinearized
+    // variables are linearized again; the others reuse their cache.
+    const bool cached = isam2.params().cacheLinearizedFactors;
+    std::set<gtsam::FactorIndex> linearized(
+        res.newFactorsIndices.begin(), res.newFactorsIndices.end());
+    for (const auto key : reeliminated)
+    {
+        const auto it = vi.find(key);
+        if (it == vi.end()) continue;
+        for (const auto fi : it->second)
+        {
+            const auto& f = factors.at(fi);
+            if (!f) continue;
+            const bool inside = std::all_of(
+                f->begin(), f->end(),
+                [&](gtsam::Key k) { return reeliminated.count(k) != 0; });
+            if (!inside) continue;
+            if (cached && std::none_of(f->begin(), f->end(), [&](gtsam::Key k) {
+                    return relinearized.count(k) != 0;
+                }))
+                continue;
+            linearized.insert(fi);
+        }
+    }
+
+    // Time the linearization of a few factors of each kind, and extrapolate
+    // to the rest of them:
+    const std::size_t max_samples =
+        static_cast<std::size_t>(std::max(1, params_.factor_cost_samples));
+    std::array<std::size_t, NUM_KINDS> n_timed{};
+    std::array<double, NUM_KINDS>      t_timed{};
+
+    for (const auto fi : linearized)
+    {
+        const auto& f = factors.at(fi);
+        if (!f) continue;
+        const auto kind = kind_index(*f);
+        st.factor_costs[kind].linearized++;
+        if (n_timed[kind] >= max_samples) continue;
+
+        const auto t0 = std::chrono::steady_clock::now();
+        // (The result is discarded: iSAM2 already holds its own copy)
+        linearize_uncached(*f, theta);
+        t_timed[kind] += std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - t0)
+                             .count();
+        n_timed[kind]++;
+    }
+    for (std::size_t k = 0; k < st.factor_costs.size(); k++)
+    {
+        auto& c = st.factor_costs[k];
+        if (n_timed[k]) c.t_linearize = t_timed[k] / n_timed[k] * c.linearized;
+    }
+
+    // Elimination: the dense partial Cholesky of each re-eliminated clique,
+    // with f frontal and s separator dimensions, costs about
+    // f^3/3 + f^2*s + f*s^2 flops:
+    std::set<const gtsam::ISAM2Clique*> cliques;
+    for (const auto key : reeliminated)
+    {
+        const auto it = isam2.nodes().find(key);
+        if (it != isam2.nodes().end() && it->second)
+            cliques.insert(it->second.get());
+    }
+
+    for (const auto* clique : cliques)
+    {
+        const auto& cond = clique->conditional();
+        if (!cond) continue;
+
+        const double f =
+            dims(theta, cond->beginFrontals(), cond->endFrontals());
+        const double s =
+            dims(theta, cond->beginParents(), cond->endParents());
+        const double flops = f * f * f / 3 + f * f * s + f * s * s;
+
+        // Split among the kinds of the factors on the frontal variables, in
+        // proportion to their dimension (rows they add to the system):
+        std::set<gtsam::FactorIndex> clique_factors;
+        for (auto it = cond->beginFrontals(); it != cond->endFrontals(); ++it)
+        {
+            const auto vit = vi.find(*it);
+            if (vit == vi.end()) continue;
+            clique_factors.insert(vit->second.begin(), vit->second.end());
+        }
+        std::array<double, NUM_KINDS> dim_kind{};
+        double                        dim_total = 0;
+        for (const auto fi : clique_factors)
+        {
+            const auto& fac = factors.at(fi);
+            if (!fac) continue;
+            dim_kind[kind_index(*fac)] += fac->dim();
+            dim_total += fac->dim();
+        }
+        if (dim_total <= 0) continue;
+        for (std::size_t k = 0; k < dim_kind.size(); k++)
+            st.factor_costs[k].elimination_flops +=
+                flops * dim_kind[k] / dim_total;
+    }
+
+    MRPT_END
+}
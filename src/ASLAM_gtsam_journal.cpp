@@ -0,0 +1,228 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @file   ASLAM_gtsam_journal.cpp
+ * @brief  SLAM in absolute coordinates with GTSAM: crash recovery
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 19, 2019
+ */
+
+#include <mola-kernel/lock_helper.h>
+#include <mola-slam-gtsam/ASLAM_gtsam.h>
+#include <mrpt/core/format.h>
+#include <mrpt/system/CDirectoryExplorer.h>
+#include <mrpt/system/filesystem.h>
+
+#include <cstdio>
+#include <fstream>
+
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
+
+using namespace mola;
+
+namespace
+{
+/** Name of the file with the number of the latest complete checkpoint */
+const char* LATEST_FILE = "LATEST";
+
+/** Makes `dst` start with the same chunks as `src`: hard links where
+ * possible, so unchanged chunks are neither copied nor rewritten. */
+void linkMapChunks(const std::string& src, const std::string& dst)
+{
+    mrpt::system::CDirectoryExplorer::TFileInfoList lst;
+    mrpt::system::CDirectoryExplorer::explore(src, FILE_ATTRIB_ARCHIVE, lst);
+    for (const auto& fi : lst)
+    {
+        if (fi.name.find(".chunk.gz") == std::string::npos) continue;
+        if (fi.name.find(".tmp") != std::string::npos) continue;
+
+        const auto target = dst + "/" + fi.name;
+#if !defined(_WIN32)
+        if (::link(fi.wholePath.c_str(), target.c_str()) == 0) continue;
+#endif
+        ASSERTMSG_(
+            mrpt::system::copyFile(fi.wholePath, target),
+            mrpt::format("Cannot copy map chunk to: `%s`", target.c_str()));
+    }
+}
+}  // namespace
+
+std::string ASLAM_gtsam::journal_checkpoint_dir(const std::size_t n) const
+{
+    return mrpt::format(
+        "%s/ckpt_%06zu", params_.journal_directory.c_str(), n);
+}
+
+std::string ASLAM_gtsam::journal_file(const std::size_t n) const
+{
+    return mrpt::format(
+        "%s/journal_%06zu.bin", params_.journal_directory.c_str(), n);
+}
+
+bool ASLAM_gtsam::journal_recover()
+{
+    MRPT_START
+    ProfilerEntry tleg(profiler_, "journal_recover");
+
+    const auto latestFile = params_.journal_directory + "/" + LATEST_FILE;
+    if (!mrpt::system::fileExists(latestFile)) return false;
+
+    const auto  t0 = mrpt::Clock::now();
+    std::size_t n  = 0;
+    {
+        std::ifstream f(latestFile);
+        ASSERTMSG_(
+            f.is_open() && (f >> n) && n > 0,
+            mrpt::format("Corrupted file: `%s`", latestFile.c_str()));
+    }
+
+    const auto ckptDir = journal_checkpoint_dir(n);
+    MRPT_LOG_WARN_STREAM("Recovering from checkpoint: " << ckptDir);
+
+    const auto st = loadChunkedMap(
+        *worldmodel_, ckptDir + "/map", map_writer_->parameters());
+    if (st.chunk_size == map_writer_->parameters().chunk_size)
+        map_writer_->markAllClean();
+    kf_observations_to_store();
+    loadCheckpoint(ckptDir + "/solver.bin");
+
+    journal_ckpt_seq_ = n;
+    journal_seq_      = n;
+
+    // Replay the journal tail. Calls after a checkpoint that was not
+    // completed are in the next journal file(s):
+    std::size_t n_calls = 0;
+    for (std::size_t k = n; mrpt::system::fileExists(journal_file(k)); k++)
+    {
+        BackendCallReader rd;
+        rd.open(journal_file(k));
+        const auto rs = replayBackendCalls(rd, *this);
+
+        for (const auto& c : rs.calls) n_calls += c.second.count;
+        if (rs.id_mismatches != 0)
+            MRPT_LOG_ERROR_FMT(
+                "Journal replay of `%s`: %zu calls returned IDs different "
+                "than the recorded ones. The recovered map may be "
+                "inconsistent.",
+                journal_file(k).c_str(), rs.id_mismatches);
+
+        journal_seq_ = k;
+    }
+
+    MRPT_LOG_WARN_FMT(
+        "Recovered %zu entities, %zu factors and %zu journaled calls in "
+        "%.03f s",
+        st.entities, st.factors, n_calls,
+        mrpt::system::timeDifference(t0, mrpt::Clock::now()));
+
+    return true;
+    MRPT_END
+}
+
+void ASLAM_gtsam::journal_checkpoint(const bool wait)
+{
+    MRPT_START
+    ProfilerEntry tleg(profiler_, "journal_checkpoint");
+
+    ASSERT_(map_writer_);
+
+    // One checkpoint at a time:
+    if (pending_checkpoint_.valid())
+    {
+        if (!wait && pending_checkpoint_.wait_for(std::chrono::seconds(0)) !=
+                         std::future_status::ready)
+            return;
+        // Rethrows errors of the former one:
+        pending_checkpoint_.get();
+    }
+
+    // Consistent cut: no API call can run while we hold isam2_lock_, so
+    // the solver state, the map chunks and the start of the new journal
+    // file all correspond to the same instant.
+    const std::size_t                 prev = journal_ckpt_seq_;
+    const std::size_t                 n    = journal_seq_ + 1;
+    const auto                        dir  = journal_checkpoint_dir(n);
+    std::shared_ptr<SolverCheckpoint> cp;
+    {
+        auto          lock = lockHelper(isam2_lock_);
+        ProfilerEntry tle(profiler_, "journal_checkpoint.pause");
+
+        mrpt::system::createDirectory(dir);
+        mrpt::system::createDirectory(dir + "/map");
+        if (prev != 0)
+            linkMapChunks(
+                journal_checkpoint_dir(prev) + "/map", dir + "/map");
+
+        // (The iSAM2 state is only copied here, and serialized below)
+        cp = std::make_shared<SolverCheckpoint>(take_checkpoint(true));
+        ASSERTMSG_(
+            map_writer_->save_async(*worldmodel_, dir + "/map"),
+            "Map writer busy while starting a checkpoint");
+
+        if (journal_.is_open())
+            journal_.rotate(journal_file(n));
+        else
+        {
+            journal_.open(
+                journal_file(n), params_.journal_sync_period,
+                api_recorder_.time_origin());
+            journal_.sync();
+        }
+
+        journal_seq_      = n;
+        journal_ckpt_seq_ = n;
+        last_checkpoint_  = mrpt::Clock::now();
+    }
+
+    auto job = [this, prev, n, dir, cp]() {
+        const auto t0 = mrpt::Clock::now();
+
+        map_writer_->wait();
+        writeSolverCheckpoint(*cp, dir + "/solver.bin");
+#if !defined(_WIN32)
+        // Checkpoint files must reach the disk before LATEST points to them
+        ::sync();
+#endif
+        const auto latestFile = params_.journal_directory + "/" + LATEST_FILE;
+        const auto tmpFile    = latestFile + ".tmp";
+        {
+            std::ofstream f(tmpFile);
+            ASSERTMSG_(
+                f.is_open(),
+                mrpt::format("Cannot create: `%s`", tmpFile.c_str()));
+            f << n << "\n";
+        }
+        ASSERTMSG_(
+            std::rename(tmpFile.c_str(), latestFile.c_str()) == 0,
+            mrpt::format("Cannot rename to: `%s`", latestFile.c_str()));
+
+        // The former checkpoint, its journal files, and any incomplete
+        // checkpoint after it (if we recovered from a crash) are not needed
+        // anymore:
+        for (std::size_t k = prev; prev != 0 && k < n; k++)
+        {
+            const auto oldDir = journal_checkpoint_dir(k);
+            if (mrpt::system::directoryExists(oldDir))
+            {
+                mrpt::system::deleteFilesInDirectory(oldDir + "/map", true);
+                mrpt::system::deleteFilesInDirectory(oldDir, true);
+            }
+            mrpt::system::deleteFile(journal_file(k));
+        }
+
+        MRPT_LOG_DEBUG_FMT(
+            "Checkpoint #%zu written in %.03f s", n,
+            mrpt::system::timeDifference(t0, mrpt::Clock::now()));
+    };
+    pending_checkpoint_ = checkpoint_worker_.enqueue(job);
+
+    if (wait) pending_checkpoint_.get();
+
+    MRPT_END
+}
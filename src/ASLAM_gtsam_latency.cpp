@@ -0,0 +1,79 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   ASLAM_gtsam_latency.cpp
+ * @brief  ASLAM_gtsam: end-to-end latency of keyframes and factors
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 20, 2019
+ */
+
+#include <mola-slam-gtsam/ASLAM_gtsam.h>
+
+#include <fstream>
+
+using namespace mola;
+
+void ASLAM_gtsam::latency_add(
+    const std::vector<Arrival>&        arrivals,
+    const latency_clock_t::time_point& solve_start,
+    const latency_clock_t::time_point& solve_end,
+    const latency_clock_t::time_point& writeback_end)
+{
+    const auto secs = [](const latency_clock_t::duration& d) {
+        return std::chrono::duration<double>(d).count();
+    };
+    const auto idx = [](const LatencyStage s) {
+        return static_cast<std::size_t>(s);
+    };
+
+    const double solve     = secs(solve_end - solve_start);
+    const double writeback = secs(writeback_end - solve_end);
+
+    std::lock_guard<std::mutex> lck(latency_mtx_);
+    for (const auto& a : arrivals)
+    {
+        auto& h = latency_[a.type];
+        h[idx(LatencyStage::Queue)].add(secs(solve_start - a.t));
+        h[idx(LatencyStage::Solve)].add(solve);
+        h[idx(LatencyStage::WriteBack)].add(writeback);
+        h[idx(LatencyStage::Total)].add(secs(writeback_end - a.t));
+    }
+}
+
+std::map<std::string, ASLAM_gtsam::LatencyStageHistograms>
+    ASLAM_gtsam::latency_histograms()
+{
+    std::lock_guard<std::mutex> lck(latency_mtx_);
+    return latency_;
+}
+
+void ASLAM_gtsam::saveLatencyStatsJSON(const std::string& file)
+{
+    MRPT_START
+
+    std::ofstream f(file);
+    if (!f.is_open())
+        THROW_EXCEPTION_FMT("Cannot write: `%s`", file.c_str());
+
+    const char* stageNames[] = {"queue", "solve", "writeback", "total"};
+
+    f << "{\n";
+    bool first = true;
+    for (const auto& type : latency_histograms())
+    {
+        f << (first ? "" : ",\n") << "\"" << type.first << "\": {";
+        first = false;
+        for (std::size_t i = 0; i < type.second.size(); i++)
+        {
+            f << (i ? ", " : "") << "\"" << stageNames[i] << "\": ";
+            type.second[i].toJSON(f);
+        }
+        f << "}";
+    }
+    f << "\n}\n";
+
+    MRPT_END
+}
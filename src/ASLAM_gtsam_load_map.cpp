@@ -0,0 +1,242 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @file   ASLAM_gtsam_load_map.cpp
+ * @brief  SLAM in absolute coordinates with GTSAM: continue from a map
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 17, 2019
+ */
+
+#include <gtsam/inference/Symbol.h>  // X(), V() symbols
+#include <mola-kernel/entities/entities-common.h>
+#include <mola-kernel/lock_helper.h>
+#include <mola-kernel/variant_helper.h>  // overloaded{}
+#include <mola-slam-gtsam/ASLAM_gtsam.h>
+#include <mola-slam-gtsam/gtsam_mola_bridge.h>
+
+using namespace mola;
+
+void ASLAM_gtsam::rebuild_from_worldmodel()
+{
+    MRPT_START
+    ProfilerEntry tleg(profiler_, "rebuild_from_worldmodel");
+
+    using namespace gtsam::symbol_shorthand;  // X(), V()
+
+    auto lock     = lockHelper(isam2_lock_);
+    auto lock_viz = lockHelper(vizmap_lock_);
+
+    ASSERTMSG_(
+        state_.root_kf_id == INVALID_ID,
+        "rebuild_from_worldmodel() must be called before adding keyframes");
+
+    const bool with_vel = (params_.state_vector == StateVectorType::SE3Vel);
+
+    // In localization-only mode, the map KFs are only registered and
+    // frozen: no gtsam values nor factors. They enter the sliding window
+    // as priors when new factors reference them (see localization_update())
+    const bool frozen = params_.localization_only;
+
+    std::size_t n_kfs = 0, n_factors = 0, n_skipped_ents = 0,
+                n_skipped_factors = 0;
+    std::map<mrpt::Clock::time_point, mola::id_t> kfs_by_time;
+    std::set<mola::id_t>                          kfs_with_dynamics;
+
+    // Atlas (see startNewMap()): one root per map. Roots of maps merged
+    // into another one have no KFs left, and must not get a prior again.
+    std::vector<mola::id_t>                   roots;
+    std::map<mola::id_t, mola::id_t>          kf_root;
+    std::map<mola::id_t, FactorRelativePose3> root_factor;
+
+    // Keyframes: their poses in the WorldModel are already optimized, so
+    // they are used as initial values as they are:
+    const auto addKF = [&](const mola::id_t id, const Entity& e) {
+        const auto tim  = mola::entity_get_timestamp(e);
+        const auto pose = mola::entity_get_pose(e);
+
+        mola2gtsam_register_new_kf(id);
+        state_.time2kf[tim] = id;
+        kfs_by_time[tim]    = id;
+
+        if (frozen)
+            state_.frozen_kfs.insert(id);
+        else
+        {
+            state_.newvalues.insert(X(id), toPose3(pose));
+            if (with_vel)
+            {
+                const auto tw = mola::entity_get_twist(e);
+                state_.newvalues.insert(
+                    V(id), gtsam::Velocity3(tw.vx, tw.vy, tw.vz));
+            }
+        }
+        state_.kf_has_value.insert(id);
+        state_.vizmap.nodes[id] = mrpt::poses::CPose3D(pose);
+        n_kfs++;
+    };
+
+    worldmodel_->entities_lock_for_read();
+    worldmodel_->factors_lock_for_read();
+    try
+    {
+        for (const auto id : worldmodel_->entity_all_ids())
+        {
+            const auto& e = worldmodel_->entity_by_id(id);
+            std::visit(
+                overloaded{
+                    [&](const RefPose3&) {
+                        roots.push_back(id);
+                        mola2gtsam_register_new_kf(id);
+                        state_.kf_has_value.insert(id);
+                        state_.vizmap.nodes[id] =
+                            mrpt::poses::CPose3D::Identity();
+                    },
+                    [&](const RelPose3KF& kf) {
+                        addKF(id, e);
+                        kf_root[id] = kf.base_id_;
+                    },
+                    [&](const RelDynPose3KF& kf) {
+                        addKF(id, e);
+                        kf_root[id] = kf.base_id_;
+                    },
+                    [&]([[maybe_unused]] const auto& other) {
+                        n_skipped_ents++;
+                    },
+                },
+                e);
+        }
+
+        for (const auto fid : worldmodel_->factor_all_ids())
+        {
+            std::visit(
+                overloaded{
+                    [&](const FactorRelativePose3& f) {
+                        if (std::holds_alternative<RefPose3>(
+                                worldmodel_->entity_by_id(f.from_kf_)))
+                            root_factor.emplace(f.from_kf_, f);
+                        if (!frozen) gtsam_add_factor(f);
+                        state_.vizmap.insertEdgeAtEnd(
+                            f.from_kf_, f.to_kf_,
+                            mrpt::poses::CPose3D(f.rel_pose_));
+                        n_factors++;
+                    },
+                    [&](const FactorDynamicsConstVel& f) {
+                        if (frozen) return;
+                        const double dt = mrpt::system::timeDifference(
+                            mola::entity_get_timestamp(
+                                worldmodel_->entity_by_id(f.from_kf_)),
+                            mola::entity_get_timestamp(
+                                worldmodel_->entity_by_id(f.to_kf_)));
+                        gtsam_add_factor(f, dt);
+                        kfs_with_dynamics.insert(f.to_kf_);
+                        n_factors++;
+                    },
+                    [&]([[maybe_unused]] const auto& other) {
+                        n_skipped_factors++;
+                    },
+                },
+                worldmodel_->factor_by_id(fid));
+        }
+    }
+    catch (...)
+    {
+        worldmodel_->factors_unlock_for_read();
+        worldmodel_->entities_unlock_for_read();
+        throw;
+    }
+    worldmodel_->factors_unlock_for_read();
+    worldmodel_->entities_unlock_for_read();
+
+    if (roots.empty())
+    {
+        ASSERTMSG_(
+            n_kfs == 0, "WorldModel has keyframes but no reference frame");
+        MRPT_LOG_INFO("rebuild_from_worldmodel: empty map, nothing to do.");
+        return;
+    }
+
+    std::set<mola::id_t> live_roots;
+    for (const auto& kr : kf_root) live_roots.insert(kr.second);
+
+    for (const auto root : roots)
+    {
+        const bool merged = live_roots.count(root) == 0 && roots.size() > 1;
+        if (frozen)
+            state_.frozen_kfs.insert(root);
+        else if (!merged)
+            gtsam_add_root_prior(root);
+        else
+        {
+            // Recover its pose from the fixed factor to its first KF:
+            gtsam::Pose3 p = gtsam::Pose3::identity();
+            if (const auto it = root_factor.find(root);
+                it != root_factor.end() &&
+                state_.newvalues.exists(X(it->second.to_kf_)))
+                p = state_.newvalues.at<gtsam::Pose3>(X(it->second.to_kf_))
+                        .compose(toPose3(it->second.rel_pose_).inverse());
+            state_.newvalues.insert(X(root), p);
+            state_.vizmap.nodes[root] = mrpt::poses::CPose3D(toTPose3D(p));
+        }
+    }
+
+    // The current map is that of the latest KF:
+    state_.root_kf_id = kfs_by_time.empty()
+                            ? roots.back()
+                            : kf_root.at(kfs_by_time.rbegin()->second);
+
+    // Keyframes not reached by any dynamics factor had a velocity prior
+    // when they were created (e.g. the first one). Restore it, keeping the
+    // stored velocity as initial value:
+    if (with_vel && !frozen)
+    {
+        for (const auto& tk : kfs_by_time)
+        {
+            const auto id = tk.second;
+            if (kfs_with_dynamics.count(id) != 0) continue;
+            const auto v0 = state_.newvalues.at<gtsam::Velocity3>(V(id));
+            internal_add_gtsam_prior_vel(id);
+            state_.newvalues.update(V(id), v0);
+        }
+    }
+
+    // Restore "last created KF" bookkeeping, in time order:
+    for (const auto& tk : kfs_by_time)
+    {
+        state_.updateLastCreatedKF(tk.second);
+        state_.last_created_kf_id_tim = tk.first;
+    }
+
+    if (frozen)
+    {
+        MRPT_LOG_INFO_FMT(
+            "Localization-only mode: %zu keyframes from the WorldModel "
+            "frozen.",
+            state_.frozen_kfs.size());
+        return;
+    }
+
+    MRPT_LOG_INFO_FMT(
+        "Rebuilt graph from WorldModel: %zu keyframes, %zu factors. Not "
+        "restored (no persistent gtsam counterpart): %zu entities, %zu "
+        "factors.",
+        n_kfs, n_factors, n_skipped_ents, n_skipped_factors);
+
+    // Initialize the solver with all factors at once, instead of
+    // replaying them one by one. The LM path picks them up in spinOnce().
+    if (params_.use_incremental_solver && !state_.newfactors.empty())
+    {
+        ProfilerEntry tle(profiler_, "rebuild_from_worldmodel.isam2_batch");
+
+        state_.isam2->update(state_.newfactors, state_.newvalues);
+        state_.last_values = state_.isam2->calculateEstimate();
+
+        state_.newfactors.resize(0);
+        state_.newvalues.clear();
+    }
+
+    MRPT_END
+}
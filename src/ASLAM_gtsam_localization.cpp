@@ -0,0 +1,194 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @file   ASLAM_gtsam_localization.cpp
+ * @brief  SLAM in absolute coordinates with GTSAM: localization-only mode
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 18, 2019
+ */
+
+#include <gtsam/inference/Symbol.h>  // X(), V() symbols
+#include <gtsam/slam/PriorFactor.h>
+#include <mola-kernel/entities/entities-common.h>
+#include <mola-kernel/lock_helper.h>
+#include <mola-slam-gtsam/ASLAM_gtsam.h>
+#include <mola-slam-gtsam/gtsam_mola_bridge.h>
+
+using namespace mola;
+
+// isam2_lock_ is locked from the caller site.
+gtsam::Values ASLAM_gtsam::localization_update()
+{
+    MRPT_START
+    ProfilerEntry tleg(profiler_, "localization_update");
+    TraceScope    trg("localization_update");
+    AllocScope    alg("localization_update");
+
+    using namespace gtsam::symbol_shorthand;  // X(), V()
+
+    ASSERT_(state_.loc_smoother);
+    auto& smoother = *state_.loc_smoother;
+
+    const bool with_vel = (params_.state_vector == StateVectorType::SE3Vel);
+
+    // Same noise as the prior of the root KF: frozen KFs are, in practice,
+    // constants.
+    const double frozen_std_vel = 1e-3;  // [m/s]
+    const auto   pose_noise     = root_prior_noise();
+    const auto   vel_noise =
+        gtsam::noiseModel::Isotropic::Sigma(3, frozen_std_vel);
+
+    // Rejected by addFactor(), see Parameters::localization_only:
+    ASSERT_(state_.changedSmartFactors.empty());
+
+    const gtsam::Values& theta = smoother.getLinearizationPoint();
+
+    auto lk = lockHelper(keys_map_lock_);
+
+    const auto kfOfKey = [&](const gtsam::Key k) -> mola::id_t {
+        for (const auto idx : {KF_KEY_POSE, KF_KEY_VEL})
+            if (const auto it = state_.gtsam2mola[idx].find(k);
+                it != state_.gtsam2mola[idx].end())
+                return it->second;
+        return INVALID_ID;
+    };
+
+    // 1) New KFs enter the window with the next sequence number:
+    gtsam::FixedLagSmoother::KeyTimestampMap stamps;
+
+    for (const auto p : state_.newvalues)
+    {
+        const auto kf = kfOfKey(p.key);
+        if (kf == INVALID_ID || state_.frozen_kfs.count(kf) != 0) continue;
+        if (state_.loc_kf_seq.count(kf) == 0)
+            state_.loc_kf_seq[kf] = ++state_.loc_last_seq;
+    }
+
+    // 2) Factors referencing variables out of the window: frozen KFs
+    // become strong priors at their map value; anything else (e.g. a
+    // landmark already marginalized) cannot be used anymore.
+    gtsam::NonlinearFactorGraph factors;
+    gtsam::Values               values = state_.newvalues;
+    std::size_t                 n_dropped = 0;
+    std::set<mola::id_t>        kfs_to_prior;
+
+    for (const auto& f : state_.newfactors)
+    {
+        if (!f) continue;
+        bool usable = true;
+        for (const auto k : f->keys())
+        {
+            if (theta.exists(k) || values.exists(k)) continue;
+            if (const auto kf = kfOfKey(k);
+                kf != INVALID_ID && state_.frozen_kfs.count(kf) != 0)
+                kfs_to_prior.insert(kf);
+            else
+                usable = false;
+        }
+        if (usable)
+            factors.push_back(f);
+        else
+            n_dropped++;
+    }
+
+    if (!kfs_to_prior.empty())
+    {
+        worldmodel_->entities_lock_for_read();
+        try
+        {
+            for (const auto kf : kfs_to_prior)
+            {
+                const auto& e    = worldmodel_->entity_by_id(kf);
+                const auto  pose = toPose3(mola::entity_get_pose(e));
+
+                values.insert(X(kf), pose);
+                factors.emplace_shared<gtsam::PriorFactor<gtsam::Pose3>>(
+                    X(kf), pose, pose_noise);
+                stamps[X(kf)] = state_.loc_last_seq;
+
+                if (with_vel)
+                {
+                    const auto tw = mola::entity_get_twist(e);
+                    const gtsam::Velocity3 vel(tw.vx, tw.vy, tw.vz);
+                    values.insert(V(kf), vel);
+                    factors
+                        .emplace_shared<gtsam::PriorFactor<gtsam::Velocity3>>(
+                            V(kf), vel, vel_noise);
+                    stamps[V(kf)] = state_.loc_last_seq;
+                }
+            }
+        }
+        catch (...)
+        {
+            worldmodel_->entities_unlock_for_read();
+            throw;
+        }
+        worldmodel_->entities_unlock_for_read();
+    }
+
+    if (n_dropped)
+        MRPT_LOG_WARN_FMT(
+            "localization_update: dropped %zu factors involving variables "
+            "out of the sliding window.",
+            n_dropped);
+
+    // 3) Timestamps of all new variables: KF sequence numbers, so the
+    // smoother lag is measured in keyframes.
+    for (const auto p : state_.newvalues)
+    {
+        const auto kf = kfOfKey(p.key);
+        const auto it = state_.loc_kf_seq.find(kf);
+        stamps[p.key] =
+            (it != state_.loc_kf_seq.end()) ? it->second : state_.loc_last_seq;
+    }
+
+    {
+        ProfilerEntry tle(profiler_, "localization_update.smoother_update");
+        smoother.update(factors, values, stamps);
+    }
+
+    // KFs of the new values now have a value in the solver:
+    for (const auto p : state_.newvalues)
+        if (const auto kf = kfOfKey(p.key); kf != INVALID_ID)
+            state_.kf_has_value.insert(kf);
+
+    state_.newfactors.resize(0);
+    state_.newvalues.clear();
+    state_.newFactor2molaid.clear();
+
+    // 4) KFs marginalized out of the window are frozen from now on:
+    for (auto it = state_.loc_kf_seq.begin(); it != state_.loc_kf_seq.end();)
+    {
+        if (!theta.exists(X(it->first)))
+        {
+            state_.frozen_kfs.insert(it->first);
+            it = state_.loc_kf_seq.erase(it);
+        }
+        else
+            ++it;
+    }
+
+    // Do not report frozen variables back (e.g. those which entered the
+    // window as priors in this step), their WorldModel values must not
+    // change:
+    const gtsam::Values estimate = smoother.calculateEstimate();
+    gtsam::Values       result;
+    for (const auto kv : estimate)
+    {
+        const auto kf = kfOfKey(kv.key);
+        if (kf != INVALID_ID && state_.frozen_kfs.count(kf) != 0) continue;
+        result.insert(kv.key, kv.value);
+    }
+
+    MRPT_LOG_DEBUG_FMT(
+        "localization_update: %zu variables in window, %zu KFs frozen.",
+        theta.size(), state_.frozen_kfs.size());
+
+    return result;
+
+    MRPT_END
+}
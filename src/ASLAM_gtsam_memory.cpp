@@ -0,0 +1,295 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   ASLAM_gtsam_memory.cpp
+ * @brief  ASLAM_gtsam: memory accounting per subsystem
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 20, 2019
+ */
+
+#include <gtsam/linear/HessianFactor.h>
+#include <gtsam/linear/JacobianFactor.h>
+#include <mola-kernel/entities/entities-common.h>
+#include <mola-kernel/lock_helper.h>
+#include <mola-kernel/variant_helper.h>  // overloaded{}
+#include <mola-slam-gtsam/ASLAM_gtsam.h>
+#include <mrpt/io/CMemoryStream.h>
+#include <mrpt/serialization/CArchive.h>
+
+#include <vector>
+
+using namespace mola;
+
+namespace
+{
+/** Approximate heap size of one std::map/std::set node holding `VALUE` */
+template <class VALUE>
+constexpr std::size_t map_node_bytes()
+{
+    return 4 * sizeof(void*) + sizeof(VALUE);
+}
+
+template <class MAP>
+std::size_t map_bytes(const MAP& m)
+{
+    return m.size() * map_node_bytes<typename MAP::value_type>();
+}
+
+std::size_t value_bytes(const gtsam::Value& v)
+{
+    // The exact type is only known for the state vector variables:
+    if (dynamic_cast<const gtsam::GenericValue<gtsam::Pose3>*>(&v))
+        return sizeof(gtsam::GenericValue<gtsam::Pose3>);
+    if (dynamic_cast<const gtsam::GenericValue<gtsam::Pose2>*>(&v))
+        return sizeof(gtsam::GenericValue<gtsam::Pose2>);
+    if (dynamic_cast<const gtsam::GenericValue<gtsam::Velocity3>*>(&v))
+        return sizeof(gtsam::GenericValue<gtsam::Velocity3>);
+    return sizeof(void*) + v.dim() * sizeof(double);
+}
+
+std::size_t values_bytes(const gtsam::Values& values)
+{
+    std::size_t b =
+        values.size() * map_node_bytes<std::pair<gtsam::Key, void*>>();
+    for (const auto& kv : values) b += value_bytes(kv.value);
+    return b;
+}
+
+/** Sum of the dimensions of the variables of `f` */
+std::size_t vars_dim(const gtsam::Factor& f, const gtsam::Values& theta)
+{
+    std::size_t d = 0;
+    for (const auto k : f.keys())
+        if (theta.exists(k)) d += theta.at(k).dim();
+    return d;
+}
+
+/** A nonlinear factor: keys, measurement and noise model (sigmas and
+ * their inverses), which are not shared among factors */
+std::size_t factor_bytes(const gtsam::NonlinearFactor& f)
+{
+    return sizeof(gtsam::NoiseModelFactor) + f.size() * sizeof(gtsam::Key) +
+           3 * f.dim() * sizeof(double);
+}
+
+std::size_t gaussian_factor_bytes(const gtsam::GaussianFactor& f)
+{
+    if (auto j = dynamic_cast<const gtsam::JacobianFactor*>(&f))
+        return sizeof(gtsam::JacobianFactor) +
+               j->matrixObject().matrix().size() * sizeof(double);
+    if (auto h = dynamic_cast<const gtsam::HessianFactor*>(&f))
+        return sizeof(gtsam::HessianFactor) +
+               h->info().rows() * h->info().cols() * sizeof(double);
+    return sizeof(gtsam::GaussianFactor) + f.size() * sizeof(gtsam::Key);
+}
+
+std::size_t bayes_tree_bytes(const gtsam::ISAM2& isam2)
+{
+    std::size_t b = isam2.nodes().size() *
+                    map_node_bytes<std::pair<gtsam::Key, void*>>();
+
+    std::vector<gtsam::ISAM2::sharedClique> pending(
+        isam2.roots().begin(), isam2.roots().end());
+    while (!pending.empty())
+    {
+        const auto c = pending.back();
+        pending.pop_back();
+
+        b += sizeof(gtsam::ISAM2Clique) + c->children.size() * sizeof(c);
+        if (const auto& cond = c->conditional())
+            b += gaussian_factor_bytes(*cond);
+        if (const auto& cached = c->cachedFactor())
+            b += gaussian_factor_bytes(*cached);
+        b += c->gradientContribution().size() * sizeof(double);
+
+        for (const auto& child : c->children) pending.push_back(child);
+    }
+    return b;
+}
+
+/** Nonlinear factors, except smart ones, and their cached linearization
+ * (a Jacobian with one row per error dimension) */
+std::size_t factors_bytes(
+    const gtsam::NonlinearFactorGraph& graph, const gtsam::Values& theta)
+{
+    std::size_t b = graph.size() * sizeof(gtsam::NonlinearFactor::shared_ptr);
+    for (const auto& f : graph)
+    {
+        if (!f ||
+            dynamic_cast<const gtsam::SmartStereoProjectionPoseFactor*>(
+                f.get()))
+            continue;
+        b += factor_bytes(*f) +
+             f->dim() * (vars_dim(*f, theta) + 1) * sizeof(double);
+    }
+    return b;
+}
+
+/** Linearization point, plus delta, Newton delta and RgProd, with one
+ * vector per variable */
+std::size_t solver_values_bytes(const gtsam::Values& theta)
+{
+    std::size_t dims = 0;
+    for (const auto& kv : theta) dims += kv.value.dim();
+    return values_bytes(theta) +
+           3 * (theta.size() *
+                    map_node_bytes<std::pair<gtsam::Key, gtsam::Vector>>() +
+                dims * sizeof(double));
+}
+
+std::size_t smart_factor_bytes(
+    const gtsam::SmartStereoProjectionPoseFactor& f, const std::size_t dim)
+{
+    // Per observation: measurement, calibration, key, and the camera pose
+    // kept for triangulation:
+    const std::size_t n = f.measured().size();
+    std::size_t       b = sizeof(gtsam::SmartStereoProjectionPoseFactor) +
+                    n * (sizeof(gtsam::StereoPoint2) +
+                         sizeof(gtsam::Cal3_S2Stereo::shared_ptr) +
+                         sizeof(gtsam::Key) + sizeof(gtsam::Pose3));
+    // Its linearization in the solver, a Hessian over all poses:
+    b += (dim + 1) * (dim + 1) * sizeof(double);
+    return b;
+}
+
+std::size_t serialized_bytes(const mrpt::serialization::CSerializable& o)
+{
+    mrpt::io::CMemoryStream mem;
+    auto                    a = mrpt::serialization::archiveFrom(mem);
+    a << o;
+    return static_cast<std::size_t>(mem.getTotalBytesCount());
+}
+}  // namespace
+
+std::size_t ASLAM_gtsam::MemoryReport::total() const
+{
+    return isam2_bayes_tree + isam2_factors + isam2_values + pending +
+           last_values + id_maps + time2kf + trajectory + smart_factors +
+           vizmap + gui_decorations + kf_observations;
+}
+
+ASLAM_gtsam::MemoryReport ASLAM_gtsam::memory_report()
+{
+    MRPT_START
+
+    MemoryReport m;
+    std::vector<mola::id_t> kfs;
+    {
+        auto lock = lockHelper(isam2_lock_);
+
+        // (Pointer, to avoid copying the linearization point)
+        const gtsam::Values  none;
+        const gtsam::Values* theta = &none;
+        if (state_.isam2)
+        {
+            const auto& isam2 = *state_.isam2;
+            theta             = &isam2.getLinearizationPoint();
+
+            m.isam2_bayes_tree = bayes_tree_bytes(isam2);
+            m.isam2_factors =
+                factors_bytes(isam2.getFactorsUnsafe(), *theta) +
+                isam2.getVariableIndex().nEntries() *
+                    sizeof(gtsam::FactorIndex) +
+                isam2.getVariableIndex().size() *
+                    map_node_bytes<
+                        std::pair<gtsam::Key, gtsam::FactorIndices>>();
+        }
+        else if (state_.loc_smoother)
+        {
+            theta           = &state_.loc_smoother->getLinearizationPoint();
+            m.isam2_factors = factors_bytes(
+                state_.loc_smoother->getFactors(), *theta);
+        }
+        m.isam2_values = solver_values_bytes(*theta);
+
+        m.pending = factors_bytes(state_.newfactors, state_.newvalues) +
+                    values_bytes(state_.newvalues) +
+                    map_bytes(state_.newFactor2molaid);
+        m.last_values = values_bytes(state_.last_values);
+        m.time2kf     = map_bytes(state_.time2kf);
+        m.trajectory  = state_.trajectory.memory_bytes();
+
+        // Smart factors, sized as linearized over the poses they observe:
+        const auto& sf = state_.stereo_factors;
+        m.smart_factors += map_bytes(sf.factors);
+        for (const auto& id_f : sf.factors)
+        {
+            if (!id_f.second) continue;
+            m.smart_factors += smart_factor_bytes(
+                *id_f.second, vars_dim(*id_f.second, *theta));
+        }
+        m.id_maps += map_bytes(sf.ids.gtsam2mola) +
+                     map_bytes(sf.ids.mola2gtsam) +
+                     map_bytes(state_.kf_has_value);
+
+        auto lk = lockHelper(keys_map_lock_);
+        m.id_maps += map_bytes(state_.mola2gtsam);
+        for (const auto& g2m : state_.gtsam2mola) m.id_maps += map_bytes(g2m);
+
+        kfs.reserve(state_.mola2gtsam.size());
+        for (const auto& kv : state_.mola2gtsam) kfs.push_back(kv.first);
+    }
+    {
+        auto lock = lockHelper(vizmap_lock_);
+        m.vizmap  = map_bytes(state_.vizmap.nodes) +
+                   map_bytes(state_.vizmap.edges) +
+                   map_bytes(state_.vizmap_dyn);
+    }
+
+    // Keyframe observations and decorations are immutable once created, so
+    // each one is serialized only the first time it is seen:
+    std::lock_guard<std::mutex> lck(memory_mtx_);
+
+    worldmodel_->entities_lock_for_read();
+    for (const auto id : kfs)
+    {
+        if (kf_bytes_.count(id) != 0) continue;
+        auto& kb = kf_bytes_[id];
+
+        mrpt::obs::CSensoryFrame::Ptr sf;
+        std::visit(
+            overloaded{
+                [&](const mola::RelPose3KF& e) { sf = e.raw_observations_; },
+                [&](const mola::RelDynPose3KF& e) { sf = e.raw_observations_; },
+                []([[maybe_unused]] const auto& e) {},
+            },
+            worldmodel_->entity_by_id(id));
+        if (sf) kb.first = serialized_bytes(*sf);
+
+        const auto& annots = worldmodel_->entity_annotations_by_id(id);
+        if (const auto it_a = annots.find("render_decoration");
+            it_a != annots.end() && it_a->second.value())
+            kb.second = serialized_bytes(*it_a->second.value());
+    }
+    worldmodel_->entities_unlock_for_read();
+
+    for (const auto& kb : kf_bytes_)
+    {
+        m.kf_observations += kb.second.first;
+        m.gui_decorations += kb.second.second;
+    }
+    if (kf_obs_store_.is_open())
+        m.kf_observations += kf_obs_store_.cached_bytes();
+
+    return m;
+
+    MRPT_END
+}
+
+void ASLAM_gtsam::memory_report_log(const MemoryReport& m)
+{
+    const auto mb = [](const std::size_t b) { return b / (1024.0 * 1024.0); };
+
+    MRPT_LOG_INFO_FMT(
+        "Memory [MiB]: total=%.02f isam2_bayes_tree=%.02f isam2_factors=%.02f "
+        "isam2_values=%.02f pending=%.02f last_values=%.02f id_maps=%.02f "
+        "time2kf=%.02f trajectory=%.02f smart_factors=%.02f vizmap=%.02f "
+        "gui_decorations=%.02f kf_observations=%.02f",
+        mb(m.total()), mb(m.isam2_bayes_tree), mb(m.isam2_factors),
+        mb(m.isam2_values), mb(m.pending), mb(m.last_values), mb(m.id_maps),
+        mb(m.time2kf), mb(m.trajectory), mb(m.smart_factors), mb(m.vizmap),
+        mb(m.gui_decorations), mb(m.kf_observations));
+}
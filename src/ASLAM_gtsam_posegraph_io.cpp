@@ -0,0 +1,139 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @file   ASLAM_gtsam_posegraph_io.cpp
+ * @brief  SLAM in absolute coordinates with GTSAM: pose-graph export
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 12, 2019
+ */
+
+#include <gtsam/slam/BetweenFactor.h>
+#include <mola-kernel/lock_helper.h>
+#include <mola-slam-gtsam/ASLAM_gtsam.h>
+
+#include <cstdio>
+
+using namespace mola;
+
+void ASLAM_gtsam::setKeyFrameInitialGuess(
+    const mola::id_t kf_id, const mrpt::math::TPose3D& pose)
+{
+    MRPT_START
+
+    auto lock = lockHelper(isam2_lock_);
+    if (kf_id == state_.root_kf_id || state_.kf_has_value.count(kf_id) != 0)
+        return;
+    state_.kf_initial_guess[kf_id] = pose;
+
+    MRPT_END
+}
+
+void ASLAM_gtsam::take_initial_guess(
+    const mola::id_t kf_id, mrpt::math::TPose3D& pose)
+{
+    const auto it = state_.kf_initial_guess.find(kf_id);
+    if (it == state_.kf_initial_guess.end()) return;
+    pose = it->second;
+    state_.kf_initial_guess.erase(it);
+}
+
+void ASLAM_gtsam::exportPoseGraphG2O(std::ostream& o)
+{
+    MRPT_START
+    ProfilerEntry tleg(profiler_, "exportPoseGraphG2O");
+
+    auto lock = lockHelper(isam2_lock_);
+    auto lk   = lockHelper(keys_map_lock_);
+
+    char buf[512];
+    auto out = [&](int n) {
+        ASSERT_(n > 0 && n < static_cast<int>(sizeof(buf)));
+        o.write(buf, n);
+    };
+
+    // Vertices: latest estimate, or initial guess if not optimized yet:
+    for (const auto& key_id : state_.gtsam2mola[KF_KEY_POSE])
+    {
+        const gtsam::Key key = key_id.first;
+        gtsam::Pose3     p;
+        if (state_.last_values.exists(key))
+            p = state_.last_values.at<gtsam::Pose3>(key);
+        else if (state_.newvalues.exists(key))
+            p = state_.newvalues.at<gtsam::Pose3>(key);
+        else
+            continue;
+
+        const auto t = p.translation();
+        const auto q = p.rotation().toQuaternion();
+        out(std::snprintf(
+            buf, sizeof(buf),
+            "VERTEX_SE3:QUAT %lu %.09g %.09g %.09g %.09g %.09g %.09g %.09g\n",
+            static_cast<unsigned long>(key_id.second), t.x(), t.y(), t.z(),
+            q.x(), q.y(), q.z(), q.w()));
+    }
+
+    // Edges, both already in the solver and pending:
+    const auto write_edges = [&](const gtsam::NonlinearFactorGraph& g) {
+        for (const auto& f : g)
+        {
+            const auto bf =
+                boost::dynamic_pointer_cast<gtsam::BetweenFactor<gtsam::Pose3>>(
+                    f);
+            if (!bf) continue;
+
+            const auto& ids     = state_.gtsam2mola[KF_KEY_POSE];
+            const auto  it_from = ids.find(bf->key1());
+            const auto  it_to   = ids.find(bf->key2());
+            if (it_from == ids.end() || it_to == ids.end()) continue;
+
+            // Noise model sigmas, in gtsam order (rx ry rz x y z):
+            auto nm = bf->noiseModel();
+            if (const auto r =
+                    boost::dynamic_pointer_cast<gtsam::noiseModel::Robust>(nm);
+                r)
+                nm = r->noise();
+            gtsam::Vector6 s = gtsam::Vector6::Ones();
+            if (const auto d =
+                    boost::dynamic_pointer_cast<gtsam::noiseModel::Diagonal>(
+                        nm);
+                d)
+                s = d->sigmas();
+
+            // g2o order: (x y z qx qy qz). The rotational part is over the
+            // quaternion vector part, q_xyz ~ theta/2, hence sigma/2:
+            double info[6];
+            for (int i = 0; i < 3; i++)
+            {
+                info[i]     = 1.0 / (s[3 + i] * s[3 + i]);
+                info[3 + i] = 4.0 / (s[i] * s[i]);
+            }
+
+            const auto& m = bf->measured();
+            const auto  t = m.translation();
+            const auto  q = m.rotation().toQuaternion();
+            out(std::snprintf(
+                buf, sizeof(buf),
+                "EDGE_SE3:QUAT %lu %lu %.09g %.09g %.09g %.09g %.09g %.09g "
+                "%.09g %g 0 0 0 0 0 %g 0 0 0 0 %g 0 0 0 %g 0 0 %g 0 %g\n",
+                static_cast<unsigned long>(it_from->second),
+                static_cast<unsigned long>(it_to->second), t.x(), t.y(), t.z(),
+                q.x(), q.y(), q.z(), q.w(), info[0], info[1], info[2],
+                info[3], info[4], info[5]));
+        }
+    };
+
+    if (state_.isam2) write_edges(state_.isam2->getFactorsUnsafe());
+    write_edges(state_.newfactors);
+
+    // Absolute reference:
+    if (state_.root_kf_id != mola::INVALID_ID)
+        out(std::snprintf(
+            buf, sizeof(buf), "FIX %lu\n",
+            static_cast<unsigned long>(state_.root_kf_id)));
+
+    MRPT_END
+}
@@ -0,0 +1,561 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @file   ASLAM_gtsam_separators.cpp
+ * @brief  SLAM in absolute coordinates with GTSAM: multi-robot summaries
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 20, 2019
+ */
+
+#include <gtsam/inference/Symbol.h>  // X(), V() symbols
+#include <gtsam/slam/BetweenFactor.h>
+#include <mola-kernel/lock_helper.h>
+#include <mola-slam-gtsam/ASLAM_gtsam.h>
+#include <mola-slam-gtsam/gtsam_mola_bridge.h>
+
+#include <Eigen/QR>  // CompleteOrthogonalDecomposition
+#include <array>
+#include <set>
+#include <utility>
+#include <vector>
+
+using namespace mola;
+
+// How this works: each robot optimizes its own keyframes, in its own frame,
+// plus a copy of every peer keyframe referenced by an inter-robot
+// constraint, and the pose of the frame of each peer (frame_key()). The
+// copy is tied to the owner's estimate by a BetweenFactor from the peer
+// frame, with the mean and covariance of the owner's marginal, so the
+// frames are estimated from the inter-robot constraints. Marginals sent to
+// a peer are computed without the factors received from that same peer,
+// so no information is counted twice when the robots' constraint graph is
+// a tree (as in DDF-SAM). With loops among robots, estimates still
+// converge but are overconfident. Summaries carry per-keyframe marginals
+// only (no cross-covariances).
+//
+// All separator variables (own KFs with constraints, peer KF copies and
+// peer frames) are kept at the root of the live iSAM2 Bayes tree with a
+// constrained ordering. Their joint is then the product of the conditionals
+// of the few cliques on top, and the factors of a peer are subtracted from
+// it in information form, so the cost of a summary depends on the number
+// of separators, not on the size of the map.
+
+static const uint64_t PEER_KF_BITS = 40;
+
+namespace
+{
+/** (offset, dimension) of each variable in a dense information matrix */
+using DenseBlocks = std::map<gtsam::Key, std::pair<std::size_t, std::size_t>>;
+
+/** Adds `sign` times the augmented information matrix of `f` to `H`, the
+ * augmented information matrix of the variables in `blocks`, which must
+ * include those of `f` */
+void addAugmentedInformation(
+    const gtsam::GaussianFactor& f, const DenseBlocks& blocks,
+    gtsam::Matrix& H, const double sign)
+{
+    const gtsam::Matrix fH = f.augmentedInformation();
+
+    // (offset in fH, offset in H, dimension), the last one for the RHS:
+    std::vector<std::array<std::size_t, 3>> idx;
+    std::size_t                             o = 0;
+    for (auto it = f.begin(); it != f.end(); ++it)
+    {
+        const auto d = f.getDim(it);
+        idx.push_back({o, blocks.at(*it).first, d});
+        o += d;
+    }
+    idx.push_back({o, static_cast<std::size_t>(H.rows() - 1), 1});
+
+    for (const auto& i : idx)
+        for (const auto& j : idx)
+            H.block(i[1], j[1], i[2], j[2]) +=
+                sign * fH.block(i[0], j[0], i[2], j[2]);
+}
+}  // namespace
+
+gtsam::Key ASLAM_gtsam::peer_key(const uint32_t robot, const mola::id_t kf)
+{
+    ASSERT_LT_(kf, 1ULL << PEER_KF_BITS);
+    ASSERT_LT_(robot, 1U << 16);
+    return gtsam::Symbol(
+        'r', (static_cast<uint64_t>(robot) << PEER_KF_BITS) | kf);
+}
+
+gtsam::Key ASLAM_gtsam::frame_key(const uint32_t robot)
+{
+    return gtsam::Symbol('t', robot);
+}
+
+gtsam::Key ASLAM_gtsam::separator_key(
+    const uint32_t robot, const mola::id_t kf) const
+{
+    if (robot == static_cast<uint32_t>(params_.robot_id))
+        return gtsam::symbol_shorthand::X(kf);
+    return peer_key(robot, kf);
+}
+
+gtsam::KeySet ASLAM_gtsam::separator_keys() const
+{
+    const auto    me = static_cast<uint32_t>(params_.robot_id);
+    gtsam::KeySet keys;
+    for (const auto& c : separators_.constraints)
+    {
+        keys.insert(separator_key(c.robot_from, c.kf_from));
+        keys.insert(separator_key(c.robot_to, c.kf_to));
+        keys.insert(frame_key(c.robot_from == me ? c.robot_to : c.robot_from));
+    }
+    return keys;
+}
+
+// isam2_lock_ is locked from the caller site.
+void ASLAM_gtsam::separator_constrain(gtsam::ISAM2UpdateParams& up) const
+{
+    // Separators last, so they form the top of the tree. They are
+    // re-eliminated in every update, which only costs as much as that top.
+    // Variables of new factors right below them, as iSAM2 does by default.
+    gtsam::FastMap<gtsam::Key, int> groups;
+    gtsam::FastList<gtsam::Key>     reelim;
+    for (const auto k : separator_keys())
+    {
+        const bool in_solver = state_.isam2->valueExists(k);
+        if (!in_solver && !state_.newvalues.exists(k)) continue;
+        groups[k] = 2;
+        if (in_solver) reelim.push_back(k);
+    }
+    if (groups.empty()) return;
+
+    for (const auto& f : state_.newfactors)
+        if (f)
+            for (const auto k : f->keys()) groups.emplace(k, 1);
+    if (up.newAffectedKeys)
+        for (const auto& idx_keys : *up.newAffectedKeys)
+            for (const auto k : idx_keys.second) groups.emplace(k, 1);
+
+    up.constrainedKeys = groups;
+    up.extraReelimKeys = reelim;
+}
+
+void ASLAM_gtsam::addInterRobotFactor(
+    const mola::id_t kf, const uint32_t peer_robot, const mola::id_t peer_kf,
+    const mrpt::math::TPose3D& rel_pose, const double sigma_xyz,
+    const double sigma_rot)
+{
+    MRPT_START
+
+    ASSERTMSG_(
+        separators_.channel.is_open(),
+        "addInterRobotFactor() requires `robot_id>=0`");
+    ASSERT_NOT_EQUAL_(peer_robot, static_cast<uint32_t>(params_.robot_id));
+
+    InterRobotConstraint c;
+    c.robot_from = static_cast<uint32_t>(params_.robot_id);
+    c.kf_from    = kf;
+    c.robot_to   = peer_robot;
+    c.kf_to      = peer_kf;
+    c.rel_pose   = toPose3(rel_pose);
+    c.sigma_xyz  = sigma_xyz;
+    c.sigma_rot  = sigma_rot;
+
+    auto lock = lockHelper(isam2_lock_);
+    separator_add_constraint(c);
+
+    MRPT_END
+}
+
+ASLAM_gtsam::SeparatorStatus ASLAM_gtsam::separatorStatus()
+{
+    auto lock = lockHelper(isam2_lock_);
+
+    SeparatorStatus st  = separators_.status;
+    st.constraints      = separators_.constraints.size();
+    st.max_disagreement = 0;
+    for (const auto& d : separators_.disagreement)
+        st.max_disagreement = std::max(st.max_disagreement, d.second);
+    return st;
+}
+
+std::optional<mrpt::math::TPose3D> ASLAM_gtsam::peerFramePose(
+    const uint32_t peer)
+{
+    auto lock = lockHelper(isam2_lock_);
+
+    const auto key = frame_key(peer);
+    if (!state_.last_values.exists(key)) return {};
+    return toTPose3D(state_.last_values.at<gtsam::Pose3>(key));
+}
+
+// isam2_lock_ is locked from the caller site.
+void ASLAM_gtsam::separator_add_constraint(const InterRobotConstraint& c)
+{
+    MRPT_START
+
+    const auto me = static_cast<uint32_t>(params_.robot_id);
+    ASSERT_(c.robot_from == me || c.robot_to == me);
+
+    for (const auto& k : separators_.constraints)
+        if (k.sameEdge(c)) return;
+
+    const bool       peer_is_to = (c.robot_from == me);
+    const mola::id_t own_kf     = peer_is_to ? c.kf_from : c.kf_to;
+    if (state_.mola2gtsam.count(own_kf) == 0)
+    {
+        // It will be sent again in the next summary:
+        MRPT_LOG_WARN_STREAM(
+            "Inter-robot constraint with unknown local KF #" << own_kf
+                                                             << ", ignored.");
+        return;
+    }
+
+    const gtsam::Key k_from = separator_key(c.robot_from, c.kf_from);
+    const gtsam::Key k_to   = separator_key(c.robot_to, c.kf_to);
+    const gtsam::Key k_own  = peer_is_to ? k_from : k_to;
+    const gtsam::Key k_peer = peer_is_to ? k_to : k_from;
+
+    // Initial value of a new peer KF copy, from our own KF (its owner's
+    // summary will bring a better one):
+    if (!state_.isam2->valueExists(k_peer) && !state_.newvalues.exists(k_peer))
+    {
+        gtsam::Pose3 p_own;
+        if (state_.last_values.exists(k_own) || state_.newvalues.exists(k_own))
+            p_own = state_.at_new_or_last_values<gtsam::Pose3>(k_own);
+        else
+        {
+            worldmodel_->entities_lock_for_read();
+            p_own = toPose3(
+                mola::entity_get_pose(worldmodel_->entity_by_id(own_kf)));
+            worldmodel_->entities_unlock_for_read();
+        }
+        state_.newvalues.insert(
+            k_peer, peer_is_to ? p_own.compose(c.rel_pose)
+                               : p_own.compose(c.rel_pose.inverse()));
+    }
+
+    // Same noise model as FactorRelativePose3:
+    auto noise = gtsam::noiseModel::Diagonal::Sigmas(
+        (gtsam::Vector6() << c.sigma_rot, c.sigma_rot, c.sigma_rot,
+         c.sigma_xyz, c.sigma_xyz, c.sigma_xyz)
+            .finished());
+    auto robust_noise_model = gtsam::noiseModel::Robust::Create(
+        gtsam::noiseModel::mEstimator::Huber::Create(1.345), noise);
+
+    state_.newfactors.emplace_shared<gtsam::BetweenFactor<gtsam::Pose3>>(
+        k_from, k_to, c.rel_pose, robust_noise_model);
+
+    separators_.constraints.push_back(c);
+
+    MRPT_END
+}
+
+// isam2_lock_ is locked from the caller site.
+void ASLAM_gtsam::separator_receive()
+{
+    MRPT_START
+    ProfilerEntry tleg(profiler_, "separator_receive");
+
+    const auto me = static_cast<uint32_t>(params_.robot_id);
+    auto&      sp = separators_;
+
+    SeparatorSummary s;
+    while (sp.channel.receive(s))
+    {
+        if (s.robot_id == me) continue;
+        // Only the latest one from each peer matters:
+        if (const auto it = sp.last_seq.find(s.robot_id);
+            it != sp.last_seq.end() && s.seq <= it->second)
+            continue;
+        sp.last_seq[s.robot_id] = s.seq;
+        sp.status.received++;
+
+        for (const auto& c : s.constraints)
+            if (c.robot_from == me || c.robot_to == me)
+                separator_add_constraint(c);
+
+        const auto frame        = frame_key(s.robot_id);
+        double     disagreement = 0;
+        for (const auto& m : s.marginals)
+        {
+            // Only KFs we have a copy of:
+            const auto key = peer_key(s.robot_id, m.kf);
+            if (!state_.isam2->valueExists(key) &&
+                !state_.newvalues.exists(key))
+                continue;
+
+            // Initial value of the peer frame, from our copy of its KF:
+            if (!state_.isam2->valueExists(frame) &&
+                !state_.newvalues.exists(frame))
+                state_.newvalues.insert(
+                    frame,
+                    state_.at_new_or_last_values<gtsam::Pose3>(key).compose(
+                        m.mean.inverse()));
+
+            if (state_.last_values.exists(key) &&
+                state_.last_values.exists(frame))
+            {
+                const auto owner =
+                    state_.last_values.at<gtsam::Pose3>(frame).compose(
+                        m.estimate);
+                disagreement = std::max(
+                    disagreement,
+                    (state_.last_values.at<gtsam::Pose3>(key).translation() -
+                     owner.translation())
+                        .norm());
+            }
+
+            // The marginal is in the owner's frame, i.e. relative to our
+            // estimate of it. Replace the former one, if any:
+            auto prior =
+                boost::make_shared<gtsam::BetweenFactor<gtsam::Pose3>>(
+                    frame, key, m.mean,
+                    gtsam::noiseModel::Gaussian::Covariance(m.cov));
+
+            if (const auto it = sp.prior_index.find(key);
+                it != sp.prior_index.end())
+            {
+                sp.to_remove.push_back(it->second);
+                sp.prior_index.erase(it);
+            }
+            bool replaced = false;
+            for (const auto& idx_key : sp.pending_priors)
+            {
+                if (idx_key.second != key) continue;
+                state_.newfactors.replace(idx_key.first, prior);
+                replaced = true;
+                break;
+            }
+            if (!replaced)
+            {
+                sp.pending_priors[state_.newfactors.size()] = key;
+                state_.newfactors.push_back(prior);
+            }
+        }
+        sp.disagreement[s.robot_id] = disagreement;
+    }
+
+    MRPT_END
+}
+
+// isam2_lock_ is locked from the caller site.
+void ASLAM_gtsam::separator_on_update(const gtsam::ISAM2Result& res)
+{
+    auto& sp = separators_;
+    for (const auto& idx_key : sp.pending_priors)
+        sp.prior_index[idx_key.second] =
+            res.newFactorsIndices.at(idx_key.first);
+    sp.pending_priors.clear();
+}
+
+void ASLAM_gtsam::separator_send()
+{
+    MRPT_START
+
+    auto&      sp   = separators_;
+    const auto tNow = mrpt::Clock::now();
+    if (mrpt::system::timeDifference(sp.last_sent, tNow) <
+        params_.separator_exchange_period)
+        return;
+    sp.last_sent = tNow;
+
+    const auto me   = static_cast<uint32_t>(params_.robot_id);
+    auto       lock = lockHelper(isam2_lock_);
+
+    // Our separator KFs for each peer:
+    std::map<uint32_t, std::set<mola::id_t>> peer_seps;
+    for (const auto& c : sp.constraints)
+    {
+        if (c.robot_from == me)
+            peer_seps[c.robot_to].insert(c.kf_from);
+        else
+            peer_seps[c.robot_from].insert(c.kf_to);
+    }
+
+    if (peer_seps.empty()) return;
+
+    using gtsam::symbol_shorthand::X;
+
+    // The live iSAM2 is only read: the marginals come from the top of its
+    // Bayes tree, at its linearization point.
+    const auto& isam2   = *state_.isam2;
+    const auto& theta   = isam2.getLinearizationPoint();
+    const auto& factors = isam2.getFactorsUnsafe();
+
+    for (const auto& [peer, kfs] : peer_seps)
+    {
+        SeparatorSummary s;
+        s.robot_id = me;
+        s.seq      = ++sp.seq;
+
+        std::vector<gtsam::Key> sep_keys;
+        for (const auto kf : kfs)
+            if (theta.exists(X(kf))) sep_keys.push_back(X(kf));
+
+        if (!sep_keys.empty())
+        {
+            ProfilerEntry tle(profiler_, "separator_send.marginals");
+            const auto    t0 = mrpt::Clock::now();
+
+            // What we know from this peer, so it is not sent back, and the
+            // outdated factors pending removal:
+            std::set<gtsam::FactorIndex> skip(
+                sp.to_remove.begin(), sp.to_remove.end());
+            for (const auto& [key, idx] : sp.prior_index)
+                if ((gtsam::Symbol(key).index() >> PEER_KF_BITS) == peer)
+                    skip.insert(idx);
+
+            // Top of the tree: the cliques of the separators and of the
+            // variables of the skipped factors, and their ancestors. The
+            // product of their conditionals is the joint of their variables.
+            std::set<gtsam::ISAM2::sharedClique> top;
+
+            const auto addCliques = [&](const gtsam::Key k) {
+                auto c = isam2[k];
+                while (c && top.insert(c).second) c = c->parent();
+            };
+            for (const auto k : sep_keys) addCliques(k);
+            for (const auto i : skip)
+                if (factors.at(i))
+                    for (const auto k : factors[i]->keys()) addCliques(k);
+
+            // Dense joint information, separators first:
+            DenseBlocks blocks;
+            std::size_t n = 0;
+            for (const auto k : sep_keys)
+            {
+                blocks[k] = {n, 6};
+                n += 6;
+            }
+            const std::size_t nS = n;
+            for (const auto& c : top)
+            {
+                const auto& cond = *c->conditional();
+                for (auto it = cond.beginFrontals(); it != cond.endFrontals();
+                     ++it)
+                    if (blocks.emplace(*it, std::make_pair(n, cond.getDim(it)))
+                            .second)
+                        n += cond.getDim(it);
+            }
+
+            gtsam::Matrix H = gtsam::Matrix::Zero(n + 1, n + 1);
+            for (const auto& c : top)
+                addAugmentedInformation(*c->conditional(), blocks, H, +1);
+            // ...minus the peer's (downdate, instead of refactorizing):
+            for (const auto i : skip)
+                if (factors.at(i))
+                    addAugmentedInformation(
+                        *factors[i]->linearize(theta), blocks, H, -1);
+
+            // Marginal of the separators (Schur complement). Variables known
+            // only from the peer have no information left, hence the
+            // pseudo-inverse:
+            gtsam::Matrix Lambda = H.topLeftCorner(nS, nS);
+            gtsam::Vector eta    = H.block(0, n, nS, 1);
+            if (n > nS)
+            {
+                const auto   nR  = n - nS;
+                const auto   LSR = H.block(0, nS, nS, nR);
+                const Eigen::CompleteOrthogonalDecomposition<gtsam::Matrix>
+                    LRR(H.block(nS, nS, nR, nR));
+                Lambda -= LSR * LRR.solve(gtsam::Matrix(LSR.transpose()));
+                eta -= LSR * LRR.solve(gtsam::Vector(H.block(nS, n, nR, 1)));
+            }
+            const gtsam::Matrix cov   = Lambda.inverse();
+            const gtsam::Vector delta = cov * eta;
+
+            for (std::size_t i = 0; i < sep_keys.size(); i++)
+            {
+                const auto                 key = sep_keys[i];
+                SeparatorSummary::Marginal m;
+                m.kf       = gtsam::Symbol(key).index();
+                m.estimate = isam2.calculateEstimate<gtsam::Pose3>(key);
+                m.mean     = theta.at<gtsam::Pose3>(key).retract(
+                    delta.segment<6>(6 * i));
+                m.cov = cov.block<6, 6>(6 * i, 6 * i);
+                s.marginals.push_back(m);
+            }
+
+            const double dt =
+                mrpt::system::timeDifference(t0, mrpt::Clock::now());
+            sp.status.marginals_time += dt;
+            sp.status.last_marginals_time = dt;
+            sp.status.last_marginals_dim  = n;
+        }
+
+        for (const auto& c : sp.constraints)
+            if (c.robot_from == peer || c.robot_to == peer)
+                s.constraints.push_back(c);
+
+        if (sp.channel.send(peer, s)) sp.status.sent++;
+    }
+
+    MRPT_END
+}
+
+// isam2_lock_ is locked from the caller site.
+void ASLAM_gtsam::separator_reindex()
+{
+    MRPT_START
+
+    const auto me = static_cast<uint32_t>(params_.robot_id);
+    auto&      sp = separators_;
+
+    // Decodes a KF key into (robot, kf):
+    const auto decode = [&](const gtsam::Key k, uint32_t& robot,
+                            mola::id_t& kf) {
+        const gtsam::Symbol sym(k);
+        if (sym.chr() == 'r')
+        {
+            robot = static_cast<uint32_t>(sym.index() >> PEER_KF_BITS);
+            kf    = sym.index() & ((1ULL << PEER_KF_BITS) - 1);
+            return true;
+        }
+        robot = me;
+        kf    = sym.index();
+        return false;
+    };
+
+    sp.constraints.clear();
+    sp.prior_index.clear();
+    sp.pending_priors.clear();
+
+    const auto& factors = state_.isam2->getFactorsUnsafe();
+    for (std::size_t i = 0; i < factors.size(); i++)
+    {
+        if (!factors[i]) continue;
+        const auto bf =
+            boost::dynamic_pointer_cast<gtsam::BetweenFactor<gtsam::Pose3>>(
+                factors[i]);
+        if (!bf) continue;
+
+        // Factors from summaries hang from the peer frame:
+        if (gtsam::Symbol(bf->key1()).chr() == 't')
+        {
+            sp.prior_index[bf->key2()] = i;
+            continue;
+        }
+
+        InterRobotConstraint c;
+
+        const bool peer1 = decode(bf->key1(), c.robot_from, c.kf_from);
+        const bool peer2 = decode(bf->key2(), c.robot_to, c.kf_to);
+        if (!peer1 && !peer2) continue;
+
+        c.rel_pose = bf->measured();
+        auto nm    = bf->noiseModel();
+        if (const auto r =
+                boost::dynamic_pointer_cast<gtsam::noiseModel::Robust>(nm))
+            nm = r->noise();
+        if (const auto d =
+                boost::dynamic_pointer_cast<gtsam::noiseModel::Diagonal>(nm))
+        {
+            c.sigma_rot = d->sigma(0);
+            c.sigma_xyz = d->sigma(3);
+        }
+        sp.constraints.push_back(c);
+    }
+
+    MRPT_END
+}
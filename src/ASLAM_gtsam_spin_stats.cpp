@@ -0,0 +1,128 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   ASLAM_gtsam_spin_stats.cpp
+ * @brief  ASLAM_gtsam: per-spin solver statistics
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 20, 2019
+ */
+
+#include <mola-slam-gtsam/ASLAM_gtsam.h>
+#include <mrpt/system/datetime.h>
+
+#include <algorithm>
+#include <fstream>
+
+using namespace mola;
+
+namespace
+{
+constexpr auto NUM_FACTOR_KINDS =
+    static_cast<std::size_t>(ASLAM_gtsam::FactorKind::Count);
+
+std::string kind_name(const std::size_t k)
+{
+    return mrpt::typemeta::TEnumType<ASLAM_gtsam::FactorKind>::value2name(
+        static_cast<ASLAM_gtsam::FactorKind>(k));
+}
+}  // namespace
+
+void ASLAM_gtsam::spin_stats_add(const SpinStats& st)
+{
+    MRPT_START
+
+    const std::size_t capacity = static_cast<std::size_t>(
+        std::max(0, params_.spin_stats_capacity));
+    {
+        std::lock_guard<std::mutex> lck(spin_stats_mtx_);
+        const auto                  spin = spin_count_++;
+        if (capacity > 0)
+        {
+            spin_stats_.push_back(st);
+            spin_stats_.back().spin = spin;
+            while (spin_stats_.size() > capacity) spin_stats_.pop_front();
+        }
+    }
+
+    // Summary in the profiler (only spins in which the solver ran):
+    if (!st.solved || !profiler_.isEnabled()) return;
+    profiler_.registerUserMeasure(
+        "spinOnce.stats.new_factors", st.new_factors);
+    profiler_.registerUserMeasure(
+        "spinOnce.stats.variables_reeliminated", st.variables_reeliminated);
+    profiler_.registerUserMeasure(
+        "spinOnce.stats.variables_relinearized", st.variables_relinearized);
+    profiler_.registerUserMeasure(
+        "spinOnce.stats.variables_total", st.variables_total);
+    profiler_.registerUserMeasure("spinOnce.stats.cliques", st.cliques);
+    profiler_.registerUserMeasure(
+        "spinOnce.stats.writeback", st.t_writeback, true /*is_time*/);
+
+    if (!params_.factor_cost_stats) return;
+    for (std::size_t k = 0; k < st.factor_costs.size(); k++)
+    {
+        const auto& c = st.factor_costs[k];
+        if (!c.linearized && c.elimination_flops == 0) continue;
+        const std::string kind = kind_name(k);
+        profiler_.registerUserMeasure(
+            ("spinOnce.linearize." + kind).c_str(), c.t_linearize,
+            true /*is_time*/);
+        profiler_.registerUserMeasure(
+            ("spinOnce.stats.linearized." + kind).c_str(), c.linearized);
+        profiler_.registerUserMeasure(
+            ("spinOnce.stats.elimination_mflops." + kind).c_str(),
+            c.elimination_flops * 1e-6);
+    }
+
+    MRPT_END
+}
+
+std::vector<ASLAM_gtsam::SpinStats> ASLAM_gtsam::spin_stats()
+{
+    std::lock_guard<std::mutex> lck(spin_stats_mtx_);
+    return {spin_stats_.begin(), spin_stats_.end()};
+}
+
+void ASLAM_gtsam::saveSpinStatsCSV(const std::string& file)
+{
+    MRPT_START
+
+    std::ofstream f(file);
+    if (!f.is_open())
+        THROW_EXCEPTION_FMT("Cannot write: `%s`", file.c_str());
+
+    f << "spin,timestamp,solved,new_factors,removed_factors,new_variables,"
+         "variables_reeliminated,variables_relinearized,"
+         "factors_recalculated,cliques,variables_total,error_before,"
+         "error_after,t_update,t_estimate,t_writeback,t_total";
+    // Per kind of factor, all zero unless factor_cost_stats is enabled:
+    for (std::size_t k = 0; k < NUM_FACTOR_KINDS; k++)
+    {
+        const auto kind = kind_name(k);
+        f << ",linearized_" << kind << ",t_linearize_" << kind
+          << ",elimination_flops_" << kind;
+    }
+    f << "\n";
+    f.precision(9);
+
+    for (const auto& s : spin_stats())
+    {
+        f << s.spin << "," << mrpt::Clock::toDouble(s.timestamp) << ","
+          << (s.solved ? 1 : 0) << "," << s.new_factors << ","
+          << s.removed_factors << "," << s.new_variables << ","
+          << s.variables_reeliminated << "," << s.variables_relinearized
+          << "," << s.factors_recalculated << "," << s.cliques << ","
+          << s.variables_total << "," << s.error_before << ","
+          << s.error_after << "," << s.t_update << "," << s.t_estimate << ","
+          << s.t_writeback << "," << s.t_total;
+        for (const auto& c : s.factor_costs)
+            f << "," << c.linearized << "," << c.t_linearize << ","
+              << c.elimination_flops;
+        f << "\n";
+    }
+
+    MRPT_END
+}
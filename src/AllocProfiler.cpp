@@ -0,0 +1,286 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   AllocProfiler.cpp
+ * @brief  Heap allocation counters per named scope
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 20, 2019
+ */
+
+#include <mola-slam-gtsam/AllocProfiler.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+
+#if defined(_WIN32)
+#include <malloc.h>  // _aligned_malloc()
+#endif
+
+using namespace mola;
+
+namespace
+{
+struct Site
+{
+    std::atomic<uint64_t> calls{0}, allocs{0}, bytes{0};
+};
+
+struct StrLess
+{
+    bool operator()(const char* a, const char* b) const
+    {
+        return std::strcmp(a, b) < 0;
+    }
+};
+
+struct Registry
+{
+    std::mutex mtx;
+    /** Keyed by the scope names, which outlive the registry */
+    std::map<const char*, std::unique_ptr<Site>, StrLess> sites;
+    std::chrono::steady_clock::time_point                 t0{};
+    bool                                                  started{false};
+};
+
+Registry& registry()
+{
+    static Registry r;
+    return r;
+}
+
+std::atomic<uint64_t> total_allocs{0}, total_bytes{0};
+
+#if defined(MOLA_SLAM_GTSAM_ALLOC_PROFILING)
+// Trivially-initialized, hence safe to use from within operator new:
+thread_local Site* current_site = nullptr;
+
+void count_alloc(const std::size_t n)
+{
+    total_allocs.fetch_add(1, std::memory_order_relaxed);
+    total_bytes.fetch_add(n, std::memory_order_relaxed);
+    if (Site* s = current_site)
+    {
+        s->allocs.fetch_add(1, std::memory_order_relaxed);
+        s->bytes.fetch_add(n, std::memory_order_relaxed);
+    }
+}
+
+void* counted_malloc(const std::size_t n)
+{
+    count_alloc(n);
+    return std::malloc(n ? n : 1);
+}
+
+void* counted_aligned_malloc(const std::size_t n, const std::align_val_t al)
+{
+    count_alloc(n);
+    const auto a = std::max(static_cast<std::size_t>(al), sizeof(void*));
+#if defined(_WIN32)
+    return _aligned_malloc(n ? n : 1, a);
+#else
+    void* p = nullptr;
+    return ::posix_memalign(&p, a, n ? n : 1) == 0 ? p : nullptr;
+#endif
+}
+
+void aligned_free(void* p) noexcept
+{
+#if defined(_WIN32)
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+#endif
+}  // namespace
+
+#if defined(MOLA_SLAM_GTSAM_ALLOC_PROFILING)
+// Replacement of the global allocation functions:
+void* operator new(std::size_t n)
+{
+    if (void* p = counted_malloc(n)) return p;
+    throw std::bad_alloc();
+}
+void* operator new[](std::size_t n)
+{
+    if (void* p = counted_malloc(n)) return p;
+    throw std::bad_alloc();
+}
+void* operator new(std::size_t n, const std::nothrow_t&) noexcept
+{
+    return counted_malloc(n);
+}
+void* operator new[](std::size_t n, const std::nothrow_t&) noexcept
+{
+    return counted_malloc(n);
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+    std::free(p);
+}
+
+// Over-aligned types (alignof > __STDCPP_DEFAULT_NEW_ALIGNMENT__):
+void* operator new(std::size_t n, std::align_val_t al)
+{
+    if (void* p = counted_aligned_malloc(n, al)) return p;
+    throw std::bad_alloc();
+}
+void* operator new[](std::size_t n, std::align_val_t al)
+{
+    if (void* p = counted_aligned_malloc(n, al)) return p;
+    throw std::bad_alloc();
+}
+void* operator new(
+    std::size_t n, std::align_val_t al, const std::nothrow_t&) noexcept
+{
+    return counted_aligned_malloc(n, al);
+}
+void* operator new[](
+    std::size_t n, std::align_val_t al, const std::nothrow_t&) noexcept
+{
+    return counted_aligned_malloc(n, al);
+}
+void operator delete(void* p, std::align_val_t) noexcept { aligned_free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { aligned_free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept
+{
+    aligned_free(p);
+}
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept
+{
+    aligned_free(p);
+}
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept
+{
+    aligned_free(p);
+}
+void operator delete[](
+    void* p, std::align_val_t, const std::nothrow_t&) noexcept
+{
+    aligned_free(p);
+}
+
+AllocScope::AllocScope(const char* name) : prev_(current_site)
+{
+    // Registry bookkeeping is not attributed to any scope:
+    current_site = nullptr;
+
+    Site* s;
+    {
+        auto&                       r = registry();
+        std::lock_guard<std::mutex> lck(r.mtx);
+        if (!r.started)
+        {
+            r.t0      = std::chrono::steady_clock::now();
+            r.started = true;
+        }
+        auto& site = r.sites[name];
+        if (!site) site = std::make_unique<Site>();
+        s = site.get();
+    }
+    s->calls.fetch_add(1, std::memory_order_relaxed);
+    current_site = s;
+}
+
+AllocScope::~AllocScope() { current_site = static_cast<Site*>(prev_); }
+
+bool AllocProfiler::available() { return true; }
+#else
+AllocScope::AllocScope(const char*) : prev_(nullptr) {}
+AllocScope::~AllocScope() {}
+
+bool AllocProfiler::available() { return false; }
+#endif
+
+std::map<std::string, AllocProfiler::Counters> AllocProfiler::scopes()
+{
+    std::map<std::string, Counters> ret;
+
+    auto&                       r = registry();
+    std::lock_guard<std::mutex> lck(r.mtx);
+    for (const auto& s : r.sites)
+    {
+        auto& c  = ret[s.first];
+        c.calls  = s.second->calls.load(std::memory_order_relaxed);
+        c.allocs = s.second->allocs.load(std::memory_order_relaxed);
+        c.bytes  = s.second->bytes.load(std::memory_order_relaxed);
+    }
+    return ret;
+}
+
+AllocProfiler::Counters AllocProfiler::totals()
+{
+    Counters c;
+    c.allocs = total_allocs.load(std::memory_order_relaxed);
+    c.bytes  = total_bytes.load(std::memory_order_relaxed);
+    return c;
+}
+
+double AllocProfiler::elapsed()
+{
+    auto&                       r = registry();
+    std::lock_guard<std::mutex> lck(r.mtx);
+    if (!r.started) return 0;
+    return std::chrono::duration<double>(
+               std::chrono::steady_clock::now() - r.t0)
+        .count();
+}
+
+void AllocProfiler::reset()
+{
+    auto&                       r = registry();
+    std::lock_guard<std::mutex> lck(r.mtx);
+    for (auto& s : r.sites)
+    {
+        s.second->calls  = 0;
+        s.second->allocs = 0;
+        s.second->bytes  = 0;
+    }
+    total_allocs = 0;
+    total_bytes  = 0;
+    r.t0         = std::chrono::steady_clock::now();
+    r.started    = true;
+}
+
+void AllocProfiler::toJSON(std::ostream& o)
+{
+    const double dt  = elapsed();
+    const auto   per = [](const uint64_t n, const double d) {
+        return d > 0 ? n / d : 0.0;
+    };
+    const auto write = [&](const Counters& c) {
+        o << "{\"calls\": " << c.calls << ", \"allocs\": " << c.allocs
+          << ", \"bytes\": " << c.bytes
+          << ", \"allocs_per_call\": " << per(c.allocs, c.calls)
+          << ", \"bytes_per_call\": " << per(c.bytes, c.calls)
+          << ", \"allocs_per_s\": " << per(c.allocs, dt)
+          << ", \"bytes_per_s\": " << per(c.bytes, dt) << "}";
+    };
+
+    o << "{\"available\": " << (available() ? "true" : "false")
+      << ", \"elapsed_s\": " << dt << ",\n\"scopes\": {";
+    bool first = true;
+    for (const auto& s : scopes())
+    {
+        o << (first ? "\n" : ",\n") << "\"" << s.first << "\": ";
+        write(s.second);
+        first = false;
+    }
+    o << "},\n\"total\": ";
+    write(totals());
+    o << "}";
+}
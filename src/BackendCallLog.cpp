@@ -0,0 +1,701 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   BackendCallLog.cpp
+ * @brief  Binary record & replay of back-end API calls
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 16, 2019
+ */
+
+#include <mola-kernel/variant_helper.h>  // overloaded{}
+#include <mola-slam-gtsam/ASLAM_gtsam.h>
+#include <mola-slam-gtsam/BackendCallLog.h>
+#include <mola-slam-gtsam/variant_serialization.h>
+#include <mrpt/io/CMemoryStream.h>
+#include <mrpt/obs/CSensoryFrame.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <thread>
+
+using namespace mola;
+
+static const char LOG_MAGIC[8] = {'M', 'O', 'L', 'A', 'B', 'C', 'L', '1'};
+static const std::size_t RECORD_HDR_SIZE = 1 + 4 + 8 + 8;
+static const std::size_t FLUSH_THRESHOLD = 1024 * 1024;
+
+namespace
+{
+std::vector<uint8_t> toBytes(mrpt::io::CMemoryStream& mem)
+{
+    const auto* p = static_cast<const uint8_t*>(mem.getRawBufferData());
+    return std::vector<uint8_t>(p, p + mem.getTotalBytesCount());
+}
+
+void writePose(mrpt::serialization::CArchive& a, const mrpt::math::TPose3D& p)
+{
+    for (int i = 0; i < 6; i++) a << p[i];
+}
+void readPose(mrpt::serialization::CArchive& a, mrpt::math::TPose3D& p)
+{
+    for (int i = 0; i < 6; i++) a >> p[i];
+}
+}  // namespace
+
+const char* mola::backendCallName(BackendCall c)
+{
+    switch (c)
+    {
+        case BackendCall::AddKeyFrame:
+            return "doAddKeyFrame";
+        case BackendCall::AddFactor:
+            return "doAddFactor";
+        case BackendCall::SmartStereoObservation:
+            return "onSmartFactorChanged";
+        case BackendCall::AdvertiseUpdatedLocalization:
+            return "doAdvertiseUpdatedLocalization";
+        case BackendCall::SpinOnce:
+            return "spinOnce";
+        case BackendCall::StartNewMap:
+            return "startNewMap";
+        case BackendCall::CallResult:
+            return "(call result)";
+        case BackendCall::CallAborted:
+            return "(call aborted)";
+        case BackendCall::DefineStereoCamera:
+            return "temp_createStereoCamera";
+        case BackendCall::CreateLandmark:
+            return "temp_createLandmark";
+    };
+    return "(unknown)";
+}
+
+// ------------------------------------------------------------------------
+//  BackendCallRecorder
+// ------------------------------------------------------------------------
+BackendCallRecorder::~BackendCallRecorder()
+{
+    try
+    {
+        close();
+    }
+    catch (...)
+    {
+    }
+}
+
+void BackendCallRecorder::open(const std::string& fileName)
+{
+    open(fileName, std::chrono::steady_clock::now());
+}
+
+void BackendCallRecorder::open(
+    const std::string&                           fileName,
+    const std::chrono::steady_clock::time_point& time_origin)
+{
+    MRPT_START
+    close();
+
+    std::lock_guard<std::mutex> lck(mtx_);
+
+    f_ = std::fopen(fileName.c_str(), "wb");
+    ASSERTMSG_(
+        f_ != nullptr,
+        mrpt::format("Cannot create call log: `%s`", fileName.c_str()));
+
+    t0_ = time_origin;
+    buf_.assign(LOG_MAGIC, sizeof(LOG_MAGIC));
+    written_ = 0;
+    MRPT_END
+}
+
+void BackendCallRecorder::close()
+{
+    std::lock_guard<std::mutex> lck(mtx_);
+    if (!f_) return;
+    flush_nolock();
+    std::fclose(f_);
+    f_ = nullptr;
+}
+
+void BackendCallRecorder::flush()
+{
+    std::lock_guard<std::mutex> lck(mtx_);
+    flush_nolock();
+}
+
+void BackendCallRecorder::flush_nolock()
+{
+    if (!f_) return;
+    if (!buf_.empty())
+    {
+        const auto n = std::fwrite(buf_.data(), 1, buf_.size(), f_);
+        ASSERT_EQUAL_(n, buf_.size());
+        written_ += n;
+        buf_.clear();
+    }
+    std::fflush(f_);
+    onFlushed();
+}
+
+uint64_t BackendCallRecorder::bytes() const
+{
+    std::lock_guard<std::mutex> lck(mtx_);
+    return written_ + buf_.size();
+}
+
+double BackendCallRecorder::now() const
+{
+    return std::chrono::duration<double>(
+               std::chrono::steady_clock::now() - t0_)
+        .count();
+}
+
+void BackendCallRecorder::append(
+    BackendCall call, double t_start, const std::vector<uint8_t>& payload)
+{
+    const double duration = now() - t_start;
+
+    std::lock_guard<std::mutex> lck(mtx_);
+    if (!f_) return;
+
+    char           hdr[RECORD_HDR_SIZE];
+    const uint32_t len = static_cast<uint32_t>(payload.size());
+    hdr[0]             = static_cast<char>(call);
+    std::memcpy(hdr + 1, &len, 4);
+    std::memcpy(hdr + 5, &t_start, 8);
+    std::memcpy(hdr + 13, &duration, 8);
+
+    buf_.append(hdr, RECORD_HDR_SIZE);
+    buf_.append(reinterpret_cast<const char*>(payload.data()), payload.size());
+
+    if (buf_.size() > FLUSH_THRESHOLD) flush_nolock();
+}
+
+void BackendCallRecorder::recordAddKeyFrame(
+    const double t_start, const mrpt::Clock::time_point& timestamp,
+    const mrpt::obs::CSensoryFrame* obs,
+    const BackEndBase::ProposeKF_Output& o)
+{
+    if (!is_open()) return;
+
+    mrpt::io::CMemoryStream mem;
+    auto                    a = mrpt::serialization::archiveFrom(mem);
+    a.WriteAs<uint64_t>(o.new_kf_id ? o.new_kf_id.value() : mola::INVALID_ID);
+    a.WriteAs<int64_t>(timestamp.time_since_epoch().count());
+    a.WriteAs<uint8_t>(obs ? 1 : 0);
+    if (obs) a << *obs;
+
+    append(BackendCall::AddKeyFrame, t_start, toBytes(mem));
+}
+
+void BackendCallRecorder::recordAddFactor(
+    const double t_start, const Factor& f,
+    const BackEndBase::AddFactor_Output& o)
+{
+    if (!is_open()) return;
+
+    mrpt::io::CMemoryStream mem;
+    auto                    a = mrpt::serialization::archiveFrom(mem);
+    a.WriteAs<uint64_t>(o.new_factor_id);
+    writeVariant(a, f);
+
+    append(BackendCall::AddFactor, t_start, toBytes(mem));
+}
+
+void BackendCallRecorder::recordSmartStereoObservation(
+    const double t_start, const mola::fid_t factor_id,
+    const mola::id_t observing_kf, const double x_left, const double x_right,
+    const double y)
+{
+    if (!is_open()) return;
+
+    mrpt::io::CMemoryStream mem;
+    auto                    a = mrpt::serialization::archiveFrom(mem);
+    a.WriteAs<uint64_t>(factor_id);
+    a.WriteAs<uint64_t>(observing_kf);
+    a << x_left << x_right << y;
+
+    append(BackendCall::SmartStereoObservation, t_start, toBytes(mem));
+}
+
+void BackendCallRecorder::recordAdvertiseUpdatedLocalization(
+    const double                                           t_start,
+    const BackEndBase::AdvertiseUpdatedLocalization_Input& l)
+{
+    if (!is_open()) return;
+
+    mrpt::io::CMemoryStream mem;
+    auto                    a = mrpt::serialization::archiveFrom(mem);
+    a.WriteAs<int64_t>(l.timestamp.time_since_epoch().count());
+    a.WriteAs<uint64_t>(l.reference_kf);
+    writePose(a, l.pose);
+
+    append(BackendCall::AdvertiseUpdatedLocalization, t_start, toBytes(mem));
+}
+
+void BackendCallRecorder::recordSpinOnce(const double t_start)
+{
+    if (!is_open()) return;
+    append(BackendCall::SpinOnce, t_start, {});
+}
+
+void BackendCallRecorder::recordStartNewMap(const double t_start)
+{
+    if (!is_open()) return;
+    append(BackendCall::StartNewMap, t_start, {});
+}
+
+void BackendCallRecorder::recordDefineStereoCamera(
+    const double t_start, const mrpt::img::TCamera& left,
+    const mrpt::img::TCamera& right, const double baseline)
+{
+    if (!is_open()) return;
+
+    mrpt::io::CMemoryStream mem;
+    auto                    a = mrpt::serialization::archiveFrom(mem);
+    a << left << right << baseline;
+
+    append(BackendCall::DefineStereoCamera, t_start, toBytes(mem));
+}
+
+void BackendCallRecorder::recordCreateLandmark(
+    const double t_start, const mrpt::math::TPoint3D& init_value,
+    const mola::id_t new_id)
+{
+    if (!is_open()) return;
+
+    mrpt::io::CMemoryStream mem;
+    auto                    a = mrpt::serialization::archiveFrom(mem);
+    a.WriteAs<uint64_t>(new_id);
+    a << init_value.x << init_value.y << init_value.z;
+
+    append(BackendCall::CreateLandmark, t_start, toBytes(mem));
+}
+
+void BackendCallRecorder::recordCallResult(
+    const double t_start, const uint64_t result_id)
+{
+    if (!is_open()) return;
+
+    mrpt::io::CMemoryStream mem;
+    auto                    a = mrpt::serialization::archiveFrom(mem);
+    a.WriteAs<uint64_t>(result_id);
+
+    append(BackendCall::CallResult, t_start, toBytes(mem));
+}
+
+void BackendCallRecorder::recordCallAborted(const double t_start)
+{
+    if (!is_open()) return;
+    append(BackendCall::CallAborted, t_start, {});
+}
+
+// ------------------------------------------------------------------------
+//  BackendCallReader
+// ------------------------------------------------------------------------
+void BackendCallReader::open(const std::string& fileName)
+{
+    MRPT_START
+    file_.open(fileName);
+    ASSERTMSG_(
+        file_.size() >= sizeof(LOG_MAGIC) &&
+            0 == std::memcmp(file_.data(), LOG_MAGIC, sizeof(LOG_MAGIC)),
+        mrpt::format("Not a back-end call log: `%s`", fileName.c_str()));
+    pos_ = sizeof(LOG_MAGIC);
+    MRPT_END
+}
+
+bool BackendCallReader::next(BackendCallRecord& r)
+{
+    MRPT_START
+
+    if (pos_ + RECORD_HDR_SIZE > file_.size()) return false;
+
+    const uint8_t* hdr = file_.data() + pos_;
+    uint32_t       len;
+    r.call = static_cast<BackendCall>(hdr[0]);
+    std::memcpy(&len, hdr + 1, 4);
+    std::memcpy(&r.wall_time, hdr + 5, 8);
+    std::memcpy(&r.duration, hdr + 13, 8);
+
+    // Truncated record?
+    if (pos_ + RECORD_HDR_SIZE + len > file_.size()) return false;
+
+    mrpt::io::CMemoryStream mem;
+    mem.assignMemoryNotOwn(hdr + RECORD_HDR_SIZE, len);
+    auto a = mrpt::serialization::archiveFrom(mem);
+
+    r.result_id = mola::INVALID_ID;
+    switch (r.call)
+    {
+        case BackendCall::AddKeyFrame:
+        {
+            r.result_id = a.ReadAs<uint64_t>();
+            r.kf        = BackEndBase::ProposeKF_Input();
+            r.kf.timestamp = mrpt::Clock::time_point(
+                mrpt::Clock::duration(a.ReadAs<int64_t>()));
+            r.kf_observations.reset();
+            if (a.ReadAs<uint8_t>())
+                r.kf_observations = a.ReadObject<mrpt::obs::CSensoryFrame>();
+        }
+        break;
+        case BackendCall::AddFactor:
+        {
+            r.result_id = a.ReadAs<uint64_t>();
+            readVariant(a, r.factor);
+        }
+        break;
+        case BackendCall::SmartStereoObservation:
+        {
+            auto& so        = r.stereo_obs;
+            so.factor_id    = a.ReadAs<uint64_t>();
+            so.observing_kf = a.ReadAs<uint64_t>();
+            a >> so.x_left >> so.x_right >> so.y;
+        }
+        break;
+        case BackendCall::AdvertiseUpdatedLocalization:
+        {
+            r.loc = BackEndBase::AdvertiseUpdatedLocalization_Input();
+            r.loc.timestamp = mrpt::Clock::time_point(
+                mrpt::Clock::duration(a.ReadAs<int64_t>()));
+            r.loc.reference_kf = a.ReadAs<uint64_t>();
+            readPose(a, r.loc.pose);
+        }
+        break;
+        case BackendCall::SpinOnce:
+        case BackendCall::StartNewMap:
+            break;
+        case BackendCall::DefineStereoCamera:
+        {
+            auto& sc = r.stereo_camera;
+            a >> sc.left >> sc.right >> sc.baseline;
+        }
+        break;
+        case BackendCall::CreateLandmark:
+        {
+            r.result_id = a.ReadAs<uint64_t>();
+            a >> r.landmark.x >> r.landmark.y >> r.landmark.z;
+        }
+        break;
+        case BackendCall::CallResult:
+        case BackendCall::CallAborted:
+        {
+            // Orphan result or abort marker (the former record was not a
+            // call returning an ID, or was dropped already): skip it.
+            pos_ += RECORD_HDR_SIZE + len;
+            return next(r);
+        }
+        default:
+            THROW_EXCEPTION_FMT(
+                "Corrupted call log: unknown record type %u at offset %zu",
+                static_cast<unsigned>(hdr[0]), pos_);
+    };
+
+    pos_ += RECORD_HDR_SIZE + len;
+
+    // Call recorded before being applied? Then its result follows it:
+    if (r.result_id == mola::INVALID_ID &&
+        (r.call == BackendCall::AddKeyFrame ||
+         r.call == BackendCall::AddFactor ||
+         r.call == BackendCall::CreateLandmark) &&
+        pos_ + RECORD_HDR_SIZE <= file_.size() &&
+        file_.data()[pos_] == static_cast<uint8_t>(BackendCall::CallResult))
+    {
+        const uint8_t* rhdr = file_.data() + pos_;
+        uint32_t       rlen;
+        std::memcpy(&rlen, rhdr + 1, 4);
+        if (rlen == sizeof(uint64_t) &&
+            pos_ + RECORD_HDR_SIZE + rlen <= file_.size())
+        {
+            std::memcpy(&r.duration, rhdr + 13, 8);
+            std::memcpy(&r.result_id, rhdr + RECORD_HDR_SIZE, 8);
+            pos_ += RECORD_HDR_SIZE + rlen;
+        }
+    }
+
+    // Call that threw while being applied? Then drop it. (Calls are
+    // journaled and applied atomically, so the marker follows the call):
+    if (pos_ + RECORD_HDR_SIZE <= file_.size() &&
+        file_.data()[pos_] == static_cast<uint8_t>(BackendCall::CallAborted))
+    {
+        uint32_t alen;
+        std::memcpy(&alen, file_.data() + pos_ + 1, 4);
+        pos_ += RECORD_HDR_SIZE + alen;
+        return next(r);
+    }
+    return true;
+
+    MRPT_END
+}
+
+// ------------------------------------------------------------------------
+//  Replay
+// ------------------------------------------------------------------------
+BackendReplayStats mola::replayBackendCalls(
+    BackendCallReader& log, BackEndBase& backend,
+    const BackendReplayOptions& opts)
+{
+    return replayBackendCalls(
+        [&log](BackendCallRecord& r) { return log.next(r); }, backend, opts);
+}
+
+namespace
+{
+/** Recorded => replayed IDs. Unknown IDs are left untouched. */
+template <typename ID>
+ID translateId(const std::map<uint64_t, uint64_t>& m, const ID id)
+{
+    const auto it = m.find(id);
+    return it == m.end() ? id : static_cast<ID>(it->second);
+}
+}  // namespace
+
+BackendReplayStats mola::replayBackendCalls(
+    const BackendCallSource& next, BackEndBase& backend,
+    const BackendReplayOptions& opts)
+{
+    MRPT_START
+
+    using clock = std::chrono::steady_clock;
+
+    BackendReplayStats stats;
+    auto* aslam = dynamic_cast<ASLAM_gtsam*>(&backend);
+
+    // IDs returned in this replay may differ from the recorded ones (e.g.
+    // another back-end, or synthetic records), so references are
+    // translated:
+    auto&                        kf_ids = stats.kf_ids;
+    std::map<uint64_t, uint64_t> lm_ids, factor_ids;
+
+    const auto t_begin = clock::now();
+    BackendCallRecord r;
+    while (next(r))
+    {
+        if (opts.realtime)
+        {
+            ASSERT_(opts.speed > 0);
+            std::this_thread::sleep_until(
+                t_begin + std::chrono::duration_cast<clock::duration>(
+                              std::chrono::duration<double>(
+                                  r.wall_time / opts.speed)));
+        }
+
+        switch (r.call)
+        {
+            case BackendCall::AddFactor:
+                std::visit(
+                    overloaded{
+                        [&](FactorRelativePose3& f) {
+                            f.from_kf_ = translateId(kf_ids, f.from_kf_);
+                            f.to_kf_   = translateId(kf_ids, f.to_kf_);
+                        },
+                        [&](FactorDynamicsConstVel& f) {
+                            f.from_kf_ = translateId(kf_ids, f.from_kf_);
+                            f.to_kf_   = translateId(kf_ids, f.to_kf_);
+                        },
+                        [&](FactorStereoProjectionPose& f) {
+                            f.observing_kf_ =
+                                translateId(kf_ids, f.observing_kf_);
+                            f.observed_landmark_ =
+                                translateId(lm_ids, f.observed_landmark_);
+                        },
+                        []([[maybe_unused]] auto& other) {},
+                    },
+                    r.factor);
+                break;
+            case BackendCall::SmartStereoObservation:
+                r.stereo_obs.factor_id =
+                    translateId(factor_ids, r.stereo_obs.factor_id);
+                r.stereo_obs.observing_kf =
+                    translateId(kf_ids, r.stereo_obs.observing_kf);
+                break;
+            case BackendCall::AdvertiseUpdatedLocalization:
+                r.loc.reference_kf = translateId(kf_ids, r.loc.reference_kf);
+                break;
+            default:
+                break;
+        };
+
+        uint64_t   new_id  = mola::INVALID_ID;
+        bool       skipped = false;
+        const auto t0      = clock::now();
+        switch (r.call)
+        {
+            case BackendCall::AddKeyFrame:
+            {
+                // ASLAM_gtsam takes the decoded observations as they are.
+                // Other back-ends get a copy through the generic API:
+                BackEndBase::ProposeKF_Output o;
+                if (aslam)
+                    o = aslam->addKeyFrameShared(
+                        r.kf.timestamp, r.kf_observations);
+                else
+                {
+                    auto in = r.kf;
+                    if (r.kf_observations) in.observations = *r.kf_observations;
+                    o = backend.doAddKeyFrame(in);
+                }
+                if (o.new_kf_id) new_id = o.new_kf_id.value();
+            }
+            break;
+            case BackendCall::AddFactor:
+                new_id = backend.doAddFactor(r.factor).new_factor_id;
+                break;
+            case BackendCall::SmartStereoObservation:
+                if (aslam)
+                {
+                    const auto& so = r.stereo_obs;
+                    aslam->lock_slam();
+                    aslam->addSmartStereoObservation(
+                        so.factor_id, so.observing_kf, so.x_left, so.x_right,
+                        so.y);
+                    aslam->unlock_slam();
+                }
+                else
+                    skipped = true;
+                break;
+            case BackendCall::AdvertiseUpdatedLocalization:
+                backend.doAdvertiseUpdatedLocalization(r.loc);
+                break;
+            case BackendCall::SpinOnce:
+                backend.spinOnce();
+                break;
+            case BackendCall::StartNewMap:
+                if (aslam)
+                    aslam->startNewMap();
+                else
+                    skipped = true;
+                break;
+            case BackendCall::DefineStereoCamera:
+            {
+                const auto& sc = r.stereo_camera;
+                backend.lock_slam();
+                backend.temp_createStereoCamera(sc.left, sc.right, sc.baseline);
+                backend.unlock_slam();
+            }
+            break;
+            case BackendCall::CreateLandmark:
+                backend.lock_slam();
+                new_id = backend.temp_createLandmark(r.landmark);
+                backend.unlock_slam();
+                break;
+            default:
+                break;
+        };
+        const double dt =
+            std::chrono::duration<double>(clock::now() - t0).count();
+
+        if (skipped)
+        {
+            stats.skipped++;
+            continue;
+        }
+        if (r.result_id != mola::INVALID_ID)
+        {
+            if (new_id != r.result_id) stats.id_mismatches++;
+            // (Only keyframes, landmarks and factors return IDs)
+            if (new_id != mola::INVALID_ID)
+            {
+                if (r.call == BackendCall::AddKeyFrame)
+                    kf_ids[r.result_id] = new_id;
+                else if (r.call == BackendCall::CreateLandmark)
+                    lm_ids[r.result_id] = new_id;
+                else
+                    factor_ids[r.result_id] = new_id;
+            }
+        }
+
+        auto& pc = stats.calls[r.call];
+        pc.count++;
+        pc.recorded_total += r.duration;
+        pc.durations.push_back(dt);
+
+        if (opts.on_call) opts.on_call(r, dt);
+    }
+    stats.total_time =
+        std::chrono::duration<double>(clock::now() - t_begin).count();
+
+    return stats;
+
+    MRPT_END
+}
+
+namespace
+{
+double percentile(std::vector<double> v, const double p)
+{
+    if (v.empty()) return 0.0;
+    const auto idx = static_cast<std::size_t>(p * (v.size() - 1));
+    std::nth_element(v.begin(), v.begin() + idx, v.end());
+    return v[idx];
+}
+}  // namespace
+
+void BackendReplayStats::print(std::ostream& o) const
+{
+    o << std::left << std::setw(32) << "call" << std::right << std::setw(9)
+      << "count" << std::setw(12) << "total[s]" << std::setw(12)
+      << "mean[ms]" << std::setw(12) << "p50[ms]" << std::setw(12)
+      << "p99[ms]" << std::setw(12) << "max[ms]" << std::setw(14)
+      << "recorded[s]"
+      << "\n";
+
+    for (const auto& kv : calls)
+    {
+        const auto& pc    = kv.second;
+        double      total = 0, max = 0;
+        for (const double d : pc.durations)
+        {
+            total += d;
+            max = std::max(max, d);
+        }
+        const double mean = total / std::max<std::size_t>(1, pc.count);
+        o << std::left << std::setw(32) << backendCallName(kv.first)
+          << std::right << std::setw(9) << pc.count << std::setw(12)
+          << total << std::setw(12) << 1e3 * mean << std::setw(12)
+          << 1e3 * percentile(pc.durations, 0.5)
+          << std::setw(12) << 1e3 * percentile(pc.durations, 0.99)
+          << std::setw(12) << 1e3 * max << std::setw(14)
+          << pc.recorded_total << "\n";
+    }
+    o << "Total replay time: " << total_time << " s. ID mismatches: "
+      << id_mismatches << ". Skipped records: " << skipped << "\n";
+}
+
+void BackendReplayStats::toJSON(std::ostream& o) const
+{
+    const auto old_prec = o.precision(9);
+    o << "{\n"
+      << "  \"total_time_s\": " << total_time << ",\n"
+      << "  \"id_mismatches\": " << id_mismatches << ",\n"
+      << "  \"skipped\": " << skipped << ",\n"
+      << "  \"calls\": {";
+    bool first = true;
+    for (const auto& kv : calls)
+    {
+        const auto& pc    = kv.second;
+        double      total = 0, max = 0;
+        for (const double d : pc.durations)
+        {
+            total += d;
+            max = std::max(max, d);
+        }
+        const double mean = total / std::max<std::size_t>(1, pc.count);
+
+        o << (first ? "\n" : ",\n") << "    \"" << backendCallName(kv.first)
+          << "\": {\"count\": " << pc.count << ", \"total_s\": " << total
+          << ", \"mean_ms\": " << 1e3 * mean
+          << ", \"p50_ms\": " << 1e3 * percentile(pc.durations, 0.5)
+          << ", \"p90_ms\": " << 1e3 * percentile(pc.durations, 0.9)
+          << ", \"p99_ms\": " << 1e3 * percentile(pc.durations, 0.99)
+          << ", \"max_ms\": " << 1e3 * max << "}";
+        first = false;
+    }
+    o << "\n  }\n}\n";
+    o.precision(old_prec);
+}
@@ -0,0 +1,102 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   BackendHarness.cpp
+ * @brief  Runs a back-end module plus its WorldModel outside mola-launcher
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 12, 2019
+ */
+
+#include <mola-slam-gtsam/BackendHarness.h>
+
+#include <iostream>
+#include <utility>
+#include <vector>
+
+using namespace mola;
+
+BackendHarness::BackendHarness(
+    const std::string& backendClass, const std::string& backendCfg,
+    const std::string& worldModelCfg)
+{
+    MRPT_START
+
+    worldmodel_ = std::make_shared<WorldModel>();
+    backend_    = std::dynamic_pointer_cast<BackEndBase>(
+        ExecutableBase::Factory(backendClass));
+    ASSERTMSG_(
+        backend_, mrpt::format(
+                      "`%s` is not a registered BackEndBase module",
+                      backendClass.c_str()));
+
+    worldmodel_->setModuleInstanceName("worldmodel");
+    backend_->setModuleInstanceName(backendClass);
+
+    // Minimal name server, so modules can find each other:
+    std::weak_ptr<WorldModel>  wm = worldmodel_;
+    std::weak_ptr<BackEndBase> be = backend_;
+    const auto ns = [wm, be](std::size_t idx) -> ExecutableBase::Ptr {
+        if (idx == 0) return wm.lock();
+        if (idx == 1) return be.lock();
+        return {};
+    };
+    worldmodel_->nameServer_ = ns;
+    backend_->nameServer_    = ns;
+
+    worldmodel_->initialize_common(worldModelCfg);
+    worldmodel_->initialize(worldModelCfg);
+    backend_->initialize_common(backendCfg);
+    backend_->initialize(backendCfg);
+
+    MRPT_END
+}
+
+std::string BackendHarness::defaultConfig(
+    const std::string& backendClass, const std::string& extraParams)
+{
+    MRPT_START
+
+    ASSERTMSG_(
+        backendClass == "ASLAM_gtsam" || backendClass == "RSLAM_gtsam",
+        mrpt::format(
+            "No default configuration for `%s`", backendClass.c_str()));
+
+    const std::vector<std::pair<std::string, std::string>> defaults = {
+        {"state_vector", "SE3"},
+        {"use_incremental_solver", "true"},
+        {"save_map_at_end", "false"},
+        {"show_gui", "false"}};
+
+    const std::string extra = "\n" + extraParams;
+    std::string       cfg   = "params:\n";
+    for (const auto& [key, value] : defaults)
+        if (extra.find("\n  " + key + ":") == std::string::npos)
+            cfg += "  " + key + ": " + value + "\n";
+    return cfg + extraParams;
+
+    MRPT_END
+}
+
+BackendHarness::~BackendHarness()
+{
+    try
+    {
+        quit();
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "[BackendHarness] Exception in onQuit(): " << e.what()
+                  << "\n";
+    }
+}
+
+void BackendHarness::quit()
+{
+    if (quit_done_) return;
+    quit_done_ = true;
+    backend_->onQuit();
+    worldmodel_->onQuit();
+}
@@ -0,0 +1,242 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   BackendJournal.cpp
+ * @brief  Durable write-ahead journal of back-end API calls
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 19, 2019
+ */
+
+#include <mola-slam-gtsam/BackendJournal.h>
+#include <mrpt/core/exceptions.h>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace mola;
+
+BackendJournal::~BackendJournal()
+{
+    try
+    {
+        close();
+    }
+    catch (...)
+    {
+    }
+}
+
+void BackendJournal::open(
+    const std::string& fileName, const double sync_period,
+    const clock::time_point& time_origin)
+{
+    MRPT_START
+    ASSERT_(sync_period >= 0);
+    close();
+    BackendCallRecorder::open(fileName, time_origin);
+    sync_period_ = sync_period;
+    last_sync_   = clock::now();
+    MRPT_END
+}
+
+void BackendJournal::close()
+{
+    if (!is_open()) return;
+    sync();
+    BackendCallRecorder::close();
+}
+
+void BackendJournal::rotate(const std::string& newFileName)
+{
+    MRPT_START
+    const double sp = sync_period_;
+    const auto   t0 = time_origin();
+    close();
+    // Make the new (empty) file durable too, so recovery finds it:
+    open(newFileName, sp, t0);
+    sync();
+    MRPT_END
+}
+
+void BackendJournal::flush()
+{
+    const auto t0 = clock::now();
+    BackendCallRecorder::flush();
+
+    std::lock_guard<std::mutex> lck(stats_mtx_);
+    stats_.append_time += std::chrono::duration<double>(
+                              clock::now() - t0 - last_flush_sync_time_)
+                              .count();
+    last_flush_sync_time_ = {};
+}
+
+void BackendJournal::sync()
+{
+    force_sync_ = true;
+    flush();
+}
+
+void BackendJournal::onFlushed()
+{
+    // Called with the recorder mutex held, so this cannot run concurrently
+    // with itself.
+    const auto t0 = clock::now();
+    if (!force_sync_ &&
+        std::chrono::duration<double>(t0 - last_sync_).count() < sync_period_)
+        return;
+    force_sync_ = false;
+
+#if defined(_WIN32)
+    const int ret = ::_commit(::_fileno(f_));
+#else
+    const int ret = ::fsync(::fileno(f_));
+#endif
+    ASSERTMSG_(ret == 0, "fsync() failed on the back-end journal");
+
+    const auto t1 = clock::now();
+    last_sync_    = t1;
+
+    std::lock_guard<std::mutex> lck(stats_mtx_);
+    last_flush_sync_time_ += t1 - t0;
+    stats_.sync_time += std::chrono::duration<double>(t1 - t0).count();
+    stats_.syncs++;
+}
+
+BackendJournal::Stats BackendJournal::stats() const
+{
+    std::lock_guard<std::mutex> lck(stats_mtx_);
+    return stats_;
+}
+
+template <class RECORD>
+double BackendJournal::write_ahead(RECORD&& record)
+{
+    if (!is_open()) return now();
+
+    const auto t0 = clock::now();
+    record();
+    // Write and sync it (or leave it to a later group commit, see
+    // `sync_period`) before the caller applies the call:
+    BackendCallRecorder::flush();
+    const auto t1 = clock::now();
+
+    std::lock_guard<std::mutex> lck(stats_mtx_);
+    stats_.append_time += std::chrono::duration<double>(
+                              t1 - t0 - last_flush_sync_time_)
+                              .count();
+    last_flush_sync_time_ = {};
+    stats_.records++;
+    return now();
+}
+
+double BackendJournal::beginAddKeyFrame(
+    const mrpt::Clock::time_point&  timestamp,
+    const mrpt::obs::CSensoryFrame* obs)
+{
+    return write_ahead([&]() {
+        // The KF ID is not known yet: see end().
+        BackendCallRecorder::recordAddKeyFrame(
+            now(), timestamp, obs, BackEndBase::ProposeKF_Output());
+    });
+}
+
+double BackendJournal::beginAddFactor(const Factor& f)
+{
+    return write_ahead([&]() {
+        BackEndBase::AddFactor_Output o;
+        o.new_factor_id = INVALID_FID;
+        BackendCallRecorder::recordAddFactor(now(), f, o);
+    });
+}
+
+double BackendJournal::beginSmartStereoObservation(
+    const mola::fid_t factor_id, const mola::id_t observing_kf,
+    const double x_left, const double x_right, const double y)
+{
+    return write_ahead([&]() {
+        BackendCallRecorder::recordSmartStereoObservation(
+            now(), factor_id, observing_kf, x_left, x_right, y);
+    });
+}
+
+double BackendJournal::beginAdvertiseUpdatedLocalization(
+    const BackEndBase::AdvertiseUpdatedLocalization_Input& l)
+{
+    return write_ahead([&]() {
+        BackendCallRecorder::recordAdvertiseUpdatedLocalization(now(), l);
+    });
+}
+
+double BackendJournal::beginSpinOnce()
+{
+    return write_ahead(
+        [&]() { BackendCallRecorder::recordSpinOnce(now()); });
+}
+
+double BackendJournal::beginStartNewMap()
+{
+    return write_ahead(
+        [&]() { BackendCallRecorder::recordStartNewMap(now()); });
+}
+
+double BackendJournal::beginDefineStereoCamera(
+    const mrpt::img::TCamera& left, const mrpt::img::TCamera& right,
+    const double baseline)
+{
+    return write_ahead([&]() {
+        BackendCallRecorder::recordDefineStereoCamera(
+            now(), left, right, baseline);
+    });
+}
+
+double BackendJournal::beginCreateLandmark(
+    const mrpt::math::TPoint3D& init_value)
+{
+    return write_ahead([&]() {
+        // The landmark ID is not known yet: see end().
+        BackendCallRecorder::recordCreateLandmark(
+            now(), init_value, INVALID_ID);
+    });
+}
+
+void BackendJournal::end(const double t_begin, const uint64_t result_id)
+{
+    if (!is_open()) return;
+    const double t_end = now();
+    const auto   t0    = clock::now();
+
+    // Buffered only: written by the next begin*() or flush(), which is
+    // before any later call can refer to this ID.
+    if (result_id != INVALID_ID) recordCallResult(t_begin, result_id);
+
+    const auto t1 = clock::now();
+
+    std::lock_guard<std::mutex> lck(stats_mtx_);
+    stats_.append_time += std::chrono::duration<double>(t1 - t0).count();
+    stats_.calls_time += t_end - t_begin;
+}
+
+void BackendJournal::abort(const double t_begin)
+{
+    if (!is_open()) return;
+    recordCallAborted(t_begin);
+    sync();
+}
+
+BackendJournal::AbortGuard::~AbortGuard()
+{
+    if (std::uncaught_exceptions() <= exceptions_) return;
+    try
+    {
+        j_.abort(t_begin_);
+    }
+    catch (...)
+    {
+    }
+}
@@ -0,0 +1,664 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   ChunkedMap.cpp
+ * @brief  Chunked, compressed and incremental WorldModel map files
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 16, 2019
+ */
+
+#include <mola-kernel/variant_helper.h>  // overloaded{}
+#include <mola-slam-gtsam/ChunkedMap.h>
+#include <mola-slam-gtsam/variant_serialization.h>
+#include <mrpt/core/exceptions.h>
+#include <mrpt/io/CFileGZInputStream.h>
+#include <mrpt/io/CFileGZOutputStream.h>
+#include <mrpt/system/CDirectoryExplorer.h>
+#include <mrpt/system/filesystem.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <sstream>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+using namespace mola;
+
+namespace
+{
+using clock_t = std::chrono::steady_clock;
+
+// Chunk files start with the number of items (format 1), or with this
+// marker and a format version, then the number of items. Format 2 adds the
+// annotations of each entity.
+const uint32_t CHUNK_FORMAT_MARKER  = 0xFFFFFFFF;
+const uint8_t  CHUNK_FORMAT_VERSION = 2;
+
+/** Entity annotations (e.g. `render_decoration`), by name */
+using Annotations = std::vector<
+    std::pair<std::string, mrpt::serialization::CSerializable::Ptr>>;
+
+unsigned int numThreads(const ChunkedMapParameters& p)
+{
+    if (p.num_threads != 0) return p.num_threads;
+    return std::max(1U, std::thread::hardware_concurrency());
+}
+
+/** IDs grouped by chunk index */
+using chunk_ids_t = std::map<std::size_t, std::vector<uint64_t>>;
+
+template <class ID>
+chunk_ids_t groupByChunk(const std::vector<ID>& ids, const std::size_t sz)
+{
+    chunk_ids_t r;
+    for (const auto id : ids) r[id / sz].push_back(id);
+    return r;
+}
+
+using ObservationsSource = ChunkedMapWriter::ObservationsSource;
+
+/** Returns a copy of `kf` with the observations given by `obs`, or nothing
+ * if it already has them or they are not available */
+template <class KF>
+std::optional<Entity> withObservations(
+    const KF& kf, const mola::id_t id, const ObservationsSource& obs)
+{
+    if (kf.raw_observations_) return {};
+    auto sf = obs(id);
+    if (!sf) return {};
+    KF c                = kf;
+    c.raw_observations_ = std::move(sf);
+    return Entity(std::move(c));
+}
+
+void writeItem(
+    mrpt::serialization::CArchive& a, const mola::id_t id, const Entity& e,
+    const ObservationsSource& obs)
+{
+    std::optional<Entity> full;
+    if (obs)
+    {
+        std::visit(
+            overloaded{
+                [&](const mola::RelPose3KF& kf) {
+                    full = withObservations(kf, id, obs);
+                },
+                [&](const mola::RelDynPose3KF& kf) {
+                    full = withObservations(kf, id, obs);
+                },
+                []([[maybe_unused]] const auto& other) {},
+            },
+            e);
+    }
+    writeVariant(a, full ? *full : e);
+}
+
+void writeItem(
+    mrpt::serialization::CArchive& a, [[maybe_unused]] const mola::fid_t id,
+    const Factor& f, [[maybe_unused]] const ObservationsSource& obs)
+{
+    writeVariant(a, f);
+}
+
+/** Copy of the chunks to be written. Raw observations are shared pointers
+ * and are not copied. */
+template <class T>
+struct ChunkCopy
+{
+    std::size_t           n{0};
+    std::vector<uint64_t> ids;
+    std::vector<T>        items;
+    /** Entities only: annotations of each item */
+    std::vector<Annotations> annotations;
+};
+
+/** Writes one chunk to `<file>.tmp`, then renames it to `file`.
+ * Returns the file size. */
+template <class T>
+std::size_t writeChunkFile(
+    const std::string& file, const ChunkCopy<T>& c, const int compress_level,
+    const ObservationsSource& obs)
+{
+    constexpr bool isEntity = std::is_same_v<T, Entity>;
+    ASSERT_EQUAL_(c.ids.size(), c.items.size());
+    if (isEntity) ASSERT_EQUAL_(c.ids.size(), c.annotations.size());
+
+    const auto tmpFile = file + ".tmp";
+    {
+        mrpt::io::CFileGZOutputStream f;
+        ASSERTMSG_(
+            f.open(tmpFile, compress_level),
+            mrpt::format("Cannot create map chunk: `%s`", tmpFile.c_str()));
+
+        auto a = mrpt::serialization::archiveFrom(f);
+        a.WriteAs<uint32_t>(CHUNK_FORMAT_MARKER);
+        a.WriteAs<uint8_t>(CHUNK_FORMAT_VERSION);
+        a.WriteAs<uint32_t>(c.ids.size());
+        for (std::size_t i = 0; i < c.ids.size(); i++)
+        {
+            a.WriteAs<uint64_t>(c.ids[i]);
+            writeItem(a, c.ids[i], c.items[i], obs);
+            if constexpr (isEntity)
+            {
+                a.WriteAs<uint32_t>(c.annotations[i].size());
+                for (const auto& [name, obj] : c.annotations[i])
+                    a << name << obj;
+            }
+        }
+    }
+
+    std::remove(file.c_str());
+    ASSERTMSG_(
+        std::rename(tmpFile.c_str(), file.c_str()) == 0,
+        mrpt::format("Cannot rename map chunk to: `%s`", file.c_str()));
+
+    return static_cast<std::size_t>(mrpt::system::getFileSize(file));
+}
+
+void writeIndex(
+    const std::string& dir, const std::size_t chunk_size,
+    const chunk_ids_t& ent, const chunk_ids_t& fac)
+{
+    const auto file    = dir + "/index.txt";
+    const auto tmpFile = file + ".tmp";
+    {
+        std::ofstream f(tmpFile);
+        ASSERTMSG_(
+            f.is_open(),
+            mrpt::format("Cannot create map index: `%s`", tmpFile.c_str()));
+
+        f << "# MOLA chunked map. Lines: `e|f <chunk> <count>`\n"
+          << "chunk_size " << chunk_size << "\n";
+        for (const auto& c : ent)
+            f << "e " << c.first << " " << c.second.size() << "\n";
+        for (const auto& c : fac)
+            f << "f " << c.first << " " << c.second.size() << "\n";
+    }
+    std::remove(file.c_str());
+    ASSERTMSG_(
+        std::rename(tmpFile.c_str(), file.c_str()) == 0,
+        mrpt::format("Cannot rename map index to: `%s`", file.c_str()));
+}
+
+template <class T>
+struct ChunkItem
+{
+    uint64_t    id{0};
+    T           item;
+    Annotations annotations;
+};
+
+/** Reads one chunk written by writeChunkFile(), in any format */
+template <class T>
+std::vector<ChunkItem<T>> readChunkFile(const std::string& file)
+{
+    mrpt::io::CFileGZInputStream f;
+    ASSERTMSG_(
+        f.open(file),
+        mrpt::format("Cannot open map chunk: `%s`", file.c_str()));
+
+    auto    a       = mrpt::serialization::archiveFrom(f);
+    auto    n       = a.ReadAs<uint32_t>();
+    uint8_t version = 1;
+    if (n == CHUNK_FORMAT_MARKER)
+    {
+        version = a.ReadAs<uint8_t>();
+        ASSERTMSG_(
+            version <= CHUNK_FORMAT_VERSION,
+            mrpt::format(
+                "Map chunk `%s` has an unknown format version: %u",
+                file.c_str(), static_cast<unsigned>(version)));
+        n = a.ReadAs<uint32_t>();
+    }
+
+    std::vector<ChunkItem<T>> items(n);
+    for (auto& it : items)
+    {
+        it.id = a.ReadAs<uint64_t>();
+        readVariant(a, it.item);
+        if (std::is_same_v<T, Entity> && version >= 2)
+        {
+            it.annotations.resize(a.ReadAs<uint32_t>());
+            for (auto& [name, obj] : it.annotations)
+            {
+                a >> name;
+                obj = a.ReadObject();
+            }
+        }
+    }
+    return items;
+}
+
+/** Deletes the chunk files of `dir` not in `ent` or `fac`, e.g. left by a
+ * former save with another chunk size */
+void removeStaleChunks(
+    const std::string& dir, const chunk_ids_t& ent, const chunk_ids_t& fac)
+{
+    mrpt::system::CDirectoryExplorer::TFileInfoList lst;
+    mrpt::system::CDirectoryExplorer::explore(dir, FILE_ATTRIB_ARCHIVE, lst);
+    for (const auto& fi : lst)
+    {
+        const auto& name = fi.name;
+        if (name.size() < 3 || name[1] != '_') continue;
+        const bool isEntity = name[0] == 'e';
+        if (!isEntity && name[0] != 'f') continue;
+
+        char*      end = nullptr;
+        const auto n   = std::strtoull(name.c_str() + 2, &end, 10);
+        if (end == name.c_str() + 2 ||
+            name != ChunkedMapWriter::ChunkFileName(isEntity, n))
+            continue;
+
+        if ((isEntity ? ent : fac).count(n) == 0)
+            std::remove(fi.wholePath.c_str());
+    }
+}
+
+struct MapSnapshot
+{
+    chunk_ids_t                    ent, fac;  //!< All chunks, for the index
+    std::vector<ChunkCopy<Entity>> ent_copy;
+    std::vector<ChunkCopy<Factor>> fac_copy;
+};
+
+/** Copies all chunks if `all`, or those in `dirty_ent` and `dirty_fac`.
+ * The WorldModel is read-locked only meanwhile. */
+MapSnapshot takeSnapshot(
+    WorldModel& wm, const std::size_t sz, const bool all,
+    const std::set<std::size_t>& dirty_ent,
+    const std::set<std::size_t>& dirty_fac)
+{
+    MapSnapshot s;
+
+    wm.entities_lock_for_read();
+    wm.factors_lock_for_read();
+    try
+    {
+        s.ent = groupByChunk(wm.entity_all_ids(), sz);
+        s.fac = groupByChunk(wm.factor_all_ids(), sz);
+        for (const auto& c : s.ent)
+        {
+            if (!all && !dirty_ent.count(c.first)) continue;
+            auto& d = s.ent_copy.emplace_back();
+            d.n     = c.first;
+            d.ids   = c.second;
+            d.items.reserve(c.second.size());
+            d.annotations.reserve(c.second.size());
+            for (const auto id : c.second)
+            {
+                d.items.push_back(wm.entity_by_id(id));
+                auto& an = d.annotations.emplace_back();
+                for (const auto& [name, res] : wm.entity_annotations_by_id(id))
+                    if (res.value()) an.emplace_back(name, res.value());
+            }
+        }
+        for (const auto& c : s.fac)
+        {
+            if (!all && !dirty_fac.count(c.first)) continue;
+            auto& d = s.fac_copy.emplace_back();
+            d.n     = c.first;
+            d.ids   = c.second;
+            d.items.reserve(c.second.size());
+            for (const auto id : c.second)
+                d.items.push_back(wm.factor_by_id(id));
+        }
+    }
+    catch (...)
+    {
+        wm.factors_unlock_for_read();
+        wm.entities_unlock_for_read();
+        throw;
+    }
+    wm.factors_unlock_for_read();
+    wm.entities_unlock_for_read();
+
+    return s;
+}
+
+/** Serializes and compresses the chunks of `s` in parallel, then writes the
+ * index and removes stale chunk files */
+ChunkedMapSaveStats writeSnapshot(
+    const MapSnapshot& s, const std::string& dir,
+    const ChunkedMapParameters& p, mola::WorkerThreadsPool& workers,
+    const ObservationsSource& obs)
+{
+    if (!mrpt::system::directoryExists(dir))
+        ASSERTMSG_(
+            mrpt::system::createDirectory(dir),
+            mrpt::format("Cannot create map directory: `%s`", dir.c_str()));
+
+    ChunkedMapSaveStats st;
+    st.entity_chunks_total   = s.ent.size();
+    st.factor_chunks_total   = s.fac.size();
+    st.entity_chunks_written = s.ent_copy.size();
+    st.factor_chunks_written = s.fac_copy.size();
+
+    // Jobs take references to `s`, which outlives them:
+    std::vector<std::future<std::size_t>> jobs;
+    for (const auto& c : s.ent_copy)
+    {
+        const auto file =
+            dir + "/" + ChunkedMapWriter::ChunkFileName(true, c.n);
+        jobs.emplace_back(workers.enqueue([&c, file, &p, &obs]() {
+            return writeChunkFile(file, c, p.compress_level, obs);
+        }));
+    }
+    for (const auto& c : s.fac_copy)
+    {
+        const auto file =
+            dir + "/" + ChunkedMapWriter::ChunkFileName(false, c.n);
+        jobs.emplace_back(workers.enqueue([&c, file, &p, &obs]() {
+            return writeChunkFile(file, c, p.compress_level, obs);
+        }));
+    }
+
+    // Wait for all jobs, even if one fails:
+    std::exception_ptr err;
+    for (auto& j : jobs)
+    {
+        try
+        {
+            st.bytes_written += j.get();
+        }
+        catch (...)
+        {
+            if (!err) err = std::current_exception();
+        }
+    }
+    if (err) std::rethrow_exception(err);
+
+    writeIndex(dir, p.chunk_size, s.ent, s.fac);
+    removeStaleChunks(dir, s.ent, s.fac);
+
+    return st;
+}
+
+}  // namespace
+
+ChunkedMapWriter::ChunkedMapWriter(const ChunkedMapParameters& p)
+    : params_(p), workers_(numThreads(p)), async_(1)
+{
+    ASSERT_(params_.chunk_size > 0);
+    dirty_.all = true;
+}
+
+ChunkedMapWriter::~ChunkedMapWriter()
+{
+    try
+    {
+        wait();
+    }
+    catch (...)
+    {
+    }
+}
+
+std::string ChunkedMapWriter::ChunkFileName(
+    const bool isEntity, const std::size_t n)
+{
+    return mrpt::format("%c_%06zu.chunk.gz", isEntity ? 'e' : 'f', n);
+}
+
+void ChunkedMapWriter::setObservationsSource(const ObservationsSource& src)
+{
+    wait();
+    obs_source_ = src;
+}
+
+void ChunkedMapWriter::markEntityDirty(const mola::id_t id)
+{
+    std::lock_guard<std::mutex> lck(dirty_mtx_);
+    dirty_.entities.insert(id / params_.chunk_size);
+}
+
+void ChunkedMapWriter::markFactorDirty(const mola::fid_t id)
+{
+    std::lock_guard<std::mutex> lck(dirty_mtx_);
+    dirty_.factors.insert(id / params_.chunk_size);
+}
+
+void ChunkedMapWriter::markAllDirty()
+{
+    std::lock_guard<std::mutex> lck(dirty_mtx_);
+    dirty_.all = true;
+}
+
+void ChunkedMapWriter::markAllClean()
+{
+    std::lock_guard<std::mutex> lck(dirty_mtx_);
+    dirty_ = Dirty();
+}
+
+ChunkedMapWriter::Dirty ChunkedMapWriter::take_dirty()
+{
+    std::lock_guard<std::mutex> lck(dirty_mtx_);
+    Dirty d = std::move(dirty_);
+    dirty_  = Dirty();
+    return d;
+}
+
+void ChunkedMapWriter::restore_dirty(const Dirty& d)
+{
+    std::lock_guard<std::mutex> lck(dirty_mtx_);
+    dirty_.all = dirty_.all || d.all;
+    dirty_.entities.insert(d.entities.begin(), d.entities.end());
+    dirty_.factors.insert(d.factors.begin(), d.factors.end());
+}
+
+bool ChunkedMapWriter::is_busy() const
+{
+    return pending_.valid() && pending_.wait_for(std::chrono::seconds(0)) !=
+                                   std::future_status::ready;
+}
+
+ChunkedMapSaveStats ChunkedMapWriter::wait()
+{
+    if (!pending_.valid()) return {};
+    return pending_.get();
+}
+
+ChunkedMapSaveStats ChunkedMapWriter::save(
+    WorldModel& wm, const std::string& dir)
+{
+    MRPT_START
+
+    wait();
+
+    const auto t0 = clock_t::now();
+
+    // Marks made from now on go to the next save:
+    const Dirty plan = take_dirty();
+
+    ChunkedMapSaveStats st;
+    try
+    {
+        // The WorldModel is only locked while copying the dirty chunks, not
+        // while serializing and compressing them:
+        const auto snap = takeSnapshot(
+            wm, params_.chunk_size, plan.all, plan.entities, plan.factors);
+        st = writeSnapshot(snap, dir, params_, workers_, obs_source_);
+    }
+    catch (...)
+    {
+        // Keep the chunks dirty for the next attempt:
+        restore_dirty(plan);
+        throw;
+    }
+
+    st.seconds = std::chrono::duration<double>(clock_t::now() - t0).count();
+    return st;
+
+    MRPT_END
+}
+
+bool ChunkedMapWriter::save_async(WorldModel& wm, const std::string& dir)
+{
+    MRPT_START
+
+    if (is_busy()) return false;
+    // Report errors of the previous save, if any:
+    wait();
+
+    const auto t0 = clock_t::now();
+
+    const Dirty plan = take_dirty();
+
+    std::shared_ptr<const MapSnapshot> snap;
+    try
+    {
+        snap = std::make_shared<const MapSnapshot>(takeSnapshot(
+            wm, params_.chunk_size, plan.all, plan.entities, plan.factors));
+    }
+    catch (...)
+    {
+        restore_dirty(plan);
+        throw;
+    }
+
+    // Compress and write in the background:
+    pending_ = async_.enqueue([this, dir, plan, snap, t0]() {
+        ChunkedMapSaveStats st;
+        try
+        {
+            st = writeSnapshot(*snap, dir, params_, workers_, obs_source_);
+        }
+        catch (...)
+        {
+            restore_dirty(plan);
+            throw;
+        }
+        st.seconds =
+            std::chrono::duration<double>(clock_t::now() - t0).count();
+        return st;
+    });
+
+    return true;
+
+    MRPT_END
+}
+
+bool mola::chunkedMapExists(const std::string& dir)
+{
+    return mrpt::system::fileExists(dir + "/index.txt");
+}
+
+ChunkedMapLoadStats mola::loadChunkedMap(
+    WorldModel& wm, const std::string& dir, const ChunkedMapParameters& p)
+{
+    MRPT_START
+
+    const auto t0 = clock_t::now();
+
+    // Parse the index:
+    std::ifstream fIdx(dir + "/index.txt");
+    ASSERTMSG_(
+        fIdx.is_open(),
+        mrpt::format("Cannot open map index in: `%s`", dir.c_str()));
+
+    std::vector<std::size_t> ent_chunks, fac_chunks;
+    std::size_t              chunk_size = 0;
+    std::string              line;
+    while (std::getline(fIdx, line))
+    {
+        if (line.empty() || line[0] == '#') continue;
+        std::istringstream ss(line);
+        std::string        kind;
+        std::size_t        n = 0, count = 0;
+        ss >> kind >> n >> count;
+        if (kind == "e")
+            ent_chunks.push_back(n);
+        else if (kind == "f")
+            fac_chunks.push_back(n);
+        else
+        {
+            ASSERTMSG_(
+                kind == "chunk_size",
+                mrpt::format("Malformed map index line: `%s`", line.c_str()));
+            chunk_size = n;
+        }
+    }
+
+    // Decode all chunks in parallel, insert them in order:
+    mola::WorkerThreadsPool pool(numThreads(p));
+
+    std::vector<std::future<std::vector<ChunkItem<Entity>>>> ents;
+    std::vector<std::future<std::vector<ChunkItem<Factor>>>> facs;
+    for (const auto n : ent_chunks)
+        ents.emplace_back(pool.enqueue(
+            &readChunkFile<Entity>,
+            dir + "/" + ChunkedMapWriter::ChunkFileName(true, n)));
+    for (const auto n : fac_chunks)
+        facs.emplace_back(pool.enqueue(
+            &readChunkFile<Factor>,
+            dir + "/" + ChunkedMapWriter::ChunkFileName(false, n)));
+
+    ChunkedMapLoadStats st;
+    st.chunks     = ents.size() + facs.size();
+    st.chunk_size = chunk_size;
+
+    wm.entities_lock_for_write();
+    wm.factors_lock_for_write();
+    try
+    {
+        for (auto& fut : ents)
+        {
+            for (auto& it : fut.get())
+            {
+                const auto id = wm.entity_emplace_back(std::move(it.item));
+                ASSERTMSG_(
+                    id == it.id,
+                    mrpt::format(
+                        "Entity ID mismatch loading map: stored=%lu "
+                        "assigned=%lu",
+                        static_cast<unsigned long>(it.id),
+                        static_cast<unsigned long>(id)));
+                auto& annots = wm.entity_annotations_by_id(id);
+                for (auto& [name, obj] : it.annotations)
+                    annots[name].value() = std::move(obj);
+                st.entities++;
+            }
+        }
+        for (auto& fut : facs)
+        {
+            for (auto& it : fut.get())
+            {
+                const auto id = wm.factor_push_back(it.item);
+                ASSERTMSG_(
+                    id == it.id,
+                    mrpt::format(
+                        "Factor ID mismatch loading map: stored=%lu "
+                        "assigned=%lu",
+                        static_cast<unsigned long>(it.id),
+                        static_cast<unsigned long>(id)));
+                st.factors++;
+            }
+        }
+    }
+    catch (...)
+    {
+        wm.factors_unlock_for_write();
+        wm.entities_unlock_for_write();
+        // Let pending jobs finish before the pool goes away:
+        for (auto& fut : ents)
+            if (fut.valid()) fut.wait();
+        for (auto& fut : facs)
+            if (fut.valid()) fut.wait();
+        throw;
+    }
+    wm.factors_unlock_for_write();
+    wm.entities_unlock_for_write();
+
+    st.seconds = std::chrono::duration<double>(clock_t::now() - t0).count();
+    return st;
+
+    MRPT_END
+}
@@ -0,0 +1,228 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   KeyframeObsStore.cpp
+ * @brief  Disk-backed, LRU-cached store of keyframe raw observations
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 14, 2019
+ */
+
+#include <mola-slam-gtsam/KeyframeObsStore.h>
+#include <mrpt/core/exceptions.h>
+#include <mrpt/io/CMemoryStream.h>
+#include <mrpt/serialization/CArchive.h>
+
+using namespace mola;
+
+KeyframeObsStore::~KeyframeObsStore()
+{
+    try
+    {
+        close();
+    }
+    catch (...)
+    {
+    }
+}
+
+void KeyframeObsStore::open(const Parameters& p)
+{
+    MRPT_START
+
+    close();
+    ASSERT_(!p.file.empty());
+
+    std::lock_guard<std::mutex> lck(mtx_);
+    params_ = p;
+    out_    = std::fopen(params_.file.c_str(), "wb");
+    ASSERTMSG_(
+        out_ != nullptr, mrpt::format(
+                             "Cannot create keyframe observations store: `%s`",
+                             params_.file.c_str()));
+    file_size_ = 0;
+    stats_     = Stats();
+
+    MRPT_END
+}
+
+bool KeyframeObsStore::is_open() const
+{
+    std::lock_guard<std::mutex> lck(mtx_);
+    return out_ != nullptr;
+}
+
+void KeyframeObsStore::close()
+{
+    std::lock_guard<std::mutex> lck(mtx_);
+    if (!out_) return;
+
+    in_.close();
+    std::fclose(out_);
+    out_ = nullptr;
+    if (delete_on_close_) std::remove(params_.file.c_str());
+
+    handles_.clear();
+    lru_.clear();
+    cache_.clear();
+    cached_bytes_ = 0;
+    file_size_    = 0;
+}
+
+void KeyframeObsStore::set_delete_on_close(const bool del)
+{
+    std::lock_guard<std::mutex> lck(mtx_);
+    delete_on_close_ = del;
+}
+
+KeyframeObsStore::Handle KeyframeObsStore::put(
+    const mola::id_t kf, const mrpt::obs::CSensoryFrame::Ptr& sf)
+{
+    MRPT_START
+    ASSERT_(sf);
+
+    // Serialize outside of the lock: this is the expensive part.
+    mrpt::io::CMemoryStream mem;
+    auto                    a = mrpt::serialization::archiveFrom(mem);
+    a << *sf;
+    const auto nbytes = static_cast<std::size_t>(mem.getTotalBytesCount());
+
+    std::lock_guard<std::mutex> lck(mtx_);
+    ASSERTMSG_(out_ != nullptr, "put() called before open()");
+    ASSERTMSG_(
+        handles_.count(kf) == 0,
+        mrpt::format(
+            "KF #%lu already in store", static_cast<unsigned long>(kf)));
+
+    const auto n = std::fwrite(mem.getRawBufferData(), 1, nbytes, out_);
+    ASSERT_EQUAL_(n, nbytes);
+
+    Handle h;
+    h.offset = file_size_;
+    h.length = nbytes;
+    file_size_ += nbytes;
+    handles_[kf] = h;
+
+    cache_insert(kf, sf, nbytes);
+    return h;
+
+    MRPT_END
+}
+
+mrpt::obs::CSensoryFrame::Ptr KeyframeObsStore::get(const mola::id_t kf)
+{
+    std::lock_guard<std::mutex> lck(mtx_);
+    return get_locked(kf, true);
+}
+
+mrpt::obs::CSensoryFrame::Ptr KeyframeObsStore::load(const mola::id_t kf)
+{
+    std::lock_guard<std::mutex> lck(mtx_);
+    return get_locked(kf, false);
+}
+
+mrpt::obs::CSensoryFrame::Ptr KeyframeObsStore::get_locked(
+    const mola::id_t kf, const bool insert_in_cache)
+{
+    MRPT_START
+
+    if (auto it = cache_.find(kf); it != cache_.end())
+    {
+        // Move to the front of the LRU list:
+        if (insert_in_cache)
+            lru_.splice(lru_.begin(), lru_, it->second.lru_it);
+        stats_.hits++;
+        return it->second.sf;
+    }
+
+    const auto it_h = handles_.find(kf);
+    if (it_h == handles_.end()) return {};
+    const Handle& h = it_h->second;
+
+    stats_.misses++;
+
+    // Make sure the record is already in the file and mapped:
+    if (!in_.is_open() || in_.size() < h.offset + h.length)
+    {
+        std::fflush(out_);
+        if (!in_.is_open())
+            in_.open(params_.file);
+        else
+            in_.remap();
+    }
+    ASSERT_(in_.size() >= h.offset + h.length);
+
+    mrpt::io::CMemoryStream mem;
+    mem.assignMemoryNotOwn(in_.data() + h.offset, h.length);
+    auto a  = mrpt::serialization::archiveFrom(mem);
+    auto sf = mrpt::obs::CSensoryFrame::Create();
+    a >> *sf;
+
+    if (insert_in_cache) cache_insert(kf, sf, h.length);
+    return sf;
+
+    MRPT_END
+}
+
+void KeyframeObsStore::cache_insert(
+    const mola::id_t kf, const mrpt::obs::CSensoryFrame::Ptr& sf,
+    const std::size_t bytes)
+{
+    if (bytes > params_.max_cached_bytes) return;
+
+    lru_.push_front(kf);
+    cache_[kf] = CacheEntry{sf, bytes, lru_.begin()};
+    cached_bytes_ += bytes;
+
+    // Evict least recently used entries:
+    while (cached_bytes_ > params_.max_cached_bytes)
+    {
+        const auto victim = lru_.back();
+        lru_.pop_back();
+        const auto it = cache_.find(victim);
+        cached_bytes_ -= it->second.bytes;
+        cache_.erase(it);
+        stats_.evictions++;
+    }
+}
+
+bool KeyframeObsStore::contains(const mola::id_t kf) const
+{
+    std::lock_guard<std::mutex> lck(mtx_);
+    return handles_.count(kf) != 0;
+}
+
+std::vector<mola::id_t> KeyframeObsStore::ids() const
+{
+    std::lock_guard<std::mutex> lck(mtx_);
+    std::vector<mola::id_t>     r;
+    r.reserve(handles_.size());
+    for (const auto& h : handles_) r.push_back(h.first);
+    return r;
+}
+
+std::size_t KeyframeObsStore::size() const
+{
+    std::lock_guard<std::mutex> lck(mtx_);
+    return handles_.size();
+}
+
+std::size_t KeyframeObsStore::cached_bytes() const
+{
+    std::lock_guard<std::mutex> lck(mtx_);
+    return cached_bytes_;
+}
+
+std::size_t KeyframeObsStore::file_bytes() const
+{
+    std::lock_guard<std::mutex> lck(mtx_);
+    return file_size_;
+}
+
+KeyframeObsStore::Stats KeyframeObsStore::stats() const
+{
+    std::lock_guard<std::mutex> lck(mtx_);
+    return stats_;
+}
@@ -0,0 +1,43 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   KeyframeTimeIndex.cpp
+ * @brief  Keyframe IDs indexed by timestamp
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 20, 2019
+ */
+
+#include <mola-slam-gtsam/KeyframeTimeIndex.h>
+#include <mrpt/system/datetime.h>
+
+#include <cmath>
+#include <iterator>
+#include <limits>
+
+mola::id_t mola::find_closest_KF_in_time(
+    const KeyframeTimeIndex& index, const mrpt::Clock::time_point& t,
+    const double tolerance)
+{
+    double     min_distance = std::numeric_limits<double>::max();
+    mola::id_t min_id       = mola::INVALID_ID;
+
+    const auto check = [&](const KeyframeTimeIndex::const_iterator& it) {
+        const auto dist = std::abs(mrpt::system::timeDifference(it->first, t));
+        if (dist <= tolerance && dist < min_distance)
+        {
+            min_distance = dist;
+            min_id       = it->second;
+        }
+    };
+
+    // Only two candidates: the last KF before `t`, and the first one at or
+    // after it. In case of a tie, the former wins.
+    const auto it = index.lower_bound(t);
+    if (it != index.begin()) check(std::prev(it));
+    if (it != index.end()) check(it);
+
+    return min_id;
+}
@@ -0,0 +1,62 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   LatencyHistogram.cpp
+ * @brief  Fixed-size histogram of durations, with log-spaced bins
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 20, 2019
+ */
+
+#include <mola-slam-gtsam/LatencyHistogram.h>
+
+#include <algorithm>
+#include <cmath>
+
+using namespace mola;
+
+void LatencyHistogram::add(const double seconds)
+{
+    // Bin 0: below MIN_TIME; bin i>0: [MIN_TIME*10^((i-1)/10), ...)
+    int bin = 0;
+    if (seconds >= MIN_TIME)
+        bin = 1 + static_cast<int>(
+                      BINS_PER_DECADE * std::log10(seconds / MIN_TIME));
+    bins_[std::min(bin, NUM_BINS - 1)]++;
+
+    count_++;
+    sum_ += seconds;
+    max_ = std::max(max_, seconds);
+}
+
+double LatencyHistogram::percentile(const double p) const
+{
+    if (!count_) return 0;
+
+    const auto target = static_cast<uint64_t>(
+        std::ceil(std::min(std::max(p, 0.0), 1.0) * count_));
+    uint64_t acc = 0;
+    for (int i = 0; i < NUM_BINS - 1; i++)
+    {
+        acc += bins_[i];
+        if (acc >= std::max<uint64_t>(target, 1))
+        {
+            // Upper edge of bin i:
+            const double edge =
+                MIN_TIME * std::pow(10.0, double(i) / BINS_PER_DECADE);
+            return std::min(edge, max_);
+        }
+    }
+    return max_;
+}
+
+void LatencyHistogram::toJSON(std::ostream& o) const
+{
+    o << "{\"count\": " << count_ << ", \"mean_ms\": " << 1e3 * mean()
+      << ", \"p50_ms\": " << 1e3 * percentile(0.5)
+      << ", \"p90_ms\": " << 1e3 * percentile(0.9)
+      << ", \"p99_ms\": " << 1e3 * percentile(0.99)
+      << ", \"max_ms\": " << 1e3 * max_ << "}";
+}
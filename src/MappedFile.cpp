@@ -0,0 +1,100 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   MappedFile.cpp
+ * @brief  Read-only memory-mapped view of a local file
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 05, 2019
+ */
+
+#include <mola-slam-gtsam/MappedFile.h>
+#include <mrpt/core/exceptions.h>
+
+#if defined(_WIN32)
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace mola;
+
+MappedFile::~MappedFile() { close(); }
+
+void MappedFile::open(const std::string& fileName)
+{
+    close();
+    fileName_ = fileName;
+    remap();
+}
+
+void MappedFile::close()
+{
+    unmap();
+    fileName_.clear();
+}
+
+void MappedFile::unmap()
+{
+#if !defined(_WIN32)
+    if (data_ != nullptr && fallback_buf_.empty())
+        ::munmap(const_cast<uint8_t*>(data_), size_);
+#endif
+    fallback_buf_.clear();
+    data_ = nullptr;
+    size_ = 0;
+}
+
+void MappedFile::remap()
+{
+    MRPT_START
+
+    ASSERT_(is_open());
+    unmap();
+
+#if defined(_WIN32)
+    std::ifstream f(fileName_, std::ios::binary | std::ios::ate);
+    ASSERTMSG_(
+        f.is_open(),
+        mrpt::format("Cannot open file: `%s`", fileName_.c_str()));
+    fallback_buf_.resize(static_cast<std::size_t>(f.tellg()));
+    f.seekg(0);
+    f.read(
+        reinterpret_cast<char*>(fallback_buf_.data()), fallback_buf_.size());
+    data_ = fallback_buf_.data();
+    size_ = fallback_buf_.size();
+#else
+    const int fd = ::open(fileName_.c_str(), O_RDONLY);
+    ASSERTMSG_(
+        fd >= 0, mrpt::format("Cannot open file: `%s`", fileName_.c_str()));
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0)
+    {
+        ::close(fd);
+        THROW_EXCEPTION_FMT("Cannot stat file: `%s`", fileName_.c_str());
+    }
+    size_ = static_cast<std::size_t>(st.st_size);
+
+    if (size_ > 0)
+    {
+        void* p = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED)
+        {
+            ::close(fd);
+            size_ = 0;
+            THROW_EXCEPTION_FMT("Cannot mmap file: `%s`", fileName_.c_str());
+        }
+        data_ = static_cast<const uint8_t*>(p);
+    }
+    // The mapping remains valid after closing the descriptor:
+    ::close(fd);
+#endif
+
+    MRPT_END
+}
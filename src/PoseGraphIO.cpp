@@ -0,0 +1,268 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   PoseGraphIO.cpp
+ * @brief  Streamed import of g2o/TORO pose-graph files into a back-end
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 12, 2019
+ */
+
+#include <mola-slam-gtsam/ASLAM_gtsam.h>
+#include <mola-slam-gtsam/PoseGraphIO.h>
+#include <mrpt/math/CQuaternion.h>
+#include <mrpt/poses/CPose3D.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+
+using namespace mola;
+
+namespace
+{
+/** Minimal, allocation-free tokenizer over one text line */
+struct LineParser
+{
+    const char* p;
+    std::size_t lineNum;
+
+    double num()
+    {
+        char*        end;
+        const double v = std::strtod(p, &end);
+        if (end == p)
+            THROW_EXCEPTION_FMT(
+                "Pose graph: expected a number in line %zu", lineNum);
+        p = end;
+        return v;
+    }
+    uint64_t id()
+    {
+        char*          end;
+        const uint64_t v = std::strtoull(p, &end, 10);
+        if (end == p)
+            THROW_EXCEPTION_FMT(
+                "Pose graph: expected a vertex ID in line %zu", lineNum);
+        p = end;
+        return v;
+    }
+};
+
+enum class Tag
+{
+    Unknown,
+    VertexSE3Quat,
+    EdgeSE3Quat,
+    VertexSE2,
+    EdgeSE2,
+    Vertex2,
+    Edge2,
+    Vertex3,
+    Edge3
+};
+
+Tag parseTag(const char*& p)
+{
+    while (*p == ' ' || *p == '\t') p++;
+    const char* s = p;
+    while (*p && *p != ' ' && *p != '\t') p++;
+    const std::size_t n = static_cast<std::size_t>(p - s);
+
+    const auto is = [&](const char* tag) {
+        return std::strlen(tag) == n && 0 == std::strncmp(s, tag, n);
+    };
+    if (is("VERTEX_SE3:QUAT")) return Tag::VertexSE3Quat;
+    if (is("EDGE_SE3:QUAT")) return Tag::EdgeSE3Quat;
+    if (is("VERTEX_SE2")) return Tag::VertexSE2;
+    if (is("EDGE_SE2")) return Tag::EdgeSE2;
+    if (is("VERTEX2")) return Tag::Vertex2;
+    if (is("EDGE2")) return Tag::Edge2;
+    if (is("VERTEX3")) return Tag::Vertex3;
+    if (is("EDGE3")) return Tag::Edge3;
+    return Tag::Unknown;
+}
+
+// sigma from the average of diagonal information entries:
+double sigmaFromInfo(std::initializer_list<double> infoDiag)
+{
+    double s = 0;
+    for (const double i : infoDiag) s += i;
+    s /= infoDiag.size();
+    ASSERT_(s > 0);
+    return 1.0 / std::sqrt(s);
+}
+}  // namespace
+
+PoseGraphImportResult mola::importPoseGraph(
+    std::istream& in, BackEndBase& backend, const PoseGraphImportOptions& opts)
+{
+    MRPT_START
+
+    using mrpt::math::TPose3D;
+    using mrpt::poses::CPose3D;
+
+    PoseGraphImportResult res;
+    std::string           line;
+    std::size_t           lineNum = 0;
+
+    // Vertex guesses, relative to the first vertex:
+    auto* aslam = opts.use_vertex_guesses
+                      ? dynamic_cast<ASLAM_gtsam*>(&backend)
+                      : nullptr;
+    std::optional<CPose3D> first_vertex;
+
+    const auto kf_for_vertex = [&](uint64_t v) {
+        const auto it = res.vertex2kf.find(v);
+        if (it == res.vertex2kf.end())
+            THROW_EXCEPTION_FMT(
+                "Pose graph: edge refers to undefined vertex %lu in line %zu",
+                static_cast<unsigned long>(v), lineNum);
+        return it->second;
+    };
+
+    while (std::getline(in, line))
+    {
+        lineNum++;
+        LineParser lp{line.c_str(), lineNum};
+        const Tag  tag = parseTag(lp.p);
+
+        switch (tag)
+        {
+            case Tag::VertexSE3Quat:
+            case Tag::VertexSE2:
+            case Tag::Vertex2:
+            case Tag::Vertex3:
+            {
+                const uint64_t v = lp.id();
+
+                CPose3D guess;
+                if (tag == Tag::VertexSE3Quat)
+                {
+                    const double x = lp.num(), y = lp.num(), z = lp.num();
+                    const double qx = lp.num(), qy = lp.num(), qz = lp.num(),
+                                 qw = lp.num();
+                    guess = CPose3D(
+                        mrpt::math::CQuaternionDouble(qw, qx, qy, qz), x, y,
+                        z);
+                }
+                else if (tag == Tag::Vertex3)
+                {
+                    // TORO: x y z roll pitch yaw
+                    const double x = lp.num(), y = lp.num(), z = lp.num();
+                    const double roll = lp.num(), pitch = lp.num(),
+                                 yaw = lp.num();
+                    guess = CPose3D(x, y, z, yaw, pitch, roll);
+                }
+                else
+                {
+                    const double x = lp.num(), y = lp.num(), th = lp.num();
+                    guess = CPose3D(x, y, 0, th, 0, 0);
+                }
+
+                BackEndBase::ProposeKF_Input kf;
+                kf.timestamp = mrpt::Clock::fromDouble(
+                    static_cast<double>(v) * opts.vertex_time_step);
+                const auto o = backend.doAddKeyFrame(kf);
+                ASSERT_(o.success && o.new_kf_id);
+
+                // The first vertex becomes the root KF, at the origin:
+                if (!first_vertex)
+                    first_vertex = guess;
+                else if (aslam)
+                    aslam->setKeyFrameInitialGuess(
+                        o.new_kf_id.value(), (guess - *first_vertex).asTPose());
+
+                res.vertex2kf[v] = o.new_kf_id.value();
+                res.vertices++;
+            }
+            break;
+
+            case Tag::EdgeSE3Quat:
+            case Tag::EdgeSE2:
+            case Tag::Edge2:
+            case Tag::Edge3:
+            {
+                const mola::id_t from = kf_for_vertex(lp.id());
+                const mola::id_t to   = kf_for_vertex(lp.id());
+
+                TPose3D rel;
+                double  sigma_xyz, sigma_rot;
+
+                if (tag == Tag::EdgeSE3Quat)
+                {
+                    const double x = lp.num(), y = lp.num(), z = lp.num();
+                    const double qx = lp.num(), qy = lp.num(), qz = lp.num(),
+                                 qw = lp.num();
+                    rel = mrpt::poses::CPose3D(
+                              mrpt::math::CQuaternionDouble(qw, qx, qy, qz),
+                              x, y, z)
+                              .asTPose();
+                    // Upper triangle of 6x6 info, (x y z qx qy qz) order.
+                    // Since q_xyz ~ theta/2, Info(theta) = Info(q_xyz)/4:
+                    double info[21];
+                    for (auto& i : info) i = lp.num();
+                    sigma_xyz = sigmaFromInfo({info[0], info[6], info[11]});
+                    sigma_rot = sigmaFromInfo(
+                        {info[15] / 4, info[18] / 4, info[20] / 4});
+                }
+                else if (tag == Tag::Edge3)
+                {
+                    // TORO: x y z roll pitch yaw, then 6x6 upper triangle
+                    const double x = lp.num(), y = lp.num(), z = lp.num();
+                    const double roll = lp.num(), pitch = lp.num(),
+                                 yaw = lp.num();
+                    rel = TPose3D(x, y, z, yaw, pitch, roll);
+                    double info[21];
+                    for (auto& i : info) i = lp.num();
+                    sigma_xyz = sigmaFromInfo({info[0], info[6], info[11]});
+                    sigma_rot = sigmaFromInfo({info[15], info[18], info[20]});
+                }
+                else
+                {
+                    const double x = lp.num(), y = lp.num(), th = lp.num();
+                    rel = TPose3D(x, y, 0, th, 0, 0);
+                    double info[6];
+                    for (auto& i : info) i = lp.num();
+                    if (tag == Tag::EdgeSE2)
+                    {
+                        // g2o: I11 I12 I13 I22 I23 I33
+                        sigma_xyz = sigmaFromInfo({info[0], info[3]});
+                        sigma_rot = sigmaFromInfo({info[5]});
+                    }
+                    else
+                    {
+                        // TORO: I11 I12 I22 I33 I13 I23
+                        sigma_xyz = sigmaFromInfo({info[0], info[2]});
+                        sigma_rot = sigmaFromInfo({info[3]});
+                    }
+                }
+
+                FactorRelativePose3 f(from, to, rel);
+                f.noise_model_diag_xyz_ = sigma_xyz;
+                f.noise_model_diag_rot_ = sigma_rot;
+
+                Factor fac = std::move(f);
+                backend.doAddFactor(fac);
+                res.edges++;
+
+                if (opts.spin_every_n_edges > 0 &&
+                    (res.edges % opts.spin_every_n_edges) == 0)
+                    backend.spinOnce();
+            }
+            break;
+
+            case Tag::Unknown:
+            default:
+                res.ignored_lines++;
+                break;
+        };
+    }
+
+    return res;
+
+    MRPT_END
+}
@@ -0,0 +1,56 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   ProcessMemory.cpp
+ * @brief  Resident memory of the current process
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 20, 2019
+ */
+
+#include <mola-slam-gtsam/ProcessMemory.h>
+
+#if defined(__linux__)
+#include <fstream>
+#include <sstream>
+#include <string>
+#elif !defined(_WIN32)
+#include <sys/resource.h>
+#endif
+
+mola::ProcessMemory mola::processMemory()
+{
+    ProcessMemory m;
+#if defined(__linux__)
+    // Lines like "VmRSS:     123456 kB"
+    std::ifstream f("/proc/self/status");
+    for (std::string line; std::getline(f, line);)
+    {
+        std::size_t* dst = nullptr;
+        if (line.rfind("VmRSS:", 0) == 0)
+            dst = &m.rss;
+        else if (line.rfind("VmHWM:", 0) == 0)
+            dst = &m.peak_rss;
+        if (!dst) continue;
+
+        std::istringstream ss(line.substr(6));
+        std::size_t        kb = 0;
+        ss >> kb;
+        *dst = kb * 1024;
+    }
+#elif !defined(_WIN32)
+    struct rusage ru;
+    if (::getrusage(RUSAGE_SELF, &ru) == 0)
+    {
+        // Bytes on macOS, kB elsewhere:
+#if defined(__APPLE__)
+        m.peak_rss = static_cast<std::size_t>(ru.ru_maxrss);
+#else
+        m.peak_rss = static_cast<std::size_t>(ru.ru_maxrss) * 1024;
+#endif
+    }
+#endif
+    return m;
+}
@@ -10,10 +10,24 @@
  * @date   Dec 21, 2018
  */
 
+#include <gtsam/inference/Symbol.h>  // X() symbols
+#include <gtsam/nonlinear/LevenbergMarquardtOptimizer.h>
+#include <gtsam/slam/BetweenFactor.h>
+#include <gtsam/slam/PriorFactor.h>
+#include <mola-kernel/entities/entities-common.h>
+#include <mola-kernel/lock_helper.h>
+#include <mola-kernel/variant_helper.h>  // overloaded{}
 #include <mola-kernel/yaml_helpers.h>
 #include <mola-slam-gtsam/RSLAM_gtsam.h>
+#include <mola-slam-gtsam/TraceRecorder.h>
+#include <mola-slam-gtsam/gtsam_mola_bridge.h>
+#include <mrpt/system/datetime.h>
 #include <yaml-cpp/yaml.h>
 
+#include <chrono>
+#include <deque>
+#include <set>
+
 using namespace mola;
 
 // arguments: class_name, parent_class, class namespace
@@ -29,17 +43,40 @@ void RSLAM_gtsam::initialize(const std::string& cfg_block)
     MRPT_LOG_DEBUG_STREAM("Initializing with these params:\n" << cfg_block);
 
     // Mandatory parameters:
-    auto cfg = YAML::Load(cfg_block);
+    auto c = YAML::Load(cfg_block);
+
+    ENSURE_YAML_ENTRY_EXISTS(c, "params");
+    auto cfg = c["params"];
+
+    YAML_LOAD_OPT(params_, local_window_depth, int);
+    YAML_LOAD_OPT(params_, local_window_max_kfs, int);
+    YAML_LOAD_OPT(params_, anchor_max_distance, double);
+    YAML_LOAD_OPT(params_, anchor_max_kfs, int);
+    YAML_LOAD_OPT(params_, max_iterations, int);
 
-    ENSURE_YAML_ENTRY_EXISTS(cfg, "params");
-    auto params = cfg["params"];
+    ASSERT_(params_.local_window_depth > 0);
+    ASSERT_(params_.local_window_max_kfs > 1);
+    ASSERT_(params_.anchor_max_kfs > 0);
+
+    // Ensure we have access to the worldmodel:
+    ASSERT_(worldmodel_);
 
     MRPT_END
 }
+
 void RSLAM_gtsam::spinOnce()
 {
     MRPT_START
     ProfilerEntry tleg(profiler_, "spinOnce");
+    TraceScope    trg("spinOnce");
+
+    auto lock = lockHelper(state_lock_);
+
+    // Nothing new to optimize?
+    if (!dirty_) return;
+    dirty_ = false;
+
+    optimizeLocalWindow();
 
     MRPT_END
 }
@@ -49,35 +86,384 @@ BackEndBase::ProposeKF_Output RSLAM_gtsam::doAddKeyFrame(
 {
     MRPT_START
     ProfilerEntry    tleg(profiler_, "doAddKeyFrame");
+    TraceScope       trg("doAddKeyFrame");
     ProposeKF_Output o;
 
-    MRPT_LOG_DEBUG("Creating new KeyFrame");
+    MRPT_LOG_DEBUG_FMT(
+        "Creating new KeyFrame (timestamp=%s)",
+        mrpt::system::dateTimeLocalToString(i.timestamp).c_str());
+
+    mrpt::obs::CSensoryFrame::Ptr obs;
+    if (i.observations)
+        obs = mrpt::obs::CSensoryFrame::Create(i.observations.value());
+
+    auto lock = lockHelper(state_lock_);
+
+    if (root_id_ == INVALID_ID)
+    {
+        // Reference of coordinates for the first anchor:
+        worldmodel_->entities_lock_for_write();
+        mola::RefPose3 root;
+        root.timestamp_ = i.timestamp;
+        root_id_        = worldmodel_->entity_emplace_back(root);
+        worldmodel_->entities_unlock_for_write();
+
+        kfs_[root_id_].has_value = true;
+
+        o.new_kf_id = addKeyFrameEntity(i.timestamp, obs);
+
+        mola::FactorRelativePose3 f(
+            root_id_, o.new_kf_id.value(), mrpt::math::TPose3D::Identity());
+        f.noise_model_diag_xyz_ = 0.1;
+        f.noise_model_diag_rot_ = mrpt::DEG2RAD(0.1);
+        mola::Factor ff         = f;
+        doAddFactor(ff);
+    }
+    else
+    {
+        o.new_kf_id = addKeyFrameEntity(i.timestamp, obs);
+    }
+    o.success = true;
+
+    return o;
+
+    MRPT_END
+}
+
+// state_lock_ is locked from the caller site.
+mola::id_t RSLAM_gtsam::addKeyFrameEntity(
+    const mrpt::Clock::time_point&       timestamp,
+    const mrpt::obs::CSensoryFrame::Ptr& obs)
+{
+    MRPT_START
+
+    // Do we already have a KF for this timestamp?
+    if (const auto id = find_closest_KF_in_time(time2kf_, timestamp, 0.1);
+        id != INVALID_ID)
+        return id;
+
+    // Start a new anchor?
+    const auto max_kfs = static_cast<std::size_t>(params_.anchor_max_kfs);
+    bool       new_anchor =
+        (anchor_id_ == INVALID_ID) || (anchor_kf_count_ >= max_kfs);
+    if (!new_anchor && last_kf_id_ != anchor_id_)
+    {
+        const auto&  last = kfs_.at(last_kf_id_);
+        const double dist = last.rel_pose.translation().norm();
+        new_anchor        = last.has_value && last.base == anchor_id_ &&
+                     dist > params_.anchor_max_distance;
+    }
+    const mola::id_t base = anchor_id_ == INVALID_ID ? root_id_ : anchor_id_;
+
+    mola::RelPose3KF new_kf;
+    new_kf.base_id_          = base;
+    new_kf.timestamp_        = timestamp;
+    new_kf.raw_observations_ = obs;
+
+    worldmodel_->entities_lock_for_write();
+    const auto new_kf_id = worldmodel_->entity_emplace_back(std::move(new_kf));
+    worldmodel_->entities_unlock_for_write();
+
+    kfs_[new_kf_id].base = base;
+    time2kf_[timestamp]  = new_kf_id;
+    last_kf_id_          = new_kf_id;
+
+    if (new_anchor)
+    {
+        MRPT_LOG_DEBUG_STREAM(
+            "New anchor: KF #" << new_kf_id << " (base: #" << base << ")");
+        anchor_id_       = new_kf_id;
+        anchor_kf_count_ = 0;
+    }
+    else
+        anchor_kf_count_++;
+
+    return new_kf_id;
+
+    MRPT_END
+}
+
+BackEndBase::AddFactor_Output RSLAM_gtsam::doAddFactor(Factor& newF)
+{
+    MRPT_START
+    ProfilerEntry    tleg(profiler_, "doAddFactor");
+    TraceScope       trg("doAddFactor");
+    AddFactor_Output o;
+
+    auto lock = lockHelper(state_lock_);
 
-    // worldmodel_-> ...;
-    MRPT_TODO("Continue here!");
+    // All factors go to the WorldModel, even if not optimized here:
+    worldmodel_->factors_lock_for_write();
+    const fid_t fid = worldmodel_->factor_push_back(newF);
+    worldmodel_->factors_unlock_for_write();
 
-    // auto e = std::make_shared<EntityBase>();
-    // o.new_kf_id = ents.emplace_back(e);
-    // o.success = true;
+    std::visit(
+        overloaded{
+            [&](const FactorRelativePose3& f) { addEdge(f); },
+            [&]([[maybe_unused]] const auto& f) {
+                if (warned_ignored_factor_) return;
+                warned_ignored_factor_ = true;
+                MRPT_LOG_WARN(
+                    "Only FactorRelativePose3 factors are optimized by "
+                    "RSLAM_gtsam; other types are ignored.");
+            },
+        },
+        newF);
+
+    o.success       = true;
+    o.new_factor_id = fid;
     return o;
 
     MRPT_END
 }
 
-BackEndBase::AddFactor_Output RSLAM_gtsam::doAddFactor(Factor& f)
+// state_lock_ is locked from the caller site.
+void RSLAM_gtsam::addEdge(const FactorRelativePose3& f)
+{
+    MRPT_START
+
+    ASSERT_(f.from_kf_ != f.to_kf_);
+    ASSERTMSG_(
+        kfs_.count(f.from_kf_) != 0 && kfs_.count(f.to_kf_) != 0,
+        mrpt::format(
+            "FactorRelativePose3 between unknown keyframes: #%lu -> #%lu",
+            static_cast<unsigned long>(f.from_kf_),
+            static_cast<unsigned long>(f.to_kf_)));
+
+    const double std_xyz = f.noise_model_diag_xyz_;
+    const double std_ang = f.noise_model_diag_rot_;
+
+    auto noise_relpose = gtsam::noiseModel::Diagonal::Sigmas(
+        (gtsam::Vector6() << std_ang, std_ang, std_ang, std_xyz, std_xyz,
+         std_xyz)
+            .finished());
+
+    Edge e;
+    e.from     = f.from_kf_;
+    e.to       = f.to_kf_;
+    e.measure  = toPose3(f.rel_pose_);
+    e.estimate = e.measure;
+    e.noise    = gtsam::noiseModel::Robust::Create(
+        gtsam::noiseModel::mEstimator::Huber::Create(1.345), noise_relpose);
+
+    auto& kf_from = kfs_.at(e.from);
+    auto& kf_to   = kfs_.at(e.to);
+
+    // Quick initial guess of a new KF from its neighbour, if both are
+    // (directly or via a common anchor) in the same frame:
+    const auto guess = [](const KeyFrame& known, const mola::id_t known_id,
+                          KeyFrame& unknown, const gtsam::Pose3& rel) {
+        if (!known.has_value || unknown.has_value) return false;
+        if (unknown.base == known_id)
+            unknown.rel_pose = rel;
+        else if (unknown.base == known.base)
+            unknown.rel_pose = known.rel_pose.compose(rel);
+        else
+            return false;
+        unknown.has_value = true;
+        return true;
+    };
+    mola::id_t guessed = INVALID_ID;
+    if (guess(kf_from, e.from, kf_to, e.measure))
+        guessed = e.to;
+    else if (guess(kf_to, e.to, kf_from, e.measure.inverse()))
+        guessed = e.from;
+
+    if (guessed != INVALID_ID)
+    {
+        worldmodel_->entities_lock_for_write();
+        updateEntityPose(
+            worldmodel_->entity_by_id(guessed), kfs_.at(guessed).rel_pose);
+        worldmodel_->entities_unlock_for_write();
+    }
+
+    kf_from.edges.push_back(edges_.size());
+    kf_to.edges.push_back(edges_.size());
+    edges_.emplace_back(std::move(e));
+
+    dirty_ = true;
+
+    MRPT_END
+}
+
+// state_lock_ is locked from the caller site.
+void RSLAM_gtsam::optimizeLocalWindow()
 {
     MRPT_START
 
-    THROW_EXCEPTION("Implement me!");
+    using gtsam::symbol_shorthand::X;
+
+    if (last_kf_id_ == INVALID_ID) return;
+
+    // Breadth-first search from the latest KF, composing the current
+    // relative estimates along edges. Poses are in the frame of the latest
+    // KF. KFs that are not fully expanded are fixed.
+    std::map<mola::id_t, int>          depth;
+    std::map<mola::id_t, gtsam::Pose3> pose;
+    std::set<mola::id_t>               fixed;
+    std::set<std::size_t>              window_edges;
+    {
+        ProfilerEntry tle(profiler_, "spinOnce.local_window");
+        TraceScope    tr("spinOnce.local_window");
+
+        const auto max_kfs =
+            static_cast<std::size_t>(params_.local_window_max_kfs);
+
+        std::deque<mola::id_t> q;
+        depth[last_kf_id_] = 0;
+        pose[last_kf_id_]  = gtsam::Pose3();
+        q.push_back(last_kf_id_);
+
+        while (!q.empty())
+        {
+            const mola::id_t a = q.front();
+            q.pop_front();
+            if (a == root_id_ || depth[a] >= params_.local_window_depth)
+            {
+                fixed.insert(a);
+                continue;
+            }
+            for (const auto ei : kfs_.at(a).edges)
+            {
+                const auto&      e = edges_[ei];
+                const mola::id_t b = (e.from == a) ? e.to : e.from;
+                if (depth.count(b) == 0)
+                {
+                    if (depth.size() >= max_kfs)
+                    {
+                        fixed.insert(a);
+                        continue;
+                    }
+                    depth[b] = depth[a] + 1;
+                    pose[b]  = (e.from == a)
+                                  ? pose[a].compose(e.estimate)
+                                  : pose[a].compose(e.estimate.inverse());
+                    q.push_back(b);
+                }
+                window_edges.insert(ei);
+            }
+        }
+        // Edges among fixed KFs may have been left out: harmless, since
+        // they cannot change anything.
+
+        // Gauge freedom: fix the oldest KF if nothing else is.
+        if (fixed.empty()) fixed.insert(pose.begin()->first);
+    }
+
+    last_window_size_ = pose.size();
+    if (window_edges.empty()) return;
+
+    gtsam::NonlinearFactorGraph graph;
+    gtsam::Values               values;
+    for (const auto& kv : pose) values.insert(X(kv.first), kv.second);
+    for (const auto ei : window_edges)
+    {
+        const auto& e = edges_[ei];
+        graph.emplace_shared<gtsam::BetweenFactor<gtsam::Pose3>>(
+            X(e.from), X(e.to), e.measure, e.noise);
+    }
+    const auto fixed_noise = gtsam::noiseModel::Isotropic::Sigma(6, 1e-6);
+    for (const auto id : fixed)
+        graph.emplace_shared<gtsam::PriorFactor<gtsam::Pose3>>(
+            X(id), pose.at(id), fixed_noise);
+
+    gtsam::Values result;
+    {
+        ProfilerEntry tle(profiler_, "spinOnce.LevenbergMarquardtOptimizer");
+        TraceScope    tr("spinOnce.LevenbergMarquardtOptimizer");
+
+        gtsam::LevenbergMarquardtParams lm_params;
+        lm_params.maxIterations = params_.max_iterations;
+
+        gtsam::LevenbergMarquardtOptimizer optimizer(graph, values, lm_params);
+        result = optimizer.optimize();
+
+        MRPT_LOG_DEBUG_STREAM(
+            "Local window: " << pose.size() << " KFs (" << fixed.size()
+                             << " fixed), " << window_edges.size()
+                             << " edges, error=" << optimizer.error()
+                             << " iterations=" << optimizer.iterations());
+    }
+
+    // Write back: relative estimates along edges, and relative poses wrt
+    // anchors.
+    ProfilerEntry tle(profiler_, "spinOnce.write_back");
+    TraceScope    tr("spinOnce.write_back");
+
+    for (const auto ei : window_edges)
+    {
+        auto& e    = edges_[ei];
+        e.estimate = result.at<gtsam::Pose3>(X(e.from))
+                         .between(result.at<gtsam::Pose3>(X(e.to)));
+    }
+
+    // Pose of an anchor in the window frame. If it is not in the window,
+    // from its stored pose: relative to a fixed KF of the window (fixed KFs
+    // did not move), or to its own base, if that one is in the window.
+    std::map<mola::id_t, gtsam::Pose3> anchor_pose;
+    for (const auto id : fixed)
+    {
+        const auto& kf = kfs_.at(id);
+        if (!kf.has_value || kf.base == INVALID_ID ||
+            pose.count(kf.base) != 0 || anchor_pose.count(kf.base) != 0)
+            continue;
+        anchor_pose[kf.base] =
+            result.at<gtsam::Pose3>(X(id)).compose(kf.rel_pose.inverse());
+    }
+    const auto findAnchor = [&](const mola::id_t base, gtsam::Pose3& p) {
+        if (pose.count(base) != 0)
+        {
+            p = result.at<gtsam::Pose3>(X(base));
+            return true;
+        }
+        if (const auto it = anchor_pose.find(base); it != anchor_pose.end())
+        {
+            p = it->second;
+            return true;
+        }
+        const auto& a = kfs_.at(base);
+        if (!a.has_value || pose.count(a.base) == 0) return false;
+        p = result.at<gtsam::Pose3>(X(a.base)).compose(a.rel_pose);
+        anchor_pose[base] = p;
+        return true;
+    };
+
+    worldmodel_->entities_lock_for_write();
+    for (const auto& kv : pose)
+    {
+        const mola::id_t id = kv.first;
+        auto&            kf = kfs_.at(id);
+        gtsam::Pose3     base_pose;
+        if (fixed.count(id) != 0 || kf.base == INVALID_ID ||
+            !findAnchor(kf.base, base_pose))
+            continue;
+
+        kf.rel_pose  = base_pose.between(result.at<gtsam::Pose3>(X(id)));
+        kf.has_value = true;
+        updateEntityPose(worldmodel_->entity_by_id(id), kf.rel_pose);
+    }
+    worldmodel_->entities_unlock_for_write();
 
     MRPT_END
 }
+
 void RSLAM_gtsam::doAdvertiseUpdatedLocalization(
     AdvertiseUpdatedLocalization_Input l)
 {
     MRPT_START
+    ProfilerEntry tleg(profiler_, "doAdvertiseUpdatedLocalization");
+    TraceScope    trg("doAdvertiseUpdatedLocalization");
+
+    ASSERT_(l.timestamp != INVALID_TIMESTAMP);
+
+    MRPT_LOG_DEBUG_STREAM(
+        "AdvertiseUpdatedLocalization: timestamp="
+        << mrpt::Clock::toDouble(l.timestamp) << " ref_kf=#" << l.reference_kf
+        << " rel_pose=" << l.pose.asString());
 
-    THROW_EXCEPTION("Implement me!");
+    // Already relative to a keyframe: nothing else to do in relative SLAM.
+    std::lock_guard<std::mutex> lck(latest_localization_data_mtx_);
+    latest_localization_data_ = l;
 
     MRPT_END
 }
@@ -0,0 +1,237 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   SeparatorExchange.cpp
+ * @brief  Separator summaries exchanged between multi-robot back-ends
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 20, 2019
+ */
+
+#include <mola-slam-gtsam/SeparatorExchange.h>
+#include <mrpt/core/exceptions.h>
+#include <mrpt/core/format.h>
+#include <mrpt/io/CMemoryStream.h>
+#include <mrpt/serialization/CArchive.h>
+
+#include <cerrno>
+#include <cstring>
+
+#if !defined(_WIN32)
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using namespace mola;
+
+/** Datagram signature. Bump the number when the encoding changes. */
+static const uint64_t SUMMARY_MAGIC = 0x31504553414C4F4DULL;  // "MOLASEP1"
+/** Larger datagrams are truncated by the kernel */
+static const std::size_t MAX_DATAGRAM = 256 * 1024;
+
+namespace
+{
+void writePose(mrpt::serialization::CArchive& a, const gtsam::Pose3& p)
+{
+    const gtsam::Matrix4 M = p.matrix();
+    for (int r = 0; r < 3; r++)
+        for (int c = 0; c < 4; c++) a << M(r, c);
+}
+gtsam::Pose3 readPose(mrpt::serialization::CArchive& a)
+{
+    gtsam::Matrix4 M = gtsam::Matrix4::Identity();
+    for (int r = 0; r < 3; r++)
+        for (int c = 0; c < 4; c++) a >> M(r, c);
+    return gtsam::Pose3(M);
+}
+}  // namespace
+
+std::vector<uint8_t> SeparatorSummary::encode() const
+{
+    mrpt::io::CMemoryStream mem;
+    auto                    a = mrpt::serialization::archiveFrom(mem);
+
+    a.WriteAs<uint64_t>(SUMMARY_MAGIC);
+    a.WriteAs<uint32_t>(robot_id);
+    a.WriteAs<uint64_t>(seq);
+
+    a.WriteAs<uint32_t>(marginals.size());
+    for (const auto& m : marginals)
+    {
+        a.WriteAs<uint64_t>(m.kf);
+        writePose(a, m.mean);
+        for (int i = 0; i < 36; i++) a << m.cov(i);
+        writePose(a, m.estimate);
+    }
+
+    a.WriteAs<uint32_t>(constraints.size());
+    for (const auto& c : constraints)
+    {
+        a.WriteAs<uint32_t>(c.robot_from);
+        a.WriteAs<uint64_t>(c.kf_from);
+        a.WriteAs<uint32_t>(c.robot_to);
+        a.WriteAs<uint64_t>(c.kf_to);
+        writePose(a, c.rel_pose);
+        a << c.sigma_xyz << c.sigma_rot;
+    }
+
+    const auto* p = static_cast<const uint8_t*>(mem.getRawBufferData());
+    return std::vector<uint8_t>(p, p + mem.getTotalBytesCount());
+}
+
+void SeparatorSummary::decode(const uint8_t* data, const std::size_t len)
+{
+    MRPT_START
+
+    mrpt::io::CMemoryStream mem;
+    mem.assignMemoryNotOwn(data, len);
+    auto a = mrpt::serialization::archiveFrom(mem);
+
+    ASSERTMSG_(
+        a.ReadAs<uint64_t>() == SUMMARY_MAGIC,
+        "Not a separator summary, or unsupported version");
+    robot_id = a.ReadAs<uint32_t>();
+    seq      = a.ReadAs<uint64_t>();
+
+    marginals.resize(a.ReadAs<uint32_t>());
+    for (auto& m : marginals)
+    {
+        m.kf   = a.ReadAs<uint64_t>();
+        m.mean = readPose(a);
+        for (int i = 0; i < 36; i++) a >> m.cov(i);
+        m.estimate = readPose(a);
+    }
+
+    constraints.resize(a.ReadAs<uint32_t>());
+    for (auto& c : constraints)
+    {
+        c.robot_from = a.ReadAs<uint32_t>();
+        c.kf_from    = a.ReadAs<uint64_t>();
+        c.robot_to   = a.ReadAs<uint32_t>();
+        c.kf_to      = a.ReadAs<uint64_t>();
+        c.rel_pose   = readPose(a);
+        a >> c.sigma_xyz >> c.sigma_rot;
+    }
+
+    MRPT_END
+}
+
+// ------------------------------------------------------------------------
+//  SeparatorChannel
+// ------------------------------------------------------------------------
+SeparatorChannel::~SeparatorChannel() { close(); }
+
+std::string SeparatorChannel::socketPath(const uint32_t robot) const
+{
+    return mrpt::format(
+        "%s/robot_%u.sock", directory_.c_str(), static_cast<unsigned>(robot));
+}
+
+#if !defined(_WIN32)
+
+void SeparatorChannel::open(
+    const std::string& directory, const uint32_t robot_id)
+{
+    MRPT_START
+
+    close();
+    directory_ = directory;
+    path_      = socketPath(robot_id);
+
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    ASSERTMSG_(
+        path_.size() < sizeof(addr.sun_path),
+        mrpt::format("Socket path too long: `%s`", path_.c_str()));
+    std::strcpy(addr.sun_path, path_.c_str());
+
+    fd_ = ::socket(AF_UNIX, SOCK_DGRAM, 0);
+    ASSERTMSG_(fd_ >= 0, "Cannot create Unix domain socket");
+
+    // Left behind by a former run:
+    ::unlink(path_.c_str());
+    if (::bind(fd_, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) !=
+        0)
+    {
+        const int err = errno;
+        close();
+        THROW_EXCEPTION_FMT(
+            "Cannot bind `%s`: %s", path_.c_str(), std::strerror(err));
+    }
+
+    MRPT_END
+}
+
+void SeparatorChannel::close()
+{
+    if (fd_ < 0) return;
+    ::close(fd_);
+    ::unlink(path_.c_str());
+    fd_ = -1;
+}
+
+bool SeparatorChannel::send(const uint32_t peer, const SeparatorSummary& s)
+{
+    MRPT_START
+    ASSERT_(is_open());
+
+    const auto buf = s.encode();
+    ASSERTMSG_(
+        buf.size() <= MAX_DATAGRAM,
+        mrpt::format("Separator summary too large: %zu bytes", buf.size()));
+
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    const auto dest = socketPath(peer);
+    ASSERT_(dest.size() < sizeof(addr.sun_path));
+    std::strcpy(addr.sun_path, dest.c_str());
+
+    const auto n = ::sendto(
+        fd_, buf.data(), buf.size(), MSG_DONTWAIT,
+        reinterpret_cast<const sockaddr*>(&addr), sizeof(addr));
+    return n == static_cast<ssize_t>(buf.size());
+
+    MRPT_END
+}
+
+bool SeparatorChannel::receive(SeparatorSummary& s)
+{
+    MRPT_START
+    ASSERT_(is_open());
+
+    std::vector<uint8_t> buf(MAX_DATAGRAM);
+    for (;;)
+    {
+        const auto n = ::recv(fd_, buf.data(), buf.size(), MSG_DONTWAIT);
+        if (n < 0) return false;  // EAGAIN: empty queue
+        try
+        {
+            s.decode(buf.data(), static_cast<std::size_t>(n));
+            return true;
+        }
+        catch (const std::exception&)
+        {
+            // Drop it and try the next one
+        }
+    }
+
+    MRPT_END
+}
+
+#else
+
+void SeparatorChannel::open(const std::string&, const uint32_t)
+{
+    THROW_EXCEPTION("SeparatorChannel is not available on Windows");
+}
+void SeparatorChannel::close() {}
+bool SeparatorChannel::send(const uint32_t, const SeparatorSummary&)
+{
+    return false;
+}
+bool SeparatorChannel::receive(SeparatorSummary&) { return false; }
+
+#endif
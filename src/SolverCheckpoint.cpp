@@ -0,0 +1,287 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   SolverCheckpoint.cpp
+ * @brief  Snapshot of the ASLAM_gtsam solver state, for warm restarts
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 18, 2019
+ */
+
+#include <mola-slam-gtsam/ConstVelocityFactorSE3.h>
+#include <mola-slam-gtsam/MappedFile.h>
+#include <mola-slam-gtsam/SolverCheckpoint.h>
+#include <mrpt/core/exceptions.h>
+#include <mrpt/core/format.h>
+
+#include <gtsam/base/serialization.h>
+#include <gtsam/linear/GaussianConditional.h>
+#include <gtsam/linear/HessianFactor.h>
+#include <gtsam/linear/JacobianFactor.h>
+#include <gtsam/linear/RegularHessianFactor.h>
+#include <gtsam/navigation/ImuBias.h>
+#include <gtsam/slam/BetweenFactor.h>
+#include <gtsam/slam/PriorFactor.h>
+#include <gtsam/slam/StereoFactor.h>
+#include <gtsam_unstable/slam/SmartStereoProjectionPoseFactor.h>
+
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/stream.hpp>
+#include <boost/serialization/map.hpp>
+#include <boost/serialization/optional.hpp>
+#include <boost/serialization/set.hpp>
+#include <boost/serialization/string.hpp>
+#include <boost/serialization/vector.hpp>
+#include <boost/serialization/weak_ptr.hpp>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+// Polymorphic types that may appear in the graph. Keep in sync with the
+// factors created in ASLAM_gtsam_addFactor.cpp:
+BOOST_CLASS_EXPORT_GUID(
+    gtsam::noiseModel::Constrained, "gtsam_noiseModel_Constrained");
+BOOST_CLASS_EXPORT_GUID(
+    gtsam::noiseModel::Diagonal, "gtsam_noiseModel_Diagonal");
+BOOST_CLASS_EXPORT_GUID(
+    gtsam::noiseModel::Gaussian, "gtsam_noiseModel_Gaussian");
+BOOST_CLASS_EXPORT_GUID(gtsam::noiseModel::Unit, "gtsam_noiseModel_Unit");
+BOOST_CLASS_EXPORT_GUID(
+    gtsam::noiseModel::Isotropic, "gtsam_noiseModel_Isotropic");
+BOOST_CLASS_EXPORT_GUID(gtsam::noiseModel::Robust, "gtsam_noiseModel_Robust");
+BOOST_CLASS_EXPORT_GUID(
+    gtsam::noiseModel::mEstimator::Base, "gtsam_noiseModel_mEstimator_Base");
+BOOST_CLASS_EXPORT_GUID(
+    gtsam::noiseModel::mEstimator::Huber,
+    "gtsam_noiseModel_mEstimator_Huber");
+BOOST_CLASS_EXPORT_GUID(gtsam::SharedNoiseModel, "gtsam_SharedNoiseModel");
+BOOST_CLASS_EXPORT_GUID(gtsam::SharedDiagonal, "gtsam_SharedDiagonal");
+
+GTSAM_VALUE_EXPORT(gtsam::Pose3);
+GTSAM_VALUE_EXPORT(gtsam::Point3);
+GTSAM_VALUE_EXPORT(gtsam::Vector3);
+GTSAM_VALUE_EXPORT(gtsam::imuBias::ConstantBias);
+
+BOOST_CLASS_EXPORT_GUID(
+    gtsam::PriorFactor<gtsam::Pose3>, "gtsam_PriorFactor_Pose3");
+BOOST_CLASS_EXPORT_GUID(
+    gtsam::PriorFactor<gtsam::Vector3>, "gtsam_PriorFactor_Vector3");
+BOOST_CLASS_EXPORT_GUID(
+    gtsam::BetweenFactor<gtsam::Pose3>, "gtsam_BetweenFactor_Pose3");
+BOOST_CLASS_EXPORT_GUID(
+    mola::ConstVelocityFactorSE3, "mola_ConstVelocityFactorSE3");
+BOOST_CLASS_EXPORT_GUID(
+    gtsam::SmartStereoProjectionPoseFactor,
+    "gtsam_SmartStereoProjectionPoseFactor");
+using StereoFactorPose3Point3 =
+    gtsam::GenericStereoFactor<gtsam::Pose3, gtsam::Point3>;
+BOOST_CLASS_EXPORT_GUID(
+    StereoFactorPose3Point3, "gtsam_GenericStereoFactor_Pose3_Point3");
+
+// Linear factors and conditionals of the iSAM2 Bayes tree. Smart factors
+// linearize into RegularHessianFactor<6>:
+BOOST_CLASS_EXPORT_GUID(gtsam::JacobianFactor, "gtsam_JacobianFactor");
+BOOST_CLASS_EXPORT_GUID(gtsam::HessianFactor, "gtsam_HessianFactor");
+BOOST_CLASS_EXPORT_GUID(
+    gtsam::GaussianConditional, "gtsam_GaussianConditional");
+BOOST_CLASS_EXPORT_GUID(
+    gtsam::RegularHessianFactor<6>, "gtsam_RegularHessianFactor_6");
+
+namespace boost::serialization
+{
+template <class ARCHIVE>
+void serialize(
+    ARCHIVE& ar, gtsam::RegularHessianFactor<6>& f,
+    const unsigned int /*version*/)
+{
+    ar& boost::serialization::base_object<gtsam::HessianFactor>(f);
+}
+
+template <class ARCHIVE>
+void serialize(
+    ARCHIVE& ar, mola::SolverCheckpoint& cp, const unsigned int /*version*/)
+{
+    ar& cp.num_factors& cp.num_variables;
+    ar& cp.newfactors& cp.newvalues& cp.newFactor2molaid&
+        cp.changedSmartFactors;
+    ar& cp.kfs& cp.kf_has_value;
+    ar& cp.root_kf_id& cp.last_created_kf_id& cp.former_last_created_kf_id;
+    ar& cp.last_created_kf_id_tim& cp.has_last_created_kf_id_tim;
+    ar& cp.time2kf;
+    ar& cp.has_camera_K& cp.camera_K;
+    ar& cp.smart_in_graph& cp.smart_in_newfactors& cp.smart_ids;
+    ar& cp.viz_nodes& cp.viz_edge_from& cp.viz_edge_to& cp.viz_edge_pose;
+    ar& cp.viz_dyn;
+}
+}  // namespace boost::serialization
+
+namespace
+{
+/** Not all GTSAM versions can serialize gtsam::ISAM2, so this does it from
+ * a derived class, which can name its protected members. Parameters are
+ * not included: they are set when the solver is created. */
+struct ISAM2State : public gtsam::ISAM2
+{
+    template <class ARCHIVE>
+    static void serialize(ARCHIVE& ar, gtsam::ISAM2& s)
+    {
+        ar& static_cast<gtsam::ISAM2::Base&>(s);  // Bayes tree cliques
+        ar& s.*(&ISAM2State::theta_);
+        ar& s.*(&ISAM2State::variableIndex_);
+        ar& s.*(&ISAM2State::delta_);
+        ar& s.*(&ISAM2State::deltaNewton_);
+        ar& s.*(&ISAM2State::RgProd_);
+        ar& s.*(&ISAM2State::deltaReplacedMask_);
+        ar& s.*(&ISAM2State::nonlinearFactors_);
+        ar& s.*(&ISAM2State::linearFactors_);
+        ar& s.*(&ISAM2State::doglegDelta_);
+        ar& s.*(&ISAM2State::fixedVariables_);
+        ar& s.*(&ISAM2State::update_count_);
+    }
+
+    static gtsam::NonlinearFactorGraph& factors(gtsam::ISAM2& s)
+    {
+        return s.*(&ISAM2State::nonlinearFactors_);
+    }
+};
+}  // namespace
+
+using namespace mola;
+
+/** File signature. Bump the number when SolverCheckpoint changes. */
+static const std::string CHECKPOINT_MAGIC = "MOLA_ASLAM_GTSAM_CHECKPOINT_2";
+
+// File layout: uint64_t length of the following archive, a Boost archive
+// with CHECKPOINT_MAGIC and the SolverCheckpoint, and another one with the
+// iSAM2 state (SolverCheckpoint::isam2).
+
+std::string mola::serializeISAM2(const gtsam::ISAM2& isam2)
+{
+    MRPT_START
+
+    std::ostringstream ss(std::ios::binary);
+    {
+        boost::archive::binary_oarchive ar(ss);
+        // Saving archives only read it:
+        ISAM2State::serialize(ar, const_cast<gtsam::ISAM2&>(isam2));
+    }
+    return ss.str();
+
+    MRPT_END
+}
+
+std::shared_ptr<gtsam::ISAM2> mola::snapshotISAM2(
+    const gtsam::ISAM2& isam2,
+    const std::function<gtsam::NonlinearFactor::shared_ptr(
+        const gtsam::NonlinearFactor::shared_ptr&)>& copyFactor)
+{
+    MRPT_START
+
+    // (The Bayes tree copy constructor clones the cliques)
+    auto snap = std::make_shared<gtsam::ISAM2>(isam2);
+    for (auto& f : ISAM2State::factors(*snap))
+        if (f) f = copyFactor(f);
+    return snap;
+
+    MRPT_END
+}
+
+std::size_t mola::writeSolverCheckpoint(
+    const SolverCheckpoint& cp, const std::string& file)
+{
+    MRPT_START
+
+    // The iSAM2 state, serialized now if it was only copied:
+    ASSERT_(!cp.isam2.empty() || cp.isam2_snapshot);
+    std::string fromSnapshot;
+    if (cp.isam2.empty()) fromSnapshot = serializeISAM2(*cp.isam2_snapshot);
+    const std::string& isam2 = cp.isam2.empty() ? fromSnapshot : cp.isam2;
+
+    const auto  tmpFile = file + ".tmp";
+    std::size_t nbytes  = 0;
+    {
+        std::ofstream f(tmpFile, std::ios::binary | std::ios::trunc);
+        ASSERTMSG_(
+            f.is_open(),
+            mrpt::format("Cannot create checkpoint: `%s`", tmpFile.c_str()));
+
+        std::ostringstream meta(std::ios::binary);
+        {
+            boost::archive::binary_oarchive ar(meta);
+            ar << CHECKPOINT_MAGIC;
+            ar << cp;
+        }
+        const std::string metaStr = meta.str();
+        const uint64_t    metaLen = metaStr.size();
+
+        f.write(reinterpret_cast<const char*>(&metaLen), sizeof(metaLen));
+        f.write(metaStr.data(), metaStr.size());
+        f.write(isam2.data(), isam2.size());
+
+        f.flush();
+        ASSERTMSG_(
+            f.good(),
+            mrpt::format("Error writing checkpoint: `%s`", tmpFile.c_str()));
+        nbytes = static_cast<std::size_t>(f.tellp());
+    }
+
+    ASSERTMSG_(
+        std::rename(tmpFile.c_str(), file.c_str()) == 0,
+        mrpt::format("Cannot rename checkpoint to: `%s`", file.c_str()));
+
+    return nbytes;
+    MRPT_END
+}
+
+void mola::readSolverCheckpoint(
+    const std::string& file, SolverCheckpoint& cp, gtsam::ISAM2& isam2)
+{
+    MRPT_START
+
+    ASSERTMSG_(
+        isam2.getFactorsUnsafe().empty(),
+        "readSolverCheckpoint() requires an empty iSAM2 solver");
+
+    MappedFile mf;
+    mf.open(file);
+
+    const auto* data = reinterpret_cast<const char*>(mf.data());
+    uint64_t    metaLen = 0;
+    const auto  invalid = mrpt::format(
+        "Not a checkpoint file, or unsupported version: `%s`", file.c_str());
+    ASSERTMSG_(mf.size() >= sizeof(metaLen), invalid);
+    std::memcpy(&metaLen, data, sizeof(metaLen));
+    ASSERTMSG_(metaLen <= mf.size() - sizeof(metaLen), invalid);
+    data += sizeof(metaLen);
+
+    namespace io = boost::iostreams;
+    {
+        io::stream<io::array_source>    is(data, metaLen);
+        boost::archive::binary_iarchive ar(is);
+
+        std::string magic;
+        ar >> magic;
+        ASSERTMSG_(magic == CHECKPOINT_MAGIC, invalid);
+
+        ar >> cp;
+    }
+    data += metaLen;
+
+    // The iSAM2 state goes straight from the mapping into the solver:
+    {
+        io::stream<io::array_source> is(
+            data, mf.size() - sizeof(metaLen) - metaLen);
+        boost::archive::binary_iarchive ar(is);
+        ISAM2State::serialize(ar, isam2);
+    }
+    cp.isam2.clear();
+
+    MRPT_END
+}
@@ -0,0 +1,352 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   SyntheticWorkload.cpp
+ * @brief  Synthetic SLAM sessions as sequences of back-end API calls
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 20, 2019
+ */
+
+#include <mola-kernel/entities/entities-common.h>
+#include <mola-kernel/variant_helper.h>  // overloaded{}
+#include <mola-slam-gtsam/ASLAM_gtsam.h>
+#include <mola-slam-gtsam/SyntheticWorkload.h>
+#include <mrpt/core/bits_math.h>  // DEG2RAD()
+#include <mrpt/img/TCamera.h>
+
+#include <algorithm>
+#include <cmath>
+
+using namespace mola;
+
+/** Stereo: landmarks farther than this are not observed [m] */
+static const double STEREO_MAX_RANGE = 25.0;
+/** Stereo: the corridor walls are at x=+-this [m] */
+static const double STEREO_CORRIDOR_HALF_WIDTH = 3.0;
+
+SyntheticWorkload::SyntheticWorkload(const Parameters& p) : params_(p)
+{
+    MRPT_START
+
+    ASSERT_(p.num_kfs > 0);
+    ASSERT_(p.kf_period > 0);
+    ASSERT_(p.spin_every > 0);
+    ASSERT_(p.sigma_xyz > 0 && p.sigma_rot > 0);
+    ASSERT_(p.sphere_kfs_per_ring > 1);
+    ASSERT_(p.corridor_length > 1);
+
+    rng_.randomize(p.seed);
+
+    // Fixed origin of time, for reproducible records:
+    t0_ = mrpt::Clock::fromDouble(1.5e9);
+
+    MRPT_END
+}
+
+bool SyntheticWorkload::next(BackendCallRecord& r)
+{
+    MRPT_START
+
+    while (pending_.empty())
+    {
+        if (gt_.size() >= params_.num_kfs) return false;
+        generateKeyFrame(gt_.size());
+    }
+    r = std::move(pending_.front());
+    pending_.pop_front();
+    return true;
+
+    MRPT_END
+}
+
+void SyntheticWorkload::push(BackendCallRecord&& r)
+{
+    // Calls happen at the time of the latest keyframe:
+    r.wall_time = gt_.back().stamp;
+    pending_.emplace_back(std::move(r));
+}
+
+mrpt::poses::CPose3D SyntheticWorkload::nextPose(const std::size_t k)
+{
+    using mrpt::poses::CPose3D;
+
+    switch (params_.type)
+    {
+        case Type::Manhattan:
+        {
+            if (k == 0) return CPose3D();
+            if (rng_.drawUniform(0.0, 1.0) < params_.manhattan_turn_prob)
+            {
+                // Turn left or right:
+                const int turn = rng_.drawUniform(0.0, 1.0) < 0.5 ? 1 : 3;
+                heading_       = (heading_ + turn) % 4;
+            }
+            const double yaw  = mrpt::DEG2RAD(90.0 * heading_);
+            const auto&  prev = gt_.back().pose;
+            return CPose3D(
+                prev.x() + std::round(std::cos(yaw)),
+                prev.y() + std::round(std::sin(yaw)), 0, yaw, 0, 0);
+        }
+
+        case Type::Sphere:
+        {
+            const double lon =
+                mrpt::DEG2RAD(360.0 * k / params_.sphere_kfs_per_ring);
+            const double lat =
+                mrpt::DEG2RAD(-90.0 + 180.0 * (k + 0.5) / params_.num_kfs);
+            const double R   = params_.sphere_radius;
+            return CPose3D(
+                R * std::cos(lat) * std::cos(lon),
+                R * std::cos(lat) * std::sin(lon), R * std::sin(lat),
+                lon + mrpt::DEG2RAD(90.0), 0, lat);
+        }
+
+        case Type::Corridor:
+        {
+            const std::size_t L = params_.corridor_length;
+            const std::size_t c = k % (2 * L);
+            const double      back = mrpt::DEG2RAD(180.0);
+            return c < L ? CPose3D(c, 0, 0, 0, 0, 0)
+                         : CPose3D(2 * L - 1 - c, 0, 0, back, 0, 0);
+        }
+
+        case Type::Stereo:
+            // The camera looks forward (+Z), as in gtsam camera models:
+            return CPose3D(0, 0, static_cast<double>(k), 0, 0, 0);
+
+        default:
+            THROW_EXCEPTION("Unhandled workload type");
+    };
+}
+
+void SyntheticWorkload::generateKeyFrame(const std::size_t k)
+{
+    MRPT_START
+
+    GroundTruthKF g;
+    g.id    = next_kf_id_++;
+    g.stamp = k * params_.kf_period;
+    g.pose  = nextPose(k);
+    gt_.push_back(g);
+
+    {
+        BackendCallRecord r;
+        r.call         = BackendCall::AddKeyFrame;
+        r.result_id    = g.id;
+        r.kf.timestamp = t0_ + std::chrono::duration_cast<
+                                   mrpt::Clock::duration>(
+                                   std::chrono::duration<double>(g.stamp));
+        push(std::move(r));
+    }
+
+    // Odometry:
+    if (k > 0) addRelPose(k - 1, k);
+
+    // Loop closures, landmarks:
+    switch (params_.type)
+    {
+        case Type::Manhattan:
+        case Type::Corridor:
+        {
+            const auto cell = std::make_tuple(
+                std::lround(g.pose.x()), std::lround(g.pose.y()),
+                std::lround(g.pose.z()));
+            if (auto it = visited_.find(cell);
+                it != visited_.end() && it->second + 1 != k)
+                addRelPose(it->second, k);
+            visited_[cell] = k;
+        }
+        break;
+        case Type::Sphere:
+            if (k >= params_.sphere_kfs_per_ring)
+                addRelPose(k - params_.sphere_kfs_per_ring, k);
+            break;
+        case Type::Stereo:
+            addStereoObservations(k);
+            break;
+        default:
+            break;
+    };
+
+    if ((k + 1) % params_.spin_every == 0 || k + 1 == params_.num_kfs)
+    {
+        BackendCallRecord r;
+        r.call = BackendCall::SpinOnce;
+        push(std::move(r));
+    }
+
+    MRPT_END
+}
+
+void SyntheticWorkload::addRelPose(const std::size_t from, const std::size_t to)
+{
+    const auto& a = gt_.at(from);
+    const auto& b = gt_.at(to);
+
+    const double sx = params_.sigma_xyz, sr = params_.sigma_rot;
+    const auto   noise = mrpt::poses::CPose3D(
+        rng_.drawGaussian1D(0, sx), rng_.drawGaussian1D(0, sx),
+        rng_.drawGaussian1D(0, sx), rng_.drawGaussian1D(0, sr),
+        rng_.drawGaussian1D(0, sr), rng_.drawGaussian1D(0, sr));
+
+    mola::FactorRelativePose3 f(
+        a.id, b.id, ((b.pose - a.pose) + noise).asTPose());
+    f.noise_model_diag_xyz_ = sx;
+    f.noise_model_diag_rot_ = sr;
+
+    BackendCallRecord r;
+    r.call      = BackendCall::AddFactor;
+    r.factor    = f;
+    r.result_id = next_factor_id_++;
+    push(std::move(r));
+}
+
+void SyntheticWorkload::addStereoObservations(const std::size_t k)
+{
+    const auto&  kf    = gt_.at(k);
+    const double z_cam = kf.pose.z();
+    const double sigma = params_.stereo_pixel_sigma;
+
+    // Populate the corridor ahead, one meter at a time:
+    const auto per_meter = static_cast<unsigned>(
+        std::max(1.0, std::round(params_.stereo_landmarks_per_meter)));
+    while (landmarks_until_ < z_cam + STEREO_MAX_RANGE)
+    {
+        for (unsigned i = 0; i < per_meter; i++)
+        {
+            Landmark l;
+            l.pos.x = rng_.drawUniform(0.0, 1.0) < 0.5
+                          ? -STEREO_CORRIDOR_HALF_WIDTH
+                          : STEREO_CORRIDOR_HALF_WIDTH;
+            l.pos.y = rng_.drawUniform(-1.5, 1.5);
+            l.pos.z = landmarks_until_ + rng_.drawUniform(0.0, 1.0);
+            landmarks_.push_back(l);
+        }
+        landmarks_until_ += 1.0;
+    }
+    // Forget those already behind the camera:
+    while (!landmarks_.empty() && landmarks_.front().pos.z < z_cam - 1.0)
+        landmarks_.pop_front();
+
+    const auto& cam = camera_;
+    for (auto& l : landmarks_)
+    {
+        const double dz = l.pos.z - z_cam;
+        if (dz < 1.0 || dz > STEREO_MAX_RANGE) continue;
+
+        const double xl = cam.f * l.pos.x / dz + cam.cx;
+        const double xr = xl - cam.f * cam.baseline / dz;
+        const double y  = cam.f * l.pos.y / dz + cam.cy;
+        if (xr < 0 || xl >= cam.ncols || y < 0 || y >= cam.nrows) continue;
+
+        // First time seen: create its smart factor.
+        if (l.factor_id == mola::INVALID_FID)
+        {
+            l.factor_id = next_factor_id_++;
+
+            BackendCallRecord r;
+            r.call      = BackendCall::AddFactor;
+            r.factor    = mola::SmartFactorStereoProjectionPose();
+            r.result_id = l.factor_id;
+            push(std::move(r));
+        }
+
+        BackendCallRecord r;
+        r.call                    = BackendCall::SmartStereoObservation;
+        r.stereo_obs.factor_id    = l.factor_id;
+        r.stereo_obs.observing_kf = kf.id;
+        r.stereo_obs.x_left       = xl + rng_.drawGaussian1D(0, sigma);
+        r.stereo_obs.x_right      = xr + rng_.drawGaussian1D(0, sigma);
+        r.stereo_obs.y            = y + rng_.drawGaussian1D(0, sigma);
+        push(std::move(r));
+    }
+}
+
+bool SyntheticWorkload::prepareBackend(BackEndBase& backend) const
+{
+    MRPT_START
+
+    if (params_.type != Type::Stereo) return true;
+
+    auto* aslam = dynamic_cast<ASLAM_gtsam*>(&backend);
+    if (!aslam) return false;
+
+    mrpt::img::TCamera cam;
+    cam.ncols = camera_.ncols;
+    cam.nrows = camera_.nrows;
+    cam.fx(camera_.f);
+    cam.fy(camera_.f);
+    cam.cx(camera_.cx);
+    cam.cy(camera_.cy);
+    aslam->lock_slam();
+    aslam->temp_createStereoCamera(cam, cam, camera_.baseline);
+    aslam->unlock_slam();
+    return true;
+
+    MRPT_END
+}
+
+mrpt::poses::CPose3D mola::worldModelKeyFramePose(
+    WorldModel& wm, const mola::id_t kf_id)
+{
+    MRPT_START
+
+    mrpt::poses::CPose3D ret;
+    wm.entities_lock_for_read();
+    for (mola::id_t id = kf_id; id != mola::INVALID_ID;)
+    {
+        const auto& e = wm.entity_by_id(id);
+        ret = mrpt::poses::CPose3D(mola::entity_get_pose(e)) + ret;
+
+        mola::id_t base = mola::INVALID_ID;
+        std::visit(
+            overloaded{
+                [&](const RelPose3KF& kf) { base = kf.base_id_; },
+                [&](const RelDynPose3KF& kf) { base = kf.base_id_; },
+                []([[maybe_unused]] const auto& other) {},
+            },
+            e);
+        id = base;
+    }
+    wm.entities_unlock_for_read();
+    return ret;
+
+    MRPT_END
+}
+
+TrajectoryEvalResult mola::evaluateWorkload(
+    const SyntheticWorkload& w, WorldModel& wm,
+    const std::map<uint64_t, uint64_t>& kf_ids)
+{
+    MRPT_START
+
+    const auto toIsometry = [](const mrpt::poses::CPose3D& p) {
+        Eigen::Isometry3d T = Eigen::Isometry3d::Identity();
+        const auto        R = p.getRotationMatrix();
+        for (int r = 0; r < 3; r++)
+            for (int c = 0; c < 3; c++) T.linear()(r, c) = R(r, c);
+        T.translation() = Eigen::Vector3d(p.x(), p.y(), p.z());
+        return T;
+    };
+
+    TimedTrajectory est, gt;
+    for (const auto& g : w.groundTruth())
+    {
+        const auto it = kf_ids.find(g.id);
+        if (it == kf_ids.end()) continue;
+
+        est.stamps.push_back(g.stamp);
+        est.poses.push_back(toIsometry(worldModelKeyFramePose(wm, it->second)));
+        gt.stamps.push_back(g.stamp);
+        gt.poses.push_back(toIsometry(g.pose));
+    }
+
+    TrajectoryEvalParams p;
+    p.max_dt = 0.25 * w.params().kf_period;
+    return evaluateTrajectory(est, gt, p);
+
+    MRPT_END
+}
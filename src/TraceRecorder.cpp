@@ -0,0 +1,161 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   TraceRecorder.cpp
+ * @brief  Timeline of scopes from all threads, in Chrome trace-event format
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 20, 2019
+ */
+
+#include <mola-slam-gtsam/TraceRecorder.h>
+
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+using namespace mola;
+
+namespace
+{
+/** Writes `s` as a JSON string literal */
+void json_string(std::ostream& o, const char* s)
+{
+    o << '"';
+    for (; *s; ++s)
+    {
+        if (*s == '"' || *s == '\\')
+            o << '\\' << *s;
+        else if (static_cast<unsigned char>(*s) < 0x20)
+            o << ' ';
+        else
+            o << *s;
+    }
+    o << '"';
+}
+}  // namespace
+
+TraceRecorder& TraceRecorder::Instance()
+{
+    static TraceRecorder r;
+    return r;
+}
+
+TraceRecorder::TraceRecorder() : epoch_(std::chrono::steady_clock::now()) {}
+
+TraceRecorder::ThreadBuffer::ThreadBuffer(
+    const std::size_t cap, const uint32_t id)
+    : events(new Event[cap]), capacity(cap), tid(id)
+{
+}
+
+void TraceRecorder::enable(const std::size_t events_per_thread)
+{
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+        capacity_ = events_per_thread;
+    }
+    enabled_.store(true, std::memory_order_relaxed);
+}
+
+TraceRecorder::ThreadBuffer& TraceRecorder::thread_buffer()
+{
+    // There is one recorder per process, so a plain thread_local suffices:
+    thread_local ThreadBuffer* buf = nullptr;
+    if (!buf)
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+        buffers_.emplace_back(std::make_unique<ThreadBuffer>(
+            capacity_, static_cast<uint32_t>(buffers_.size() + 1)));
+        buf = buffers_.back().get();
+    }
+    return *buf;
+}
+
+void TraceRecorder::record(const char* name, const char phase)
+{
+    const int64_t t = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          std::chrono::steady_clock::now() - epoch_)
+                          .count();
+
+    ThreadBuffer&     b = thread_buffer();
+    const std::size_t n = b.size.load(std::memory_order_relaxed);
+    if (n >= b.capacity)
+    {
+        b.dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    b.events[n] = Event{name, t, phase};
+    b.size.store(n + 1, std::memory_order_release);
+}
+
+void TraceRecorder::setThreadName(const std::string& name)
+{
+    if (!enabled()) return;
+    ThreadBuffer&               b = thread_buffer();
+    std::lock_guard<std::mutex> lck(mtx_);
+    b.name = name;
+}
+
+void TraceRecorder::saveJSON(std::ostream& o) const
+{
+    std::lock_guard<std::mutex> lck(mtx_);
+
+    o << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    bool first = true;
+    for (const auto& b : buffers_)
+    {
+        if (!b->name.empty())
+        {
+            o << (first ? "" : ",\n")
+              << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+                 "\"tid\": "
+              << b->tid << ", \"args\": {\"name\": ";
+            json_string(o, b->name.c_str());
+            o << "}}";
+            first = false;
+        }
+
+        const std::size_t n = b->size.load(std::memory_order_acquire);
+        for (std::size_t i = 0; i < n; i++)
+        {
+            const Event& e = b->events[i];
+            char         ts[32];
+            std::snprintf(ts, sizeof(ts), "%.3f", e.t_ns * 1e-3);
+
+            o << (first ? "" : ",\n") << "{\"name\": ";
+            json_string(o, e.name);
+            o << ", \"ph\": \"" << e.phase << "\", \"ts\": " << ts
+              << ", \"pid\": 1, \"tid\": " << b->tid << "}";
+            first = false;
+        }
+    }
+    o << "\n]}\n";
+}
+
+void TraceRecorder::saveJSON(const std::string& file) const
+{
+    std::ofstream f(file);
+    if (!f.is_open()) throw std::runtime_error("Cannot write: " + file);
+    saveJSON(f);
+}
+
+std::size_t TraceRecorder::recorded() const
+{
+    std::lock_guard<std::mutex> lck(mtx_);
+    std::size_t                 n = 0;
+    for (const auto& b : buffers_)
+        n += b->size.load(std::memory_order_acquire);
+    return n;
+}
+
+std::size_t TraceRecorder::dropped() const
+{
+    std::lock_guard<std::mutex> lck(mtx_);
+    std::size_t                 n = 0;
+    for (const auto& b : buffers_)
+        n += b->dropped.load(std::memory_order_relaxed);
+    return n;
+}
@@ -0,0 +1,294 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   TrajectoryEvaluation.cpp
+ * @brief  Trajectory accuracy metrics (ATE, RPE) against ground truth
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 09, 2019
+ */
+
+#include <mola-slam-gtsam/TrajectoryEvaluation.h>
+#include <mrpt/core/bits_math.h>  // RAD2DEG()
+
+#include <Eigen/Dense>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+using namespace mola;
+
+// Runs f(begin,end) over [0,n) split into one block per hardware thread.
+template <class FUNCTOR>
+static void parallel_for_blocks(const std::size_t n, FUNCTOR&& f)
+{
+    const std::size_t nThreads = std::max<std::size_t>(
+        1,
+        std::min<std::size_t>(std::thread::hardware_concurrency(), n / 1024));
+    if (nThreads <= 1)
+    {
+        f(0, n);
+        return;
+    }
+    std::vector<std::thread> threads;
+    const std::size_t        block = (n + nThreads - 1) / nThreads;
+    for (std::size_t i = 0; i < nThreads; i++)
+    {
+        const std::size_t b = i * block, e = std::min(n, b + block);
+        if (b >= e) break;
+        threads.emplace_back([&f, b, e]() { f(b, e); });
+    }
+    for (auto& t : threads) t.join();
+}
+
+TimedTrajectory mola::loadTrajectory(const std::string& fileName)
+{
+    std::ifstream f(fileName);
+    if (!f.is_open())
+        throw std::runtime_error("Cannot open trajectory file: " + fileName);
+
+    // Sort by time while loading:
+    std::map<double, Eigen::Isometry3d> poses;
+
+    std::vector<double> v;
+    std::size_t         lineIdx = 0;
+    for (std::string line; std::getline(f, line); lineIdx++)
+    {
+        const auto first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#' ||
+            line[first] == '%')
+            continue;
+
+        v.clear();
+        std::istringstream ss(line);
+        for (double d; ss >> d;) v.push_back(d);
+
+        Eigen::Isometry3d T = Eigen::Isometry3d::Identity();
+        double            t = 0;
+        switch (v.size())
+        {
+            case 8:  // TUM
+                t               = v[0];
+                T.translation() = Eigen::Vector3d(v[1], v[2], v[3]);
+                T.linear() =
+                    Eigen::Quaterniond(v[7], v[4], v[5], v[6])
+                        .normalized()
+                        .toRotationMatrix();
+                break;
+            case 7:  // MRPT: t x y z yaw pitch roll
+                t               = v[0];
+                T.translation() = Eigen::Vector3d(v[1], v[2], v[3]);
+                T.linear() =
+                    (Eigen::AngleAxisd(v[4], Eigen::Vector3d::UnitZ()) *
+                     Eigen::AngleAxisd(v[5], Eigen::Vector3d::UnitY()) *
+                     Eigen::AngleAxisd(v[6], Eigen::Vector3d::UnitX()))
+                        .toRotationMatrix();
+                break;
+            case 12:  // KITTI
+                t = static_cast<double>(poses.size());
+                for (int r = 0; r < 3; r++)
+                {
+                    for (int c = 0; c < 3; c++) T.linear()(r, c) = v[r * 4 + c];
+                    T.translation()[r] = v[r * 4 + 3];
+                }
+                break;
+            default:
+                throw std::runtime_error(
+                    "Unrecognized trajectory format in " + fileName +
+                    " line " + std::to_string(lineIdx + 1));
+        };
+        poses[t] = T;
+    }
+
+    TimedTrajectory ret;
+    ret.stamps.reserve(poses.size());
+    ret.poses.reserve(poses.size());
+    for (const auto& p : poses)
+    {
+        ret.stamps.push_back(p.first);
+        ret.poses.push_back(p.second);
+    }
+    return ret;
+}
+
+TrajectoryAssociation mola::associateByTime(
+    const TimedTrajectory& est, const TimedTrajectory& gt, const double max_dt)
+{
+    const std::size_t        n = est.size();
+    std::vector<std::size_t> match(n, gt.size());
+
+    parallel_for_blocks(n, [&](std::size_t b, std::size_t e) {
+        for (std::size_t i = b; i < e; i++)
+        {
+            const double t  = est.stamps[i];
+            const auto   it = std::lower_bound(
+                gt.stamps.begin(), gt.stamps.end(), t);
+
+            double      best_dt  = max_dt;
+            std::size_t best_idx = gt.size();
+            if (it != gt.stamps.end() && std::abs(*it - t) <= best_dt)
+            {
+                best_dt  = std::abs(*it - t);
+                best_idx = static_cast<std::size_t>(it - gt.stamps.begin());
+            }
+            if (it != gt.stamps.begin() && std::abs(*(it - 1) - t) <= best_dt)
+                best_idx =
+                    static_cast<std::size_t>(it - gt.stamps.begin()) - 1;
+            match[i] = best_idx;
+        }
+    });
+
+    TrajectoryAssociation assoc;
+    assoc.reserve(n);
+    for (std::size_t i = 0; i < n; i++)
+        if (match[i] < gt.size()) assoc.emplace_back(i, match[i]);
+    return assoc;
+}
+
+Eigen::Isometry3d mola::alignTrajectories(
+    const TimedTrajectory& est, const TimedTrajectory& gt,
+    const TrajectoryAssociation& assoc, const bool with_scale,
+    double* out_scale)
+{
+    const auto n = static_cast<Eigen::Index>(assoc.size());
+    if (n < 3)
+        throw std::runtime_error("At least 3 associated poses are required");
+
+    Eigen::Matrix3Xd src(3, n), dst(3, n);
+    for (Eigen::Index i = 0; i < n; i++)
+    {
+        src.col(i) = est.poses[assoc[i].first].translation();
+        dst.col(i) = gt.poses[assoc[i].second].translation();
+    }
+
+    const Eigen::Matrix4d M = Eigen::umeyama(src, dst, with_scale);
+
+    // Split similarity into scale + rigid transform:
+    const double s = std::cbrt(M.block<3, 3>(0, 0).determinant());
+    if (out_scale) *out_scale = s;
+
+    Eigen::Isometry3d T = Eigen::Isometry3d::Identity();
+    T.linear()          = M.block<3, 3>(0, 0) / s;
+    T.translation()     = M.block<3, 1>(0, 3);
+    return T;
+}
+
+ErrorStats mola::computeErrorStats(std::vector<double> errors)
+{
+    ErrorStats s;
+    s.count = errors.size();
+    if (errors.empty()) return s;
+
+    const double n   = static_cast<double>(errors.size());
+    double       sum = 0, sum2 = 0;
+    for (const double e : errors)
+    {
+        sum += e;
+        sum2 += e * e;
+    }
+    s.mean = sum / n;
+    s.rmse = std::sqrt(sum2 / n);
+    s.std  = std::sqrt(std::max(0.0, sum2 / n - s.mean * s.mean));
+
+    const auto mid = errors.begin() + errors.size() / 2;
+    std::nth_element(errors.begin(), mid, errors.end());
+    s.median = *mid;
+
+    const auto mm = std::minmax_element(errors.begin(), errors.end());
+    s.min         = *mm.first;
+    s.max         = *mm.second;
+    return s;
+}
+
+TrajectoryEvalResult mola::evaluateTrajectory(
+    const TimedTrajectory& est, const TimedTrajectory& gt,
+    const TrajectoryEvalParams& p)
+{
+    TrajectoryEvalResult r;
+    r.est_poses = est.size();
+    r.gt_poses  = gt.size();
+    r.rpe_delta = std::max<std::size_t>(1, p.rpe_delta);
+
+    const auto assoc = associateByTime(est, gt, p.max_dt);
+    r.associated     = assoc.size();
+
+    const Eigen::Isometry3d T =
+        alignTrajectories(est, gt, assoc, p.with_scale, &r.scale);
+
+    auto scaled = [&](const Eigen::Isometry3d& P) {
+        Eigen::Isometry3d ret = P;
+        ret.translation() *= r.scale;
+        return ret;
+    };
+
+    // ATE:
+    std::vector<double> ate(assoc.size());
+    parallel_for_blocks(assoc.size(), [&](std::size_t b, std::size_t e) {
+        for (std::size_t i = b; i < e; i++)
+        {
+            const auto P = T * scaled(est.poses[assoc[i].first]);
+            ate[i] = (P.translation() - gt.poses[assoc[i].second].translation())
+                         .norm();
+        }
+    });
+    r.ate_trans = computeErrorStats(std::move(ate));
+
+    // RPE, over pairs of associated poses `rpe_delta` steps apart:
+    const std::size_t nRel =
+        assoc.size() > r.rpe_delta ? assoc.size() - r.rpe_delta : 0;
+    std::vector<double> rpe_t(nRel), rpe_r(nRel);
+    parallel_for_blocks(nRel, [&](std::size_t b, std::size_t e) {
+        for (std::size_t i = b; i < e; i++)
+        {
+            const auto& a0 = assoc[i];
+            const auto& a1 = assoc[i + r.rpe_delta];
+
+            const Eigen::Isometry3d dEst =
+                scaled(est.poses[a0.first]).inverse() *
+                scaled(est.poses[a1.first]);
+            const Eigen::Isometry3d dGt =
+                gt.poses[a0.second].inverse() * gt.poses[a1.second];
+            const Eigen::Isometry3d E = dGt.inverse() * dEst;
+
+            rpe_t[i] = E.translation().norm();
+            rpe_r[i] = mrpt::RAD2DEG(Eigen::AngleAxisd(E.linear()).angle());
+        }
+    });
+    r.rpe_trans = computeErrorStats(std::move(rpe_t));
+    r.rpe_rot   = computeErrorStats(std::move(rpe_r));
+
+    return r;
+}
+
+static void statsToJSON(
+    const char* name, const ErrorStats& s, std::ostream& o, bool last = false)
+{
+    o << "  \"" << name << "\": {\"count\": " << s.count
+      << ", \"rmse\": " << s.rmse << ", \"mean\": " << s.mean
+      << ", \"median\": " << s.median << ", \"std\": " << s.std
+      << ", \"min\": " << s.min << ", \"max\": " << s.max << "}"
+      << (last ? "\n" : ",\n");
+}
+
+void mola::reportToJSON(const TrajectoryEvalResult& r, std::ostream& o)
+{
+    const auto old_prec = o.precision(9);
+    o << "{\n"
+      << "  \"est_poses\": " << r.est_poses << ",\n"
+      << "  \"gt_poses\": " << r.gt_poses << ",\n"
+      << "  \"associated\": " << r.associated << ",\n"
+      << "  \"scale\": " << r.scale << ",\n"
+      << "  \"rpe_delta\": " << r.rpe_delta << ",\n";
+    statsToJSON("ate_trans", r.ate_trans, o);
+    statsToJSON("rpe_trans", r.rpe_trans, o);
+    statsToJSON("rpe_rot_deg", r.rpe_rot, o, true);
+    o << "}\n";
+    o.precision(old_prec);
+}
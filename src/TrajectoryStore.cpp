@@ -0,0 +1,174 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   TrajectoryStore.cpp
+ * @brief  Chunked, columnar storage of localization history
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 05, 2019
+ */
+
+#include <mola-slam-gtsam/TrajectoryStore.h>
+#include <mrpt/core/exceptions.h>
+
+#include <cstdio>
+
+using namespace mola;
+
+TrajectoryStore::~TrajectoryStore()
+{
+    try
+    {
+        clear();
+    }
+    catch (...)
+    {
+    }
+}
+
+void TrajectoryStore::setParameters(const Parameters& p)
+{
+    ASSERT_(p.chunk_size > 0);
+    ASSERT_(p.max_resident_chunks == 0 || !p.spill_file.empty());
+    ASSERTMSG_(empty(), "setParameters() must be called before push_back()");
+    params_ = p;
+}
+
+void TrajectoryStore::clear()
+{
+    spill_in_.close();
+    if (spill_out_)
+    {
+        std::fclose(spill_out_);
+        spill_out_ = nullptr;
+        std::remove(params_.spill_file.c_str());
+    }
+    spill_size_ = 0;
+    chunks_.clear();
+    count_      = 0;
+    last_stamp_ = 0;
+}
+
+void TrajectoryStore::push_back(
+    const mrpt::Clock::time_point& t, const mola::id_t ref_kf,
+    const mrpt::math::TPose3D& rel_pose)
+{
+    const mrpt::Clock::rep stamp = t.time_since_epoch().count();
+
+    // Same timestamp as the last entry: the newest one wins, as it did with
+    // the former std::map. The last entry is always in the last chunk, which
+    // is never spilled:
+    if (count_ != 0 && stamp == last_stamp_)
+    {
+        auto& c = chunks_.back();
+        ASSERT_(c.spill_offset < 0 && !c.stamps.empty());
+        c.ref_kfs.back() = ref_kf;
+        float* p         = c.poses.data() + c.poses.size() - 6;
+        for (int i = 0; i < 6; i++) p[i] = static_cast<float>(rel_pose[i]);
+        return;
+    }
+
+    // Decimation:
+    if (count_ != 0 && params_.decimation_period > 0)
+    {
+        const auto dt = mrpt::Clock::duration(stamp - last_stamp_);
+        if (std::chrono::duration<double>(dt).count() <
+            params_.decimation_period)
+            return;
+    }
+
+    if (chunks_.empty() || chunks_.back().size() >= params_.chunk_size)
+    {
+        chunks_.emplace_back();
+        auto& c = chunks_.back();
+        c.stamps.reserve(params_.chunk_size);
+        c.ref_kfs.reserve(params_.chunk_size);
+        c.poses.reserve(6 * params_.chunk_size);
+
+        spill_old_chunks();
+    }
+
+    auto& c = chunks_.back();
+    c.stamps.push_back(stamp);
+    c.ref_kfs.push_back(ref_kf);
+    for (int i = 0; i < 6; i++)
+        c.poses.push_back(static_cast<float>(rel_pose[i]));
+
+    last_stamp_ = stamp;
+    count_++;
+}
+
+void TrajectoryStore::spill_old_chunks()
+{
+    if (params_.max_resident_chunks == 0) return;
+
+    // Count resident chunks (the last one is the one being filled):
+    std::size_t resident = 0;
+    for (const auto& c : chunks_)
+        if (c.spill_offset < 0) resident++;
+
+    for (auto& c : chunks_)
+    {
+        if (resident <= params_.max_resident_chunks) break;
+        if (c.spill_offset >= 0) continue;
+
+        if (!spill_out_)
+        {
+            spill_out_ = std::fopen(params_.spill_file.c_str(), "wb");
+            ASSERTMSG_(
+                spill_out_ != nullptr,
+                mrpt::format(
+                    "Cannot create spill file: `%s`",
+                    params_.spill_file.c_str()));
+        }
+
+        const std::size_t n      = c.stamps.size();
+        const std::size_t nbytes = n * (sizeof(mrpt::Clock::rep) +
+                                        sizeof(mola::id_t) + 6 * sizeof(float));
+
+        std::size_t written = 0;
+        written += std::fwrite(
+            c.stamps.data(), sizeof(mrpt::Clock::rep), n, spill_out_);
+        written +=
+            std::fwrite(c.ref_kfs.data(), sizeof(mola::id_t), n, spill_out_);
+        written +=
+            std::fwrite(c.poses.data(), sizeof(float), 6 * n, spill_out_);
+        ASSERT_EQUAL_(written, 8 * n);
+        std::fflush(spill_out_);
+
+        c.spill_offset  = spill_size_;
+        c.spilled_count = n;
+        spill_size_ += static_cast<int64_t>(nbytes);
+
+        // Release memory:
+        c.stamps  = {};
+        c.ref_kfs = {};
+        c.poses   = {};
+        resident--;
+    }
+}
+
+const uint8_t* TrajectoryStore::spilled_data(const Chunk& c) const
+{
+    if (!spill_in_.is_open())
+        spill_in_.open(params_.spill_file);
+    else if (spill_in_.size() < static_cast<std::size_t>(spill_size_))
+        spill_in_.remap();
+
+    ASSERT_(spill_in_.size() >= static_cast<std::size_t>(spill_size_));
+    return spill_in_.data() + c.spill_offset;
+}
+
+std::size_t TrajectoryStore::memory_bytes() const
+{
+    std::size_t n = chunks_.capacity() * sizeof(Chunk);
+    for (const auto& c : chunks_)
+    {
+        n += c.stamps.capacity() * sizeof(mrpt::Clock::rep);
+        n += c.ref_kfs.capacity() * sizeof(mola::id_t);
+        n += c.poses.capacity() * sizeof(float);
+    }
+    return n;
+}
@@ -0,0 +1,310 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+/**
+ * @file   TrajectoryWriter.cpp
+ * @brief  Append-only, streamed trajectory writer (TUM, KITTI, binary)
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 02, 2019
+ */
+
+#include <mola-slam-gtsam/TrajectoryWriter.h>
+#include <mrpt/core/exceptions.h>
+#include <mrpt/math/CQuaternion.h>
+#include <mrpt/poses/CPose3D.h>
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <vector>
+
+using namespace mola;
+
+// Flush to the OS when the memory buffer grows beyond this size [bytes]:
+static constexpr std::size_t FLUSH_THRESHOLD = 256 * 1024;
+
+static void poseToArray(const mrpt::math::TPose3D& p, double out[7])
+{
+    mrpt::math::CQuaternionDouble q;
+    mrpt::poses::CPose3D(p).getAsQuaternion(q);
+    out[0] = p.x;
+    out[1] = p.y;
+    out[2] = p.z;
+    out[3] = q.x();
+    out[4] = q.y();
+    out[5] = q.z();
+    out[6] = q.r();
+}
+
+static mrpt::poses::CPose3D arrayToPose(const double a[7])
+{
+    return mrpt::poses::CPose3D(
+        mrpt::math::CQuaternionDouble(a[6], a[3], a[4], a[5]), a[0], a[1],
+        a[2]);
+}
+
+static mrpt::poses::CPose3D arrayToPose(const float a[7])
+{
+    double d[7];
+    std::copy(a, a + 7, d);
+    return arrayToPose(d);
+}
+
+TrajectoryWriter::~TrajectoryWriter()
+{
+    try
+    {
+        close();
+    }
+    catch (...)
+    {
+    }
+}
+
+std::string TrajectoryWriter::fileExtension(Format fmt)
+{
+    switch (fmt)
+    {
+        case Format::TUM:
+            return ".tum";
+        case Format::KITTI:
+            return ".kitti";
+        case Format::Binary:
+            return ".bin";
+        default:
+            THROW_EXCEPTION("Invalid trajectory format");
+    };
+}
+
+std::string TrajectoryWriter::streamFileName(const std::string& textFileName)
+{
+    return textFileName + ".stream" + fileExtension(Format::Binary);
+}
+
+void TrajectoryWriter::open(const std::string& fileName, Format fmt)
+{
+    MRPT_START
+
+    open_log(fileName, fmt);
+    if (fmt != Format::Binary)
+    {
+        file_name_ = fileName;
+        stream_    = std::make_unique<TrajectoryWriter>();
+        stream_->open_log(streamFileName(fileName), Format::Binary);
+    }
+
+    MRPT_END
+}
+
+void TrajectoryWriter::open_log(const std::string& fileName, Format fmt)
+{
+    MRPT_START
+
+    close();
+    ASSERT_(fmt != Format::None);
+
+    f_ = std::fopen(fileName.c_str(), fmt == Format::Binary ? "wb" : "wt");
+    ASSERTMSG_(
+        f_ != nullptr,
+        mrpt::format("Cannot create trajectory file: `%s`", fileName.c_str()));
+
+    fmt_ = fmt;
+    known_kfs_.clear();
+    buf_.clear();
+    buf_.reserve(FLUSH_THRESHOLD + 1024);
+
+    if (fmt_ == Format::TUM) buf_ += "# timestamp x y z qx qy qz qw\n";
+
+    MRPT_END
+}
+
+void TrajectoryWriter::close()
+{
+    if (!f_) return;
+    flush();
+    std::fclose(f_);
+    f_             = nullptr;
+    const auto fmt = fmt_;
+    fmt_           = Format::None;
+
+    if (stream_)
+    {
+        // Replace the text log with the final trajectory:
+        stream_->close();
+        stream_.reset();
+        const auto streamFile = streamFileName(file_name_);
+        Compact(streamFile, file_name_, fmt);
+        std::remove(streamFile.c_str());
+    }
+}
+
+void TrajectoryWriter::flush()
+{
+    if (!f_) return;
+    if (!buf_.empty())
+    {
+        const auto n = std::fwrite(buf_.data(), 1, buf_.size(), f_);
+        ASSERT_EQUAL_(n, buf_.size());
+        buf_.clear();
+    }
+    std::fflush(f_);
+    if (stream_) stream_->flush();
+}
+
+void TrajectoryWriter::appendNonKeyFrame(
+    const mrpt::Clock::time_point& t, const mola::id_t ref_kf,
+    const mrpt::math::TPose3D& rel_pose, const mrpt::math::TPose3D& abs_pose)
+{
+    BinaryRecord r;
+    r.timestamp = mrpt::Clock::toDouble(t);
+    r.kind      = EntryKind::NonKeyFrame;
+    r.kf_id     = ref_kf;
+
+    double rel[7];
+    poseToArray(rel_pose, rel);
+    std::copy(rel, rel + 7, r.rel_pose);
+    poseToArray(abs_pose, r.abs_pose);
+
+    append(r);
+}
+
+void TrajectoryWriter::appendKeyFrame(
+    const mrpt::Clock::time_point& t, const mola::id_t kf_id,
+    const mrpt::math::TPose3D& abs_pose)
+{
+    BinaryRecord r;
+    r.timestamp = mrpt::Clock::toDouble(t);
+    r.kind      = known_kfs_.insert(kf_id).second ? EntryKind::KeyFrame
+                                             : EntryKind::KeyFrameRevision;
+    r.kf_id = kf_id;
+    poseToArray(abs_pose, r.abs_pose);
+
+    append(r);
+}
+
+void TrajectoryWriter::append(const BinaryRecord& r)
+{
+    if (!f_) return;
+    if (stream_) stream_->append(r);
+
+    switch (fmt_)
+    {
+        case Format::Binary:
+        {
+            char  rec[kBinaryRecordSize];
+            char* p = rec;
+            std::memcpy(p, &r.timestamp, sizeof(r.timestamp));
+            p += sizeof(r.timestamp);
+            *p++ = static_cast<char>(r.kind);
+            std::memcpy(p, &r.kf_id, sizeof(r.kf_id));
+            p += sizeof(r.kf_id);
+            std::memcpy(p, r.rel_pose, sizeof(r.rel_pose));
+            p += sizeof(r.rel_pose);
+            std::memcpy(p, r.abs_pose, sizeof(r.abs_pose));
+            buf_.append(rec, kBinaryRecordSize);
+        }
+        break;
+        case Format::TUM:
+        {
+            char          line[256];
+            const double* a = r.abs_pose;
+            const int     n = std::snprintf(
+                line, sizeof(line),
+                "%.06f %.06f %.06f %.06f %.09f %.09f %.09f %.09f\n",
+                r.timestamp, a[0], a[1], a[2], a[3], a[4], a[5], a[6]);
+            buf_.append(line, static_cast<std::size_t>(n));
+        }
+        break;
+        case Format::KITTI:
+        {
+            const auto p = arrayToPose(r.abs_pose);
+            const auto R = p.getRotationMatrix();
+            char       line[320];
+            const int  n = std::snprintf(
+                line, sizeof(line),
+                "%e %e %e %e %e %e %e %e %e %e %e %e\n", R(0, 0), R(0, 1),
+                R(0, 2), p.x(), R(1, 0), R(1, 1), R(1, 2), p.y(), R(2, 0),
+                R(2, 1), R(2, 2), p.z());
+            buf_.append(line, static_cast<std::size_t>(n));
+        }
+        break;
+        default:
+            THROW_EXCEPTION("Invalid trajectory format");
+    };
+
+    if (buf_.size() > FLUSH_THRESHOLD) flush();
+}
+
+bool TrajectoryWriter::readRecord(std::FILE* f, BinaryRecord& r)
+{
+    char rec[kBinaryRecordSize];
+    if (std::fread(rec, 1, kBinaryRecordSize, f) != kBinaryRecordSize)
+        return false;
+
+    const char* p = rec;
+    std::memcpy(&r.timestamp, p, sizeof(r.timestamp));
+    p += sizeof(r.timestamp);
+    r.kind = static_cast<EntryKind>(*p++);
+    std::memcpy(&r.kf_id, p, sizeof(r.kf_id));
+    p += sizeof(r.kf_id);
+    std::memcpy(r.rel_pose, p, sizeof(r.rel_pose));
+    p += sizeof(r.rel_pose);
+    std::memcpy(r.abs_pose, p, sizeof(r.abs_pose));
+    return true;
+}
+
+void TrajectoryWriter::Compact(
+    const std::string& binaryStreamFile, const std::string& outFile,
+    Format outFmt)
+{
+    MRPT_START
+
+    ASSERT_(outFmt == Format::TUM || outFmt == Format::KITTI);
+
+    std::FILE* f = std::fopen(binaryStreamFile.c_str(), "rb");
+    ASSERTMSG_(
+        f != nullptr, mrpt::format(
+                          "Cannot open trajectory stream: `%s`",
+                          binaryStreamFile.c_str()));
+
+    // Latest revision of each KF, and all non-KFs in arrival order:
+    std::map<uint64_t, BinaryRecord> kfs;
+    std::vector<BinaryRecord>        nonkfs;
+
+    BinaryRecord r;
+    while (readRecord(f, r))
+    {
+        if (r.kind == EntryKind::NonKeyFrame)
+            nonkfs.push_back(r);
+        else
+            kfs[r.kf_id] = r;
+    }
+    std::fclose(f);
+
+    // Final poses, sorted by time. KFs take precedence over non-KFs with
+    // the same timestamp, since they underwent optimization:
+    std::map<double, BinaryRecord> path;
+    for (const auto& kf : kfs) path[kf.second.timestamp] = kf.second;
+
+    for (auto& nk : nonkfs)
+    {
+        if (path.count(nk.timestamp) != 0) continue;
+
+        if (const auto it_ref = kfs.find(nk.kf_id); it_ref != kfs.end())
+        {
+            const auto abs = arrayToPose(it_ref->second.abs_pose) +
+                             arrayToPose(nk.rel_pose);
+            poseToArray(abs.asTPose(), nk.abs_pose);
+        }
+        path[nk.timestamp] = nk;
+    }
+
+    TrajectoryWriter out;
+    out.open_log(outFile, outFmt);
+    for (const auto& e : path) out.append(e.second);
+    out.close();
+
+    MRPT_END
+}
@@ -0,0 +1,114 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @file   test-alloc-profiler.cpp
+ * @brief  AllocProfiler: attribution of allocations to nested scopes.
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 20, 2019
+ */
+
+#include <mola-slam-gtsam/AllocProfiler.h>
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+/** Exit code when profiling is not built in (CTest SKIP_RETURN_CODE) */
+static const int SKIP_RETURN_CODE = 77;
+
+// Keeps allocations from being optimized out:
+static std::vector<std::unique_ptr<int>> sink;
+
+static void allocate(const int n)
+{
+    for (int i = 0; i < n; i++) sink.emplace_back(new int(i));
+}
+
+/** Allocated through the `std::align_val_t` overload of operator new */
+struct alignas(64) OverAligned
+{
+    char data[64];
+};
+
+/** Returns false if profiling is not built in */
+bool test_scopes()
+{
+    sink.reserve(1000);
+    mola::AllocProfiler::reset();
+
+    for (int call = 0; call < 2; call++)
+    {
+        mola::AllocScope outer("outer");
+        allocate(10);
+        {
+            mola::AllocScope inner("inner");
+            allocate(5);
+        }
+        allocate(1);
+    }
+    // Other threads do not count towards this one's scopes:
+    std::thread([]() { allocate(7); }).join();
+    {
+        mola::AllocScope other("other_thread");
+        std::thread([]() { allocate(3); }).join();
+    }
+
+    const auto s = mola::AllocProfiler::scopes();
+    if (!mola::AllocProfiler::available())
+    {
+        if (!s.empty() || mola::AllocProfiler::totals().allocs != 0)
+            throw std::runtime_error("Counters should be empty");
+        std::cout << "Allocation profiling not built in: skipping.\n";
+        return false;
+    }
+
+    const auto& o = s.at("outer");
+    const auto& i = s.at("inner");
+    if (o.calls != 2 || o.allocs != 22 || o.bytes != 22 * sizeof(int))
+        throw std::runtime_error("Wrong counters in outer scope");
+    if (i.calls != 2 || i.allocs != 10 || i.bytes != 10 * sizeof(int))
+        throw std::runtime_error("Wrong counters in inner scope");
+    // (Only the std::thread state, if it is heap-allocated at all)
+    if (s.at("other_thread").allocs > 2)
+        throw std::runtime_error("Allocations of another thread counted");
+    if (mola::AllocProfiler::totals().allocs < 32 + 7 + 3)
+        throw std::runtime_error("Wrong totals");
+
+    {
+        mola::AllocScope aligned("aligned");
+        auto             p = std::make_unique<OverAligned>();
+        if (reinterpret_cast<std::uintptr_t>(p.get()) % 64 != 0)
+            throw std::runtime_error("Wrong alignment");
+    }
+    if (const auto& a = mola::AllocProfiler::scopes().at("aligned");
+        a.allocs != 1 || a.bytes != sizeof(OverAligned))
+        throw std::runtime_error("Wrong counters of aligned allocations");
+
+    std::stringstream ss;
+    mola::AllocProfiler::toJSON(ss);
+    if (ss.str().find("\"inner\": {\"calls\": 2, \"allocs\": 10,") ==
+        std::string::npos)
+        throw std::runtime_error("Unexpected JSON: " + ss.str());
+    return true;
+}
+
+int main([[maybe_unused]] int argc, [[maybe_unused]] char** argv)
+{
+    try
+    {
+        if (!test_scopes()) return SKIP_RETURN_CODE;
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
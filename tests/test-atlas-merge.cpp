@@ -0,0 +1,163 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @file   test-atlas-merge.cpp
+ * @brief  ASLAM_gtsam atlas: two maps built after startNewMap() are merged
+ *         by a factor between them, and the keyframes of the newer map get
+ *         their poses and velocities in the frame of the older one.
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 20, 2019
+ */
+
+#include <mola-kernel/entities/entities-common.h>
+#include <mola-slam-gtsam/ASLAM_gtsam.h>
+#include <mola-slam-gtsam/BackendHarness.h>
+#include <mola-slam-gtsam/SyntheticWorkload.h>
+#include <mrpt/core/bits_math.h>
+#include <mrpt/core/format.h>
+#include <mrpt/math/wrap2pi.h>
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+#include <variant>
+#include <vector>
+
+static const std::size_t KFS_PER_MAP = 10;
+
+static void addRelPose(
+    mola::BackEndBase& be, const mola::id_t from, const mola::id_t to,
+    const mrpt::math::TPose3D& p)
+{
+    mola::FactorRelativePose3 f(from, to, p);
+    f.noise_model_diag_xyz_ = 0.01;
+    f.noise_model_diag_rot_ = 0.01;
+    mola::Factor ff         = f;
+    be.doAddFactor(ff);
+}
+
+/** Map (root ID) of a keyframe, i.e. its `base_id_` */
+static mola::id_t mapOf(mola::WorldModel& wm, const mola::id_t kf)
+{
+    wm.entities_lock_for_read();
+    const auto* e = std::get_if<mola::RelDynPose3KF>(&wm.entity_by_id(kf));
+    const auto  root = e ? e->base_id_ : mola::INVALID_ID;
+    wm.entities_unlock_for_read();
+    return root;
+}
+
+/** KFS_PER_MAP keyframes, 1 m and 1 s apart, driving forward */
+static std::vector<mola::id_t> buildMap(
+    mola::ASLAM_gtsam& slam, const mrpt::Clock::time_point& t0)
+{
+    std::vector<mola::id_t> kfs;
+    for (std::size_t k = 0; k < KFS_PER_MAP; k++)
+    {
+        mola::BackEndBase::ProposeKF_Input in;
+        in.timestamp = t0 + std::chrono::seconds(k);
+        kfs.push_back(slam.doAddKeyFrame(in).new_kf_id.value());
+        if (k > 0)
+            addRelPose(
+                slam, kfs[k - 1], kfs[k],
+                mrpt::math::TPose3D(1, 0, 0, 0, 0, 0));
+        slam.spinOnce();
+    }
+    return kfs;
+}
+
+void test_atlas_merge()
+{
+    mola::BackendHarness h(
+        "ASLAM_gtsam", mola::BackendHarness::defaultConfig(
+                           "ASLAM_gtsam", "  state_vector: SE3Vel\n"));
+    auto& slam = dynamic_cast<mola::ASLAM_gtsam&>(h.backend());
+    auto& wm   = h.worldmodel();
+
+    // Map A drives along +x from the origin. Tracking is lost, and map B
+    // starts at (12,3), driving along +y, in its own frame:
+    const auto t0   = mrpt::Clock::fromDouble(1.5e9);
+    const auto kfsA = buildMap(slam, t0);
+    slam.startNewMap();
+    const auto kfsB = buildMap(slam, t0 + std::chrono::seconds(13));
+
+    if (slam.atlas_map_count() != 2)
+        throw std::runtime_error("Expected two maps");
+    if (mapOf(wm, kfsB.front()) == mapOf(wm, kfsA.front()))
+        throw std::runtime_error("Maps not separated");
+
+    // Before merging, B is in its own frame:
+    if (mola::worldModelKeyFramePose(wm, kfsB[5]).distanceTo(
+            mrpt::poses::CPose3D(5, 0, 0, 0, 0, 0)) > 0.01)
+        throw std::runtime_error("Unexpected pose of map B before merge");
+
+    // Loop closure between the last KF of A and the first of B:
+    addRelPose(
+        slam, kfsA.back(), kfsB.front(),
+        mrpt::math::TPose3D(3, 3, 0, mrpt::DEG2RAD(90.0), 0, 0));
+    slam.spinOnce();
+
+    if (slam.atlas_map_count() != 1)
+        throw std::runtime_error("Maps were not merged");
+    for (const auto kf : kfsB)
+        if (mapOf(wm, kf) != mapOf(wm, kfsA.front()))
+            throw std::runtime_error("Map B not moved into map A");
+
+    // Merged poses, in the frame of A:
+    for (std::size_t k = 0; k < KFS_PER_MAP; k++)
+    {
+        const mrpt::poses::CPose3D expectedA(k, 0, 0, 0, 0, 0);
+        const mrpt::poses::CPose3D expectedB(
+            12, 3 + k, 0, mrpt::DEG2RAD(90.0), 0, 0);
+        const auto pA = mola::worldModelKeyFramePose(wm, kfsA[k]);
+        const auto pB = mola::worldModelKeyFramePose(wm, kfsB[k]);
+        if (pA.distanceTo(expectedA) > 0.05 ||
+            pB.distanceTo(expectedB) > 0.05 ||
+            std::abs(mrpt::math::wrapToPi(pB.yaw() - expectedB.yaw())) >
+                mrpt::DEG2RAD(1.0))
+            throw std::runtime_error(mrpt::format(
+                "Unexpected merged pose at KF #%zu: A=%s B=%s", k,
+                pA.asString().c_str(), pB.asString().c_str()));
+    }
+
+    // Velocities are in the map frame: B moves along +y now. (The first KF
+    // of each map has a zero velocity prior, so only directions are
+    // checked.)
+    wm.entities_lock_for_read();
+    std::vector<mrpt::math::TTwist3D> velA, velB;
+    for (std::size_t k = 0; k < KFS_PER_MAP; k++)
+    {
+        velA.push_back(mola::entity_get_twist(wm.entity_by_id(kfsA[k])));
+        velB.push_back(mola::entity_get_twist(wm.entity_by_id(kfsB[k])));
+    }
+    wm.entities_unlock_for_read();
+
+    for (std::size_t k = 1; k < KFS_PER_MAP; k++)
+    {
+        const auto& a = velA[k];
+        const auto& b = velB[k];
+        if (a.vx < 0.5 || std::abs(a.vy) > 0.2 * a.vx || b.vy < 0.5 ||
+            std::abs(b.vx) > 0.2 * b.vy)
+            throw std::runtime_error(mrpt::format(
+                "Unexpected merged velocity at KF #%zu: A=(%.3f,%.3f) "
+                "B=(%.3f,%.3f)",
+                k, a.vx, a.vy, b.vx, b.vy));
+    }
+}
+
+int main([[maybe_unused]] int argc, [[maybe_unused]] char** argv)
+{
+    try
+    {
+        test_atlas_merge();
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
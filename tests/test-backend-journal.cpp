@@ -0,0 +1,170 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @file   test-backend-journal.cpp
+ * @brief  Checks BackendJournal write-ahead syncs, group syncs, rotation,
+ *         and read back of call results and aborted calls.
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 19, 2019
+ */
+
+#include <mola-slam-gtsam/BackendJournal.h>
+#include <mrpt/system/filesystem.h>
+
+#include <iostream>
+#include <stdexcept>
+#include <utility>
+
+static std::size_t countRecords(const std::string& file)
+{
+    mola::BackendCallReader rd;
+    rd.open(file);
+    mola::BackendCallRecord r;
+    std::size_t             n = 0;
+    while (rd.next(r))
+    {
+        if (r.call != mola::BackendCall::SpinOnce)
+            throw std::runtime_error("Unexpected record type");
+        n++;
+    }
+    return n;
+}
+
+void test_backend_journal()
+{
+    const auto f1 = mrpt::system::getTempFileName();
+    const auto f2 = mrpt::system::getTempFileName();
+
+    mola::BackendJournal j;
+    // Long sync period: only explicit syncs and rotations sync.
+    j.open(f1, 1e6, std::chrono::steady_clock::now());
+
+    for (int i = 0; i < 10; i++) j.end(j.beginSpinOnce());
+    if (j.stats().syncs != 0) throw std::runtime_error("Unexpected sync");
+
+    // Rotation syncs the old file, and the new empty one:
+    j.rotate(f2);
+    if (j.stats().syncs != 2) throw std::runtime_error("Expected 2 syncs");
+
+    for (int i = 0; i < 5; i++) j.end(j.beginSpinOnce());
+    j.close();
+
+    const auto st = j.stats();
+    if (st.records != 15) throw std::runtime_error("Wrong record count");
+    if (st.syncs != 3) throw std::runtime_error("close() must sync");
+
+    if (countRecords(f1) != 10) throw std::runtime_error("Wrong file #1");
+    if (countRecords(f2) != 5) throw std::runtime_error("Wrong file #2");
+
+    mrpt::system::deleteFile(f1);
+    mrpt::system::deleteFile(f2);
+}
+
+void test_write_ahead()
+{
+    const auto file = mrpt::system::getTempFileName();
+
+    mola::BackendJournal j;
+    // Each call is synced before being applied:
+    j.open(file, 0, std::chrono::steady_clock::now());
+
+    const auto stamp = mrpt::Clock::fromDouble(1.5e9);
+    double     t     = j.beginAddKeyFrame(stamp, nullptr);
+    if (j.stats().syncs != 1) throw std::runtime_error("Not synced ahead");
+    j.end(t, 42);
+
+    mola::Factor f = mola::FactorRelativePose3(
+        42, 43, mrpt::math::TPose3D(1, 0, 0, 0, 0, 0));
+    t = j.beginAddFactor(f);
+    if (j.stats().syncs != 2) throw std::runtime_error("Not synced ahead");
+    j.end(t, 7);
+
+    // A call that was not completed (crash while applying it):
+    j.beginAddKeyFrame(stamp, nullptr);
+    j.close();
+
+    // Results are merged into their calls:
+    mola::BackendCallReader rd;
+    rd.open(file);
+    mola::BackendCallRecord r;
+    const std::pair<mola::BackendCall, uint64_t> expected[] = {
+        {mola::BackendCall::AddKeyFrame, 42},
+        {mola::BackendCall::AddFactor, 7},
+        {mola::BackendCall::AddKeyFrame, mola::INVALID_ID}};
+    for (const auto& e : expected)
+    {
+        if (!rd.next(r) || r.call != e.first || r.result_id != e.second)
+            throw std::runtime_error("Unexpected record or result");
+    }
+    if (rd.next(r)) throw std::runtime_error("Unexpected extra record");
+
+    mrpt::system::deleteFile(file);
+}
+
+void test_aborted_calls()
+{
+    const auto file = mrpt::system::getTempFileName();
+
+    mola::BackendJournal j;
+    j.open(file, 1e6, std::chrono::steady_clock::now());
+
+    const auto   stamp = mrpt::Clock::fromDouble(1.5e9);
+    const double t0    = j.beginAddKeyFrame(stamp, nullptr);
+    j.end(t0, 42);
+
+    // A call that throws while being applied is marked, and synced:
+    const auto syncs = j.stats().syncs;
+    try
+    {
+        mola::Factor f = mola::FactorRelativePose3(
+            42, 43, mrpt::math::TPose3D(1, 0, 0, 0, 0, 0));
+        const double                     t = j.beginAddFactor(f);
+        mola::BackendJournal::AbortGuard guard(j, t);
+        throw std::runtime_error("Unknown factor type!");
+    }
+    catch (const std::runtime_error&)
+    {
+    }
+    if (j.stats().syncs != syncs + 1)
+        throw std::runtime_error("Abort marker not synced");
+
+    // Calls that end normally are not marked:
+    {
+        const double                     t = j.beginSpinOnce();
+        mola::BackendJournal::AbortGuard guard(j, t);
+        j.end(t);
+    }
+    j.close();
+
+    // The aborted call is dropped, the others are kept:
+    mola::BackendCallReader rd;
+    rd.open(file);
+    mola::BackendCallRecord r;
+    if (!rd.next(r) || r.call != mola::BackendCall::AddKeyFrame ||
+        r.result_id != 42)
+        throw std::runtime_error("Expected the keyframe");
+    if (!rd.next(r) || r.call != mola::BackendCall::SpinOnce)
+        throw std::runtime_error("Aborted call not dropped");
+    if (rd.next(r)) throw std::runtime_error("Unexpected extra record");
+
+    mrpt::system::deleteFile(file);
+}
+
+int main([[maybe_unused]] int argc, [[maybe_unused]] char** argv)
+{
+    try
+    {
+        test_backend_journal();
+        test_write_ahead();
+        test_aborted_calls();
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
@@ -0,0 +1,180 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @file   test-checkpoint-restore.cpp
+ * @brief  A live ASLAM_gtsam is checkpointed, restored into a fresh
+ *         instance, and both continue the same session: their estimates
+ *         must match. Also reports the restore time next to a cold-start
+ *         batch solve of the same map.
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 20, 2019
+ */
+
+#include <mola-slam-gtsam/ASLAM_gtsam.h>
+#include <mola-slam-gtsam/BackendHarness.h>
+#include <mola-slam-gtsam/ChunkedMap.h>
+#include <mola-slam-gtsam/SyntheticWorkload.h>
+#include <mrpt/core/bits_math.h>
+#include <mrpt/core/format.h>
+#include <mrpt/random/RandomGenerators.h>
+#include <mrpt/system/datetime.h>
+#include <mrpt/system/filesystem.h>
+
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// A square loop of LAP_SIDE x LAP_SIDE meters, 1 m per KF, driven
+// NUM_LAPS times with a loop closure to the former lap at each KF. The
+// checkpoint is taken after CHECKPOINT_LAPS laps.
+static const std::size_t LAP_SIDE = 10, LAP_KFS = 4 * LAP_SIDE;
+static const std::size_t NUM_LAPS = 4, CHECKPOINT_LAPS = 3;
+
+/** One step of the session: a new KF, noisy odometry from the former
+ * one, and a loop closure to the same place in the former lap */
+struct Step
+{
+    mrpt::math::TPose3D odom;
+    mrpt::math::TPose3D loop;
+};
+
+static std::vector<Step> makeSession()
+{
+    auto& rng = mrpt::random::getRandomGenerator();
+    rng.randomize(321);
+
+    std::vector<Step> steps(NUM_LAPS * LAP_KFS);
+    for (std::size_t k = 0; k < steps.size(); k++)
+    {
+        // Turn left at each corner:
+        const bool   corner = ((k + 1) % LAP_SIDE) == 0;
+        const double yaw    = corner ? mrpt::DEG2RAD(90.0) : 0;
+        steps[k].odom       = mrpt::math::TPose3D(
+            1.0 + rng.drawGaussian1D(0, 0.05), rng.drawGaussian1D(0, 0.05),
+            0, yaw + rng.drawGaussian1D(0, 0.01), 0, 0);
+        steps[k].loop = mrpt::math::TPose3D(
+            rng.drawGaussian1D(0, 0.01), rng.drawGaussian1D(0, 0.01), 0,
+            rng.drawGaussian1D(0, 0.002), 0, 0);
+    }
+    return steps;
+}
+
+static void addRelPose(
+    mola::BackEndBase& be, const mola::id_t from, const mola::id_t to,
+    const mrpt::math::TPose3D& p, const double sigma_xyz)
+{
+    mola::FactorRelativePose3 f(from, to, p);
+    f.noise_model_diag_xyz_ = sigma_xyz;
+    f.noise_model_diag_rot_ = 0.01;
+    mola::Factor ff         = f;
+    be.doAddFactor(ff);
+}
+
+/** Runs steps [first,last) of the session. `kfs` holds the IDs of the KFs
+ * of the former steps, in this instance. */
+static void runSteps(
+    mola::ASLAM_gtsam& slam, const std::vector<Step>& steps,
+    const std::size_t first, const std::size_t last,
+    std::vector<mola::id_t>& kfs)
+{
+    const auto t0 = mrpt::Clock::fromDouble(1.5e9);
+    for (std::size_t k = first; k < last; k++)
+    {
+        mola::BackEndBase::ProposeKF_Input in;
+        in.timestamp = t0 + std::chrono::seconds(k + 1);
+        kfs.push_back(slam.doAddKeyFrame(in).new_kf_id.value());
+        if (k == 0) continue;
+
+        addRelPose(slam, kfs[k - 1], kfs[k], steps[k].odom, 0.05);
+        if (k >= LAP_KFS)
+            addRelPose(slam, kfs[k - LAP_KFS], kfs[k], steps[k].loop, 0.01);
+        slam.spinOnce();
+    }
+}
+
+void test_checkpoint_restore()
+{
+    const auto steps = makeSession();
+    const auto nCkpt = CHECKPOINT_LAPS * LAP_KFS;
+
+    const auto cfg = mola::BackendHarness::defaultConfig("ASLAM_gtsam");
+
+    // Uninterrupted session, checkpointed along the way:
+    mola::BackendHarness hRef("ASLAM_gtsam", cfg);
+    auto& ref = dynamic_cast<mola::ASLAM_gtsam&>(hRef.backend());
+    std::vector<mola::id_t> refKFs;
+
+    runSteps(ref, steps, 0, nCkpt, refKFs);
+
+    const auto base     = mrpt::system::getTempFileName();
+    const auto mapDir   = base + "_map";
+    const auto ckptFile = base + "_solver.bin";
+    mola::ChunkedMapWriter().save(hRef.worldmodel(), mapDir);
+    ref.saveCheckpoint(ckptFile);
+
+    runSteps(ref, steps, nCkpt, steps.size(), refKFs);
+
+    // Restored from the checkpoint:
+    mola::BackendHarness h("ASLAM_gtsam", cfg);
+    auto& slam = dynamic_cast<mola::ASLAM_gtsam&>(h.backend());
+    mola::loadChunkedMap(h.worldmodel(), mapDir);
+
+    const auto t0 = mrpt::Clock::now();
+    slam.loadCheckpoint(ckptFile);
+    const double tRestore =
+        mrpt::system::timeDifference(t0, mrpt::Clock::now());
+
+    // Cold start from the same map, for reference:
+    double tCold = 0;
+    {
+        mola::BackendHarness hCold("ASLAM_gtsam", cfg);
+        auto& cold = dynamic_cast<mola::ASLAM_gtsam&>(hCold.backend());
+        mola::loadChunkedMap(hCold.worldmodel(), mapDir);
+
+        const auto t1 = mrpt::Clock::now();
+        cold.rebuild_from_worldmodel();
+        tCold = mrpt::system::timeDifference(t1, mrpt::Clock::now());
+    }
+
+    std::cout << mrpt::format(
+        "%zu KFs: checkpoint restore %.03f ms, cold-start batch solve "
+        "%.03f ms\n",
+        nCkpt, 1e3 * tRestore, 1e3 * tCold);
+
+    std::vector<mola::id_t> kfs(refKFs.begin(), refKFs.begin() + nCkpt);
+    runSteps(slam, steps, nCkpt, steps.size(), kfs);
+
+    mrpt::system::deleteFilesInDirectory(mapDir, true);
+    mrpt::system::deleteFile(ckptFile);
+
+    // Same estimates, for the KFs before and after the checkpoint:
+    for (std::size_t k = 0; k < steps.size(); k++)
+    {
+        const auto pRef =
+            mola::worldModelKeyFramePose(hRef.worldmodel(), refKFs[k]);
+        const auto   p   = mola::worldModelKeyFramePose(h.worldmodel(), kfs[k]);
+        const double err = p.distanceTo(pRef);
+        if (err > 1e-6)
+            throw std::runtime_error(mrpt::format(
+                "Restored session differs by %e m at KF #%zu", err, k));
+    }
+}
+
+int main([[maybe_unused]] int argc, [[maybe_unused]] char** argv)
+{
+    try
+    {
+        test_checkpoint_restore();
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
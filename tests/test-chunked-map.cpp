@@ -0,0 +1,103 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @file   test-chunked-map.cpp
+ * @brief  ChunkedMapWriter: reloading with entity annotations, and no
+ *         stale chunks after a change of the chunk size.
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 20, 2019
+ */
+
+#include <mola-slam-gtsam/BackendHarness.h>
+#include <mola-slam-gtsam/ChunkedMap.h>
+#include <mrpt/opengl/CBox.h>
+#include <mrpt/system/filesystem.h>
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+void test_chunk_size_change()
+{
+    const auto cfg = mola::BackendHarness::defaultConfig("ASLAM_gtsam");
+
+    mola::BackendHarness h("ASLAM_gtsam", cfg);
+
+    // Root KF plus 9 more:
+    const auto t0     = mrpt::Clock::now();
+    mola::id_t lastKF = mola::INVALID_ID;
+    for (int k = 0; k < 9; k++)
+    {
+        mola::BackEndBase::ProposeKF_Input in;
+        in.timestamp = t0 + std::chrono::seconds(10 * k);
+        lastKF       = h.backend().doAddKeyFrame(in).new_kf_id.value();
+    }
+    const auto nEnts = h.worldmodel().entity_all_ids().size();
+
+    // As a front-end does:
+    h.worldmodel().entities_lock_for_write();
+    h.worldmodel()
+        .entity_annotations_by_id(lastKF)["render_decoration"]
+        .value() = mrpt::opengl::CBox::Create();
+    h.worldmodel().entities_unlock_for_write();
+
+    const auto dir      = mrpt::system::getTempFileName() + "_chunks";
+    const auto entChunk = [&](const std::size_t n) {
+        return dir + "/" + mola::ChunkedMapWriter::ChunkFileName(true, n);
+    };
+
+    mola::ChunkedMapParameters p;
+    p.chunk_size = 2;
+    {
+        mola::ChunkedMapWriter w(p);
+        const auto             st = w.save(h.worldmodel(), dir);
+        if (st.entity_chunks_written != (nEnts + 1) / 2)
+            throw std::runtime_error("Unexpected number of chunks");
+    }
+    if (!mrpt::system::fileExists(entChunk(4)))
+        throw std::runtime_error("Missing chunk file");
+
+    // Larger chunks: former files beyond the first chunk must go away.
+    p.chunk_size = 100;
+    {
+        mola::ChunkedMapWriter w(p);
+        w.save(h.worldmodel(), dir);
+    }
+    if (!mrpt::system::fileExists(entChunk(0)))
+        throw std::runtime_error("Missing chunk file");
+    for (std::size_t n = 1; n <= 4; n++)
+        if (mrpt::system::fileExists(entChunk(n)))
+            throw std::runtime_error("Stale chunk file not deleted");
+
+    mola::BackendHarness h2("ASLAM_gtsam", cfg);
+    const auto           st = mola::loadChunkedMap(h2.worldmodel(), dir);
+    if (st.entities != nEnts || st.chunk_size != 100)
+        throw std::runtime_error("Unexpected reloaded map");
+
+    const auto& annots = h2.worldmodel().entity_annotations_by_id(lastKF);
+    if (const auto it = annots.find("render_decoration");
+        it == annots.end() ||
+        !std::dynamic_pointer_cast<mrpt::opengl::CBox>(it->second.value()))
+        throw std::runtime_error("Entity annotation not reloaded");
+
+    mrpt::system::deleteFilesInDirectory(dir, true);
+}
+
+int main([[maybe_unused]] int argc, [[maybe_unused]] char** argv)
+{
+    try
+    {
+        test_chunk_size_change();
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
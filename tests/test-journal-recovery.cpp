@@ -0,0 +1,230 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @file   test-journal-recovery.cpp
+ * @brief  ASLAM_gtsam with `journal_directory` is killed (SIGKILL) in the
+ *         middle of a session, recovered by a new instance, which continues
+ *         the session: the result must match an uninterrupted run. Also
+ *         checks the journal overhead with its default settings.
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 20, 2019
+ */
+
+#include <mola-slam-gtsam/ASLAM_gtsam.h>
+#include <mola-slam-gtsam/BackendHarness.h>
+#include <mola-slam-gtsam/SyntheticWorkload.h>
+#include <mrpt/core/bits_math.h>
+#include <mrpt/core/format.h>
+#include <mrpt/random/RandomGenerators.h>
+#include <mrpt/system/datetime.h>
+#include <mrpt/system/filesystem.h>
+
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+/** With a journal in `journalDir`, if not empty, and frequent checkpoints
+ * if `frequentCheckpoints`. Otherwise, with the default journal settings. */
+static std::string slamConfig(
+    const std::string& journalDir, const bool frequentCheckpoints = true)
+{
+    std::string cfg;
+    if (!journalDir.empty())
+        cfg += "  map_chunk_size: 50\n  journal_directory: " + journalDir +
+               "\n";
+    if (!journalDir.empty() && frequentCheckpoints)
+        cfg += "  checkpoint_period: 0.05\n";
+    return mola::BackendHarness::defaultConfig("ASLAM_gtsam", cfg);
+}
+
+/** Max. journal time, relative to the journaled calls, with the default
+ * `journal_sync_period` [%] */
+static const double MAX_JOURNAL_OVERHEAD = 5.0;
+
+// A square loop of LAP_SIDE x LAP_SIDE meters, 1 m per KF, with a loop
+// closure to the former lap at each KF. The process is killed after
+// CRASH_AT KFs.
+static const std::size_t LAP_SIDE = 10, LAP_KFS = 4 * LAP_SIDE;
+static const std::size_t NUM_KFS = 5 * LAP_KFS, CRASH_AT = 130;
+
+struct Step
+{
+    mrpt::math::TPose3D odom;
+    mrpt::math::TPose3D loop;
+};
+
+static std::vector<Step> makeSession()
+{
+    auto& rng = mrpt::random::getRandomGenerator();
+    rng.randomize(654);
+
+    std::vector<Step> steps(NUM_KFS);
+    for (std::size_t k = 0; k < steps.size(); k++)
+    {
+        // Turn left at each corner:
+        const bool   corner = ((k + 1) % LAP_SIDE) == 0;
+        const double yaw    = corner ? mrpt::DEG2RAD(90.0) : 0;
+        steps[k].odom       = mrpt::math::TPose3D(
+            1.0 + rng.drawGaussian1D(0, 0.05), rng.drawGaussian1D(0, 0.05),
+            0, yaw + rng.drawGaussian1D(0, 0.01), 0, 0);
+        steps[k].loop = mrpt::math::TPose3D(
+            rng.drawGaussian1D(0, 0.01), rng.drawGaussian1D(0, 0.01), 0,
+            rng.drawGaussian1D(0, 0.002), 0, 0);
+    }
+    return steps;
+}
+
+static void addRelPose(
+    mola::BackEndBase& be, const mola::id_t from, const mola::id_t to,
+    const mrpt::math::TPose3D& p, const double sigma_xyz)
+{
+    mola::FactorRelativePose3 f(from, to, p);
+    f.noise_model_diag_xyz_ = sigma_xyz;
+    f.noise_model_diag_rot_ = 0.01;
+    mola::Factor ff         = f;
+    be.doAddFactor(ff);
+}
+
+/** Runs steps [first,last) of the session. `kfs` holds the IDs of the KFs
+ * of the former steps, in this instance. Returns the elapsed time [s]. */
+static double runSteps(
+    mola::BackEndBase& slam, const std::vector<Step>& steps,
+    const std::size_t first, const std::size_t last,
+    std::vector<mola::id_t>& kfs)
+{
+    const auto t0    = mrpt::Clock::fromDouble(1.5e9);
+    const auto start = mrpt::Clock::now();
+    for (std::size_t k = first; k < last; k++)
+    {
+        mola::BackEndBase::ProposeKF_Input in;
+        in.timestamp = t0 + std::chrono::seconds(k + 1);
+        kfs.push_back(slam.doAddKeyFrame(in).new_kf_id.value());
+        if (k == 0) continue;
+
+        addRelPose(slam, kfs[k - 1], kfs[k], steps[k].odom, 0.05);
+        if (k >= LAP_KFS)
+            addRelPose(slam, kfs[k - LAP_KFS], kfs[k], steps[k].loop, 0.01);
+        slam.spinOnce();
+    }
+    return mrpt::system::timeDifference(start, mrpt::Clock::now());
+}
+
+static void comparePoses(
+    mola::WorldModel& wmRef, const std::vector<mola::id_t>& refKFs,
+    mola::WorldModel& wm, const std::vector<mola::id_t>& kfs,
+    const char* what)
+{
+    if (kfs != refKFs)
+        throw std::runtime_error(mrpt::format("%s: KF IDs differ", what));
+    for (std::size_t k = 0; k < refKFs.size(); k++)
+    {
+        const auto   pRef = mola::worldModelKeyFramePose(wmRef, refKFs[k]);
+        const auto   p    = mola::worldModelKeyFramePose(wm, kfs[k]);
+        const double err  = p.distanceTo(pRef);
+        if (err > 1e-6)
+            throw std::runtime_error(mrpt::format(
+                "%s: differs by %e m at KF #%zu", what, err, k));
+    }
+}
+
+void test_journal_recovery()
+{
+#if defined(_WIN32)
+    std::cout << "Skipped: requires fork()\n";
+#else
+    const auto steps    = makeSession();
+    const auto base     = mrpt::system::getTempFileName();
+    const auto dirCrash = base + "_journal_crash";
+    const auto dirFull  = base + "_journal_full";
+
+    // Killed in the middle of the session. Forked before any module
+    // starts its threads:
+    const pid_t pid = ::fork();
+    if (pid < 0) throw std::runtime_error("fork() failed");
+    if (pid == 0)
+    {
+        try
+        {
+            mola::BackendHarness    h("ASLAM_gtsam", slamConfig(dirCrash));
+            std::vector<mola::id_t> kfs;
+            runSteps(h.backend(), steps, 0, CRASH_AT, kfs);
+            // No onQuit(), no final checkpoint, no journal close():
+            ::kill(::getpid(), SIGKILL);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << e.what() << "\n";
+        }
+        ::_exit(2);
+    }
+    int status = 0;
+    ::waitpid(pid, &status, 0);
+    if (!WIFSIGNALED(status) || WTERMSIG(status) != SIGKILL)
+        throw std::runtime_error("The journaled process did not crash");
+
+    // Uninterrupted, without and with journal (default settings, to
+    // measure its overhead):
+    mola::BackendHarness    hRef("ASLAM_gtsam", slamConfig(""));
+    std::vector<mola::id_t> refKFs;
+    const double tPlain = runSteps(hRef.backend(), steps, 0, NUM_KFS, refKFs);
+
+    mola::BackendHarness hFull("ASLAM_gtsam", slamConfig(dirFull, false));
+    auto& full = dynamic_cast<mola::ASLAM_gtsam&>(hFull.backend());
+    std::vector<mola::id_t> fullKFs;
+    const double tJournal = runSteps(full, steps, 0, NUM_KFS, fullKFs);
+    const auto   js       = full.journal_stats();
+
+    std::cout << mrpt::format(
+        "Session of %zu KFs: %.03f s without journal, %.03f s with it "
+        "(%+.02f%%). Journal: %zu records, %zu syncs, append %.03f s, "
+        "fsync %.03f s, %.02f%% of the time of journaled calls.\n",
+        NUM_KFS, tPlain, tJournal, 100.0 * (tJournal - tPlain) / tPlain,
+        js.records, js.syncs, js.append_time, js.sync_time,
+        js.overhead_percent());
+
+    if (js.overhead_percent() > MAX_JOURNAL_OVERHEAD)
+        throw std::runtime_error(mrpt::format(
+            "Journal overhead %.02f%% exceeds %.01f%%", js.overhead_percent(),
+            MAX_JOURNAL_OVERHEAD));
+
+    comparePoses(
+        hRef.worldmodel(), refKFs, hFull.worldmodel(), fullKFs, "Journaled");
+
+    // Recovered from the crash, then the rest of the session:
+    mola::BackendHarness    h("ASLAM_gtsam", slamConfig(dirCrash));
+    std::vector<mola::id_t> kfs(refKFs.begin(), refKFs.begin() + CRASH_AT);
+    runSteps(h.backend(), steps, CRASH_AT, NUM_KFS, kfs);
+
+    comparePoses(hRef.worldmodel(), refKFs, h.worldmodel(), kfs, "Recovered");
+
+    hFull.quit();
+    h.quit();
+    mrpt::system::deleteFilesInDirectory(dirCrash, true);
+    mrpt::system::deleteFilesInDirectory(dirFull, true);
+#endif
+}
+
+int main([[maybe_unused]] int argc, [[maybe_unused]] char** argv)
+{
+    try
+    {
+        test_journal_recovery();
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
@@ -0,0 +1,168 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @file   test-kf-obs-store.cpp
+ * @brief  Checks KeyframeObsStore round-trips and LRU eviction, and that
+ *         maps saved by ASLAM_gtsam keep the stored observations.
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 14, 2019
+ */
+
+#include <mola-kernel/variant_helper.h>  // overloaded{}
+#include <mola-slam-gtsam/BackendHarness.h>
+#include <mola-slam-gtsam/ChunkedMap.h>
+#include <mola-slam-gtsam/KeyframeObsStore.h>
+#include <mrpt/obs/CObservationOdometry.h>
+#include <mrpt/system/filesystem.h>
+
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+static mrpt::obs::CSensoryFrame::Ptr makeSF(double x)
+{
+    auto obs          = mrpt::obs::CObservationOdometry::Create();
+    obs->sensorLabel  = "odom";
+    obs->odometry.x() = x;
+
+    auto sf = mrpt::obs::CSensoryFrame::Create();
+    sf->insert(obs);
+    return sf;
+}
+
+static double getX(const mrpt::obs::CSensoryFrame::Ptr& sf)
+{
+    if (!sf || sf->size() != 1) throw std::runtime_error("Bad sensory frame");
+    auto o = sf->getObservationByClass<mrpt::obs::CObservationOdometry>();
+    if (!o) throw std::runtime_error("Bad observation class");
+    return o->odometry.x();
+}
+
+void test_kf_obs_store()
+{
+    mola::KeyframeObsStore             store;
+    mola::KeyframeObsStore::Parameters p;
+    p.file = mrpt::system::getTempFileName();
+
+    // Measure the size of one entry, then allow caching ~3 of them:
+    {
+        store.open(p);
+        const auto h = store.put(0, makeSF(0));
+        p.max_cached_bytes = 3 * h.length + h.length / 2;
+        store.close();
+    }
+    store.open(p);
+
+    const mola::id_t N = 20;
+    for (mola::id_t i = 0; i < N; i++) store.put(i, makeSF(1.0 * i));
+
+    if (store.size() != N) throw std::runtime_error("Wrong size()");
+    if (store.cached_bytes() > p.max_cached_bytes)
+        throw std::runtime_error("Cache budget exceeded");
+    if (store.stats().evictions != N - 3)
+        throw std::runtime_error("Wrong number of evictions");
+
+    // Recent ones are hits, old ones are decoded from disk:
+    if (getX(store.get(N - 1)) != N - 1) throw std::runtime_error("KF N-1");
+    if (store.stats().hits != 1) throw std::runtime_error("Expected hit");
+
+    for (mola::id_t i = 0; i < N; i++)
+        if (getX(store.get(i)) != 1.0 * i)
+            throw std::runtime_error("Mismatch reading back observations");
+
+    if (store.stats().misses == 0) throw std::runtime_error("Expected miss");
+    if (store.get(N + 1)) throw std::runtime_error("Unknown KF found");
+    if (store.cached_bytes() > p.max_cached_bytes)
+        throw std::runtime_error("Cache budget exceeded");
+
+    store.close();
+    if (mrpt::system::fileExists(p.file))
+        throw std::runtime_error("Backing file not deleted");
+}
+
+// Save a map with the observations moved to the store, reload it into an
+// empty WorldModel and check them. chunkSize=0: single `WorldModel.map`.
+void test_map_save_keeps_observations(const int chunkSize)
+{
+    const auto storeFile = mrpt::system::getTempFileName();
+    const auto cfg       = mola::BackendHarness::defaultConfig(
+        "ASLAM_gtsam", mrpt::format(
+                           "  save_map_at_end: true\n"
+                           "  map_chunk_size: %i\n"
+                           "  keyframe_obs_store_file: '%s'\n"
+                           "  keyframe_obs_cache_mb: 0\n",
+                           chunkSize, storeFile.c_str()));
+
+    std::vector<mola::id_t> kfs;
+    std::string             mapDir;
+    {
+        mola::BackendHarness h("ASLAM_gtsam", cfg);
+
+        const auto t0 = mrpt::Clock::now();
+        for (int k = 0; k < 5; k++)
+        {
+            mola::BackEndBase::ProposeKF_Input in;
+            in.timestamp    = t0 + std::chrono::seconds(10 * k);
+            in.observations = *makeSF(1.0 * k);
+            kfs.push_back(h.backend().doAddKeyFrame(in).new_kf_id.value());
+        }
+        if (!mrpt::system::fileExists(storeFile))
+            throw std::runtime_error("Observations store not in use");
+
+        h.quit();
+        mapDir = h.worldmodel().map_base_directory();
+    }
+    if (mrpt::system::fileExists(storeFile))
+        throw std::runtime_error("Store file not deleted after map save");
+
+    mola::BackendHarness h2(
+        "ASLAM_gtsam",
+        "params:\n"
+        "  show_gui: false\n"
+        "  save_map_at_end: false\n");
+    auto& wm = h2.worldmodel();
+    if (chunkSize > 0)
+        mola::loadChunkedMap(wm, mapDir + "/WorldModel.chunks");
+    else
+        wm.map_load_from(mapDir + "/WorldModel.map");
+
+    wm.entities_lock_for_read();
+    for (std::size_t k = 0; k < kfs.size(); k++)
+    {
+        mrpt::obs::CSensoryFrame::Ptr sf;
+        std::visit(
+            overloaded{
+                [&](const mola::RelPose3KF& e) { sf = e.raw_observations_; },
+                []([[maybe_unused]] const auto& e) {},
+            },
+            wm.entity_by_id(kfs[k]));
+        if (!sf || getX(sf) != 1.0 * k)
+        {
+            wm.entities_unlock_for_read();
+            throw std::runtime_error(mrpt::format(
+                "Saved map lost the observations of KF #%zu", k));
+        }
+    }
+    wm.entities_unlock_for_read();
+}
+
+int main([[maybe_unused]] int argc, [[maybe_unused]] char** argv)
+{
+    try
+    {
+        test_kf_obs_store();
+        test_map_save_keeps_observations(2);
+        test_map_save_keeps_observations(0);
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
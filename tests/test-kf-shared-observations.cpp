@@ -0,0 +1,111 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @file   test-kf-shared-observations.cpp
+ * @brief  ASLAM_gtsam::addKeyFrameShared() does not copy the observations:
+ *         its heap allocations do not grow with their number.
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 20, 2019
+ */
+
+#include <mola-slam-gtsam/ASLAM_gtsam.h>
+#include <mola-slam-gtsam/AllocProfiler.h>
+#include <mola-slam-gtsam/BackendHarness.h>
+#include <mrpt/obs/CObservationOdometry.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+static mrpt::obs::CSensoryFrame::Ptr makeSF(const std::size_t n)
+{
+    auto sf = mrpt::obs::CSensoryFrame::Create();
+    for (std::size_t i = 0; i < n; i++)
+        sf->insert(mrpt::obs::CObservationOdometry::Create());
+    return sf;
+}
+
+// Fewest bytes allocated inside `scope` by one call of `add()`, out of
+// several calls, to filter out occasional container growth:
+template <class FUNCTOR>
+static uint64_t minBytesPerCall(const char* scope, FUNCTOR add)
+{
+    uint64_t best = std::numeric_limits<uint64_t>::max();
+    for (int i = 0; i < 10; i++)
+    {
+        mola::AllocProfiler::reset();
+        add();
+        best = std::min(best, mola::AllocProfiler::scopes().at(scope).bytes);
+    }
+    return best;
+}
+
+void test_kf_shared_observations()
+{
+    if (!mola::AllocProfiler::available())
+    {
+        std::cout << "Allocation profiling not built in: skipping.\n";
+        return;
+    }
+
+    mola::BackendHarness h(
+        "ASLAM_gtsam", mola::BackendHarness::defaultConfig("ASLAM_gtsam"));
+    auto& slam = dynamic_cast<mola::ASLAM_gtsam&>(h.backend());
+
+    const std::size_t N     = 1000;
+    const auto        small = makeSF(1), big = makeSF(N);
+
+    const auto t0   = mrpt::Clock::now();
+    int        next = 0;
+    const auto at   = [&]() { return t0 + std::chrono::seconds(10 * next++); };
+
+    const auto viaCopy = [&](const mrpt::obs::CSensoryFrame::Ptr& sf) {
+        return minBytesPerCall("doAddKeyFrame", [&]() {
+            mola::BackEndBase::ProposeKF_Input in;
+            in.timestamp    = at();
+            in.observations = *sf;
+            slam.doAddKeyFrame(in);
+        });
+    };
+    const auto viaShared = [&](const mrpt::obs::CSensoryFrame::Ptr& sf) {
+        return minBytesPerCall("addKeyFrameShared", [&]() {
+            slam.addKeyFrameShared(at(), sf);
+        });
+    };
+
+    // The root KF takes a different path:
+    slam.addKeyFrameShared(at(), small);
+
+    const auto copy_small = viaCopy(small), copy_big = viaCopy(big);
+    const auto shared_small = viaShared(small), shared_big = viaShared(big);
+    std::cout << "Bytes per KF with 1/" << N
+              << " observations: doAddKeyFrame=" << copy_small << "/"
+              << copy_big << " addKeyFrameShared=" << shared_small << "/"
+              << shared_big << "\n";
+
+    // The copy holds at least one pointer per observation:
+    if (copy_big < copy_small + N * sizeof(void*))
+        throw std::runtime_error("doAddKeyFrame: copy not detected");
+    if (shared_big != shared_small)
+        throw std::runtime_error("addKeyFrameShared copies observations");
+}
+
+int main([[maybe_unused]] int argc, [[maybe_unused]] char** argv)
+{
+    try
+    {
+        test_kf_shared_observations();
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
@@ -0,0 +1,63 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @file   test-latency-histogram.cpp
+ * @brief  Checks LatencyHistogram percentiles against exact ones.
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 20, 2019
+ */
+
+#include <mola-slam-gtsam/LatencyHistogram.h>
+
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+
+void test_latency_histogram()
+{
+    mola::LatencyHistogram h;
+    if (h.percentile(0.5) != 0) throw std::runtime_error("Empty: expected 0");
+
+    // 1 ms ... 1000 ms, uniformly:
+    for (int i = 1; i <= 1000; i++) h.add(1e-3 * i);
+
+    if (h.count() != 1000) throw std::runtime_error("Wrong count()");
+    if (std::abs(h.mean() - 0.5005) > 1e-9)
+        throw std::runtime_error("Wrong mean()");
+    if (h.max() != 1.0) throw std::runtime_error("Wrong max()");
+
+    for (const double p : {0.1, 0.5, 0.9, 0.99})
+    {
+        const double exact  = p;  // [s]
+        const double approx = h.percentile(p);
+        // Upper edge of the bin: never below, less than one bin above:
+        if (approx < exact - 1e-9 || approx > exact * 1.26)
+            throw std::runtime_error("Percentile out of bounds");
+    }
+    if (h.percentile(1.0) != 1.0)
+        throw std::runtime_error("p100 must be max()");
+
+    // Out of range values go to the extreme bins:
+    mola::LatencyHistogram h2;
+    h2.add(1e-9);
+    h2.add(1e5);
+    if (h2.percentile(0.5) > 1e-6 || h2.percentile(1.0) != 1e5)
+        throw std::runtime_error("Wrong under/overflow handling");
+}
+
+int main([[maybe_unused]] int argc, [[maybe_unused]] char** argv)
+{
+    try
+    {
+        test_latency_histogram();
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
@@ -0,0 +1,175 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @file   test-localization-only.cpp
+ * @brief  ASLAM_gtsam `localization_only`: prior map KFs stay frozen, new
+ *         KFs are localized against them, and the per-update cost does not
+ *         grow with the size of the prior map.
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 20, 2019
+ */
+
+#include <mola-slam-gtsam/ASLAM_gtsam.h>
+#include <mola-slam-gtsam/BackendHarness.h>
+#include <mola-slam-gtsam/ChunkedMap.h>
+#include <mola-slam-gtsam/SyntheticWorkload.h>
+#include <mrpt/core/format.h>
+#include <mrpt/random/RandomGenerators.h>
+#include <mrpt/system/filesystem.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// KFs of the localization session, driving 0.5 m to the left of the map:
+static const std::size_t NUM_LOC_KFS = 30;
+
+static void addRelPose(
+    mola::BackEndBase& be, const mola::id_t from, const mola::id_t to,
+    const double dx, const double dy, const double sigma_xyz)
+{
+    mola::FactorRelativePose3 f(
+        from, to, mrpt::math::TPose3D(dx, dy, 0, 0, 0, 0));
+    f.noise_model_diag_xyz_ = sigma_xyz;
+    f.noise_model_diag_rot_ = 0.01;
+    mola::Factor ff         = f;
+    be.doAddFactor(ff);
+}
+
+struct PriorMap
+{
+    std::string             dir;
+    std::vector<mola::id_t> kfs;
+};
+
+/** `n` KFs, 1 m apart along the x axis, mapped by ASLAM_gtsam and saved
+ * into a new directory */
+static PriorMap buildMap(const std::size_t n)
+{
+    mola::BackendHarness h(
+        "ASLAM_gtsam", mola::BackendHarness::defaultConfig("ASLAM_gtsam"));
+    auto&                be = h.backend();
+
+    PriorMap   m;
+    const auto t0 = mrpt::Clock::fromDouble(1.5e9);
+    for (std::size_t k = 0; k < n; k++)
+    {
+        mola::BackEndBase::ProposeKF_Input in;
+        in.timestamp = t0 + std::chrono::seconds(10 * k);
+        m.kfs.push_back(be.doAddKeyFrame(in).new_kf_id.value());
+        if (k > 0) addRelPose(be, m.kfs[k - 1], m.kfs[k], 1.0, 0, 0.01);
+    }
+    be.spinOnce();
+
+    m.dir = mrpt::system::getTempFileName() + "_map";
+    mola::ChunkedMapWriter().save(h.worldmodel(), m.dir);
+    return m;
+}
+
+struct LocResult
+{
+    std::size_t max_variables{0};
+    double      mean_t_update{0};
+};
+
+static LocResult localize(const PriorMap& m)
+{
+    mola::BackendHarness h(
+        "ASLAM_gtsam", mola::BackendHarness::defaultConfig(
+                           "ASLAM_gtsam",
+                           "  localization_only: true\n"
+                           "  localization_window_size: 5\n"));
+    auto& slam = dynamic_cast<mola::ASLAM_gtsam&>(h.backend());
+    auto& wm   = h.worldmodel();
+
+    mola::loadChunkedMap(wm, m.dir);
+    slam.rebuild_from_worldmodel();
+
+    std::vector<mrpt::poses::CPose3D> map_poses;
+    for (const auto kf : m.kfs)
+        map_poses.push_back(mola::worldModelKeyFramePose(wm, kf));
+
+    auto& rng = mrpt::random::getRandomGenerator();
+    rng.randomize(123);
+
+    LocResult               r;
+    std::vector<mola::id_t> kfs;
+    const auto              t0 = mrpt::Clock::fromDouble(1.6e9);
+    for (std::size_t k = 0; k < NUM_LOC_KFS; k++)
+    {
+        mola::BackEndBase::ProposeKF_Input in;
+        in.timestamp = t0 + std::chrono::seconds(10 * k);
+        kfs.push_back(slam.doAddKeyFrame(in).new_kf_id.value());
+
+        // Observation of the nearby map KF, then noisy odometry:
+        addRelPose(slam, m.kfs[k], kfs[k], 0, 0.5, 0.01);
+        if (k > 0)
+            addRelPose(
+                slam, kfs[k - 1], kfs[k], 1.0 + rng.drawGaussian1D(0, 0.05),
+                rng.drawGaussian1D(0, 0.05), 0.05);
+        slam.spinOnce();
+
+        const auto st   = slam.spin_stats().back();
+        r.max_variables = std::max(r.max_variables, st.variables_total);
+        r.mean_t_update += st.t_update / NUM_LOC_KFS;
+    }
+
+    // The prior map is untouched:
+    for (std::size_t i = 0; i < m.kfs.size(); i++)
+        if (mola::worldModelKeyFramePose(wm, m.kfs[i]) != map_poses[i])
+            throw std::runtime_error("A frozen map KF was modified");
+
+    // New KFs are localized against it:
+    for (std::size_t k = 0; k < NUM_LOC_KFS; k++)
+    {
+        const auto expected =
+            map_poses[k] + mrpt::poses::CPose3D(0, 0.5, 0, 0, 0, 0);
+        const auto p = mola::worldModelKeyFramePose(wm, kfs[k]);
+        if (p.distanceTo(expected) > 0.05)
+            throw std::runtime_error(mrpt::format(
+                "Localization error of %.3f m at KF #%zu",
+                p.distanceTo(expected), k));
+    }
+
+    mrpt::system::deleteFilesInDirectory(m.dir, true);
+    return r;
+}
+
+void test_localization_only()
+{
+    std::vector<LocResult> res;
+    for (const std::size_t n : {50, 500})
+    {
+        res.push_back(localize(buildMap(n)));
+        std::cout << "Prior map of " << n << " KFs: up to "
+                  << res.back().max_variables
+                  << " variables per update, mean update time: "
+                  << 1e3 * res.back().mean_t_update << " ms\n";
+    }
+
+    // Same window contents, regardless of the prior map size:
+    if (res[0].max_variables != res[1].max_variables)
+        throw std::runtime_error("Update size depends on the prior map");
+    if (res[0].max_variables > 2 * 5 + 1)
+        throw std::runtime_error("Window larger than expected");
+}
+
+int main([[maybe_unused]] int argc, [[maybe_unused]] char** argv)
+{
+    try
+    {
+        test_localization_only();
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
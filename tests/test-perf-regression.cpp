@@ -0,0 +1,262 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @file   test-perf-regression.cpp
+ * @brief  Compares time and allocations per back-end call to a baseline
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 20, 2019
+ */
+
+#include <mola-slam-gtsam/AllocProfiler.h>
+#include <mola-slam-gtsam/BackendHarness.h>
+#include <mola-slam-gtsam/SyntheticWorkload.h>
+#include <yaml-cpp/yaml.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <new>
+#include <stdexcept>
+
+// Counts heap allocations of the whole process:
+#if defined(MOLA_SLAM_GTSAM_ALLOC_PROFILING)
+// (The library already replaces operator new, see AllocProfiler)
+static uint64_t allocs_now() { return mola::AllocProfiler::totals().allocs; }
+static uint64_t bytes_now() { return mola::AllocProfiler::totals().bytes; }
+#else
+static std::atomic<uint64_t> num_allocs{0}, num_bytes{0};
+
+void* operator new(std::size_t n)
+{
+    num_allocs++;
+    num_bytes += n;
+    if (void* p = std::malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+void* operator new[](std::size_t n) { return operator new(n); }
+void  operator delete(void* p) noexcept { std::free(p); }
+void  operator delete[](void* p) noexcept { std::free(p); }
+void  operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void  operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+
+static uint64_t allocs_now() { return num_allocs; }
+static uint64_t bytes_now() { return num_bytes; }
+#endif
+
+/** Number of keyframes per workload */
+static const std::size_t NUM_KFS = 500;
+
+/** Exit code for workloads without a baseline (CTest SKIP_RETURN_CODE) */
+static const int SKIP_RETURN_CODE = 77;
+
+/** Default tolerance bands, unless given in the baseline file */
+struct Tolerance
+{
+    double time{0.5};  //!< Relative
+    double time_abs_us{20};  //!< Absolute slack, for very short calls
+    double allocs{0.1};  //!< Relative, also used for bytes
+};
+
+/** Metrics of one stage (call type) */
+using StageMetrics = std::map<std::string, double>;
+using Metrics      = std::map<std::string, StageMetrics>;
+
+static Metrics runWorkload(const mola::SyntheticWorkload::Type type)
+{
+    mola::SyntheticWorkload::Parameters wp;
+    wp.type    = type;
+    wp.num_kfs = NUM_KFS;
+    wp.seed    = 1;
+
+    mola::BackendHarness    h(
+        "ASLAM_gtsam", mola::BackendHarness::defaultConfig("ASLAM_gtsam"));
+    mola::SyntheticWorkload w(wp);
+    if (!w.prepareBackend(h.backend()))
+        throw std::runtime_error("Workload not supported");
+
+    struct Allocs
+    {
+        uint64_t count{0}, bytes{0};
+    };
+    std::map<mola::BackendCall, Allocs> allocs;
+
+    // Allocations between consecutive calls are attributed to the latter
+    // (including some replay bookkeeping, which is deterministic).
+    uint64_t last_allocs = allocs_now(), last_bytes = bytes_now();
+
+    mola::BackendReplayOptions opts;
+    opts.on_call = [&](const mola::BackendCallRecord& r, double) {
+        const uint64_t na = allocs_now(), nb = bytes_now();
+        allocs[r.call].count += na - last_allocs;
+        allocs[r.call].bytes += nb - last_bytes;
+        // (Re-read, to exclude this lambda's own map insertion)
+        last_allocs = allocs_now();
+        last_bytes  = bytes_now();
+    };
+    const auto stats = mola::replayBackendCalls(w.source(), h.backend(), opts);
+
+    Metrics m;
+    for (const auto& c : stats.calls)
+    {
+        auto d = c.second.durations;
+        if (d.empty()) continue;
+        std::sort(d.begin(), d.end());
+
+        auto& sm      = m[mola::backendCallName(c.first)];
+        sm["time_us"] = 1e6 * d[d.size() / 2];
+        sm["allocs"]  = double(allocs[c.first].count) / c.second.count;
+        sm["bytes"]   = double(allocs[c.first].bytes) / c.second.count;
+    }
+    m["total"]["time_us"] = 1e6 * stats.total_time;
+    return m;
+}
+
+/** Returns false if any metric is out of its tolerance band */
+static bool compare(
+    const Metrics& cur, const YAML::Node& base, const Tolerance& tol)
+{
+    bool ok = true;
+    std::cout << std::left << std::setw(34) << "stage.metric" << std::right
+              << std::setw(14) << "baseline" << std::setw(14) << "current"
+              << std::setw(10) << "change"
+              << "\n";
+    for (const auto& stage : cur)
+    {
+        for (const auto& kv : stage.second)
+        {
+            const std::string name = stage.first + "." + kv.first;
+            const double      v    = kv.second;
+            std::cout << std::left << std::setw(34) << name << std::right
+                      << std::fixed << std::setprecision(1);
+
+            if (!base[stage.first] || !base[stage.first][kv.first])
+            {
+                std::cout << std::setw(14) << "-" << std::setw(14) << v
+                          << "  (no baseline)\n";
+                continue;
+            }
+            const double b = base[stage.first][kv.first].as<double>();
+
+            const bool   is_time = (kv.first == "time_us");
+            const double limit =
+                is_time ? b * (1 + tol.time) + tol.time_abs_us
+                        : b * (1 + tol.allocs) + 1;  // +1: rounding
+            const double change = b > 0 ? 100.0 * (v - b) / b : 0;
+
+            std::cout << std::setw(14) << b << std::setw(14) << v
+                      << std::setw(9) << std::showpos << change << "%"
+                      << std::noshowpos;
+            if (v > limit)
+            {
+                ok = false;
+                std::cout << "  REGRESSION (limit: " << limit << ")";
+            }
+            std::cout << "\n";
+        }
+    }
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    try
+    {
+        using mola::SyntheticWorkload;
+
+        std::string baselineFile, workload = "Manhattan";
+        bool        update = false;
+        for (int i = 1; i < argc; i++)
+        {
+            const bool has_arg = (i + 1 < argc);
+            if (!std::strcmp(argv[i], "--baseline") && has_arg)
+                baselineFile = argv[++i];
+            else if (!std::strcmp(argv[i], "--workload") && has_arg)
+                workload = argv[++i];
+            else if (!std::strcmp(argv[i], "--update-baseline"))
+                update = true;
+            else
+            {
+                std::cerr << "Usage: " << argv[0]
+                          << " --baseline <FILE.yml> [--workload <NAME>] "
+                             "[--update-baseline]\n";
+                return 1;
+            }
+        }
+        if (baselineFile.empty())
+            throw std::runtime_error("Missing --baseline");
+
+        YAML::Node root;
+        if (std::ifstream(baselineFile).is_open())
+            root = YAML::LoadFile(baselineFile);
+
+        // Without a baseline there is nothing to compare with: report it
+        // as skipped rather than passed.
+        if (!update && !root["workloads"][workload])
+        {
+            std::cout << "No baseline for workload `" << workload << "` in "
+                      << baselineFile
+                      << ": skipped. Create it with --update-baseline.\n";
+            return SKIP_RETURN_CODE;
+        }
+
+        const auto type =
+            mrpt::typemeta::TEnumType<SyntheticWorkload::Type>::name2value(
+                workload);
+        const Metrics cur = runWorkload(type);
+
+        if (update)
+        {
+            YAML::Node wl;
+            for (const auto& stage : cur)
+                for (const auto& kv : stage.second)
+                    wl[stage.first][kv.first] = kv.second;
+            root["workloads"][workload] = wl;
+
+            std::ofstream f(baselineFile);
+            if (!f.is_open())
+                throw std::runtime_error("Cannot write: " + baselineFile);
+            f << "# Performance baseline for test-perf-regression.\n"
+                 "# Regenerate with: test-perf-regression --baseline <this "
+                 "file> --workload <NAME> --update-baseline\n";
+            YAML::Emitter out;
+            out << root;
+            f << out.c_str() << "\n";
+            std::cout << "Baseline updated for workload `" << workload
+                      << "` in: " << baselineFile << "\n";
+            return 0;
+        }
+
+        Tolerance tol;
+        if (const auto t = root["tolerance"]; t)
+        {
+            if (t["time"]) tol.time = t["time"].as<double>();
+            if (t["time_abs_us"])
+                tol.time_abs_us = t["time_abs_us"].as<double>();
+            if (t["allocs"]) tol.allocs = t["allocs"].as<double>();
+        }
+
+        std::cout << "Workload: " << workload << " (" << NUM_KFS
+                  << " KFs)\n";
+        if (!compare(cur, root["workloads"][workload], tol))
+        {
+            std::cerr << "Performance regression. If expected, run with "
+                         "--update-baseline and commit the baseline file.\n";
+            return 1;
+        }
+        return 0;
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
@@ -0,0 +1,148 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @file   test-posegraph-io.cpp
+ * @brief  g2o import into ASLAM_gtsam and export: vertex guesses and
+ *         information matrices survive the round trip.
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 20, 2019
+ */
+
+#include <mola-slam-gtsam/ASLAM_gtsam.h>
+#include <mola-slam-gtsam/BackendHarness.h>
+#include <mola-slam-gtsam/PoseGraphIO.h>
+
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Unit square, turning left at each corner, closed by a loop edge.
+// Information: 100 in translation, 4000 in (qx,qy,qz), i.e. 1000 in angle.
+#define INFO "100 0 0 0 0 0 100 0 0 0 0 100 0 0 0 4000 0 0 4000 0 4000"
+static const char* SQUARE_G2O =
+    "VERTEX_SE3:QUAT 0 0 0 0 0 0 0 1\n"
+    "VERTEX_SE3:QUAT 1 1.1 0 0 0 0 0 1\n"
+    "VERTEX_SE3:QUAT 2 1 0.9 0 0 0 0.7071068 0.7071068\n"
+    "VERTEX_SE3:QUAT 3 0 1 0 0 0 1 0\n"
+    "EDGE_SE3:QUAT 0 1 1 0 0 0 0 0 1 " INFO "\n"
+    "EDGE_SE3:QUAT 1 2 0 1 0 0 0 0.7071068 0.7071068 " INFO "\n"
+    "EDGE_SE3:QUAT 2 3 0 1 0 0 0 0.7071068 0.7071068 " INFO "\n"
+    "EDGE_SE3:QUAT 3 0 0 1 0 0 0 1 0 " INFO "\n"
+    "FIX 0\n";
+#undef INFO
+
+/** Parsed `VERTEX_SE3:QUAT`/`EDGE_SE3:QUAT` lines, keyed by their IDs */
+struct G2OContents
+{
+    std::map<uint64_t, std::vector<double>>                       vertices;
+    std::map<std::pair<uint64_t, uint64_t>, std::vector<double>> edges;
+};
+
+static G2OContents parse(const std::string& s)
+{
+    G2OContents        g;
+    std::istringstream in(s);
+    for (std::string line; std::getline(in, line);)
+    {
+        std::istringstream ss(line);
+        std::string        tag;
+        ss >> tag;
+        std::vector<double> nums;
+        if (tag == "VERTEX_SE3:QUAT")
+        {
+            uint64_t id;
+            ss >> id;
+            for (double v; ss >> v;) nums.push_back(v);
+            g.vertices[id] = nums;
+        }
+        else if (tag == "EDGE_SE3:QUAT")
+        {
+            uint64_t from, to;
+            ss >> from >> to;
+            for (double v; ss >> v;) nums.push_back(v);
+            g.edges[{from, to}] = nums;
+        }
+    }
+    return g;
+}
+
+static std::string exportG2O(mola::ASLAM_gtsam& slam)
+{
+    std::stringstream ss;
+    slam.exportPoseGraphG2O(ss);
+    return ss.str();
+}
+
+void test_g2o_round_trip()
+{
+    mola::BackendHarness h(
+        "ASLAM_gtsam", mola::BackendHarness::defaultConfig("ASLAM_gtsam"));
+    auto& slam = dynamic_cast<mola::ASLAM_gtsam&>(h.backend());
+
+    std::istringstream in(SQUARE_G2O);
+    const auto         res = mola::importPoseGraph(in, slam);
+    if (res.vertices != 4 || res.edges != 4 || res.ignored_lines != 1)
+        throw std::runtime_error("Unexpected import counts");
+
+    const auto kf = [&](uint64_t v) { return res.vertex2kf.at(v); };
+
+    // Before optimizing, vertices are at the file guesses, not at the
+    // poses composed from the edges:
+    {
+        const auto g  = parse(exportG2O(slam));
+        const auto v1 = g.vertices.at(kf(1));
+        const auto v2 = g.vertices.at(kf(2));
+        if (std::abs(v1.at(0) - 1.1) > 1e-6 ||
+            std::abs(v2.at(1) - 0.9) > 1e-6)
+            throw std::runtime_error("Vertex guesses were not used");
+    }
+
+    slam.spinOnce();
+    const auto g = parse(exportG2O(slam));
+
+    // Optimized poses close the square:
+    const double expected[4][2] = {{0, 0}, {1, 0}, {1, 1}, {0, 1}};
+    for (uint64_t v = 0; v < 4; v++)
+    {
+        const auto& p = g.vertices.at(kf(v));
+        if (std::abs(p.at(0) - expected[v][0]) > 0.05 ||
+            std::abs(p.at(1) - expected[v][1]) > 0.05)
+            throw std::runtime_error("Unexpected optimized vertex");
+    }
+
+    // Information blocks survive import+export unchanged, including the
+    // quaternion-vector scaling of the rotational part:
+    const auto orig = parse(SQUARE_G2O);
+    for (const auto& e : orig.edges)
+    {
+        const auto& out = g.edges.at({kf(e.first.first), kf(e.first.second)});
+        // x y z qx qy qz qw, then 21 upper triangle entries:
+        for (const int diag : {0, 6, 11, 15, 18, 20})
+        {
+            const double a = e.second.at(7 + diag), b = out.at(7 + diag);
+            if (std::abs(a - b) > 1e-6 * a)
+                throw std::runtime_error("Information matrix changed");
+        }
+    }
+}
+
+int main([[maybe_unused]] int argc, [[maybe_unused]] char** argv)
+{
+    try
+    {
+        test_g2o_round_trip();
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
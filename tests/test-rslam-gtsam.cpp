@@ -0,0 +1,220 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @file   test-rslam-gtsam.cpp
+ * @brief  RSLAM_gtsam: anchors, bounded local windows and loop closures
+ *         with noisy odometry. Also compares it with ASLAM_gtsam on
+ *         SyntheticWorkload sessions.
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 20, 2019
+ */
+
+#include <mola-kernel/entities/entities-common.h>
+#include <mola-slam-gtsam/BackendHarness.h>
+#include <mola-slam-gtsam/RSLAM_gtsam.h>
+#include <mola-slam-gtsam/SyntheticWorkload.h>
+#include <mrpt/core/bits_math.h>  // DEG2RAD()
+#include <mrpt/core/format.h>
+#include <mrpt/poses/CPose3D.h>
+#include <mrpt/random/RandomGenerators.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <set>
+#include <stdexcept>
+#include <vector>
+
+static const unsigned KFS_PER_LAP = 40;
+static const unsigned NUM_LAPS    = 3;
+static const double   RADIUS      = 10.0;
+
+/** Keyframe `k` on a circle, facing forward */
+static mrpt::poses::CPose3D groundTruth(const unsigned k)
+{
+    const double a = mrpt::DEG2RAD(360.0 * k / KFS_PER_LAP);
+    return mrpt::poses::CPose3D(
+        RADIUS * std::cos(a), RADIUS * std::sin(a), 0,
+        a + mrpt::DEG2RAD(90.0), 0, 0);
+}
+
+/** `p` with Gaussian noise in x, y and yaw */
+static mrpt::poses::CPose3D noisy(
+    const mrpt::poses::CPose3D& p, const double sigma_xy,
+    const double sigma_yaw)
+{
+    auto& rng = mrpt::random::getRandomGenerator();
+    return mrpt::poses::CPose3D(
+        p.x() + rng.drawGaussian1D(0, sigma_xy),
+        p.y() + rng.drawGaussian1D(0, sigma_xy), p.z(),
+        p.yaw() + rng.drawGaussian1D(0, sigma_yaw), p.pitch(), p.roll());
+}
+
+void test_rslam_loops()
+{
+    mola::BackendHarness h(
+        "RSLAM_gtsam",
+        "params:\n"
+        "  local_window_depth: 5\n"
+        "  local_window_max_kfs: 30\n"
+        "  anchor_max_distance: 8.0\n");
+    auto& be = dynamic_cast<mola::RSLAM_gtsam&>(h.backend());
+
+    auto& rng = mrpt::random::getRandomGenerator();
+    rng.randomize(1234);
+
+    // Noisy odometry, plus an accurate loop closure with the same place in
+    // the former lap. odo[k] is the odometry from KF k-1 to k.
+    std::vector<mola::id_t>           kfs;
+    std::vector<mrpt::poses::CPose3D> odo(KFS_PER_LAP * NUM_LAPS);
+    std::size_t                       max_window = 0;
+    const auto                        t0         = mrpt::Clock::now();
+    for (unsigned k = 0; k < KFS_PER_LAP * NUM_LAPS; k++)
+    {
+        mola::BackEndBase::ProposeKF_Input in;
+        in.timestamp = t0 + std::chrono::seconds(k);
+        kfs.push_back(be.doAddKeyFrame(in).new_kf_id.value());
+
+        const auto addEdge = [&](const unsigned from, const unsigned to,
+                                 const mrpt::poses::CPose3D& rel,
+                                 const double                sigma_xyz,
+                                 const double                sigma_rot) {
+            mola::FactorRelativePose3 f(kfs[from], kfs[to], rel.asTPose());
+            f.noise_model_diag_xyz_ = sigma_xyz;
+            f.noise_model_diag_rot_ = sigma_rot;
+            mola::Factor ff         = f;
+            be.doAddFactor(ff);
+        };
+        if (k > 0)
+        {
+            odo[k] = noisy(groundTruth(k) - groundTruth(k - 1), 0.05, 0.01);
+            addEdge(k - 1, k, odo[k], 0.05, 0.01);
+        }
+        if (k >= KFS_PER_LAP)
+            addEdge(
+                k - KFS_PER_LAP, k,
+                noisy(groundTruth(k) - groundTruth(k - KFS_PER_LAP), 0.005,
+                      0.001),
+                0.005, 0.001);
+
+        be.spinOnce();
+        max_window = std::max(max_window, be.last_window_size());
+    }
+
+    if (max_window > 30)
+        throw std::runtime_error("Local window exceeded its max. size");
+
+    // Pose of each KF wrt its anchor, vs. the ground truth and vs. the
+    // odometry composed from the anchor:
+    auto&                wm = h.worldmodel();
+    std::set<mola::id_t> anchors;
+    const auto           root_id = kfs.front() - 1;
+    std::vector<double>  err_opt, err_odo;
+    wm.entities_lock_for_read();
+    for (unsigned k = 0; k < kfs.size(); k++)
+    {
+        const auto& kf = std::get<mola::RelPose3KF>(wm.entity_by_id(kfs[k]));
+        anchors.insert(kf.base_id_);
+
+        // (The root is at the first KF)
+        const unsigned base_k =
+            kf.base_id_ == root_id ? 0 : kf.base_id_ - kfs.front();
+        const auto expected = groundTruth(k) - groundTruth(base_k);
+
+        mrpt::poses::CPose3D from_odo;
+        for (unsigned i = base_k + 1; i <= k; i++) from_odo = from_odo + odo[i];
+
+        err_opt.push_back(
+            mrpt::poses::CPose3D(mola::entity_get_pose(wm.entity_by_id(kfs[k])))
+                .distanceTo(expected));
+        err_odo.push_back(from_odo.distanceTo(expected));
+    }
+    wm.entities_unlock_for_read();
+
+    if (anchors.size() < 3) throw std::runtime_error("Expected more anchors");
+
+    // After the first loop closes, each KF is tied to the former laps, so
+    // its pose wrt its anchor must be better than what odometry says:
+    double sum_opt = 0, sum_odo = 0, max_opt = 0;
+    for (unsigned k = KFS_PER_LAP; k < kfs.size(); k++)
+    {
+        sum_opt += err_opt[k];
+        sum_odo += err_odo[k];
+        max_opt = std::max(max_opt, err_opt[k]);
+    }
+    std::cout << mrpt::format(
+        "Error wrt anchors after loop closure: mean %.03f m (odometry: "
+        "%.03f m), max %.03f m\n",
+        sum_opt / (kfs.size() - KFS_PER_LAP),
+        sum_odo / (kfs.size() - KFS_PER_LAP), max_opt);
+
+    if (sum_opt > 0.8 * sum_odo || max_opt > 0.3)
+        throw std::runtime_error("Loop closures did not reduce the error");
+}
+
+/** Same SyntheticWorkload sessions in RSLAM_gtsam and ASLAM_gtsam: reports
+ * throughput, spinOnce() latency and local error (RPE) of both. */
+void test_rslam_vs_aslam()
+{
+    for (const auto type : {mola::SyntheticWorkload::Type::Manhattan,
+                            mola::SyntheticWorkload::Type::Corridor})
+    {
+        mola::SyntheticWorkload::Parameters p;
+        p.type    = type;
+        p.num_kfs = 500;
+
+        for (const char* backend : {"ASLAM_gtsam", "RSLAM_gtsam"})
+        {
+            mola::BackendHarness h(
+                backend, mola::BackendHarness::defaultConfig(backend));
+            mola::SyntheticWorkload w(p);
+            if (!w.prepareBackend(h.backend()))
+                throw std::runtime_error("Workload not supported");
+
+            const auto stats =
+                mola::replayBackendCalls(w.source(), h.backend());
+            const auto err =
+                mola::evaluateWorkload(w, h.worldmodel(), stats.kf_ids);
+            h.quit();
+
+            if (stats.kf_ids.size() != p.num_kfs)
+                throw std::runtime_error(
+                    mrpt::format("%s: missing keyframes", backend));
+
+            std::vector<double> spin_ms;
+            for (const double dt :
+                 stats.calls.at(mola::BackendCall::SpinOnce).durations)
+                spin_ms.push_back(1e3 * dt);
+            const auto spin = mola::computeErrorStats(spin_ms);
+
+            std::cout << mrpt::format(
+                "%-10s %-12s: %7.01f KF/s, spinOnce median %.03f ms max "
+                "%.03f ms, RPE %.03f m, ATE %.03f m\n",
+                mrpt::typemeta::TEnumType<mola::SyntheticWorkload::Type>::
+                    value2name(type)
+                        .c_str(),
+                backend, p.num_kfs / std::max(stats.total_time, 1e-9),
+                spin.median, spin.max, err.rpe_trans.rmse,
+                err.ate_trans.rmse);
+        }
+    }
+}
+
+int main([[maybe_unused]] int argc, [[maybe_unused]] char** argv)
+{
+    try
+    {
+        test_rslam_loops();
+        test_rslam_vs_aslam();
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
@@ -0,0 +1,247 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @file   test-separator-exchange.cpp
+ * @brief  Multi-robot back-ends, each in its own frame, converge to
+ *         consistent maps and estimate each other's frames by exchanging
+ *         separator summaries, spun in lockstep rounds. Also checks the
+ *         cost of the marginals of a summary is bounded as maps grow.
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 20, 2019
+ */
+
+#include <mola-slam-gtsam/ASLAM_gtsam.h>
+#include <mola-slam-gtsam/BackendHarness.h>
+#include <mola-slam-gtsam/SeparatorExchange.h>
+#include <mrpt/core/bits_math.h>  // DEG2RAD()
+#include <mrpt/core/format.h>
+#include <mrpt/math/wrap2pi.h>
+#include <mrpt/poses/CPose3D.h>
+#include <mrpt/random/RandomGenerators.h>
+#include <mrpt/system/filesystem.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+static const unsigned NUM_ROBOTS = 3;
+static const unsigned MAX_ROUNDS = 30;
+
+static void test_summary_encoding()
+{
+    mola::SeparatorSummary s;
+    s.robot_id = 3;
+    s.seq      = 42;
+    mola::SeparatorSummary::Marginal m;
+    m.kf   = 7;
+    m.mean = gtsam::Pose3(
+        gtsam::Rot3::RzRyRx(0.1, 0.2, 0.3), gtsam::Point3(1, 2, 3));
+    m.cov      = gtsam::Matrix6::Identity() * 0.01;
+    m.estimate = m.mean;
+    s.marginals.push_back(m);
+    mola::InterRobotConstraint c;
+    c.robot_from = 3;
+    c.kf_from    = 7;
+    c.robot_to   = 1;
+    c.kf_to      = 9;
+    c.rel_pose   = m.mean;
+    s.constraints.push_back(c);
+
+    const auto             buf = s.encode();
+    mola::SeparatorSummary s2;
+    s2.decode(buf.data(), buf.size());
+
+    if (s2.robot_id != 3 || s2.seq != 42 || s2.marginals.size() != 1 ||
+        s2.constraints.size() != 1 || !s2.marginals[0].mean.equals(m.mean) ||
+        !s2.marginals[0].cov.isApprox(m.cov) ||
+        !s2.constraints[0].sameEdge(c))
+        throw std::runtime_error("Summary encoding round-trip failed");
+}
+
+/** Where robot `id` starts, in the world. Each robot builds its map in its
+ * own frame, with its first KF at the origin. */
+static mrpt::poses::CPose3D robotStart(const unsigned id)
+{
+    return mrpt::poses::CPose3D(
+        4.0 * id, -3.0 * id, 0, mrpt::DEG2RAD(120.0 * id), 0, 0);
+}
+
+/** Robot `id` drives straight ahead from its start. Robot `id` observes the
+ * last KF of robot `id+1`, so robots form a chain. */
+static mrpt::poses::CPose3D groundTruth(const unsigned id, const unsigned k)
+{
+    return robotStart(id) + mrpt::poses::CPose3D(k, 0, 0, 0, 0, 0);
+}
+
+struct SessionResult
+{
+    unsigned    rounds{0};
+    std::size_t max_marginals_dim{0};  //!< among all robots
+};
+
+/** Runs NUM_ROBOTS instances in this process, spinning each once per
+ * round (summaries sent in one round are received in the next one), until
+ * all of them agree. */
+static SessionResult runSession(const unsigned numKFs, const bool checkFrames)
+{
+    const auto dir = mrpt::system::getTempFileName();
+    mrpt::system::deleteFile(dir);
+    mrpt::system::createDirectory(dir);
+
+    std::vector<std::unique_ptr<mola::BackendHarness>> robots;
+    for (unsigned id = 0; id < NUM_ROBOTS; id++)
+        robots.emplace_back(std::make_unique<mola::BackendHarness>(
+            "ASLAM_gtsam", mola::BackendHarness::defaultConfig(
+                               "ASLAM_gtsam",
+                               mrpt::format(
+                                   "  robot_id: %u\n"
+                                   "  separator_ipc_directory: %s\n"
+                                   "  separator_exchange_period: 0\n",
+                                   id, dir.c_str()))));
+    const auto be = [&](const unsigned id) -> mola::ASLAM_gtsam& {
+        return dynamic_cast<mola::ASLAM_gtsam&>(robots[id]->backend());
+    };
+
+    auto& rng = mrpt::random::getRandomGenerator();
+    rng.randomize(numKFs);
+
+    // Own trajectories, with noisy odometry. KF IDs are the same in all
+    // instances, since all of them create the same entities in order.
+    std::vector<mola::id_t> kfs;
+    const auto              t0 = mrpt::Clock::fromDouble(1.5e9);
+    for (unsigned k = 0; k < numKFs; k++)
+    {
+        for (unsigned id = 0; id < NUM_ROBOTS; id++)
+        {
+            mola::BackEndBase::ProposeKF_Input in;
+            in.timestamp = t0 + std::chrono::seconds(10 * k);
+            const auto kf = be(id).doAddKeyFrame(in).new_kf_id.value();
+            if (id == 0) kfs.push_back(kf);
+            if (kf != kfs.back())
+                throw std::runtime_error("KF IDs differ among robots");
+
+            if (k > 0)
+            {
+                auto odo =
+                    (groundTruth(id, k) - groundTruth(id, k - 1)).asTPose();
+                odo.x += rng.drawGaussian1D(0, 0.01);
+                odo.y += rng.drawGaussian1D(0, 0.01);
+
+                mola::FactorRelativePose3 f(kfs[k - 1], kfs[k], odo);
+                f.noise_model_diag_xyz_ = 0.05;
+                f.noise_model_diag_rot_ = 0.01;
+                mola::Factor ff         = f;
+                be(id).doAddFactor(ff);
+            }
+            be(id).spinOnce();
+        }
+    }
+
+    const auto last = numKFs - 1;
+    for (unsigned id = 0; id + 1 < NUM_ROBOTS; id++)
+        be(id).addInterRobotFactor(
+            kfs.back(), id + 1, kfs.back(),
+            (groundTruth(id + 1, last) - groundTruth(id, last)).asTPose(),
+            0.01, 0.001);
+
+    unsigned rounds = 0;
+    bool     agreed = false;
+    while (!agreed && rounds < MAX_ROUNDS)
+    {
+        for (unsigned id = 0; id < NUM_ROBOTS; id++) be(id).spinOnce();
+        rounds++;
+
+        agreed = true;
+        for (unsigned id = 0; id < NUM_ROBOTS; id++)
+        {
+            const auto     st = be(id).separatorStatus();
+            const unsigned expected_constraints =
+                (id == 0 || id + 1 == NUM_ROBOTS) ? 1 : 2;
+            agreed = agreed && st.received > 0 &&
+                     st.constraints == expected_constraints &&
+                     st.max_disagreement < 1e-2;
+        }
+    }
+
+    SessionResult ret;
+    ret.rounds = rounds;
+    for (unsigned id = 0; id < NUM_ROBOTS; id++)
+    {
+        const auto st = be(id).separatorStatus();
+        std::cout << mrpt::format(
+            "%u KFs, robot #%u: sent=%zu received=%zu constraints=%zu "
+            "max_disagreement=%.04f m, marginals of the last summary: "
+            "%.03f ms, from a joint of dim %zu\n",
+            numKFs, id, st.sent, st.received, st.constraints,
+            st.max_disagreement, 1e3 * st.last_marginals_time,
+            st.last_marginals_dim);
+        ret.max_marginals_dim =
+            std::max(ret.max_marginals_dim, st.last_marginals_dim);
+    }
+    if (!agreed)
+        throw std::runtime_error(mrpt::format(
+            "%u KFs: robots did not agree after %u rounds", numKFs, rounds));
+
+    // Each robot knows where its neighbors start, relative to itself:
+    for (unsigned id = 0; checkFrames && id < NUM_ROBOTS; id++)
+    {
+        for (const unsigned peer : {id - 1, id + 1})
+        {
+            if (peer >= NUM_ROBOTS) continue;  // id-1 wraps around
+            const auto est = be(id).peerFramePose(peer);
+            if (!est) throw std::runtime_error("Peer frame not estimated");
+
+            const auto expected = robotStart(peer) - robotStart(id);
+            const auto p        = mrpt::poses::CPose3D(*est);
+            if (p.distanceTo(expected) > 0.2 ||
+                std::abs(mrpt::math::wrapToPi(p.yaw() - expected.yaw())) >
+                    mrpt::DEG2RAD(1.0))
+                throw std::runtime_error(mrpt::format(
+                    "Robot #%u: frame of #%u is %s, expected %s", id, peer,
+                    p.asString().c_str(), expected.asString().c_str()));
+        }
+    }
+
+    for (auto& r : robots) r->quit();
+    mrpt::system::deleteFilesInDirectory(dir, true);
+    return ret;
+}
+
+static void test_separator_exchange()
+{
+    // Small maps, with the frames checked against the ground truth, then
+    // larger ones. Summaries only look at the top of the Bayes tree, so
+    // their cost must not grow with the size of the map:
+    const auto r1 = runSession(10, true);
+    const auto r2 = runSession(200, false);
+    std::cout << "Rounds to agree: " << r1.rounds << " (10 KFs), "
+              << r2.rounds << " (200 KFs)\n";
+
+    if (r2.max_marginals_dim > 2 * r1.max_marginals_dim)
+        throw std::runtime_error(mrpt::format(
+            "Marginals are not bounded: joint of dim %zu (10 KFs) vs %zu "
+            "(200 KFs)",
+            r1.max_marginals_dim, r2.max_marginals_dim));
+}
+
+int main([[maybe_unused]] int argc, [[maybe_unused]] char** argv)
+{
+    try
+    {
+        test_summary_encoding();
+        test_separator_exchange();
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
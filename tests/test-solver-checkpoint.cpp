@@ -0,0 +1,129 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @file   test-solver-checkpoint.cpp
+ * @brief  Checks SolverCheckpoint file round-trips, iSAM2 state included.
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 18, 2019
+ */
+
+#include <gtsam/inference/Symbol.h>
+#include <gtsam/slam/BetweenFactor.h>
+#include <gtsam/slam/PriorFactor.h>
+#include <mola-slam-gtsam/ConstVelocityFactorSE3.h>
+#include <mola-slam-gtsam/SolverCheckpoint.h>
+#include <mrpt/system/filesystem.h>
+
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+void test_solver_checkpoint()
+{
+    using namespace gtsam::symbol_shorthand;  // X(), V()
+
+    mola::SolverCheckpoint cp;
+
+    const auto noise = gtsam::noiseModel::Diagonal::Sigmas(
+        (gtsam::Vector6() << 0.1, 0.1, 0.1, 0.2, 0.2, 0.2).finished());
+    const auto robust = gtsam::noiseModel::Robust::Create(
+        gtsam::noiseModel::mEstimator::Huber::Create(1.345), noise);
+
+    const gtsam::Pose3 p1(
+        gtsam::Rot3::RzRyRx(0.1, 0.2, 0.3), gtsam::Point3(1, 2, 3));
+    gtsam::NonlinearFactorGraph graph;
+    gtsam::Values               theta;
+    graph.emplace_shared<gtsam::PriorFactor<gtsam::Pose3>>(
+        X(0), gtsam::Pose3(), noise);
+    graph.emplace_shared<gtsam::BetweenFactor<gtsam::Pose3>>(
+        X(0), X(1), p1, robust);
+    graph.emplace_shared<mola::ConstVelocityFactorSE3>(
+        X(0), V(0), X(1), V(1), 0.5,
+        gtsam::noiseModel::Isotropic::Sigma(6, 0.1));
+    graph.emplace_shared<gtsam::PriorFactor<gtsam::Vector3>>(
+        V(0), gtsam::Vector3(1, 0, 0),
+        gtsam::noiseModel::Isotropic::Sigma(3, 0.1));
+    theta.insert(X(0), gtsam::Pose3());
+    theta.insert(X(1), p1);
+    theta.insert(V(0), gtsam::Vector3(1, 0, 0));
+    theta.insert(V(1), gtsam::Vector3(1, 0, 0));
+
+    gtsam::ISAM2Params params;
+    params.cacheLinearizedFactors = true;
+    gtsam::ISAM2 isam2(params);
+    isam2.update(graph, theta);
+    cp.isam2 = mola::serializeISAM2(isam2);
+
+    cp.kfs                = {1, 2};
+    cp.root_kf_id         = 0;
+    cp.last_created_kf_id = 2;
+    cp.time2kf[1000]      = 1;
+    cp.viz_nodes[1]       = p1;
+    cp.viz_dyn[1]         = {1, 2, 3, 4, 5, 6};
+
+    const auto file = mrpt::system::getTempFileName();
+    if (mola::writeSolverCheckpoint(cp, file) == 0)
+        throw std::runtime_error("Empty checkpoint file");
+
+    mola::SolverCheckpoint cp2;
+    gtsam::ISAM2           isam2b(params);
+    mola::readSolverCheckpoint(file, cp2, isam2b);
+    mrpt::system::deleteFile(file);
+
+    // Bayes tree, factors, linearization point and variable index:
+    if (!isam2b.equals(isam2, 1e-9))
+        throw std::runtime_error("iSAM2 state mismatch");
+    if (!isam2b.calculateEstimate().equals(isam2.calculateEstimate(), 1e-9))
+        throw std::runtime_error("Estimate mismatch");
+
+    // Both solvers continue identically:
+    gtsam::NonlinearFactorGraph more;
+    gtsam::Values               moreValues;
+    more.emplace_shared<gtsam::BetweenFactor<gtsam::Pose3>>(
+        X(1), X(2), p1, noise);
+    moreValues.insert(X(2), p1 * p1);
+    isam2.update(more, moreValues);
+    isam2b.update(more, moreValues);
+    if (!isam2b.calculateEstimate().equals(isam2.calculateEstimate(), 1e-9))
+        throw std::runtime_error("Estimate mismatch after update");
+    if (cp2.kfs != cp.kfs || cp2.root_kf_id != 0 ||
+        cp2.last_created_kf_id != 2 || cp2.time2kf != cp.time2kf ||
+        cp2.viz_dyn != cp.viz_dyn || !cp2.viz_nodes.at(1).equals(p1))
+        throw std::runtime_error("Bookkeeping mismatch");
+
+    // Not a checkpoint:
+    const auto bad = mrpt::system::getTempFileName();
+    {
+        std::ofstream f(bad);
+        f << "garbage";
+    }
+    bool thrown = false;
+    try
+    {
+        gtsam::ISAM2 isam2c(params);
+        mola::readSolverCheckpoint(bad, cp2, isam2c);
+    }
+    catch (const std::exception&)
+    {
+        thrown = true;
+    }
+    mrpt::system::deleteFile(bad);
+    if (!thrown) throw std::runtime_error("Invalid file not detected");
+}
+
+int main([[maybe_unused]] int argc, [[maybe_unused]] char** argv)
+{
+    try
+    {
+        test_solver_checkpoint();
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
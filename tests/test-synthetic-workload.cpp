@@ -0,0 +1,264 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @file   test-synthetic-workload.cpp
+ * @brief  SyntheticWorkload determinism, replay into ASLAM_gtsam, and
+ *         record => replay round trip of a stereo session.
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 20, 2019
+ */
+
+#include <mola-slam-gtsam/ASLAM_gtsam.h>
+#include <mola-slam-gtsam/BackendCallLog.h>
+#include <mola-slam-gtsam/BackendHarness.h>
+#include <mola-slam-gtsam/SyntheticWorkload.h>
+#include <mrpt/system/filesystem.h>
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+
+void test_determinism()
+{
+    for (const auto type : {mola::SyntheticWorkload::Type::Manhattan,
+                            mola::SyntheticWorkload::Type::Sphere,
+                            mola::SyntheticWorkload::Type::Corridor,
+                            mola::SyntheticWorkload::Type::Stereo})
+    {
+        mola::SyntheticWorkload::Parameters p;
+        p.type    = type;
+        p.num_kfs = 150;
+
+        mola::SyntheticWorkload w1(p), w2(p);
+        mola::BackendCallRecord r1, r2;
+        std::size_t             n = 0;
+        while (w1.next(r1))
+        {
+            if (!w2.next(r2) || r1.call != r2.call ||
+                r1.result_id != r2.result_id ||
+                r1.stereo_obs.x_left != r2.stereo_obs.x_left)
+                throw std::runtime_error("Workload is not deterministic");
+            if (r1.call == mola::BackendCall::AddFactor &&
+                std::holds_alternative<mola::FactorRelativePose3>(r1.factor))
+            {
+                const auto& f1 = std::get<mola::FactorRelativePose3>(r1.factor);
+                const auto& f2 = std::get<mola::FactorRelativePose3>(r2.factor);
+                if (f1.rel_pose_ != f2.rel_pose_)
+                    throw std::runtime_error("Workload is not deterministic");
+            }
+            n++;
+        }
+        if (w2.next(r2)) throw std::runtime_error("Different lengths");
+        if (w1.groundTruth().size() != p.num_kfs)
+            throw std::runtime_error("Unexpected number of keyframes");
+        // KFs, odometry and spins, at least:
+        if (n < 3 * p.num_kfs - 1)
+            throw std::runtime_error("Too few records");
+    }
+}
+
+void test_replay_manhattan()
+{
+    mola::SyntheticWorkload::Parameters p;
+    p.type    = mola::SyntheticWorkload::Type::Manhattan;
+    p.num_kfs = 200;
+
+    mola::BackendHarness    h(
+        "ASLAM_gtsam", mola::BackendHarness::defaultConfig("ASLAM_gtsam"));
+    mola::SyntheticWorkload w(p);
+
+    const auto stats = mola::replayBackendCalls(w.source(), h.backend());
+    if (stats.kf_ids.size() != p.num_kfs)
+        throw std::runtime_error("Not all keyframes were created");
+
+    const auto err = mola::evaluateWorkload(w, h.worldmodel(), stats.kf_ids);
+    std::cout << "Manhattan, " << p.num_kfs
+              << " KFs: ATE rmse=" << err.ate_trans.rmse << " m\n";
+    if (err.associated != p.num_kfs || err.ate_trans.rmse > 0.5)
+        throw std::runtime_error("Too large trajectory error");
+
+    // All KFs and odometry edges are in the solver and the ID maps:
+    const auto mem = dynamic_cast<mola::ASLAM_gtsam&>(h.backend())
+                         .memory_report();
+    std::cout << "Manhattan, " << p.num_kfs
+              << " KFs: estimated memory=" << mem.total() << " bytes\n";
+    if (mem.isam2_bayes_tree == 0 || mem.isam2_factors == 0 ||
+        mem.last_values < p.num_kfs * sizeof(gtsam::Pose3) ||
+        mem.id_maps == 0 || mem.time2kf == 0 || mem.vizmap == 0)
+        throw std::runtime_error("Unexpected memory report");
+}
+
+/** Factor costs of all the spinOnce() calls of a session */
+static mola::ASLAM_gtsam::FactorKindCosts factorCosts(
+    const mola::SyntheticWorkload::Type type, const std::size_t num_kfs)
+{
+    mola::SyntheticWorkload::Parameters p;
+    p.type    = type;
+    p.num_kfs = num_kfs;
+
+    mola::BackendHarness h(
+        "ASLAM_gtsam", mola::BackendHarness::defaultConfig(
+                           "ASLAM_gtsam", "  factor_cost_stats: true\n"));
+    mola::SyntheticWorkload w(p);
+    if (!w.prepareBackend(h.backend()))
+        throw std::runtime_error("Workload not supported");
+    mola::replayBackendCalls(w.source(), h.backend());
+
+    mola::ASLAM_gtsam::FactorKindCosts sum{};
+    for (const auto& s :
+         dynamic_cast<mola::ASLAM_gtsam&>(h.backend()).spin_stats())
+        for (std::size_t k = 0; k < sum.size(); k++)
+        {
+            sum[k].linearized += s.factor_costs[k].linearized;
+            sum[k].t_linearize += s.factor_costs[k].t_linearize;
+            sum[k].elimination_flops += s.factor_costs[k].elimination_flops;
+        }
+    h.quit();
+    return sum;
+}
+
+void test_factor_costs()
+{
+    using Kind = mola::ASLAM_gtsam::FactorKind;
+    const std::size_t num_kfs = 100;
+
+    // Every odometry edge is linearized at least once:
+    const auto manhattan =
+        factorCosts(mola::SyntheticWorkload::Type::Manhattan, num_kfs);
+    const auto& rel = manhattan[static_cast<std::size_t>(Kind::RelativePose3)];
+    std::cout << "Manhattan, " << num_kfs
+              << " KFs: relative pose factors linearized=" << rel.linearized
+              << " t=" << rel.t_linearize
+              << " s, elimination=" << rel.elimination_flops << " flops\n";
+    if (rel.linearized < num_kfs - 1 || rel.t_linearize <= 0 ||
+        rel.elimination_flops <= 0)
+        throw std::runtime_error("Unexpected relative pose factor costs");
+
+    // Smart factors are timed with their triangulation, and weigh in the
+    // elimination cost by their dimension (3 rows per observation):
+    const auto stereo =
+        factorCosts(mola::SyntheticWorkload::Type::Stereo, num_kfs);
+    const auto& smart = stereo[static_cast<std::size_t>(Kind::SmartStereo)];
+    const auto& odo   = stereo[static_cast<std::size_t>(Kind::RelativePose3)];
+    std::cout << "Stereo, " << num_kfs
+              << " KFs: smart factors linearized=" << smart.linearized
+              << " t=" << smart.t_linearize
+              << " s, elimination=" << smart.elimination_flops
+              << " flops; relative pose factors linearized=" << odo.linearized
+              << " t=" << odo.t_linearize << " s\n";
+    if (smart.linearized == 0 || smart.t_linearize <= 0 ||
+        smart.elimination_flops <= 0)
+        throw std::runtime_error("Unexpected smart factor costs");
+    if (smart.t_linearize / smart.linearized <=
+        odo.t_linearize / std::max<std::size_t>(odo.linearized, 1))
+        throw std::runtime_error(
+            "Smart factors should be costlier to linearize than odometry");
+}
+
+/** Records a Stereo session plus a landmark with stereo projection factors,
+ * then replays the log into a back-end which numbers entities differently:
+ * the camera and landmark must be recreated and all references translated
+ * for the estimates to match. */
+void test_record_replay_stereo()
+{
+    mola::SyntheticWorkload::Parameters p;
+    p.type    = mola::SyntheticWorkload::Type::Stereo;
+    p.num_kfs = 30;
+
+    const auto logFile = mrpt::system::getTempFileName();
+
+    mola::BackendHarness hRec(
+        "ASLAM_gtsam",
+        mola::BackendHarness::defaultConfig(
+            "ASLAM_gtsam", "  record_api_calls_file: " + logFile + "\n"));
+    auto& rec = dynamic_cast<mola::ASLAM_gtsam&>(hRec.backend());
+
+    mola::SyntheticWorkload w(p);
+    if (!w.prepareBackend(rec))
+        throw std::runtime_error("Workload not supported");
+    const auto recStats = mola::replayBackendCalls(w.source(), rec);
+
+    // A landmark ahead of the last two KFs (the camera looks along +Z):
+    const auto                 cam = w.stereoCamera();
+    const mrpt::math::TPoint3D lmPos(0.5, 0.2, p.num_kfs + 4.0);
+    rec.lock_slam();
+    const auto lm = rec.temp_createLandmark(
+        mrpt::math::TPoint3D(lmPos.x + 0.1, lmPos.y, lmPos.z - 0.2));
+    rec.unlock_slam();
+    for (std::size_t k = p.num_kfs - 2; k < p.num_kfs; k++)
+    {
+        const auto&  g  = w.groundTruth().at(k);
+        const double dz = lmPos.z - g.pose.z();
+
+        mola::FactorStereoProjectionPose f;
+        f.observing_kf_       = recStats.kf_ids.at(g.id);
+        f.observed_landmark_  = lm;
+        f.observation_.x_left = cam.f * lmPos.x / dz + cam.cx;
+        f.observation_.x_right =
+            f.observation_.x_left - cam.f * cam.baseline / dz;
+        f.observation_.y = cam.f * lmPos.y / dz + cam.cy;
+
+        mola::Factor ff = f;
+        rec.doAddFactor(ff);
+    }
+    rec.spinOnce();  // (flushes the log)
+
+    // Shift entity IDs in the replay, so no recorded one is valid there:
+    mola::BackendHarness hRep(
+        "ASLAM_gtsam", mola::BackendHarness::defaultConfig("ASLAM_gtsam"));
+    hRep.worldmodel().entities_lock_for_write();
+    hRep.worldmodel().entity_emplace_back(mola::LandmarkPoint3());
+    hRep.worldmodel().entities_unlock_for_write();
+
+    mola::BackendCallReader log;
+    log.open(logFile);
+    const auto st = mola::replayBackendCalls(log, hRep.backend());
+
+    const auto count = [&](const mola::BackendCall c) {
+        return st.calls.count(c) ? st.calls.at(c).count : 0;
+    };
+    if (st.skipped != 0 || count(mola::BackendCall::DefineStereoCamera) != 1 ||
+        count(mola::BackendCall::CreateLandmark) != 1 ||
+        st.kf_ids.size() != p.num_kfs)
+        throw std::runtime_error("Unexpected calls in the replay");
+    if (st.id_mismatches == 0)
+        throw std::runtime_error("Entity IDs should differ in the replay");
+
+    double maxDist = 0;
+    for (const auto& [recId, repId] : st.kf_ids)
+        maxDist = std::max(
+            maxDist,
+            mola::worldModelKeyFramePose(hRec.worldmodel(), recId)
+                .distanceTo(
+                    mola::worldModelKeyFramePose(hRep.worldmodel(), repId)));
+    std::cout << "Stereo record => replay, " << p.num_kfs
+              << " KFs: max. KF distance=" << maxDist << " m\n";
+    if (maxDist > 1e-3)
+        throw std::runtime_error("Replayed estimates differ");
+
+    hRec.quit();
+    hRep.quit();
+    mrpt::system::deleteFile(logFile);
+}
+
+int main([[maybe_unused]] int argc, [[maybe_unused]] char** argv)
+{
+    try
+    {
+        test_determinism();
+        test_replay_manhattan();
+        test_factor_costs();
+        test_record_replay_stereo();
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
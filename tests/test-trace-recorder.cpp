@@ -0,0 +1,113 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @file   test-trace-recorder.cpp
+ * @brief  TraceRecorder: balanced events from several threads, JSON export.
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 20, 2019
+ */
+
+#include <mola-slam-gtsam/TraceRecorder.h>
+
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+static std::size_t count_of(const std::string& s, const std::string& what)
+{
+    std::size_t n = 0;
+    for (auto pos = s.find(what); pos != std::string::npos;
+         pos      = s.find(what, pos + 1))
+        n++;
+    return n;
+}
+
+void test_disabled()
+{
+    auto& tr = mola::TraceRecorder::Instance();
+    {
+        mola::TraceScope s("ignored");
+    }
+    if (tr.recorded() != 0)
+        throw std::runtime_error("Events recorded while disabled");
+}
+
+void test_threads()
+{
+    auto& tr = mola::TraceRecorder::Instance();
+    tr.enable(1000);
+
+    const std::size_t        NUM_THREADS = 4, NUM_SCOPES = 100;
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < NUM_THREADS; t++)
+        threads.emplace_back([&]() {
+            tr.setThreadName("worker \"quoted\"");
+            for (std::size_t i = 0; i < NUM_SCOPES; i++)
+            {
+                mola::TraceScope outer("outer");
+                mola::TraceScope inner("inner");
+            }
+        });
+
+    // Export while recording, which must be safe:
+    std::stringstream ss_partial;
+    tr.saveJSON(ss_partial);
+
+    for (auto& th : threads) th.join();
+
+    if (tr.recorded() != NUM_THREADS * NUM_SCOPES * 4 || tr.dropped() != 0)
+        throw std::runtime_error("Unexpected number of events");
+
+    std::stringstream ss;
+    tr.saveJSON(ss);
+    const std::string json = ss.str();
+    if (count_of(json, "\"ph\": \"B\"") != NUM_THREADS * NUM_SCOPES * 2 ||
+        count_of(json, "\"ph\": \"E\"") != NUM_THREADS * NUM_SCOPES * 2)
+        throw std::runtime_error("Unbalanced begin/end events");
+    if (count_of(json, "worker \\\"quoted\\\"") != NUM_THREADS)
+        throw std::runtime_error("Missing thread names");
+}
+
+void test_full_buffer()
+{
+    auto& tr = mola::TraceRecorder::Instance();
+    tr.enable(10);
+
+    // New thread, hence a new buffer with room for 10 events:
+    std::thread([]() {
+        for (int i = 0; i < 8; i++) mola::TraceScope s("scope");
+    }).join();
+
+    if (tr.dropped() != 6) throw std::runtime_error("Expected 6 dropped");
+
+    // Disabling in the middle of a scope keeps its end event:
+    const auto before = tr.recorded();
+    {
+        mola::TraceScope s("last");
+        tr.disable();
+    }
+    if (tr.recorded() != before + 2)
+        throw std::runtime_error("End event lost after disable()");
+}
+
+int main([[maybe_unused]] int argc, [[maybe_unused]] char** argv)
+{
+    try
+    {
+        test_disabled();
+        test_threads();
+        test_full_buffer();
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
@@ -0,0 +1,69 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @file   test-trajectory-eval.cpp
+ * @brief  ATE/RPE of a rigidly-transformed copy of a trajectory must be ~0.
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 09, 2019
+ */
+
+#include <mola-slam-gtsam/TrajectoryEvaluation.h>
+
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+
+void test_trajectory_eval_rigid()
+{
+    mola::TimedTrajectory gt, est;
+
+    Eigen::Isometry3d T = Eigen::Isometry3d::Identity();
+    T.linear() =
+        Eigen::AngleAxisd(0.3, Eigen::Vector3d::UnitZ()).toRotationMatrix();
+    T.translation() = Eigen::Vector3d(5, -2, 1);
+
+    for (int i = 0; i < 5000; i++)
+    {
+        const double      t = i * 0.1;
+        Eigen::Isometry3d P = Eigen::Isometry3d::Identity();
+        P.translation() =
+            Eigen::Vector3d(10 * std::cos(t * 0.1), 10 * std::sin(t * 0.1), 0);
+        P.linear() = Eigen::AngleAxisd(t * 0.1, Eigen::Vector3d::UnitZ())
+                         .toRotationMatrix();
+
+        gt.stamps.push_back(t);
+        gt.poses.push_back(P);
+        // Estimate: same path in another frame, slightly shifted in time:
+        est.stamps.push_back(t + 0.001);
+        est.poses.push_back(T * P);
+    }
+
+    const auto r = mola::evaluateTrajectory(est, gt);
+
+    if (r.associated != 5000) throw std::runtime_error("Wrong association");
+    if (r.ate_trans.rmse > 1e-6) throw std::runtime_error("ATE should be 0");
+    if (r.rpe_trans.rmse > 1e-6 || r.rpe_rot.rmse > 1e-6)
+        throw std::runtime_error("RPE should be 0");
+
+    // Now, add a constant bias to one pose: it must show up in the max.
+    est.poses[100].translation() += Eigen::Vector3d(0, 0, 1.0);
+    const auto r2 = mola::evaluateTrajectory(est, gt);
+    if (r2.ate_trans.max < 0.9) throw std::runtime_error("ATE max too low");
+}
+
+int main([[maybe_unused]] int argc, [[maybe_unused]] char** argv)
+{
+    try
+    {
+        test_trajectory_eval_rigid();
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
@@ -0,0 +1,112 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @file   test-trajectory-store.cpp
+ * @brief  Checks TrajectoryStore decimation and spilling to disk.
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 05, 2019
+ */
+
+#include <mola-slam-gtsam/TrajectoryStore.h>
+#include <mrpt/system/filesystem.h>
+
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+
+static mrpt::Clock::time_point tim(double t)
+{
+    return mrpt::Clock::time_point(
+        std::chrono::duration_cast<mrpt::Clock::duration>(
+            std::chrono::duration<double>(t)));
+}
+
+void test_trajectory_store_spill()
+{
+    mola::TrajectoryStore             store;
+    mola::TrajectoryStore::Parameters p;
+    p.chunk_size          = 100;
+    p.max_resident_chunks = 2;
+    p.spill_file          = mrpt::system::getTempFileName();
+    store.setParameters(p);
+
+    const std::size_t N = 1050;
+    for (std::size_t i = 0; i < N; i++)
+        store.push_back(
+            tim(i * 0.1), i / 10,
+            mrpt::math::TPose3D(0.01 * i, 0, 0, 0, 0, 0));
+
+    if (store.size() != N) throw std::runtime_error("Wrong size()");
+
+    std::size_t idx = 0;
+    store.for_each([&](const mrpt::Clock::time_point& t, mola::id_t ref_kf,
+                       const mrpt::math::TPose3D& rel) {
+        if (t != tim(idx * 0.1) || ref_kf != idx / 10 ||
+            std::abs(rel.x - 0.01 * idx) > 1e-4)
+            throw std::runtime_error("Mismatch reading back entries");
+        idx++;
+    });
+    if (idx != N) throw std::runtime_error("for_each() missed entries");
+}
+
+void test_trajectory_store_decimation()
+{
+    mola::TrajectoryStore             store;
+    mola::TrajectoryStore::Parameters p;
+    p.decimation_period = 0.45;
+    store.setParameters(p);
+
+    for (int i = 0; i < 100; i++)
+        store.push_back(tim(i * 0.1), 0, mrpt::math::TPose3D());
+
+    // One every 5 entries:
+    if (store.size() != 20) throw std::runtime_error("Wrong decimation");
+}
+
+void test_trajectory_store_same_stamp()
+{
+    mola::TrajectoryStore             store;
+    mola::TrajectoryStore::Parameters p;
+    p.chunk_size          = 2;
+    p.max_resident_chunks = 1;
+    p.spill_file          = mrpt::system::getTempFileName();
+    store.setParameters(p);
+
+    // The repeated stamp fills up the first chunk, then gets spilled:
+    store.push_back(tim(0.0), 1, mrpt::math::TPose3D(0, 0, 0, 0, 0, 0));
+    store.push_back(tim(1.0), 1, mrpt::math::TPose3D(1, 0, 0, 0, 0, 0));
+    store.push_back(tim(1.0), 2, mrpt::math::TPose3D(5, 0, 0, 0, 0, 0));
+    store.push_back(tim(2.0), 2, mrpt::math::TPose3D(2, 0, 0, 0, 0, 0));
+    store.push_back(tim(3.0), 2, mrpt::math::TPose3D(3, 0, 0, 0, 0, 0));
+
+    if (store.size() != 4) throw std::runtime_error("Duplicate stamp kept");
+
+    const double expected_x[] = {0, 5, 2, 3};
+    std::size_t  idx          = 0;
+    store.for_each([&](const mrpt::Clock::time_point&, mola::id_t ref_kf,
+                       const mrpt::math::TPose3D& rel) {
+        if (std::abs(rel.x - expected_x[idx]) > 1e-6 ||
+            (idx == 1 && ref_kf != 2))
+            throw std::runtime_error("Last entry with a stamp must win");
+        idx++;
+    });
+}
+
+int main([[maybe_unused]] int argc, [[maybe_unused]] char** argv)
+{
+    try
+    {
+        test_trajectory_store_spill();
+        test_trajectory_store_decimation();
+        test_trajectory_store_same_stamp();
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
@@ -0,0 +1,128 @@
+/* -------------------------------------------------------------------------
+ *   A Modular Optimization framework for Localization and mApping  (MOLA)
+ * Copyright (C) 2018-2019 Jose Luis Blanco, University of Almeria
+ * See LICENSE for license information.
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @file   test-trajectory-writer.cpp
+ * @brief  Writes trajectory streams with KF revisions and checks the
+ *         result of compacting them.
+ * @author Jose Luis Blanco Claraco
+ * @date   Sep 02, 2019
+ */
+
+#include <mola-slam-gtsam/TrajectoryWriter.h>
+#include <mrpt/system/filesystem.h>
+
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+static mrpt::Clock::time_point tim(double t)
+{
+    return mrpt::Clock::fromDouble(t);
+}
+
+static void write_sample_trajectory(mola::TrajectoryWriter& w)
+{
+    using mrpt::math::TPose3D;
+
+    // KF #1 at t=1, first guess at x=1:
+    w.appendKeyFrame(tim(1.0), 1, TPose3D(1, 0, 0, 0, 0, 0));
+    // Non-KF at t=1.5, 0.5m ahead of KF #1:
+    w.appendNonKeyFrame(
+        tim(1.5), 1, TPose3D(0.5, 0, 0, 0, 0, 0),
+        TPose3D(1.5, 0, 0, 0, 0, 0));
+    // KF #2 at t=2:
+    w.appendKeyFrame(tim(2.0), 2, TPose3D(2, 0, 0, 0, 0, 0));
+    // Optimizer corrects KF #1 to y=1:
+    w.appendKeyFrame(tim(1.0), 1, TPose3D(1, 1, 0, 0, 0, 0));
+}
+
+/** Checks the compacted version of write_sample_trajectory() */
+static void check_compacted_tum(const std::string& tumFile)
+{
+    std::ifstream f(tumFile);
+    if (!f.is_open()) throw std::runtime_error("Cannot read compacted file");
+
+    std::vector<std::vector<double>> rows;
+    for (std::string line; std::getline(f, line);)
+    {
+        if (line.empty() || line[0] == '#') continue;
+        std::istringstream ss(line);
+        std::vector<double> row;
+        for (double v; ss >> v;) row.push_back(v);
+        rows.push_back(row);
+    }
+
+    if (rows.size() != 3)
+        throw std::runtime_error("Expected 3 poses after compaction");
+
+    // Non-KF must follow the latest revision of its reference KF:
+    const auto& nk = rows.at(1);
+    if (std::abs(nk.at(0) - 1.5) > 1e-6 || std::abs(nk.at(1) - 1.5) > 1e-6 ||
+        std::abs(nk.at(2) - 1.0) > 1e-6)
+        throw std::runtime_error("Non-KF pose was not re-attached to KF");
+
+    // KF #1 must be the last revision:
+    if (std::abs(rows.at(0).at(2) - 1.0) > 1e-6)
+        throw std::runtime_error("KF revision was not applied");
+}
+
+void test_trajectory_writer_compact()
+{
+    const auto binFile = mrpt::system::getTempFileName();
+    const auto tumFile = mrpt::system::getTempFileName();
+
+    {
+        mola::TrajectoryWriter w;
+        w.open(binFile, mola::TrajectoryWriter::Format::Binary);
+        write_sample_trajectory(w);
+        w.close();
+    }
+
+    mola::TrajectoryWriter::Compact(binFile, tumFile);
+    check_compacted_tum(tumFile);
+}
+
+void test_trajectory_writer_text_compacted_on_close()
+{
+    const auto tumFile = mrpt::system::getTempFileName();
+
+    mola::TrajectoryWriter w;
+    w.open(tumFile, mola::TrajectoryWriter::Format::TUM);
+    write_sample_trajectory(w);
+    w.flush();
+
+    // While open, the text file is a log with the KF #1 revision:
+    std::size_t lines = 0;
+    {
+        std::ifstream f(tumFile);
+        for (std::string line; std::getline(f, line);)
+            if (!line.empty() && line[0] != '#') lines++;
+    }
+    if (lines != 4) throw std::runtime_error("Expected 4 streamed lines");
+
+    w.close();
+    check_compacted_tum(tumFile);
+    if (mrpt::system::fileExists(
+            mola::TrajectoryWriter::streamFileName(tumFile)))
+        throw std::runtime_error("Side binary stream was not deleted");
+}
+
+int main([[maybe_unused]] int argc, [[maybe_unused]] char** argv)
+{
+    try
+    {
+        test_trajectory_writer_compact();
+        test_trajectory_writer_text_compacted_on_close();
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}